@@ -0,0 +1,1311 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sched.h>
+#include <dirent.h>
+#include <math.h>
+
+#include <algorithm>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../util/timer.hpp"
+#include "../util/perf_counters.hpp"
+
+#include "../strassen/naive_matrix_multiplier.hpp"
+#include "../strassen/transpose_matrix_multiplier.hpp"
+#include "../strassen/strassen_matrix_multiplier.hpp"
+#include "../strassen/parallel_strassen_matrix_multiplier.hpp"
+#include "../strassen/caps_strassen_matrix_multiplier.hpp"
+#include "../strassen/adaptive_matrix_multiplier.hpp"
+#include "../strassen/skinny_matrix_multiplier.hpp"
+#include "../strassen/verified_matrix_multiplier.hpp"
+#include "../strassen/async_matrix_multiplier.hpp"
+#include "../strassen/distributed_strassen_matrix_multiplier.hpp"
+#include "../strassen/cached_matrix_multiplier.hpp"
+#include "../strassen/trace.hpp"
+#include "../strassen/allocator.hpp"
+
+/**
+ * Benchmark driver for the matrix multipliers.
+ *
+ * For every combination of multiplier, element type and shape, the product is computed a number of
+ * untimed warmup times and then a number of timed repetitions. Each result reports the minimum, median,
+ * 95th percentile and mean time, the GFLOP/s achieved at the median (counting 2mkn operations for an
+ * m x k by k x n product), and the effective bandwidth, taken as the compulsory traffic of reading A and
+ * B and writing C once, divided by the median time.
+ *
+ * With --counters, every timed repetition is also wrapped in a group of hardware performance counters,
+ * and the per-call averages are reported alongside the timings. Multipliers built on the Strassen
+ * recursion additionally break the counts down by phase (padding, operand formation, leaf multiply,
+ * combine, ...).
+ *
+ * Every result also reports the peak memory allocated by one multiplication, as measured by the
+ * multiplier's mem_account, next to the multiplier's own prediction of it.
+ *
+ * With --huge-pages, operands, results and scratch buffers of 4 MiB or more are backed by transparent huge
+ * pages; comparing the dtlb-misses counter of runs with and without it shows the effect on large products.
+ *
+ * With --trace, the internals of the Strassen multipliers are written to a Chrome trace file, one track
+ * per thread with events nested by recursion depth. This requires a build with STRASSEN_TRACE defined
+ * (cmake -DSTRASSEN_TRACE=ON); only the most recent events of each thread are kept.
+ *
+ * With --async N, a stream of N requests cycling through the shapes is also run twice for each type: once
+ * preparing operands and multiplying them in turn with the adaptive multiplier, and once submitting them to
+ * an async_matrix_multiplier as soon as they are prepared. The requests per second of each, and the gain of
+ * the second over the first, are reported.
+ *
+ * The cached multiplier keeps the products of the adaptive multiplier. After the first run every repetition
+ * is a hit, so its times are those of hashing the operands and copying out the product, and its predicted
+ * peak is the product alone.
+ *
+ * The skinny multiplier is meant for shapes with a dimension of 16 or less, such as 4096x4096x1 or
+ * 4096x8x4096, which the adaptive multiplier also hands to it; on other shapes it is slow.
+ *
+ * The distributed multiplier ships its seven top-level products to worker processes over TCP. --workers N
+ * starts N of them on this machine (2 by default), for each element type benchmarked, and every result of the
+ * distributed multiplier is followed by the bytes it moved and the time spent communicating against the time
+ * the workers spent computing.
+ *
+ * With --scaling LIST, the multipliers which can use several threads (strassen, parallel, caps and skinny) are
+ * instead run with each thread count in LIST, for strong and weak scaling. Strong scaling keeps each shape
+ * and reports the speedup and efficiency over the first thread count. Weak scaling grows each dimension of
+ * the shape by the cube root of the ratio of thread counts, so that the multiply-adds per thread stay the
+ * same, and reports the time and the efficiency as GFLOP/s per thread relative to the first thread count.
+ * The Strassen multipliers pad to a power of two, so weak scaling is only even with thread counts a power of 8
+ * apart, such as 1,8,64, which double each dimension of a power-of-two shape.
+ * The strassen multiplier only divides its O(n^2) phases between threads, and the parallel one uses at most
+ * 7 workers for its products, which the results show against the caps multiplier. The CPU topology the
+ * results were taken on (model, online and allowed CPUs, packages, cores, NUMA nodes and caches) is recorded
+ * with them: as the first lines of text, as "# " comment lines of CSV, and as a "topology" object in JSON.
+ *
+ * The product of the last repetition of each result is checked with freivalds (), which costs a few
+ * matrix-vector products rather than a reference multiplication, so that even the largest shapes are
+ * verified. A product which fails is reported to stderr and in the verified column, and makes the exit
+ * status nonzero.
+ */
+
+struct bench_options
+{
+  std::vector<std::string> multipliers;
+  std::vector<std::string> types;
+  std::vector<size_t> shapes;   /* Flattened (m, k, n) triples */
+  size_t reps;
+  size_t warmup;
+  std::string format;
+  bool counters;
+  size_t async;             /* Requests in the async stream, or 0 */
+  std::vector<size_t> scaling;  /* Thread counts of the scaling runs, or empty */
+};
+
+struct bench_result
+{
+  std::string multiplier;
+  std::string type;
+  size_t m;
+  size_t k;
+  size_t n;
+  size_t reps;
+  double min;
+  double median;
+  double p95;
+  double mean;
+  double gflops;
+  double gbps;
+  size_t peak_bytes;        /* Measured on the last repetition */
+  size_t predicted_bytes;
+  size_t allocations;
+  bool verified;            /* Whether the last product passed freivalds () */
+
+  /* Hardware counter averages per call, if requested */
+  bool counters;
+  strassen::perf_sample total;
+  strassen::perf_sample phases[strassen::NUM_PHASES];
+};
+
+/* One run of a scaling sweep */
+struct scaling_result
+{
+  std::string multiplier;
+  std::string type;
+  std::string mode;         /* "strong" or "weak" */
+  size_t m;
+  size_t k;
+  size_t n;
+  size_t threads;
+  double median;
+  double gflops;
+  double speedup;           /* Strong scaling: the time at the first thread count over this one */
+  double efficiency;        /* Speedup, or for weak scaling GFLOP/s, per thread relative to the first count */
+  bool verified;
+};
+
+/* The machine the results were taken on */
+struct cpu_topology
+{
+  std::string model;
+  size_t online;            /* Processors online */
+  size_t allowed;           /* Processors this process may run on */
+  size_t packages;
+  size_t cores;             /* Physical cores, over all packages */
+  size_t numa_nodes;
+  std::string caches;       /* Those of the first processor, such as "L1d 48K, L1i 32K, L2 2048K" */
+};
+
+static std::vector<std::string>
+split (const char *s)
+{
+  std::vector<std::string> v;
+  std::string cur;
+
+  for (const char *p = s; ; p++)
+    {
+      if (*p == ',' || !*p)
+        {
+          if (!cur.empty ())
+            v.push_back (cur);
+
+          cur.clear ();
+
+          if (!*p)
+            break;
+        }
+      else
+        cur += *p;
+    }
+
+  return v;
+}
+
+/**
+ * Parses a shape of the form N (square), MxK (an M x K matrix times a K x M matrix) or MxKxN.
+ */
+static bool
+parse_shape (const std::string &s, std::vector<size_t> &shapes)
+{
+  size_t d[3];
+  int n = sscanf (s.c_str (), "%lux%lux%lu", &d[0], &d[1], &d[2]);
+
+  if (n == 1)
+    d[1] = d[2] = d[0];
+  else if (n == 2)
+    d[2] = d[0];
+  else if (n != 3)
+    return false;
+
+  if (!d[0] || !d[1] || !d[2])
+    return false;
+
+  shapes.insert (shapes.end (), d, d + 3);
+  return true;
+}
+
+/* The first line of a file, without its newline, or "" */
+static std::string
+read_line (const std::string &path)
+{
+  char buf[256];
+  FILE *f = fopen (path.c_str (), "r");
+  std::string s;
+
+  if (!f)
+    return s;
+
+  if (fgets (buf, sizeof (buf), f))
+    s = buf;
+
+  fclose (f);
+
+  while (!s.empty () && (s[s.size () - 1] == '\n' || s[s.size () - 1] == '\r'))
+    s.erase (s.size () - 1);
+
+  return s;
+}
+
+/**
+ * Reads the topology from /proc/cpuinfo and /sys. Figures which cannot be read are left at 0 or "", and the
+ * core count falls back to the processors online.
+ */
+static cpu_topology
+read_topology ()
+{
+  cpu_topology t;
+  long online = sysconf (_SC_NPROCESSORS_ONLN);
+  cpu_set_t set;
+
+  t.online = (online > 0) ? online : 1;
+  t.allowed = t.online;
+
+  if (!sched_getaffinity (0, sizeof (set), &set))
+    t.allowed = CPU_COUNT (&set);
+
+  FILE *f = fopen ("/proc/cpuinfo", "r");
+  char line[512];
+
+  while (f && fgets (line, sizeof (line), f))
+    {
+      char *colon = strchr (line, ':');
+
+      if (!strncmp (line, "model name", 10) && colon)
+        {
+          t.model = colon + 2;
+          t.model.erase (t.model.find_last_not_of ("\n") + 1);
+          break;
+        }
+    }
+
+  if (f)
+    fclose (f);
+
+  std::set<std::string> packages;
+  std::set<std::pair<std::string, std::string> > cores;
+
+  for (size_t cpu = 0; cpu < t.online; cpu++)
+    {
+      char dir[128];
+      snprintf (dir, sizeof (dir), "/sys/devices/system/cpu/cpu%lu/topology/", cpu);
+
+      std::string package = read_line (std::string (dir) + "physical_package_id");
+      std::string core = read_line (std::string (dir) + "core_id");
+
+      if (!package.empty ())
+        packages.insert (package);
+
+      if (!package.empty () && !core.empty ())
+        cores.insert (std::make_pair (package, core));
+    }
+
+  t.packages = packages.size ();
+  t.cores = cores.empty () ? t.online : cores.size ();
+  t.numa_nodes = 0;
+
+  DIR *d = opendir ("/sys/devices/system/node");
+  struct dirent *e;
+
+  while (d && (e = readdir (d)))
+    {
+      if (!strncmp (e->d_name, "node", 4) && e->d_name[4] >= '0' && e->d_name[4] <= '9')
+        t.numa_nodes++;
+    }
+
+  if (d)
+    closedir (d);
+
+  for (size_t i = 0; ; i++)
+    {
+      char dir[128];
+      snprintf (dir, sizeof (dir), "/sys/devices/system/cpu/cpu0/cache/index%lu/", i);
+
+      std::string level = read_line (std::string (dir) + "level");
+      std::string type = read_line (std::string (dir) + "type");
+      std::string size = read_line (std::string (dir) + "size");
+
+      if (level.empty ())
+        break;
+
+      if (!t.caches.empty ())
+        t.caches += ", ";
+
+      t.caches += "L" + level + (type == "Data" ? "d" : (type == "Instruction" ? "i" : "")) + " " + size;
+    }
+
+  return t;
+}
+
+/* Local worker processes for the distributed multiplier, started on first use */
+static size_t distributed_workers = 2;
+static std::vector<pid_t> worker_pids;
+
+template <typename T>
+static const std::vector<std::string>&
+worker_endpoints ()
+{
+  static std::vector<std::string> endpoints;
+
+  if (endpoints.empty ())
+    {
+      for (size_t i = 0; i < distributed_workers; i++)
+        {
+          std::string e;
+          pid_t pid = strassen::strassen_worker<T>::spawn (e);
+
+          if (pid > 0)
+            {
+              endpoints.push_back (e);
+              worker_pids.push_back (pid);
+            }
+        }
+    }
+
+  return endpoints;
+}
+
+template <typename T>
+static strassen::matrix_multiplier<T>*
+make_multiplier (const std::string &name)
+{
+  if (name == "naive")
+    return new strassen::naive_matrix_multiplier<T> ();
+  if (name == "transpose")
+    return new strassen::transpose_matrix_multiplier<T> ();
+  if (name == "strassen")
+    return new strassen::strassen_matrix_multiplier<T> ();
+  if (name == "parallel")
+    return new strassen::parallel_strassen_matrix_multiplier<T> ();
+  if (name == "caps")
+    return new strassen::caps_strassen_matrix_multiplier<T> ();
+  if (name == "adaptive")
+    return new strassen::adaptive_matrix_multiplier<T> ();
+  if (name == "distributed")
+    return new strassen::distributed_strassen_matrix_multiplier<T> (worker_endpoints<T> ());
+  if (name == "cached")
+    return new strassen::cached_matrix_multiplier<T> (new strassen::adaptive_matrix_multiplier<T> ());
+  if (name == "skinny")
+    return new strassen::skinny_matrix_multiplier<T> ();
+
+  return NULL;
+}
+
+/* The multipliers whose thread count can be set, with that many threads, or NULL for the others */
+template <typename T>
+static strassen::matrix_multiplier<T>*
+make_threaded_multiplier (const std::string &name, size_t threads)
+{
+  if (name == "strassen")
+    {
+      strassen::strassen_matrix_multiplier<T> *smm = new strassen::strassen_matrix_multiplier<T> ();
+      smm->threads (threads);
+      return smm;
+    }
+  if (name == "parallel")
+    return new strassen::parallel_strassen_matrix_multiplier<T> (strassen::STRASSEN_THRESHOLD, threads);
+  if (name == "caps")
+    return new strassen::caps_strassen_matrix_multiplier<T> (threads);
+  if (name == "skinny")
+    return new strassen::skinny_matrix_multiplier<T> (threads);
+
+  return NULL;
+}
+
+template <typename T>
+static size_t
+predicted_peak_bytes (const std::string &name, size_t m, size_t k, size_t n)
+{
+  if (name == "naive")
+    return strassen::naive_matrix_multiplier<T>::predicted_peak_bytes (m, k, k, n);
+  if (name == "transpose")
+    return strassen::transpose_matrix_multiplier<T>::predicted_peak_bytes (m, k, k, n);
+  if (name == "strassen")
+    return strassen::strassen_matrix_multiplier<T>::predicted_peak_bytes (m, k, k, n);
+  if (name == "parallel")
+    return strassen::parallel_strassen_matrix_multiplier<T>::predicted_peak_bytes (m, k, k, n);
+  if (name == "caps")
+    return strassen::caps_strassen_matrix_multiplier<T>::predicted_peak_bytes (m, k, k, n, 0, 0);
+  if (name == "adaptive")
+    return strassen::adaptive_matrix_multiplier<T>::predicted_peak_bytes (m, k, k, n);
+  if (name == "distributed")
+    return strassen::distributed_strassen_matrix_multiplier<T>::predicted_peak_bytes (m, k, k, n);
+  if (name == "cached")
+    return (m * n * sizeof (T));
+  if (name == "skinny")
+    return strassen::skinny_matrix_multiplier<T>::predicted_peak_bytes (m, k, k, n);
+
+  return 0;
+}
+
+template <typename T>
+static void
+fill (T *A, size_t n)
+{
+  for (size_t i = 0; i < n; i++)
+    A[i] = (T) ((rand () % 2001) - 1000) / (T) 16;
+}
+
+/* Integers are kept small enough that products cannot overflow */
+template <>
+void
+fill<int> (int *A, size_t n)
+{
+  for (size_t i = 0; i < n; i++)
+    A[i] = (rand () % 201) - 100;
+}
+
+/**
+ * Returns the value at fraction q of the sorted samples, by nearest rank.
+ */
+static double
+percentile (const std::vector<double> &sorted, double q)
+{
+  size_t rank = (size_t) (q * sorted.size () + 0.999999);
+
+  if (rank < 1)
+    rank = 1;
+
+  return sorted[rank - 1];
+}
+
+/**
+ * Adds the counts of b into a.
+ */
+static void
+add_sample (strassen::perf_sample &a, const strassen::perf_sample &b)
+{
+  for (int i = 0; i < strassen::NUM_PERF_EVENTS; i++)
+    {
+      a.count[i] += b.count[i];
+      a.valid[i] = b.valid[i];
+    }
+}
+
+static void
+scale_sample (strassen::perf_sample &a, size_t n)
+{
+  for (int i = 0; i < strassen::NUM_PERF_EVENTS; i++)
+    a.count[i] /= n;
+}
+
+static void
+zero_sample (strassen::perf_sample &a)
+{
+  for (int i = 0; i < strassen::NUM_PERF_EVENTS; i++)
+    {
+      a.count[i] = 0;
+      a.valid[i] = false;
+    }
+}
+
+/* Whether anything at all was counted in a */
+static bool
+sample_counted (const strassen::perf_sample &a)
+{
+  for (int i = 0; i < strassen::NUM_PERF_EVENTS; i++)
+    {
+      if (a.valid[i] && a.count[i])
+        return true;
+    }
+
+  return false;
+}
+
+static void
+print_sample_text (const char *label, const strassen::perf_sample &a)
+{
+  printf ("    %-10s", label);
+
+  for (int i = 0; i < strassen::NUM_PERF_EVENTS; i++)
+    {
+      if (a.valid[i])
+        printf (" %s=%lu", strassen::perf_counters::event_name ((strassen::perf_event) i), a.count[i]);
+      else
+        printf (" %s=n/a", strassen::perf_counters::event_name ((strassen::perf_event) i));
+    }
+
+  printf ("\n");
+}
+
+static void
+print_sample_json (FILE *out, const strassen::perf_sample &a)
+{
+  fprintf (out, "{");
+
+  for (int i = 0; i < strassen::NUM_PERF_EVENTS; i++)
+    {
+      fprintf (out, "%s\"%s\": ", i ? ", " : "", strassen::perf_counters::event_name ((strassen::perf_event) i));
+
+      if (a.valid[i])
+        fprintf (out, "%lu", a.count[i]);
+      else
+        fprintf (out, "null");
+    }
+
+  fprintf (out, "}");
+}
+
+template <typename T>
+static void
+bench_type (const char *type, const bench_options &opts, std::vector<bench_result> &results)
+{
+  strassen::timer t;
+  strassen::perf_counters pc;
+
+  for (size_t x = 0; x < opts.multipliers.size (); x++)
+    {
+      strassen::matrix_multiplier<T> *mm = make_multiplier<T> (opts.multipliers[x]);
+      strassen::strassen_matrix_multiplier<T> *smm = dynamic_cast<strassen::strassen_matrix_multiplier<T> *> (mm);
+
+      if (opts.counters && smm)
+        smm->observe (&pc);
+
+      for (size_t s = 0; s < opts.shapes.size (); s += 3)
+        {
+          size_t m = opts.shapes[s];
+          size_t k = opts.shapes[s + 1];
+          size_t n = opts.shapes[s + 2];
+
+          T *A = (T *) strassen::aligned_malloc (m * k * sizeof (T));
+          T *B = (T *) strassen::aligned_malloc (k * n * sizeof (T));
+          std::vector<double> times;
+          bench_result r;
+
+          r.counters = opts.counters;
+          r.verified = false;
+          zero_sample (r.total);
+
+          for (int p = 0; p < strassen::NUM_PHASES; p++)
+            zero_sample (r.phases[p]);
+
+          fill (A, m * k);
+          fill (B, k * n);
+
+          for (size_t i = 0; i < opts.warmup + opts.reps; i++)
+            {
+              if (opts.counters)
+                pc.start ();
+
+              t.start ();
+              T *C = mm->mult (A, B, m, k, k, n);
+              t.stop ();
+
+              if (opts.counters)
+                pc.stop ();
+
+              if (i + 1 == opts.warmup + opts.reps)
+                r.verified = C && strassen::freivalds (A, B, C, m, k, n);
+
+              free (C);
+
+              if (i >= opts.warmup)
+                {
+                  times.push_back (t.elapsed ());
+
+                  if (opts.counters)
+                    {
+                      add_sample (r.total, pc.total ());
+
+                      for (int p = 0; p < strassen::NUM_PHASES; p++)
+                        add_sample (r.phases[p], pc.phase_total ((strassen::mult_phase) p));
+                    }
+                }
+            }
+
+          std::sort (times.begin (), times.end ());
+
+          double sum = 0.0;
+
+          for (size_t i = 0; i < times.size (); i++)
+            sum += times[i];
+
+          r.multiplier = opts.multipliers[x];
+          r.type = type;
+          r.m = m;
+          r.k = k;
+          r.n = n;
+          r.reps = times.size ();
+          r.min = times.front ();
+          r.median = percentile (times, 0.5);
+          r.p95 = percentile (times, 0.95);
+          r.mean = sum / times.size ();
+          r.gflops = (2.0 * m * k * n) / r.median / 1e9;
+          r.gbps = ((double) ((m * k) + (k * n) + (m * n)) * sizeof (T)) / r.median / 1e9;
+          r.peak_bytes = mm->usage ().peak ();
+          r.allocations = mm->usage ().allocations ();
+          r.predicted_bytes = predicted_peak_bytes<T> (opts.multipliers[x], m, k, n);
+
+          scale_sample (r.total, r.reps);
+
+          for (int p = 0; p < strassen::NUM_PHASES; p++)
+            scale_sample (r.phases[p], r.reps);
+
+          results.push_back (r);
+
+          if (!r.verified)
+            fprintf (stderr, "strassen_bench: %s %s %lux%lux%lu product failed verification\n", type,
+                     r.multiplier.c_str (), m, k, n);
+
+          if (opts.format != "text")
+            fprintf (stderr, "strassen_bench: %s %s %lux%lux%lu done\n", type, r.multiplier.c_str (), m, k, n);
+          else
+            {
+              printf ("%-10s %-8s %6lu %6lu %6lu %12.6f %12.6f %12.6f %10.3f %10.3f %10.2f %10.2f\n",
+                      r.multiplier.c_str (), type, m, k, n, r.min, r.median, r.p95, r.gflops, r.gbps,
+                      r.peak_bytes / 1048576.0, r.predicted_bytes / 1048576.0);
+
+              if (r.counters)
+                {
+                  print_sample_text ("total", r.total);
+
+                  for (int p = 0; p < strassen::NUM_PHASES; p++)
+                    {
+                      if (sample_counted (r.phases[p]))
+                        print_sample_text (strassen::phase_name ((strassen::mult_phase) p), r.phases[p]);
+                    }
+                }
+            }
+
+          strassen::distributed_strassen_matrix_multiplier<T> *dsmm =
+            dynamic_cast<strassen::distributed_strassen_matrix_multiplier<T> *> (mm);
+
+          if (dsmm)
+            {
+              const strassen::distributed_stats &ds = dsmm->stats ();
+
+              fprintf ((opts.format == "text") ? stdout : stderr,
+                       "distributed %-8s %lux%lux%lu: %lu workers, %lu remote and %lu local products, "
+                       "%.2f MiB sent, %.2f MiB received, communication %.6f s, compute %.6f s (ratio %.3f), "
+                       "wall %.6f s\n", type, m, k, n, dsmm->workers (), ds.products, ds.local,
+                       ds.bytes_sent / 1048576.0, ds.bytes_received / 1048576.0, ds.communication, ds.compute,
+                       ds.compute > 0.0 ? ds.communication / ds.compute : 0.0, ds.wall);
+            }
+
+          fflush (stdout);
+
+          free (A);
+          free (B);
+        }
+
+      delete mm;
+    }
+}
+
+/**
+ * Runs a stream of opts.async requests, cycling through the shapes, synchronously and through an
+ * async_matrix_multiplier. Each request fills new operands, as a caller producing them would, and its product
+ * is released when it is done; the async stream does this in a callback, so the future is not needed.
+ */
+template <typename T>
+static void
+bench_async (const char *type, const bench_options &opts)
+{
+  strassen::timer t;
+  strassen::adaptive_matrix_multiplier<T> amm;
+  size_t shapes = opts.shapes.size () / 3;
+
+  t.start ();
+
+  for (size_t r = 0; r < opts.async; r++)
+    {
+      size_t m = opts.shapes[3 * (r % shapes)];
+      size_t k = opts.shapes[(3 * (r % shapes)) + 1];
+      size_t n = opts.shapes[(3 * (r % shapes)) + 2];
+
+      T *A = (T *) strassen::aligned_malloc (m * k * sizeof (T));
+      T *B = (T *) strassen::aligned_malloc (k * n * sizeof (T));
+
+      fill (A, m * k);
+      fill (B, k * n);
+      free (amm.mult (A, B, m, k, k, n));
+      free (A);
+      free (B);
+    }
+
+  t.stop ();
+
+  double sync = t.elapsed ();
+  strassen::async_matrix_multiplier<T> *async = new strassen::async_matrix_multiplier<T> ();
+  size_t workers = async->workers ();
+
+  t.start ();
+
+  for (size_t r = 0; r < opts.async; r++)
+    {
+      size_t m = opts.shapes[3 * (r % shapes)];
+      size_t k = opts.shapes[(3 * (r % shapes)) + 1];
+      size_t n = opts.shapes[(3 * (r % shapes)) + 2];
+
+      T *A = (T *) strassen::aligned_malloc (m * k * sizeof (T));
+      T *B = (T *) strassen::aligned_malloc (k * n * sizeof (T));
+
+      fill (A, m * k);
+      fill (B, k * n);
+      async->submit (A, B, m, k, k, n, [A, B] (T *C)
+                     {
+                       free (C);
+                       free (A);
+                       free (B);
+                     });
+    }
+
+  async->wait ();
+  t.stop ();
+  delete async;
+
+  double overlapped = t.elapsed ();
+  FILE *out = (opts.format == "text") ? stdout : stderr;
+
+  fprintf (out, "async %-8s %lu requests over %lu shapes: sync %.2f req/s, async %.2f req/s on %lu workers, "
+           "speedup %.2fx\n", type, opts.async, shapes, opts.async / sync, opts.async / overlapped, workers,
+           sync / overlapped);
+  fflush (out);
+}
+
+/**
+ * The median time of the timed repetitions of an m x k by k x n product on new operands, after the warmup
+ * runs. verified is set to whether the last product passed freivalds ().
+ */
+template <typename T>
+static double
+median_time (strassen::matrix_multiplier<T> *mm, size_t m, size_t k, size_t n, const bench_options &opts,
+             bool &verified)
+{
+  strassen::timer t;
+  T *A = (T *) strassen::aligned_malloc (m * k * sizeof (T));
+  T *B = (T *) strassen::aligned_malloc (k * n * sizeof (T));
+  std::vector<double> times;
+
+  fill (A, m * k);
+  fill (B, k * n);
+  verified = false;
+
+  for (size_t i = 0; i < opts.warmup + opts.reps; i++)
+    {
+      t.start ();
+      T *C = mm->mult (A, B, m, k, k, n);
+      t.stop ();
+
+      if (i + 1 == opts.warmup + opts.reps)
+        verified = C && strassen::freivalds (A, B, C, m, k, n);
+
+      free (C);
+
+      if (i >= opts.warmup)
+        times.push_back (t.elapsed ());
+    }
+
+  free (A);
+  free (B);
+
+  std::sort (times.begin (), times.end ());
+
+  return percentile (times, 0.5);
+}
+
+/**
+ * Runs every multiplier with each of opts.scaling threads, on each shape for strong scaling and on the shape
+ * grown with the thread count for weak scaling. The first thread count is the baseline of both; its run is
+ * shared by the two.
+ */
+template <typename T>
+static void
+bench_scaling (const char *type, const bench_options &opts, std::vector<scaling_result> &results)
+{
+  size_t p0 = opts.scaling[0];
+
+  for (size_t x = 0; x < opts.multipliers.size (); x++)
+    {
+      for (size_t s = 0; s < opts.shapes.size (); s += 3)
+        {
+          double t0 = 0.0;
+          double g0 = 0.0;
+
+          for (int weak = 0; weak < 2; weak++)
+            {
+              for (size_t i = 0; i < opts.scaling.size (); i++)
+                {
+                  size_t p = opts.scaling[i];
+                  double grow = weak ? cbrt ((double) p / p0) : 1.0;
+                  scaling_result r;
+
+                  r.multiplier = opts.multipliers[x];
+                  r.type = type;
+                  r.mode = weak ? "weak" : "strong";
+                  r.m = (size_t) ((opts.shapes[s] * grow) + 0.5);
+                  r.k = (size_t) ((opts.shapes[s + 1] * grow) + 0.5);
+                  r.n = (size_t) ((opts.shapes[s + 2] * grow) + 0.5);
+                  r.threads = p;
+
+                  if (weak && !i)
+                    {
+                      r.median = t0;
+                      r.verified = results[results.size () - opts.scaling.size ()].verified;
+                    }
+                  else
+                    {
+                      strassen::matrix_multiplier<T> *mm = make_threaded_multiplier<T> (r.multiplier, p);
+
+                      r.median = median_time (mm, r.m, r.k, r.n, opts, r.verified);
+                      delete mm;
+                    }
+
+                  r.gflops = (2.0 * r.m * r.k * r.n) / r.median / 1e9;
+
+                  if (!i)
+                    {
+                      t0 = r.median;
+                      g0 = r.gflops;
+                    }
+
+                  r.speedup = weak ? (r.gflops / g0) : (t0 / r.median);
+                  r.efficiency = (r.speedup * p0) / p;
+
+                  results.push_back (r);
+
+                  if (!r.verified)
+                    fprintf (stderr, "strassen_bench: %s %s %lux%lux%lu on %lu threads failed verification\n", type,
+                             r.multiplier.c_str (), r.m, r.k, r.n, p);
+
+                  if (opts.format != "text")
+                    fprintf (stderr, "strassen_bench: %s %s %s %lux%lux%lu on %lu threads done\n", type,
+                             r.multiplier.c_str (), r.mode.c_str (), r.m, r.k, r.n, p);
+                  else
+                    printf ("%-10s %-8s %-6s %6lu %6lu %6lu %7lu %12.6f %10.3f %8.3f %10.3f\n",
+                            r.multiplier.c_str (), type, r.mode.c_str (), r.m, r.k, r.n, p, r.median, r.gflops,
+                            r.speedup, r.efficiency);
+
+                  fflush (stdout);
+                }
+            }
+        }
+    }
+}
+
+static void
+print_topology_text (FILE *out, const cpu_topology &t, const char *prefix)
+{
+  fprintf (out, "%smodel: %s\n", prefix, t.model.c_str ());
+  fprintf (out, "%sonline: %lu\n", prefix, t.online);
+  fprintf (out, "%sallowed: %lu\n", prefix, t.allowed);
+  fprintf (out, "%spackages: %lu\n", prefix, t.packages);
+  fprintf (out, "%scores: %lu\n", prefix, t.cores);
+  fprintf (out, "%snuma_nodes: %lu\n", prefix, t.numa_nodes);
+  fprintf (out, "%scaches: %s\n", prefix, t.caches.c_str ());
+}
+
+static void
+print_scaling_csv (FILE *out, const cpu_topology &t, const std::vector<scaling_result> &results)
+{
+  print_topology_text (out, t, "# ");
+
+  fprintf (out, "multiplier,type,mode,m,k,n,threads,median_s,gflops,speedup,efficiency,verified\n");
+
+  for (size_t i = 0; i < results.size (); i++)
+    {
+      const scaling_result &r = results[i];
+
+      fprintf (out, "%s,%s,%s,%lu,%lu,%lu,%lu,%.9f,%.6f,%.6f,%.6f,%d\n",
+               r.multiplier.c_str (), r.type.c_str (), r.mode.c_str (), r.m, r.k, r.n, r.threads,
+               r.median, r.gflops, r.speedup, r.efficiency, r.verified ? 1 : 0);
+    }
+}
+
+static void
+print_scaling_json (FILE *out, const cpu_topology &t, const std::vector<scaling_result> &results)
+{
+  /* The model name is the only free text, and has no quotes or backslashes to escape in practice */
+  fprintf (out, "{\n  \"topology\": {\"model\": \"%s\", \"online\": %lu, \"allowed\": %lu, \"packages\": %lu, "
+           "\"cores\": %lu, \"numa_nodes\": %lu, \"caches\": \"%s\"},\n  \"results\": [\n",
+           t.model.c_str (), t.online, t.allowed, t.packages, t.cores, t.numa_nodes, t.caches.c_str ());
+
+  for (size_t i = 0; i < results.size (); i++)
+    {
+      const scaling_result &r = results[i];
+
+      fprintf (out, "    {\"multiplier\": \"%s\", \"type\": \"%s\", \"mode\": \"%s\", \"m\": %lu, \"k\": %lu, "
+               "\"n\": %lu, \"threads\": %lu, \"median_s\": %.9f, \"gflops\": %.6f, \"speedup\": %.6f, "
+               "\"efficiency\": %.6f, \"verified\": %s}%s\n",
+               r.multiplier.c_str (), r.type.c_str (), r.mode.c_str (), r.m, r.k, r.n, r.threads,
+               r.median, r.gflops, r.speedup, r.efficiency, r.verified ? "true" : "false",
+               (i + 1 < results.size ()) ? "," : "");
+    }
+
+  fprintf (out, "  ]\n}\n");
+}
+
+static void
+print_csv (FILE *out, const std::vector<bench_result> &results)
+{
+  bool counters = !results.empty () && results[0].counters;
+
+  fprintf (out, "multiplier,type,m,k,n,reps,min_s,median_s,p95_s,mean_s,gflops,gbps,"
+           "peak_bytes,predicted_bytes,allocations,verified");
+
+  if (counters)
+    {
+      for (int e = 0; e < strassen::NUM_PERF_EVENTS; e++)
+        fprintf (out, ",%s", strassen::perf_counters::event_name ((strassen::perf_event) e));
+    }
+
+  fprintf (out, "\n");
+
+  for (size_t i = 0; i < results.size (); i++)
+    {
+      const bench_result &r = results[i];
+
+      fprintf (out, "%s,%s,%lu,%lu,%lu,%lu,%.9f,%.9f,%.9f,%.9f,%.6f,%.6f,%lu,%lu,%lu,%d",
+               r.multiplier.c_str (), r.type.c_str (), r.m, r.k, r.n, r.reps,
+               r.min, r.median, r.p95, r.mean, r.gflops, r.gbps,
+               r.peak_bytes, r.predicted_bytes, r.allocations, r.verified ? 1 : 0);
+
+      if (counters)
+        {
+          /* Counters which could not be read are left empty */
+          for (int e = 0; e < strassen::NUM_PERF_EVENTS; e++)
+            {
+              if (r.total.valid[e])
+                fprintf (out, ",%lu", r.total.count[e]);
+              else
+                fprintf (out, ",");
+            }
+        }
+
+      fprintf (out, "\n");
+    }
+}
+
+static void
+print_json (FILE *out, const std::vector<bench_result> &results)
+{
+  fprintf (out, "[\n");
+
+  for (size_t i = 0; i < results.size (); i++)
+    {
+      const bench_result &r = results[i];
+
+      fprintf (out, "  {\"multiplier\": \"%s\", \"type\": \"%s\", \"m\": %lu, \"k\": %lu, \"n\": %lu, "
+               "\"reps\": %lu, \"min_s\": %.9f, \"median_s\": %.9f, \"p95_s\": %.9f, \"mean_s\": %.9f, "
+               "\"gflops\": %.6f, \"gbps\": %.6f, \"peak_bytes\": %lu, \"predicted_bytes\": %lu, "
+               "\"allocations\": %lu, \"verified\": %s",
+               r.multiplier.c_str (), r.type.c_str (), r.m, r.k, r.n, r.reps,
+               r.min, r.median, r.p95, r.mean, r.gflops, r.gbps,
+               r.peak_bytes, r.predicted_bytes, r.allocations, r.verified ? "true" : "false");
+
+      if (r.counters)
+        {
+          fprintf (out, ", \"counters\": ");
+          print_sample_json (out, r.total);
+          fprintf (out, ", \"phases\": {");
+
+          bool first = true;
+
+          for (int p = 0; p < strassen::NUM_PHASES; p++)
+            {
+              if (!sample_counted (r.phases[p]))
+                continue;
+
+              fprintf (out, "%s\"%s\": ", first ? "" : ", ", strassen::phase_name ((strassen::mult_phase) p));
+              print_sample_json (out, r.phases[p]);
+              first = false;
+            }
+
+          fprintf (out, "}");
+        }
+
+      fprintf (out, "}%s\n", (i + 1 < results.size ()) ? "," : "");
+    }
+
+  fprintf (out, "]\n");
+}
+
+/**
+ * The --scaling mode of main (): runs the sweep for each type and writes the results with the topology.
+ */
+static int
+run_scaling (const bench_options &opts, const char *output)
+{
+  cpu_topology topology = read_topology ();
+  std::vector<scaling_result> results;
+
+  for (size_t i = 0; i < opts.scaling.size (); i++)
+    {
+      if (opts.scaling[i] > topology.allowed)
+        fprintf (stderr, "strassen_bench: %lu threads is more than the %lu processors this process may use\n",
+                 opts.scaling[i], topology.allowed);
+    }
+
+  if (opts.format == "text")
+    {
+      print_topology_text (stdout, topology, "");
+      printf ("%-10s %-8s %-6s %6s %6s %6s %7s %12s %10s %8s %10s\n", "multiplier", "type", "mode", "m", "k", "n",
+              "threads", "median(s)", "GFLOP/s", "speedup", "efficiency");
+    }
+
+  for (size_t i = 0; i < opts.types.size (); i++)
+    {
+      if (opts.types[i] == "int")
+        bench_scaling<int> ("int", opts, results);
+      else if (opts.types[i] == "float")
+        bench_scaling<float> ("float", opts, results);
+      else if (opts.types[i] == "double")
+        bench_scaling<double> ("double", opts, results);
+      else
+        fprintf (stderr, "strassen_bench: unknown type '%s'\n", opts.types[i].c_str ());
+    }
+
+  FILE *out = stdout;
+
+  if (output)
+    {
+      out = fopen (output, "w");
+
+      if (!out)
+        {
+          perror ("strassen_bench: fopen");
+          return 1;
+        }
+    }
+
+  if (opts.format == "json")
+    print_scaling_json (out, topology, results);
+  else if (opts.format == "csv" || output)
+    print_scaling_csv (out, topology, results);
+
+  if (output)
+    fclose (out);
+
+  for (size_t i = 0; i < results.size (); i++)
+    {
+      if (!results[i].verified)
+        return 1;
+    }
+
+  return 0;
+}
+
+static void
+usage (const char *name)
+{
+  fprintf (stderr,
+           "usage: %s [options]\n"
+           "  -s, --sizes LIST        comma separated shapes: N, MxK or MxKxN (default 128,256,512,1024)\n"
+           "  -m, --multipliers LIST  naive,transpose,strassen,parallel,caps,adaptive,distributed,\n"
+           "                          cached,skinny\n"
+           "                          (default all but caps, distributed, cached and skinny)\n"
+           "  -t, --types LIST        int,float,double (default int,double)\n"
+           "  -r, --reps N            timed repetitions (default 5)\n"
+           "  -w, --warmup N          untimed warmup runs (default 1)\n"
+           "  -f, --format FORMAT     text, csv or json (default text)\n"
+           "  -o, --output PATH       write results to PATH rather than stdout\n"
+           "  -c, --counters          report hardware performance counters per call and per phase\n"
+           "  -W, --workers N         local worker processes for the distributed multiplier (default 2)\n"
+           "  -a, --async N           also run a stream of N mixed-size requests, synchronously and asynchronously\n"
+           "  -H, --huge-pages        back buffers of 4 MiB or more with transparent huge pages\n"
+           "  -T, --trace PATH        write a Chrome trace of the multipliers' internals to PATH\n"
+           "  -S, --scaling LIST      run strassen, parallel, caps or skinny with each of these thread\n"
+           "                          counts, for strong and weak scaling (default multipliers strassen,\n"
+           "                          parallel,caps)\n",
+           name);
+}
+
+int
+main (int argc, char **argv)
+{
+  bench_options opts;
+  const char *output = NULL;
+  const char *trace = NULL;
+  std::vector<std::string> sizes = split ("128,256,512,1024");
+
+  opts.multipliers = split ("naive,transpose,strassen,parallel,adaptive");
+  opts.types = split ("int,double");
+  opts.reps = 5;
+  opts.warmup = 1;
+  opts.format = "text";
+  opts.counters = false;
+  opts.async = 0;
+
+  static struct option long_opts[] =
+    {
+      { "sizes", required_argument, NULL, 's' },
+      { "multipliers", required_argument, NULL, 'm' },
+      { "types", required_argument, NULL, 't' },
+      { "reps", required_argument, NULL, 'r' },
+      { "warmup", required_argument, NULL, 'w' },
+      { "format", required_argument, NULL, 'f' },
+      { "output", required_argument, NULL, 'o' },
+      { "counters", no_argument, NULL, 'c' },
+      { "trace", required_argument, NULL, 'T' },
+      { "huge-pages", no_argument, NULL, 'H' },
+      { "async", required_argument, NULL, 'a' },
+      { "workers", required_argument, NULL, 'W' },
+      { "scaling", required_argument, NULL, 'S' },
+      { "help", no_argument, NULL, 'h' },
+      { NULL, 0, NULL, 0 }
+    };
+
+  int c;
+  bool multipliers = false;
+
+  while ((c = getopt_long (argc, argv, "s:m:t:r:w:f:o:cT:Ha:W:S:h", long_opts, NULL)) != -1)
+    {
+      switch (c)
+        {
+        case 's': sizes = split (optarg); break;
+        case 'm': opts.multipliers = split (optarg); multipliers = true; break;
+        case 't': opts.types = split (optarg); break;
+        case 'r': opts.reps = strtoul (optarg, NULL, 10); break;
+        case 'w': opts.warmup = strtoul (optarg, NULL, 10); break;
+        case 'f': opts.format = optarg; break;
+        case 'o': output = optarg; break;
+        case 'c': opts.counters = true; break;
+        case 'T': trace = optarg; break;
+        case 'H': strassen::set_huge_page_threshold (strassen::HUGE_PAGE_DEFAULT_THRESHOLD); break;
+        case 'a': opts.async = strtoul (optarg, NULL, 10); break;
+        case 'W': distributed_workers = strtoul (optarg, NULL, 10); break;
+        case 'S':
+          {
+            std::vector<std::string> counts = split (optarg);
+
+            for (size_t i = 0; i < counts.size (); i++)
+              opts.scaling.push_back (strtoul (counts[i].c_str (), NULL, 10));
+
+            break;
+          }
+        default:
+          usage (argv[0]);
+          return (c == 'h' ? 0 : 1);
+        }
+    }
+
+  for (size_t i = 0; i < sizes.size (); i++)
+    {
+      if (!parse_shape (sizes[i], opts.shapes))
+        {
+          fprintf (stderr, "strassen_bench: bad shape '%s'\n", sizes[i].c_str ());
+          return 1;
+        }
+    }
+
+  if (!opts.scaling.empty ())
+    {
+      if (!multipliers)
+        opts.multipliers = split ("strassen,parallel,caps");
+
+      for (size_t i = 0; i < opts.scaling.size (); i++)
+        {
+          if (!opts.scaling[i])
+            {
+              fprintf (stderr, "strassen_bench: bad thread count in --scaling\n");
+              return 1;
+            }
+        }
+
+      for (size_t i = 0; i < opts.multipliers.size (); i++)
+        {
+          strassen::matrix_multiplier<int> *mm = make_threaded_multiplier<int> (opts.multipliers[i], 1);
+
+          if (!mm)
+            {
+              fprintf (stderr, "strassen_bench: the thread count of '%s' cannot be set\n",
+                       opts.multipliers[i].c_str ());
+              return 1;
+            }
+
+          delete mm;
+        }
+    }
+
+  for (size_t i = 0; i < opts.multipliers.size (); i++)
+    {
+      /* Not made here, which would start its workers */
+      if (opts.multipliers[i] == "distributed")
+        continue;
+
+      strassen::matrix_multiplier<int> *mm = make_multiplier<int> (opts.multipliers[i]);
+
+      if (!mm)
+        {
+          fprintf (stderr, "strassen_bench: unknown multiplier '%s'\n", opts.multipliers[i].c_str ());
+          return 1;
+        }
+
+      delete mm;
+    }
+
+  if (!opts.reps || (opts.format != "text" && opts.format != "csv" && opts.format != "json"))
+    {
+      usage (argv[0]);
+      return 1;
+    }
+
+  if (opts.counters)
+    {
+      strassen::perf_counters pc;
+
+      if (!pc.available ())
+        fprintf (stderr, "strassen_bench: hardware performance counters are unavailable; "
+                 "counts will be reported as n/a\n");
+    }
+
+#ifndef STRASSEN_TRACE
+  if (trace)
+    fprintf (stderr, "strassen_bench: built without STRASSEN_TRACE; the trace will be empty\n");
+#endif
+
+  srand (1);
+
+  if (!opts.scaling.empty ())
+    return (run_scaling (opts, output));
+
+  if (opts.format == "text")
+    printf ("%-10s %-8s %6s %6s %6s %12s %12s %12s %10s %10s %10s %10s\n",
+            "multiplier", "type", "m", "k", "n", "min(s)", "median(s)", "p95(s)", "GFLOP/s", "GB/s",
+            "peak(MiB)", "pred(MiB)");
+
+  std::vector<bench_result> results;
+
+  for (size_t i = 0; i < opts.types.size (); i++)
+    {
+      if (opts.types[i] == "int")
+        {
+          bench_type<int> ("int", opts, results);
+
+          if (opts.async)
+            bench_async<int> ("int", opts);
+        }
+      else if (opts.types[i] == "float")
+        {
+          bench_type<float> ("float", opts, results);
+
+          if (opts.async)
+            bench_async<float> ("float", opts);
+        }
+      else if (opts.types[i] == "double")
+        {
+          bench_type<double> ("double", opts, results);
+
+          if (opts.async)
+            bench_async<double> ("double", opts);
+        }
+      else
+        fprintf (stderr, "strassen_bench: unknown type '%s'\n", opts.types[i].c_str ());
+    }
+
+  for (size_t i = 0; i < worker_pids.size (); i++)
+    strassen::strassen_worker<int>::stop (worker_pids[i]);
+
+  FILE *out = stdout;
+
+  if (output)
+    {
+      out = fopen (output, "w");
+
+      if (!out)
+        {
+          perror ("strassen_bench: fopen");
+          return 1;
+        }
+    }
+
+  if (opts.format == "csv")
+    print_csv (out, results);
+  else if (opts.format == "json")
+    print_json (out, results);
+  else if (output)
+    print_csv (out, results);
+
+  if (output)
+    fclose (out);
+
+  if (trace && !strassen::trace_export_chrome (trace))
+    return 1;
+
+  for (size_t i = 0; i < results.size (); i++)
+    {
+      if (!results[i].verified)
+        return 1;
+    }
+
+  return 0;
+}
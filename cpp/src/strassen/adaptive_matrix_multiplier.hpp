@@ -0,0 +1,795 @@
+#ifndef ADAPTIVE_MATRIX_MULTIPLIER_HPP_
+#define ADAPTIVE_MATRIX_MULTIPLIER_HPP_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "matrix_multiplier.hpp"
+#include "naive_matrix_multiplier.hpp"
+#include "transpose_matrix_multiplier.hpp"
+#include "strassen_matrix_multiplier.hpp"
+#include "parallel_strassen_matrix_multiplier.hpp"
+#include "skinny_matrix_multiplier.hpp"
+
+namespace strassen
+{
+  /* Smallest submatrix the adaptive multiplier will let the Strassen recursion produce */
+  const size_t ADAPTIVE_MIN_LEAF = 16;
+
+  /* Block operations (additions, copies) per level of the Strassen recursion, in units of one quadrant */
+  const size_t ADAPTIVE_BLOCK_OPS = 22;
+
+  /**
+   * Largest second operand, in bytes, for which the naive algorithm is considered. It walks its second operand
+   * by columns, which only runs at the calibrated rate while the operand stays in cache.
+   */
+  const size_t ADAPTIVE_NAIVE_MAX_BYTES = 128 * 1024;
+
+  /* Products at the top level of a parallel Strassen multiplication, shared between its workers */
+  const size_t ADAPTIVE_PARALLEL_TASKS = 7;
+
+  enum adaptive_algorithm
+  {
+    ADAPTIVE_NAIVE = 0,
+    ADAPTIVE_TRANSPOSE,
+    ADAPTIVE_STRASSEN,
+    ADAPTIVE_PARALLEL,
+    ADAPTIVE_SKINNY
+  };
+
+  inline const char*
+  adaptive_algorithm_name (adaptive_algorithm a)
+  {
+    switch (a)
+      {
+      case ADAPTIVE_NAIVE: return "naive";
+      case ADAPTIVE_TRANSPOSE: return "transpose";
+      case ADAPTIVE_STRASSEN: return "strassen";
+      case ADAPTIVE_PARALLEL: return "parallel";
+      case ADAPTIVE_SKINNY: return "skinny";
+      }
+
+    return "unknown";
+  }
+
+  /**
+   * The rates of the basic kernels on this machine, from which the adaptive multiplier estimates the running
+   * time of each algorithm.
+   */
+  struct adaptive_cost_model
+  {
+    double naive_rate;        /* Multiply-adds per second of the naive kernel */
+    double transpose_rate;    /* Multiply-adds per second of the transpose kernel */
+    double block_rate;        /* Elements per second of block additions and copies */
+    double call_overhead;     /* Seconds of fixed cost (allocation, setup) per kernel call or recursion step */
+    double thread_overhead;   /* Seconds to hand work to the parallel workers and collect it */
+    size_t cpus;              /* Processors online */
+  };
+
+  /**
+   * What the adaptive multiplier chose to do for one product.
+   */
+  struct adaptive_decision
+  {
+    adaptive_algorithm algorithm;
+    size_t depth;       /* Levels of Strassen recursion; 0 for the naive algorithms */
+    size_t threshold;   /* Size of the Strassen leaves */
+    size_t threads;     /* Threads doing the multiplication */
+    double estimate;    /* Predicted time, in seconds */
+  };
+
+  /**
+   * An adaptive_matrix_multiplier chooses, for each product, between the naive, transpose, Strassen and parallel
+   * Strassen multipliers, and for Strassen the depth of the recursion. The choice minimizes the time predicted by
+   * a simple cost model: the multiply-adds done by the kernels at the leaves, plus the block additions and copies
+   * done at each level of the recursion, padding included, at rates measured on this machine, plus a fixed cost
+   * for every step of the recursion. The parallel multiplier gets a worker for each processor besides the
+   * calling thread, at most one for each of the 7 products below the top level, at a fixed cost per handoff,
+   * so it is only chosen on multiprocessor machines and for large products. Products with a dimension of at
+   * most SKINNY_MAX, matrix-vector products among them, always go to the skinny multiplier, which neither pads
+   * nor transposes the large operand.
+   *
+   * The rates are calibrated once per element type, the first time a decision is needed, by timing the kernels
+   * on small matrices; this takes a few milliseconds. The underlying multipliers are created when first chosen.
+   *
+   * Decisions are logged to stderr if the STRASSEN_LOG environment variable is set, or to a stream given to
+   * log ().
+   */
+  template <typename T>
+  class adaptive_matrix_multiplier : public strassen::matrix_multiplier<T>
+  {
+  private:
+    naive_matrix_multiplier<T> *__nmm;
+    transpose_matrix_multiplier<T> *__tmm;
+    strassen_matrix_multiplier<T> *__smm;
+    parallel_strassen_matrix_multiplier<T> *__psmm;
+    skinny_matrix_multiplier<T> *__skmm;
+
+    FILE *__log;
+    adaptive_decision __last;
+    size_t __max_threads;
+
+    /* The decision for this multiplier, which may be limited to fewer threads than the model allows */
+    adaptive_decision __choose (size_t m, size_t k, size_t n) const;
+    static adaptive_decision __decide (const adaptive_cost_model &cm, size_t m, size_t k, size_t n);
+
+    static adaptive_cost_model& __model ();
+    static adaptive_cost_model __calibrate ();
+    static double __now ();
+
+    static double __strassen_cost (const adaptive_cost_model &cm, size_t m, size_t k, size_t n, size_t depth);
+    static double __parallel_cost (const adaptive_cost_model &cm, size_t m, size_t k, size_t n, size_t depth);
+    static size_t __parallel_threads (const adaptive_cost_model &cm);
+
+    adaptive_matrix_multiplier (const adaptive_matrix_multiplier<T> &m);
+    adaptive_matrix_multiplier<T>& operator = (const adaptive_matrix_multiplier<T> &m);
+
+  public:
+    adaptive_matrix_multiplier ();
+    virtual ~adaptive_matrix_multiplier ();
+
+    T* mult (const T *a, const T *b, size_t arows, size_t acols, size_t brows, size_t bcols);
+    matrix_multiplier<T>* copy () const;
+
+    T* pow (const T *a, size_t n, size_t k, double tolerance = 0.0);
+    T* mult_layout (const T *a, matrix_layout al, const T *b, matrix_layout bl,
+                    size_t arows, size_t acols, size_t brows, size_t bcols);
+
+    /**
+     * Prepares b with the multiplier chosen for a product with a first operand of as many rows as b: the
+     * transpose or Strassen multiplier, or a copy for the others.
+     */
+    prepared_operand<T>* prepare (const T *b, size_t brows, size_t bcols);
+    T* mult_prepared (const T *a, const prepared_operand<T> &b, size_t arows);
+
+    void account (mem_account *a);
+
+    /* Log each decision to f, or stop logging if f is NULL */
+    void log (FILE *f);
+
+    /* The decision made for the most recent multiplication */
+    const adaptive_decision& last_decision () const;
+
+    /* Use at most t threads per product, or as many as there are processors if t is 0 */
+    void max_threads (size_t t);
+
+    /* The decision that would be made for an m x k by k x n product */
+    static adaptive_decision decide (size_t m, size_t k, size_t n);
+
+    /* Peak bytes allocated by the multiplier decide () chooses for these dimensions */
+    static size_t predicted_peak_bytes (size_t arows, size_t acols, size_t brows, size_t bcols);
+
+    /* Re-measure the kernel rates, or replace them with the given model */
+    static void calibrate ();
+    static void set_model (const adaptive_cost_model &cm);
+    static adaptive_cost_model model ();
+  };
+
+  template <typename T>
+  adaptive_matrix_multiplier<T>::adaptive_matrix_multiplier ()
+    : __nmm (NULL),
+      __tmm (NULL),
+      __smm (NULL),
+      __psmm (NULL),
+      __skmm (NULL),
+      __log (getenv ("STRASSEN_LOG") ? stderr : NULL),
+      __max_threads (0)
+  {
+    __last.algorithm = ADAPTIVE_TRANSPOSE;
+    __last.depth = 0;
+    __last.threshold = 0;
+    __last.threads = 1;
+    __last.estimate = 0.0;
+  }
+
+  template <typename T>
+  adaptive_matrix_multiplier<T>::~adaptive_matrix_multiplier ()
+  {
+    delete __nmm;
+    delete __tmm;
+    delete __smm;
+    delete __psmm;
+    delete __skmm;
+  }
+
+  template <typename T>
+  matrix_multiplier<T>*
+  adaptive_matrix_multiplier<T>::copy () const
+  {
+    adaptive_matrix_multiplier<T> *amm = new adaptive_matrix_multiplier<T> ();
+    amm->log (__log);
+    amm->max_threads (__max_threads);
+
+    return amm;
+  }
+
+  template <typename T>
+  void
+  adaptive_matrix_multiplier<T>::account (mem_account *a)
+  {
+    matrix_multiplier<T>::account (a);
+
+    if (__nmm)
+      __nmm->account (this->__account);
+
+    if (__tmm)
+      __tmm->account (this->__account);
+
+    if (__smm)
+      __smm->account (this->__account);
+
+    if (__psmm)
+      __psmm->account (this->__account);
+
+    if (__skmm)
+      __skmm->account (this->__account);
+  }
+
+  template <typename T>
+  void
+  adaptive_matrix_multiplier<T>::log (FILE *f)
+  {
+    __log = f;
+  }
+
+  template <typename T>
+  const adaptive_decision&
+  adaptive_matrix_multiplier<T>::last_decision () const
+  {
+    return __last;
+  }
+
+  template <typename T>
+  void
+  adaptive_matrix_multiplier<T>::max_threads (size_t t)
+  {
+    __max_threads = t;
+  }
+
+  template <typename T>
+  adaptive_decision
+  adaptive_matrix_multiplier<T>::__choose (size_t m, size_t k, size_t n) const
+  {
+    adaptive_cost_model cm = __model ();
+
+    if (__max_threads && __max_threads < cm.cpus)
+      cm.cpus = __max_threads;
+
+    return (__decide (cm, m, k, n));
+  }
+
+  /**
+   * Multiplies a and b with whichever multiplier decide () picks for their dimensions.
+   */
+  template <typename T>
+  T*
+  adaptive_matrix_multiplier<T>::mult (const T *a, const T *b,
+                                       size_t arows, size_t acols,
+                                       size_t brows, size_t bcols)
+  {
+    this->__begin ();
+
+    if (acols != brows)
+      return NULL;
+
+    __last = __choose (arows, acols, bcols);
+
+    if (__log)
+      fprintf (__log, "adaptive_matrix_multiplier: %lux%lux%lu -> %s (depth %lu, leaf %lu, %lu threads), "
+               "estimated %.6fs\n", arows, acols, bcols, adaptive_algorithm_name (__last.algorithm),
+               __last.depth, __last.threshold, __last.threads, __last.estimate);
+
+    matrix_multiplier<T> *mm = NULL;
+
+    switch (__last.algorithm)
+      {
+      case ADAPTIVE_NAIVE:
+        if (!__nmm)
+          __nmm = new naive_matrix_multiplier<T> ();
+
+        mm = __nmm;
+        break;
+
+      case ADAPTIVE_TRANSPOSE:
+        if (!__tmm)
+          __tmm = new transpose_matrix_multiplier<T> ();
+
+        mm = __tmm;
+        break;
+
+      case ADAPTIVE_STRASSEN:
+        if (!__smm)
+          __smm = new strassen_matrix_multiplier<T> ();
+
+        __smm->threshold (__last.threshold);
+        mm = __smm;
+        break;
+
+      case ADAPTIVE_PARALLEL:
+        /* Its workers are started with it, so it is made afresh for a different number of threads */
+        if (__psmm && __psmm->threads () != __last.threads)
+          {
+            delete __psmm;
+            __psmm = NULL;
+          }
+
+        if (!__psmm)
+          __psmm = new parallel_strassen_matrix_multiplier<T> (__last.threshold, __last.threads);
+
+        __psmm->threshold (__last.threshold);
+        mm = __psmm;
+        break;
+
+      case ADAPTIVE_SKINNY:
+        if (!__skmm)
+          __skmm = new skinny_matrix_multiplier<T> ();
+
+        __skmm->threads (__last.threads);
+        mm = __skmm;
+        break;
+      }
+
+    mm->account (this->__account);
+
+    return (mm->mult (a, b, arows, acols, brows, bcols));
+  }
+
+  /**
+   * Multiplies operands in the given layouts. The transpose multiplier uses them as they are, so when it is
+   * the choice they are passed straight to it; the others lay them out by rows first.
+   */
+  template <typename T>
+  T*
+  adaptive_matrix_multiplier<T>::mult_layout (const T *a, matrix_layout al, const T *b, matrix_layout bl,
+                                              size_t arows, size_t acols, size_t brows, size_t bcols)
+  {
+    if (acols != brows || (al == ROW_MAJOR && bl == ROW_MAJOR))
+      return (matrix_multiplier<T>::mult_layout (a, al, b, bl, arows, acols, brows, bcols));
+
+    adaptive_decision d = __choose (arows, acols, bcols);
+
+    if (d.algorithm != ADAPTIVE_TRANSPOSE)
+      return (matrix_multiplier<T>::mult_layout (a, al, b, bl, arows, acols, brows, bcols));
+
+    this->__begin ();
+    __last = d;
+
+    if (!__tmm)
+      __tmm = new transpose_matrix_multiplier<T> ();
+
+    __tmm->account (this->__account);
+
+    return (__tmm->mult_layout (a, al, b, bl, arows, acols, brows, bcols));
+  }
+
+  template <typename T>
+  prepared_operand<T>*
+  adaptive_matrix_multiplier<T>::prepare (const T *b, size_t brows, size_t bcols)
+  {
+    adaptive_decision d = __choose (brows, brows, bcols);
+
+    this->__begin ();
+
+    switch (d.algorithm)
+      {
+      case ADAPTIVE_TRANSPOSE:
+        if (!__tmm)
+          __tmm = new transpose_matrix_multiplier<T> ();
+
+        __tmm->account (this->__account);
+        return (__tmm->prepare (b, brows, bcols));
+
+      case ADAPTIVE_STRASSEN:
+      case ADAPTIVE_PARALLEL:
+        if (!__smm)
+          __smm = new strassen_matrix_multiplier<T> ();
+
+        __smm->threshold (d.threshold);
+        __smm->account (this->__account);
+        return (__smm->prepare (b, brows, bcols));
+
+      default:
+        return (matrix_multiplier<T>::prepare (b, brows, bcols));
+      }
+  }
+
+  /**
+   * Multiplies by a prepared operand with the multiplier that prepared it, which decided already; copies are
+   * multiplied with mult (), which decides for their dimensions.
+   */
+  template <typename T>
+  T*
+  adaptive_matrix_multiplier<T>::mult_prepared (const T *a, const prepared_operand<T> &b, size_t arows)
+  {
+    const strassen_prepared_operand<T> *sp = dynamic_cast<const strassen_prepared_operand<T> *> (&b);
+
+    if (sp)
+      {
+        if (!__smm)
+          __smm = new strassen_matrix_multiplier<T> ();
+
+        this->__begin ();
+        __last = __choose (arows, b.rows (), b.cols ());
+        __last.algorithm = ADAPTIVE_STRASSEN;
+        __last.depth = 0;
+        __last.threshold = sp->threshold ();
+        __last.threads = 1;
+
+        for (size_t n = sp->padded_size (); n > sp->threshold (); n /= 2)
+          __last.depth++;
+
+        __smm->account (this->__account);
+        return (__smm->mult_prepared (a, b, arows));
+      }
+
+    if (dynamic_cast<const transposed_operand<T> *> (&b))
+      {
+        if (!__tmm)
+          __tmm = new transpose_matrix_multiplier<T> ();
+
+        this->__begin ();
+        __last = __choose (arows, b.rows (), b.cols ());
+        __last.algorithm = ADAPTIVE_TRANSPOSE;
+        __last.depth = 0;
+        __last.threshold = 0;
+        __last.threads = 1;
+
+        __tmm->account (this->__account);
+        return (__tmm->mult_prepared (a, b, arows));
+      }
+
+    return (matrix_multiplier<T>::mult_prepared (a, b, arows));
+  }
+
+  /**
+   * Raises a to the power k. When decide () picks the sequential Strassen multiplier for an n x n product, the
+   * whole computation is handed to it, so that a is padded once for all of the products.
+   */
+  template <typename T>
+  T*
+  adaptive_matrix_multiplier<T>::pow (const T *a, size_t n, size_t k, double tolerance)
+  {
+    adaptive_decision d = __choose (n, n, n);
+
+    if (k < 2 || d.algorithm != ADAPTIVE_STRASSEN)
+      return (matrix_multiplier<T>::pow (a, n, k, tolerance));
+
+    this->__begin ();
+    __last = d;
+
+    if (!__smm)
+      __smm = new strassen_matrix_multiplier<T> ();
+
+    __smm->threshold (d.threshold);
+    __smm->account (this->__account);
+
+    return (__smm->pow (a, n, k, tolerance));
+  }
+
+  /**
+   * Estimates the time of a Strassen multiplication recursing depth levels. The operands are padded to N x N;
+   * level l of the recursion does 7^l sets of block operations on quadrants of size (N / 2^(l+1))^2, and the
+   * 7^depth leaves are multiplied by the transpose kernel.
+   */
+  template <typename T>
+  double
+  adaptive_matrix_multiplier<T>::__strassen_cost (const adaptive_cost_model &cm,
+                                                  size_t m, size_t k, size_t n, size_t depth)
+  {
+    double N = strassen_matrix_multiplier<T>::padded_size (m, k, k, n);
+    double blocks = 0.0;
+    double leaves = 1.0;
+    double steps = 0.0;
+    double q = N;
+
+    for (size_t l = 0; l < depth; l++)
+      {
+        q /= 2;
+        blocks += leaves * ADAPTIVE_BLOCK_OPS * q * q;
+        steps += leaves;
+        leaves *= 7;
+      }
+
+    steps += leaves;
+
+    /* Padding both operands and copying out the result, when the shape is not already N x N */
+    if (m != N || k != N || n != N)
+      blocks += (2 * N * N) + ((double) m * n);
+
+    /* Each leaf product transposes its second operand */
+    blocks += leaves * q * q;
+
+    return ((leaves * q * q * q / cm.transpose_rate) + (blocks / cm.block_rate) + (steps * cm.call_overhead));
+  }
+
+  /**
+   * Estimates the time of a parallel Strassen multiplication: the top level runs on the calling thread, and the
+   * 7 products below it are shared between the workers.
+   */
+  template <typename T>
+  double
+  adaptive_matrix_multiplier<T>::__parallel_cost (const adaptive_cost_model &cm,
+                                                  size_t m, size_t k, size_t n, size_t depth)
+  {
+    double N = strassen_matrix_multiplier<T>::padded_size (m, k, k, n);
+    double half = N / 2;
+    size_t workers = __parallel_threads (cm) - 1;
+
+    /* Without workers the calling thread computes the products itself */
+    if (!workers)
+      workers = 1;
+
+    double rounds = (double) ((ADAPTIVE_PARALLEL_TASKS + workers - 1) / workers);
+    double top = ADAPTIVE_BLOCK_OPS * half * half;
+
+    if (m != N || k != N || n != N)
+      top += (2 * N * N) + ((double) m * n);
+
+    /* One worker's product is a Strassen multiplication one level shallower, on N / 2 */
+    double task = __strassen_cost (cm, (size_t) half, (size_t) half, (size_t) half, depth - 1);
+
+    return (cm.thread_overhead + (top / cm.block_rate) + (rounds * task));
+  }
+
+  /**
+   * Threads for a parallel Strassen multiplication: the calling thread, which divides the O(n^2) phases with
+   * the workers and waits while they compute the products, and a worker for each of the other processors, up
+   * to one per product.
+   */
+  template <typename T>
+  size_t
+  adaptive_matrix_multiplier<T>::__parallel_threads (const adaptive_cost_model &cm)
+  {
+    size_t cpus = cm.cpus ? cm.cpus : 1;
+
+    return ((cpus <= ADAPTIVE_PARALLEL_TASKS) ? cpus : ADAPTIVE_PARALLEL_TASKS + 1);
+  }
+
+  template <typename T>
+  adaptive_decision
+  adaptive_matrix_multiplier<T>::decide (size_t m, size_t k, size_t n)
+  {
+    return (__decide (__model (), m, k, n));
+  }
+
+  template <typename T>
+  adaptive_decision
+  adaptive_matrix_multiplier<T>::__decide (const adaptive_cost_model &cm, size_t m, size_t k, size_t n)
+  {
+    double mkn = (double) m * k * n;
+    adaptive_decision d;
+
+    d.depth = 0;
+    d.threshold = 0;
+
+    /* The skinny kernels read each operand about once, which none of the others can better */
+    if (skinny_matrix_multiplier<T>::suits (m, k, n))
+      {
+        d.algorithm = ADAPTIVE_SKINNY;
+        d.threads = skinny_matrix_multiplier<T>::threads_for (m, k, n, cm.cpus);
+        d.estimate = (mkn / cm.transpose_rate / d.threads) + cm.call_overhead
+          + ((d.threads > 1) ? cm.thread_overhead : 0.0);
+
+        return d;
+      }
+
+    d.algorithm = ADAPTIVE_TRANSPOSE;
+    d.threads = 1;
+    d.estimate = (mkn / cm.transpose_rate) + ((double) k * n / cm.block_rate) + cm.call_overhead;
+
+    double naive = (mkn / cm.naive_rate) + cm.call_overhead;
+
+    if (naive < d.estimate && k * n * sizeof (T) <= ADAPTIVE_NAIVE_MAX_BYTES)
+      {
+        d.algorithm = ADAPTIVE_NAIVE;
+        d.estimate = naive;
+      }
+
+    size_t N = strassen_matrix_multiplier<T>::padded_size (m, k, k, n);
+
+    for (size_t depth = 1; (N >> depth) >= ADAPTIVE_MIN_LEAF; depth++)
+      {
+        double t = __strassen_cost (cm, m, k, n, depth);
+
+        if (t < d.estimate)
+          {
+            d.algorithm = ADAPTIVE_STRASSEN;
+            d.depth = depth;
+            d.threshold = N >> depth;
+            d.threads = 1;
+            d.estimate = t;
+          }
+
+        if (cm.cpus > 1)
+          {
+            t = __parallel_cost (cm, m, k, n, depth);
+
+            if (t < d.estimate)
+              {
+                d.algorithm = ADAPTIVE_PARALLEL;
+                d.depth = depth;
+                d.threshold = N >> depth;
+                d.threads = __parallel_threads (cm);
+                d.estimate = t;
+              }
+          }
+      }
+
+    return d;
+  }
+
+  template <typename T>
+  size_t
+  adaptive_matrix_multiplier<T>::predicted_peak_bytes (size_t arows, size_t acols, size_t brows, size_t bcols)
+  {
+    if (acols != brows)
+      return 0;
+
+    adaptive_decision d = decide (arows, acols, bcols);
+
+    switch (d.algorithm)
+      {
+      case ADAPTIVE_NAIVE:
+        return (naive_matrix_multiplier<T>::predicted_peak_bytes (arows, acols, brows, bcols));
+      case ADAPTIVE_TRANSPOSE:
+        return (transpose_matrix_multiplier<T>::predicted_peak_bytes (arows, acols, brows, bcols));
+      case ADAPTIVE_STRASSEN:
+        return (strassen_matrix_multiplier<T>::predicted_peak_bytes (arows, acols, brows, bcols, d.threshold));
+      case ADAPTIVE_PARALLEL:
+        return (parallel_strassen_matrix_multiplier<T>::predicted_peak_bytes (arows, acols, brows, bcols,
+                                                                              d.threshold, d.threads));
+      case ADAPTIVE_SKINNY:
+        return (skinny_matrix_multiplier<T>::predicted_peak_bytes (arows, acols, brows, bcols));
+      }
+
+    return 0;
+  }
+
+  /**
+   * The cost model for T, calibrated on first use.
+   */
+  template <typename T>
+  adaptive_cost_model&
+  adaptive_matrix_multiplier<T>::__model ()
+  {
+    static adaptive_cost_model cm = __calibrate ();
+
+    return cm;
+  }
+
+  template <typename T>
+  void
+  adaptive_matrix_multiplier<T>::calibrate ()
+  {
+    __model () = __calibrate ();
+  }
+
+  template <typename T>
+  void
+  adaptive_matrix_multiplier<T>::set_model (const adaptive_cost_model &cm)
+  {
+    __model () = cm;
+  }
+
+  template <typename T>
+  adaptive_cost_model
+  adaptive_matrix_multiplier<T>::model ()
+  {
+    return __model ();
+  }
+
+  template <typename T>
+  double
+  adaptive_matrix_multiplier<T>::__now ()
+  {
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return (ts.tv_sec + (ts.tv_nsec / 1e9));
+  }
+
+  /**
+   * Times the naive and transpose kernels on a small product, and block additions on a few quadrants, taking
+   * the best of several runs of each. The fixed cost of a call is what remains of the time of a tiny transpose
+   * product once its multiply-adds are accounted for. The handoff cost of the parallel multiplier is not
+   * measured, since that would mean starting its threads; a typical figure for a wakeup and join of 7 threads
+   * is used.
+   */
+  template <typename T>
+  adaptive_cost_model
+  adaptive_matrix_multiplier<T>::__calibrate ()
+  {
+    const size_t n = 96;
+    const size_t runs = 3;
+
+    adaptive_cost_model cm;
+    naive_matrix_multiplier<T> nmm;
+    transpose_matrix_multiplier<T> tmm;
+
+    T *A = (T *) aligned_malloc (n * n * sizeof (T));
+    T *B = (T *) aligned_malloc (n * n * sizeof (T));
+    T *C = (T *) aligned_malloc (n * n * sizeof (T));
+
+    for (size_t i = 0; i < n * n; i++)
+      {
+        A[i] = T (i % 7);
+        B[i] = T (i % 5);
+      }
+
+    const size_t tiny = 16;
+    const size_t calls = 64;
+
+    double naive = 0.0;
+    double transpose = 0.0;
+    double block = 0.0;
+    double call = 0.0;
+
+    for (size_t r = 0; r < runs; r++)
+      {
+        double t = __now ();
+        free (nmm.mult (A, B, n, n, n, n));
+        t = __now () - t;
+
+        if (!r || t < naive)
+          naive = t;
+
+        t = __now ();
+        free (tmm.mult (A, B, n, n, n, n));
+        t = __now () - t;
+
+        if (!r || t < transpose)
+          transpose = t;
+
+        t = __now ();
+
+        for (size_t x = 0; x < 8; x++)
+          {
+            for (size_t i = 0; i < n * n; i++)
+              C[i] = A[i] + B[i];
+
+            /* Keep the compiler from dropping the loop */
+            B[x] = C[x * n];
+          }
+
+        t = __now () - t;
+
+        if (!r || t < block)
+          block = t;
+
+        t = __now ();
+
+        for (size_t x = 0; x < calls; x++)
+          free (tmm.mult (A, B, tiny, tiny, tiny, tiny));
+
+        t = (__now () - t) / calls;
+
+        if (!r || t < call)
+          call = t;
+      }
+
+    double mkn = (double) n * n * n;
+
+    /* Guard against a clock too coarse to see the runs at all */
+    cm.naive_rate = mkn / (naive > 1e-7 ? naive : 1e-7);
+    cm.transpose_rate = mkn / (transpose > 1e-7 ? transpose : 1e-7);
+    cm.block_rate = (8.0 * n * n) / (block > 1e-7 ? block : 1e-7);
+    cm.call_overhead = call - ((double) tiny * tiny * tiny / cm.transpose_rate);
+
+    if (cm.call_overhead < 0.0)
+      cm.call_overhead = 0.0;
+    cm.thread_overhead = 100e-6;
+
+    long cpus = sysconf (_SC_NPROCESSORS_ONLN);
+    cm.cpus = (cpus > 0) ? cpus : 1;
+
+    free (A);
+    free (B);
+    free (C);
+
+    return cm;
+  }
+}
+
+#endif /* ADAPTIVE_MATRIX_MULTIPLIER_HPP_ */
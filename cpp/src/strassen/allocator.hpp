@@ -0,0 +1,108 @@
+#ifndef ALLOCATOR_HPP_
+#define ALLOCATOR_HPP_
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <atomic>
+
+/**
+ * Alignment, in bytes, of all matrix and scratch storage. It must be a power of 2 and a multiple of
+ * sizeof (void *); define it wider (e.g. 128, or 4096) to suit other vector widths or page colouring.
+ */
+#ifndef STRASSEN_ALIGNMENT
+#define STRASSEN_ALIGNMENT 64
+#endif
+
+namespace strassen
+{
+  /* Size of a transparent huge page on x86-64 and most arm64 configurations */
+  const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+  /* Huge page threshold used when STRASSEN_HUGE_PAGES is set in the environment without a value */
+  const size_t HUGE_PAGE_DEFAULT_THRESHOLD = 4 * 1024 * 1024;
+
+  inline size_t
+  __huge_page_initial_threshold ()
+  {
+    const char *s = getenv ("STRASSEN_HUGE_PAGES");
+
+    if (!s)
+      return 0;
+
+    size_t t = strtoul (s, NULL, 10);
+
+    return ((t > 1) ? t : (*s == '0' ? 0 : HUGE_PAGE_DEFAULT_THRESHOLD));
+  }
+
+  inline std::atomic<size_t> __huge_page_threshold (__huge_page_initial_threshold ());
+
+  /**
+   * Buffers of at least threshold bytes are aligned to HUGE_PAGE_SIZE and the kernel is asked to back them
+   * with transparent huge pages, which cuts the dTLB misses of walking multi-megabyte operands. A threshold of
+   * 0 turns this off, which is the default unless STRASSEN_HUGE_PAGES is set in the environment (to 1 for the
+   * default threshold, or to a threshold in bytes).
+   */
+  inline void
+  set_huge_page_threshold (size_t threshold)
+  {
+    __huge_page_threshold = threshold;
+  }
+
+  inline size_t
+  huge_page_threshold ()
+  {
+    return __huge_page_threshold.load ();
+  }
+
+  /**
+   * Allocates bytes of storage aligned to STRASSEN_ALIGNMENT, or to HUGE_PAGE_SIZE and advised for huge pages
+   * if it is at least the huge page threshold. Returns NULL on failure. The memory is released with free ().
+   */
+  inline void*
+  aligned_malloc (size_t bytes)
+  {
+    size_t huge = __huge_page_threshold.load ();
+    size_t align = (huge && bytes >= huge) ? HUGE_PAGE_SIZE : STRASSEN_ALIGNMENT;
+    void *p = NULL;
+
+    if (posix_memalign (&p, align, bytes ? bytes : 1))
+      return NULL;
+
+#ifdef MADV_HUGEPAGE
+    if (align == HUGE_PAGE_SIZE)
+      {
+        size_t page = (size_t) sysconf (_SC_PAGESIZE);
+        madvise (p, bytes & ~(page - 1), MADV_HUGEPAGE);
+      }
+#endif
+
+    return p;
+  }
+
+  /* Smallest mmap threshold of glibc's malloc; it only rises from here as mapped chunks are freed */
+  const size_t MMAP_THRESHOLD_MIN = 128 * 1024;
+
+  /**
+   * Most bytes an aligned_malloc () of bytes can take up, as malloc_usable_size () reports them. glibc asks
+   * for the alignment and a minimum chunk more than requested, to align within, and gives back what it can.
+   * Below the mmap threshold the rest is a few headers' worth; above it the chunk may instead be mapped on
+   * its own, in whole pages. The peak predictions of the multipliers add this up buffer by buffer.
+   */
+  inline size_t
+  allocation_bytes (size_t bytes)
+  {
+    size_t huge = __huge_page_threshold.load ();
+    size_t align = (huge && bytes >= huge) ? HUGE_PAGE_SIZE : STRASSEN_ALIGNMENT;
+    size_t page = (size_t) sysconf (_SC_PAGESIZE);
+    size_t most = (bytes ? bytes : 1) + align + 64;
+
+    if (most < MMAP_THRESHOLD_MIN)
+      return ((bytes ? bytes : 1) + 64);
+
+    return ((most + page - 1) & ~(page - 1));
+  }
+}
+
+#endif /* ALLOCATOR_HPP_ */
@@ -0,0 +1,299 @@
+#ifndef ASYNC_MATRIX_MULTIPLIER_HPP_
+#define ASYNC_MATRIX_MULTIPLIER_HPP_
+
+#include <stdio.h>
+#include <pthread.h>
+
+#include <deque>
+#include <functional>
+#include <future>
+#include <vector>
+
+#include "matrix.hpp"
+#include "adaptive_matrix_multiplier.hpp"
+
+namespace strassen
+{
+  /* Requests which may wait in the queue of an async_matrix_multiplier before submit () blocks */
+  const size_t ASYNC_QUEUE_CAPACITY = 64;
+
+  /**
+   * An async_matrix_multiplier computes products on a pool of worker threads, so that the thread submitting
+   * them can go on preparing the next while they are computed. submit () places a request on a bounded queue,
+   * blocking while the queue is full, and returns a future for the product. An optional callback is also
+   * given the product, on the worker thread, as soon as it is ready and before the future is.
+   *
+   * There is one worker per processor by default. Each has an adaptive_matrix_multiplier of its own, limited
+   * to one thread per product, and takes the oldest request whenever it finishes one; so products in flight
+   * together share the processors evenly, in the order they were submitted, rather than each trying to
+   * use all of them at once.
+   *
+   * Products are new arrays, to be released with free () by whoever ends up holding them, or NULL if the
+   * operands do not conform. The operands must stay valid until the product is ready. Destroying the
+   * multiplier completes the requests already queued.
+   */
+  template <typename T>
+  class async_matrix_multiplier
+  {
+  public:
+    typedef std::function<void (T *)> callback;
+
+  private:
+    struct request
+    {
+      const T *a;
+      const T *b;
+      matrix_layout al;
+      matrix_layout bl;
+      size_t arows;
+      size_t acols;
+      size_t brows;
+      size_t bcols;
+      callback done;
+      std::promise<T *> result;
+    };
+
+    struct worker
+    {
+      async_matrix_multiplier<T> *owner;
+      adaptive_matrix_multiplier<T> amm;
+      pthread_t thread;
+    };
+
+    std::deque<request *> __queue;
+    size_t __capacity;
+    size_t __active;      /* Requests being computed */
+    bool __stop;
+
+    pthread_mutex_t __lock;
+    pthread_cond_t __not_empty;
+    pthread_cond_t __not_full;
+    pthread_cond_t __idle;
+
+    std::vector<worker *> __workers;
+
+    static void* __entry (void *p);
+    void __loop (worker *w);
+
+    async_matrix_multiplier (const async_matrix_multiplier<T> &m);
+    async_matrix_multiplier<T>& operator = (const async_matrix_multiplier<T> &m);
+
+  public:
+    /* Compute on the given number of workers, or one per processor if 0, queueing up to capacity requests */
+    async_matrix_multiplier (size_t workers = 0, size_t capacity = ASYNC_QUEUE_CAPACITY);
+    ~async_matrix_multiplier ();
+
+    std::future<T *> submit (const T *a, const T *b, size_t arows, size_t acols, size_t brows, size_t bcols,
+                             callback done = callback ());
+    std::future<T *> submit (const T *a, matrix_layout al, const T *b, matrix_layout bl,
+                             size_t arows, size_t acols, size_t brows, size_t bcols, callback done = callback ());
+    template <typename M>
+    std::future<T *> submit (const matrix<T, M> &a, const matrix<T, M> &b, callback done = callback ());
+
+    /* Wait until every request submitted so far has been completed */
+    void wait ();
+
+    size_t workers () const;
+    /* Requests queued or being computed */
+    size_t pending ();
+  };
+
+  template <typename T>
+  async_matrix_multiplier<T>::async_matrix_multiplier (size_t workers, size_t capacity)
+    : __capacity (capacity ? capacity : 1),
+      __active (0),
+      __stop (false)
+  {
+    if (!workers)
+      workers = adaptive_matrix_multiplier<T>::model ().cpus;
+
+    pthread_mutex_init (&__lock, NULL);
+    pthread_cond_init (&__not_empty, NULL);
+    pthread_cond_init (&__not_full, NULL);
+    pthread_cond_init (&__idle, NULL);
+
+    for (size_t i = 0; i < workers; i++)
+      {
+        worker *w = new worker ();
+
+        w->owner = this;
+        w->amm.max_threads (1);
+
+        if (pthread_create (&w->thread, NULL, __entry, w))
+          {
+            perror ("async_matrix_multiplier: pthread_create");
+            delete w;
+            break;
+          }
+
+        __workers.push_back (w);
+      }
+  }
+
+  template <typename T>
+  async_matrix_multiplier<T>::~async_matrix_multiplier ()
+  {
+    pthread_mutex_lock (&__lock);
+    __stop = true;
+    pthread_cond_broadcast (&__not_empty);
+    pthread_mutex_unlock (&__lock);
+
+    for (size_t i = 0; i < __workers.size (); i++)
+      {
+        pthread_join (__workers[i]->thread, NULL);
+        delete __workers[i];
+      }
+
+    pthread_mutex_destroy (&__lock);
+    pthread_cond_destroy (&__not_empty);
+    pthread_cond_destroy (&__not_full);
+    pthread_cond_destroy (&__idle);
+  }
+
+  template <typename T>
+  std::future<T *>
+  async_matrix_multiplier<T>::submit (const T *a, const T *b, size_t arows, size_t acols, size_t brows, size_t bcols,
+                                      callback done)
+  {
+    return (submit (a, ROW_MAJOR, b, ROW_MAJOR, arows, acols, brows, bcols, done));
+  }
+
+  template <typename T>
+  template <typename M>
+  std::future<T *>
+  async_matrix_multiplier<T>::submit (const matrix<T, M> &a, const matrix<T, M> &b, callback done)
+  {
+    return (submit (a.data (), a.layout (), b.data (), b.layout (), a.rows (), a.cols (), b.rows (), b.cols (),
+                    done));
+  }
+
+  template <typename T>
+  std::future<T *>
+  async_matrix_multiplier<T>::submit (const T *a, matrix_layout al, const T *b, matrix_layout bl,
+                                      size_t arows, size_t acols, size_t brows, size_t bcols, callback done)
+  {
+    request *r = new request ();
+
+    r->a = a;
+    r->b = b;
+    r->al = al;
+    r->bl = bl;
+    r->arows = arows;
+    r->acols = acols;
+    r->brows = brows;
+    r->bcols = bcols;
+    r->done = done;
+
+    std::future<T *> f = r->result.get_future ();
+
+    /* Without workers, compute on the calling thread */
+    if (__workers.empty ())
+      {
+        adaptive_matrix_multiplier<T> amm;
+        T *C = amm.mult_layout (a, al, b, bl, arows, acols, brows, bcols);
+
+        if (done)
+          done (C);
+
+        r->result.set_value (C);
+        delete r;
+
+        return f;
+      }
+
+    pthread_mutex_lock (&__lock);
+
+    while (__queue.size () >= __capacity)
+      pthread_cond_wait (&__not_full, &__lock);
+
+    __queue.push_back (r);
+    pthread_cond_signal (&__not_empty);
+    pthread_mutex_unlock (&__lock);
+
+    return f;
+  }
+
+  template <typename T>
+  void
+  async_matrix_multiplier<T>::wait ()
+  {
+    pthread_mutex_lock (&__lock);
+
+    while (!__queue.empty () || __active)
+      pthread_cond_wait (&__idle, &__lock);
+
+    pthread_mutex_unlock (&__lock);
+  }
+
+  template <typename T>
+  size_t
+  async_matrix_multiplier<T>::workers () const
+  {
+    return __workers.size ();
+  }
+
+  template <typename T>
+  size_t
+  async_matrix_multiplier<T>::pending ()
+  {
+    pthread_mutex_lock (&__lock);
+    size_t n = __queue.size () + __active;
+    pthread_mutex_unlock (&__lock);
+
+    return n;
+  }
+
+  template <typename T>
+  void*
+  async_matrix_multiplier<T>::__entry (void *p)
+  {
+    worker *w = (worker *) p;
+    w->owner->__loop (w);
+
+    return NULL;
+  }
+
+  /**
+   * Takes requests from the queue until it is empty and the multiplier is being destroyed.
+   */
+  template <typename T>
+  void
+  async_matrix_multiplier<T>::__loop (worker *w)
+  {
+    pthread_mutex_lock (&__lock);
+
+    for (;;)
+      {
+        while (__queue.empty () && !__stop)
+          pthread_cond_wait (&__not_empty, &__lock);
+
+        if (__queue.empty ())
+          break;
+
+        request *r = __queue.front ();
+        __queue.pop_front ();
+        ++__active;
+
+        pthread_cond_signal (&__not_full);
+        pthread_mutex_unlock (&__lock);
+
+        T *C = w->amm.mult_layout (r->a, r->al, r->b, r->bl, r->arows, r->acols, r->brows, r->bcols);
+
+        if (r->done)
+          r->done (C);
+
+        r->result.set_value (C);
+        delete r;
+
+        pthread_mutex_lock (&__lock);
+        --__active;
+
+        if (__queue.empty () && !__active)
+          pthread_cond_broadcast (&__idle);
+      }
+
+    pthread_mutex_unlock (&__lock);
+  }
+}
+
+#endif /* ASYNC_MATRIX_MULTIPLIER_HPP_ */
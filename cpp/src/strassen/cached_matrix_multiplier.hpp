@@ -0,0 +1,274 @@
+#ifndef CACHED_MATRIX_MULTIPLIER_HPP_
+#define CACHED_MATRIX_MULTIPLIER_HPP_
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <list>
+#include <unordered_map>
+
+#include "allocator.hpp"
+#include "hash.hpp"
+#include "matrix_multiplier.hpp"
+
+namespace strassen
+{
+  /* Bytes of products a cached_matrix_multiplier keeps unless told otherwise */
+  const size_t CACHE_DEFAULT_BUDGET = 256 * 1048576;
+
+  /* Counters of a cached_matrix_multiplier, since it was made or its counters last reset */
+  struct cache_stats
+  {
+    size_t hits;
+    size_t misses;
+    size_t evictions;       /* Products dropped to make room for newer ones */
+    size_t uncacheable;     /* Products larger than the whole budget, computed but not kept */
+    size_t entries;         /* Products held now */
+    size_t bytes;           /* Bytes of products held now */
+  };
+
+  /**
+   * A cached_matrix_multiplier remembers the products another multiplier computes, and answers a repeated
+   * request with a copy of the remembered product rather than multiplying again. Products are identified by
+   * the shapes of the operands and the hash64 () of the contents of each, so an operand which is modified in
+   * place is a different operand. The contents are not compared, so two operands of the same shape whose
+   * hashes collide, with a probability of about 2^-64, would be taken for one another. Hashing reads each
+   * operand once, which is small next to multiplying them.
+   *
+   * The products kept take at most the byte budget, the least recently used being evicted to make room for
+   * new ones. They are not allocated through the mem_account, which describes the product computed or copied
+   * by the most recent multiplication as usual; stats () reports the cache's own size, along with its hits,
+   * misses and evictions, for choosing a budget.
+   *
+   * The multiplier given at construction is owned by the cache and deleted with it.
+   */
+  template <typename T>
+  class cached_matrix_multiplier : public strassen::matrix_multiplier<T>
+  {
+  private:
+    struct key
+    {
+      uint64_t a;
+      uint64_t b;
+      size_t arows;
+      size_t acols;
+      size_t bcols;
+
+      bool
+      operator == (const key &k) const
+      {
+        return (a == k.a && b == k.b && arows == k.arows && acols == k.acols && bcols == k.bcols);
+      }
+    };
+
+    struct key_hash
+    {
+      size_t
+      operator () (const key &k) const
+      {
+        return (k.a ^ __hash_rotl (k.b, 32));
+      }
+    };
+
+    struct entry
+    {
+      key k;
+      T *product;
+      size_t bytes;
+    };
+
+    typedef std::list<entry> lru_list;
+
+    matrix_multiplier<T> *__mm;
+    size_t __budget;
+    lru_list __lru;           /* Most recently used first */
+    std::unordered_map<key, typename lru_list::iterator, key_hash> __index;
+    cache_stats __stats;
+
+    void __evict (size_t bytes);
+
+    cached_matrix_multiplier (const cached_matrix_multiplier<T> &c);
+    cached_matrix_multiplier<T>& operator = (const cached_matrix_multiplier<T> &c);
+
+  public:
+    cached_matrix_multiplier (matrix_multiplier<T> *mm, size_t budget = CACHE_DEFAULT_BUDGET);
+    virtual ~cached_matrix_multiplier ();
+
+    T* mult (const T *a, const T *b, size_t arows, size_t acols, size_t brows, size_t bcols);
+    /* A new cache, empty, around a copy of the multiplier */
+    matrix_multiplier<T>* copy () const;
+
+    void account (mem_account *a);
+
+    size_t budget () const;
+    /* Changes the budget, evicting products until they fit */
+    void budget (size_t bytes);
+
+    /* Drops every product */
+    void clear ();
+
+    const cache_stats& stats () const;
+    void reset_stats ();
+  };
+
+  template <typename T>
+  cached_matrix_multiplier<T>::cached_matrix_multiplier (matrix_multiplier<T> *mm, size_t budget)
+    : __mm (mm),
+      __budget (budget)
+  {
+    memset (&__stats, 0, sizeof (__stats));
+
+    account (this->__account);
+  }
+
+  template <typename T>
+  cached_matrix_multiplier<T>::~cached_matrix_multiplier ()
+  {
+    clear ();
+
+    delete __mm;
+  }
+
+  template <typename T>
+  matrix_multiplier<T>*
+  cached_matrix_multiplier<T>::copy () const
+  {
+    return (new cached_matrix_multiplier<T> (__mm->copy (), __budget));
+  }
+
+  template <typename T>
+  void
+  cached_matrix_multiplier<T>::account (mem_account *a)
+  {
+    matrix_multiplier<T>::account (a);
+    __mm->account (this->__account);
+  }
+
+  template <typename T>
+  size_t
+  cached_matrix_multiplier<T>::budget () const
+  {
+    return __budget;
+  }
+
+  template <typename T>
+  void
+  cached_matrix_multiplier<T>::budget (size_t bytes)
+  {
+    __budget = bytes;
+    __evict (0);
+  }
+
+  template <typename T>
+  void
+  cached_matrix_multiplier<T>::clear ()
+  {
+    for (typename lru_list::iterator i = __lru.begin (); i != __lru.end (); ++i)
+      free (i->product);
+
+    __lru.clear ();
+    __index.clear ();
+    __stats.entries = 0;
+    __stats.bytes = 0;
+  }
+
+  template <typename T>
+  const cache_stats&
+  cached_matrix_multiplier<T>::stats () const
+  {
+    return __stats;
+  }
+
+  template <typename T>
+  void
+  cached_matrix_multiplier<T>::reset_stats ()
+  {
+    __stats.hits = 0;
+    __stats.misses = 0;
+    __stats.evictions = 0;
+    __stats.uncacheable = 0;
+  }
+
+  /**
+   * Evicts the least recently used products until another of the given size fits in the budget.
+   */
+  template <typename T>
+  void
+  cached_matrix_multiplier<T>::__evict (size_t bytes)
+  {
+    while (!__lru.empty () && __stats.bytes + bytes > __budget)
+      {
+        entry &e = __lru.back ();
+
+        __index.erase (e.k);
+        __stats.bytes -= e.bytes;
+        __stats.entries--;
+        __stats.evictions++;
+
+        free (e.product);
+        __lru.pop_back ();
+      }
+  }
+
+  template <typename T>
+  T*
+  cached_matrix_multiplier<T>::mult (const T *a, const T *b, size_t arows, size_t acols, size_t brows, size_t bcols)
+  {
+    this->__begin ();
+
+    if (acols != brows)
+      return NULL;
+
+    size_t bytes = arows * bcols * sizeof (T);
+    key k = { hash64 (a, arows * acols * sizeof (T)), hash64 (b, brows * bcols * sizeof (T)), arows, acols, bcols };
+
+    typename std::unordered_map<key, typename lru_list::iterator, key_hash>::iterator i = __index.find (k);
+
+    if (i != __index.end ())
+      {
+        __stats.hits++;
+
+        /* Now the most recently used */
+        __lru.splice (__lru.begin (), __lru, i->second);
+
+        T *C = this->__alloc (arows * bcols);
+
+        if (C)
+          memcpy (C, i->second->product, bytes);
+
+        return C;
+      }
+
+    __stats.misses++;
+
+    T *C = __mm->mult (a, b, arows, acols, brows, bcols);
+
+    if (!C)
+      return NULL;
+
+    if (bytes > __budget)
+      __stats.uncacheable++;
+    else
+      {
+        T *P = (T *) aligned_malloc (bytes);
+
+        if (P)
+          {
+            memcpy (P, C, bytes);
+            __evict (bytes);
+
+            entry e = { k, P, bytes };
+
+            __lru.push_front (e);
+            __index[k] = __lru.begin ();
+            __stats.entries++;
+            __stats.bytes += bytes;
+          }
+      }
+
+    return C;
+  }
+}
+
+#endif /* CACHED_MATRIX_MULTIPLIER_HPP_ */
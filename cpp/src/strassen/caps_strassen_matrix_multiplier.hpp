@@ -0,0 +1,543 @@
+#ifndef CAPS_STRASSEN_MATRIX_MULTIPLIER_HPP_
+#define CAPS_STRASSEN_MATRIX_MULTIPLIER_HPP_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <string>
+
+#include "matrix_multiplier.hpp"
+#include "strassen_matrix_multiplier.hpp"
+#include "transpose_matrix_multiplier.hpp"
+#include "trace.hpp"
+
+namespace strassen
+{
+  /* Processors online, asked of the system once */
+  inline size_t
+  caps_processors ()
+  {
+    static const long cpus = sysconf (_SC_NPROCESSORS_ONLN);
+
+    return ((cpus > 0) ? cpus : 1);
+  }
+
+  /* Half of the physical memory, the default budget of a caps_strassen_matrix_multiplier */
+  inline size_t
+  caps_memory ()
+  {
+    static const long pages = sysconf (_SC_PHYS_PAGES);
+    static const long page_size = sysconf (_SC_PAGESIZE);
+
+    if (pages <= 0 || page_size <= 0)
+      return ((size_t) 1 << 30);
+
+    return (((size_t) pages * (size_t) page_size) / 2);
+  }
+
+  template <typename T>
+  class caps_strassen_matrix_multiplier;
+
+  /* The products a group of threads computes in a breadth-first step: MM[first], MM[first + stride], ... */
+  template <typename T>
+  struct caps_group
+  {
+    caps_strassen_matrix_multiplier<T> *mm;
+    T * const *AA;
+    T * const *BB;
+    T **MM;
+    size_t first;
+    size_t stride;
+    size_t m;
+    size_t threads;
+    size_t budget;
+  };
+
+  /**
+   * A Strassen multiplier with a schedule in the manner of CAPS (communication-avoiding parallel Strassen),
+   * which decides at each step of the recursion how the group of threads given that step takes on its 7
+   * products.
+   *
+   * A breadth-first step divides the group into up to 7 smaller groups, which compute the products at the
+   * same time, so that all 7 are held at once along with the working memory of each group. A depth-first step
+   * keeps the group together and computes the products one after another, each with all of its threads, so
+   * that only one is in progress. Breadth-first steps give parallelism and depth-first steps save memory: a
+   * step is breadth-first if the peak of the schedule below it then fits the memory left to the group, and
+   * depth-first otherwise. A product which is short of memory thus takes its depth-first steps at the top,
+   * where the blocks are largest, and spreads out across the threads further down. A group of one thread
+   * follows the sequential recursion.
+   *
+   * The thread count, the processors online by default, is threads () of the base class; the O(n^2) phases
+   * of each step are divided by rows between the threads of its group. The memory budget is half of the
+   * physical memory by default. Threads are started for each breadth-first step and joined at its end.
+   */
+  template <typename T>
+  class caps_strassen_matrix_multiplier : public strassen::strassen_matrix_multiplier<T>
+  {
+  private:
+    size_t __budget;
+
+    T* __caps (const T *A, const T *B, size_t n, size_t threads, size_t budget, bool report);
+
+    static size_t __less (size_t a, size_t b);
+    static size_t __groups (size_t threads);
+    static size_t __group_threads (size_t threads, size_t groups, size_t j);
+
+    /* Bytes each group of a breadth-first step on an n x n product may use */
+    static size_t __group_budget (size_t n, size_t threads, size_t budget);
+
+    /* Peak bytes of the schedule chosen for an n x n product, and whether its first step is breadth-first */
+    static size_t __predicted_caps_bytes (size_t n, size_t threads, size_t budget, size_t threshold, bool *bfs);
+
+  public:
+    /* threads 0 stands for the processors online and budget 0 for half of the physical memory */
+    caps_strassen_matrix_multiplier (size_t threads = 0, size_t budget = 0, size_t threshold = STRASSEN_THRESHOLD);
+    virtual ~caps_strassen_matrix_multiplier ();
+
+    T* mult (const T *a, const T *b, size_t arows, size_t acols, size_t brows, size_t bcols);
+    matrix_multiplier<T>* copy () const;
+
+    /* These go through mult () to use all of the threads */
+    T* square (const T *a, size_t n);
+    T* pow (const T *a, size_t n, size_t k, double tolerance = 0.0);
+
+    size_t budget () const;
+    void budget (size_t bytes);
+
+    /**
+     * The steps chosen for a product of these dimensions, from the top of the recursion down to the
+     * leaves, as 'B' for breadth-first and 'D' for depth-first. Below a breadth-first step, the steps
+     * are those of its largest group.
+     */
+    std::string schedule (size_t arows, size_t acols, size_t brows, size_t bcols) const;
+
+    /* Thread entry function for this class */
+    void run_group (caps_group<T> *g);
+
+    /* Peak bytes allocated by one call to mult () with these dimensions, threads and budget */
+    static size_t predicted_peak_bytes (size_t arows, size_t acols, size_t brows, size_t bcols,
+                                        size_t threads, size_t budget, size_t threshold = STRASSEN_THRESHOLD);
+  };
+
+  template <typename T>
+  void*
+  caps_group_entry (void *p)
+  {
+    caps_group<T> *g = (caps_group<T> *) p;
+
+    g->mm->run_group (g);
+
+    return NULL;
+  }
+
+  template <typename T>
+  caps_strassen_matrix_multiplier<T>::caps_strassen_matrix_multiplier (size_t threads, size_t budget,
+                                                                       size_t threshold)
+    : strassen_matrix_multiplier<T> (threshold),
+      __budget (budget ? budget : caps_memory ())
+  {
+    this->threads (threads ? threads : caps_processors ());
+  }
+
+  template <typename T>
+  caps_strassen_matrix_multiplier<T>::~caps_strassen_matrix_multiplier ()
+  {
+  }
+
+  template <typename T>
+  matrix_multiplier<T>*
+  caps_strassen_matrix_multiplier<T>::copy () const
+  {
+    return (new caps_strassen_matrix_multiplier<T> (this->__row_threads, __budget, this->__threshold));
+  }
+
+  template <typename T>
+  size_t
+  caps_strassen_matrix_multiplier<T>::budget () const
+  {
+    return __budget;
+  }
+
+  template <typename T>
+  void
+  caps_strassen_matrix_multiplier<T>::budget (size_t bytes)
+  {
+    __budget = bytes ? bytes : caps_memory ();
+  }
+
+  /* a - b, or 0 if b is the larger */
+  template <typename T>
+  size_t
+  caps_strassen_matrix_multiplier<T>::__less (size_t a, size_t b)
+  {
+    return ((a > b) ? (a - b) : 0);
+  }
+
+  template <typename T>
+  size_t
+  caps_strassen_matrix_multiplier<T>::__groups (size_t threads)
+  {
+    return ((threads < 7) ? threads : 7);
+  }
+
+  /* The threads of group j of groups, which differ in number by at most one */
+  template <typename T>
+  size_t
+  caps_strassen_matrix_multiplier<T>::__group_threads (size_t threads, size_t groups, size_t j)
+  {
+    return (((threads * (j + 1)) / groups) - ((threads * j) / groups));
+  }
+
+  /**
+   * The output and the 14 operand blocks of the step are held throughout. A group computing several
+   * products holds those it has finished, so that up to 7 - groups are held besides the one each group has
+   * in progress, which counts towards that group's own peak.
+   */
+  template <typename T>
+  size_t
+  caps_strassen_matrix_multiplier<T>::__group_budget (size_t n, size_t threads, size_t budget)
+  {
+    size_t m = n / 2;
+    size_t groups = __groups (threads);
+    size_t held = ((n * n) + (14 * m * m) + ((7 - groups) * m * m)) * sizeof (T);
+
+    return (__less (budget, held) / groups);
+  }
+
+  /**
+   * A depth-first step holds the output, the 14 operand blocks and the 6 products already computed while
+   * the last one is in progress, as the sequential recursion does. A breadth-first step holds the same
+   * less the products in progress, and the peak of each of its groups on top, the largest group taken for
+   * all of them.
+   */
+  template <typename T>
+  size_t
+  caps_strassen_matrix_multiplier<T>::__predicted_caps_bytes (size_t n, size_t threads, size_t budget,
+                                                              size_t threshold, bool *bfs)
+  {
+    if (bfs)
+      *bfs = false;
+
+    if (n <= threshold)
+      return (transpose_matrix_multiplier<T>::predicted_peak_bytes (n, n, n, n));
+
+    size_t m = n / 2;
+    size_t block = allocation_bytes (m * m * sizeof (T));
+    size_t level = allocation_bytes (n * n * sizeof (T)) + (20 * block);
+    size_t dfs = level + __predicted_caps_bytes (m, threads, __less (budget, level), threshold, NULL);
+
+    if (threads > 1)
+      {
+        size_t groups = __groups (threads);
+        size_t share = __group_budget (n, threads, budget);
+        size_t largest = (threads + groups - 1) / groups;
+        size_t group = __predicted_caps_bytes (m, largest, share, threshold, NULL);
+        size_t held = allocation_bytes (n * n * sizeof (T)) + ((21 - groups) * block);
+
+        /* A smaller group may take a schedule of its own, but never more memory than a larger one */
+        if (held + (groups * group) <= budget)
+          {
+            if (bfs)
+              *bfs = true;
+
+            return (held + (groups * group));
+          }
+      }
+
+    return dfs;
+  }
+
+  template <typename T>
+  size_t
+  caps_strassen_matrix_multiplier<T>::predicted_peak_bytes (size_t arows, size_t acols, size_t brows, size_t bcols,
+                                                            size_t threads, size_t budget, size_t threshold)
+  {
+    if (acols != brows)
+      return 0;
+
+    if (!threshold)
+      threshold = 1;
+
+    if (!threads)
+      threads = caps_processors ();
+
+    if (!budget)
+      budget = caps_memory ();
+
+    size_t N = strassen_matrix_multiplier<T>::padded_size (arows, acols, brows, bcols);
+    size_t pads = 0;
+
+    if (arows != N || acols != N)
+      pads += allocation_bytes (N * N * sizeof (T));
+
+    if (brows != N || bcols != N)
+      pads += allocation_bytes (N * N * sizeof (T));
+
+    return (pads + __predicted_caps_bytes (N, threads, __less (budget, pads), threshold, NULL));
+  }
+
+  template <typename T>
+  std::string
+  caps_strassen_matrix_multiplier<T>::schedule (size_t arows, size_t acols, size_t brows, size_t bcols) const
+  {
+    std::string s;
+
+    if (acols != brows)
+      return s;
+
+    size_t N = this->padded_size (arows, acols, brows, bcols);
+    size_t pads = 0;
+
+    if (arows != N || acols != N)
+      pads += allocation_bytes (N * N * sizeof (T));
+
+    if (brows != N || bcols != N)
+      pads += allocation_bytes (N * N * sizeof (T));
+
+    size_t threads = this->__row_threads;
+    size_t budget = __less (__budget, pads);
+
+    for (size_t n = N; n > this->__threshold; n /= 2)
+      {
+        bool bfs = false;
+
+        if (threads > 1)
+          __predicted_caps_bytes (n, threads, budget, this->__threshold, &bfs);
+
+        if (bfs)
+          {
+            s += 'B';
+            budget = __group_budget (n, threads, budget);
+            threads = (threads + __groups (threads) - 1) / __groups (threads);
+          }
+        else
+          {
+            s += 'D';
+            budget = __less (budget, ((n * n) + (20 * (n / 2) * (n / 2))) * sizeof (T));
+          }
+      }
+
+    return s;
+  }
+
+  template <typename T>
+  T*
+  caps_strassen_matrix_multiplier<T>::square (const T *a, size_t n)
+  {
+    return (mult (a, a, n, n, n, n));
+  }
+
+  template <typename T>
+  T*
+  caps_strassen_matrix_multiplier<T>::pow (const T *a, size_t n, size_t k, double tolerance)
+  {
+    return (matrix_multiplier<T>::pow (a, n, k, tolerance));
+  }
+
+  template <typename T>
+  T*
+  caps_strassen_matrix_multiplier<T>::mult (const T *m, const T *n,
+                                            size_t arows, size_t acols,
+                                            size_t brows, size_t bcols)
+  {
+    this->__begin ();
+
+    /* Make sure this is a valid multiplication */
+    if (acols != brows)
+      return NULL;
+
+    size_t N = this->padded_size (arows, acols, brows, bcols);
+    size_t threads = this->__row_threads;
+
+    if (arows == N && acols == N && bcols == N)
+      {
+        T *C = __caps (m, n, N, threads, __budget, true);
+        this->__phase (PHASE_NONE);
+        return C;
+      }
+
+    T *A = NULL;
+    T *B = NULL;
+    T *C = NULL;
+    T *D = NULL;
+    size_t pads = 0;
+
+    this->__phase (PHASE_PAD);
+
+    {
+      STRASSEN_TRACE_SCOPE ("pad", N);
+
+      if (arows != N || acols != N)
+        {
+          A = this->__pad (m, arows, acols, N, threads);
+          pads += N * N * sizeof (T);
+        }
+
+      if (brows != N || bcols != N)
+        {
+          B = this->__pad (n, brows, bcols, N, threads);
+          pads += N * N * sizeof (T);
+        }
+    }
+
+    /* A padding which could not be allocated leaves its operand NULL */
+    if ((A || (arows == N && acols == N)) && (B || (brows == N && bcols == N)))
+      C = __caps (A ? A : m, B ? B : n, N, threads, __less (__budget, pads), true);
+
+    this->__phase (PHASE_UNPAD);
+
+    if (C)
+      {
+        STRASSEN_TRACE_SCOPE ("unpad", N);
+        D = this->__unpad (C, arows, bcols, N, threads);
+      }
+
+    this->__free (A);
+    this->__free (B);
+    this->__free (C);
+
+    this->__phase (PHASE_NONE);
+
+    return D;
+  }
+
+  /**
+   * Multiplies the n x n matrices A and B with the given threads, keeping within budget bytes where the
+   * schedule allows. Only the calling thread of mult () reports its phases.
+   */
+  template <typename T>
+  T*
+  caps_strassen_matrix_multiplier<T>::__caps (const T *A, const T *B, size_t n, size_t threads, size_t budget,
+                                              bool report)
+  {
+    if (n <= this->__threshold)
+      {
+        STRASSEN_TRACE_SCOPE ("leaf", n);
+
+        if (report)
+          this->__phase (PHASE_LEAF);
+
+        return (this->__tmm.mult (A, B, n, n, n, n));
+      }
+
+    STRASSEN_TRACE_SCOPE ("operands", n);
+
+    if (report)
+      this->__phase (PHASE_OPERANDS);
+
+    size_t m = n / 2;
+
+    T *C = this->__alloc (n * n);
+
+    T* AA[7]; /* Submatrix blocks for A */
+    T* BB[7]; /* Submatrix blocks for B */
+    T* MM[7] = {NULL}; /* Products of above submatrices */
+
+    if ((A[0] == T () && A[1] == T () && this->__zeroes (A, n))
+        || (B[0] == T () && B[1] == T () && this->__zeroes (B, n)))
+      {
+        for (size_t i = 0; i < n * n; i++)
+          C[i] = T ();
+        return C;
+      }
+
+    for (uint32_t i = 0; i < 7; i++)
+      {
+        AA[i] = this->__alloc (m * m);
+        BB[i] = this->__alloc (m * m);
+      }
+
+    this->__operands (AA, BB, A, B, m, n, threads);
+
+    bool bfs = false;
+
+    if (threads > 1)
+      __predicted_caps_bytes (n, threads, budget, this->__threshold, &bfs);
+
+    if (bfs)
+      {
+        STRASSEN_TRACE_NEXT ("bfs");
+
+        if (report)
+          this->__phase (PHASE_WAIT);
+
+        size_t groups = __groups (threads);
+        size_t share = __group_budget (n, threads, budget);
+
+        caps_group<T> g[7];
+        pthread_t tids[7];
+        bool spawned[7] = {false};
+
+        for (size_t j = 0; j < groups; j++)
+          {
+            g[j].mm = this;
+            g[j].AA = AA;
+            g[j].BB = BB;
+            g[j].MM = MM;
+            g[j].first = j;
+            g[j].stride = groups;
+            g[j].m = m;
+            g[j].threads = __group_threads (threads, groups, j);
+            g[j].budget = share;
+
+            if (j)
+              {
+                spawned[j] = !pthread_create (&tids[j], NULL, caps_group_entry<T>, &g[j]);
+
+                if (!spawned[j])
+                  perror ("caps_strassen_matrix_multiplier: pthread_create");
+              }
+          }
+
+        run_group (&g[0]);
+
+        for (size_t j = 1; j < groups; j++)
+          {
+            /* A group whose thread could not be started runs on the calling thread after all */
+            if (spawned[j])
+              pthread_join (tids[j], NULL);
+            else
+              run_group (&g[j]);
+          }
+      }
+    else
+      {
+        STRASSEN_TRACE_NEXT ("dfs");
+
+        size_t rest = __less (budget, ((n * n) + (20 * m * m)) * sizeof (T));
+
+        for (uint32_t i = 0; i < 7; i++)
+          MM[i] = __caps (AA[i], BB[i], m, threads, rest, report);
+      }
+
+    STRASSEN_TRACE_NEXT ("combine");
+
+    if (report)
+      this->__phase (PHASE_COMBINE);
+
+    this->__combine (C, MM, m, n, threads);
+
+    for (uint32_t i = 0; i < 7; i++)
+      {
+        this->__free (AA[i]);
+        this->__free (BB[i]);
+        this->__free (MM[i]);
+      }
+
+    return C;
+  }
+
+  template <typename T>
+  void
+  caps_strassen_matrix_multiplier<T>::run_group (caps_group<T> *g)
+  {
+    STRASSEN_TRACE_SCOPE ("group", g->m);
+
+    for (size_t i = g->first; i < 7; i += g->stride)
+      g->MM[i] = __caps (g->AA[i], g->BB[i], g->m, g->threads, g->budget, false);
+  }
+}
+
+#endif /* CAPS_STRASSEN_MATRIX_MULTIPLIER_HPP_ */
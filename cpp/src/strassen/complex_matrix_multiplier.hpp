@@ -0,0 +1,182 @@
+#ifndef COMPLEX_MATRIX_MULTIPLIER_HPP_
+#define COMPLEX_MATRIX_MULTIPLIER_HPP_
+
+#include <complex>
+#include "matrix_multiplier.hpp"
+#include "strassen_matrix_multiplier.hpp"
+
+namespace strassen
+{
+  /**
+   * A complex_matrix_multiplier multiplies two matrices of std::complex<T> using the 3M method. Rather than
+   * doing complex arithmetic element by element, the operands are split into planes of real and imaginary
+   * parts and the product is formed from three real matrix products:
+   *
+   *   T1 = Ar * Br
+   *   T2 = Ai * Bi
+   *   T3 = (Ar + Ai)(Br + Bi)
+   *
+   *   Cr = T1 - T2
+   *   Ci = T3 - T1 - T2
+   *
+   * The real products are performed by a real-valued matrix_multiplier<T>, which defaults to a
+   * strassen::strassen_matrix_multiplier<T>. This needs 3 real multiplications per complex one instead of 4,
+   * at the cost of a few extra O(n^2) additions.
+   */
+  template <typename T>
+  class complex_matrix_multiplier : public strassen::matrix_multiplier<std::complex<T> >
+  {
+  private:
+    /* The real-valued multiplier used to compute T1, T2 and T3 */
+    matrix_multiplier<T> *__rmm;
+
+    void __split (const std::complex<T> *A, size_t n, T *re, T *im, T *sum);
+
+  public:
+    complex_matrix_multiplier (matrix_multiplier<T> *rmm = new strassen_matrix_multiplier<T> ());
+    virtual ~complex_matrix_multiplier ();
+
+    std::complex<T>* mult (const std::complex<T> *a, const std::complex<T> *b,
+                           size_t arows, size_t acols, size_t brows, size_t bcols);
+    matrix_multiplier<std::complex<T> >* copy () const;
+
+    void account (mem_account *a);
+
+    /**
+     * Peak bytes allocated by one call to mult () with these dimensions, when the real products are done by
+     * a strassen_matrix_multiplier<T>: the six real planes, two finished products and the third in progress,
+     * or afterwards the three products and the complex result.
+     */
+    static size_t predicted_peak_bytes (size_t arows, size_t acols, size_t brows, size_t bcols);
+  };
+
+  template <typename T>
+  complex_matrix_multiplier<T>::complex_matrix_multiplier (matrix_multiplier<T> *rmm)
+    : __rmm (rmm)
+  {
+    __rmm->account (this->__account);
+  }
+
+  template <typename T>
+  complex_matrix_multiplier<T>::~complex_matrix_multiplier ()
+  {
+    delete __rmm;
+  }
+
+  template <typename T>
+  matrix_multiplier<std::complex<T> >*
+  complex_matrix_multiplier<T>::copy () const
+  {
+    return (new complex_matrix_multiplier<T> (__rmm->copy ()));
+  }
+
+  template <typename T>
+  void
+  complex_matrix_multiplier<T>::account (mem_account *a)
+  {
+    matrix_multiplier<std::complex<T> >::account (a);
+    __rmm->account (this->__account);
+  }
+
+  template <typename T>
+  size_t
+  complex_matrix_multiplier<T>::predicted_peak_bytes (size_t arows, size_t acols, size_t brows, size_t bcols)
+  {
+    if (acols != brows)
+      return 0;
+
+    size_t planes = 3 * (allocation_bytes (arows * acols * sizeof (T))
+                         + allocation_bytes (brows * bcols * sizeof (T)));
+    size_t product = allocation_bytes (arows * bcols * sizeof (T));
+    size_t during = (2 * product) + strassen_matrix_multiplier<T>::predicted_peak_bytes (arows, acols, brows, bcols);
+    size_t after = (3 * product) + allocation_bytes (arows * bcols * sizeof (std::complex<T>));
+
+    return (planes + ((during > after) ? during : after));
+  }
+
+  /**
+   * Multiplies the complex matrices a and b using three real products of their real and imaginary planes.
+   * Returns NULL if the real multiplier rejects the dimensions, or memory runs out.
+   */
+  template <typename T>
+  std::complex<T>*
+  complex_matrix_multiplier<T>::mult (const std::complex<T> *a, const std::complex<T> *b,
+                                      size_t arows, size_t acols,
+                                      size_t brows, size_t bcols)
+  {
+    this->__begin ();
+
+    if (acols != brows)
+      return NULL;
+
+    size_t na = arows * acols;
+    size_t nb = brows * bcols;
+    size_t nc = arows * bcols;
+
+    /* The real planes are allocated through our account too, though not of our element type */
+    mem_account *acct = this->__account;
+
+    T *Ar = (T *) acct->alloc (na * sizeof (T));
+    T *Ai = (T *) acct->alloc (na * sizeof (T));
+    T *As = (T *) acct->alloc (na * sizeof (T));
+    T *Br = (T *) acct->alloc (nb * sizeof (T));
+    T *Bi = (T *) acct->alloc (nb * sizeof (T));
+    T *Bs = (T *) acct->alloc (nb * sizeof (T));
+
+    T *T1 = NULL;
+    T *T2 = NULL;
+    T *T3 = NULL;
+    std::complex<T> *C = NULL;
+
+    /* If memory runs out, whatever was allocated is released below and NULL returned */
+    if (Ar && Ai && As && Br && Bi && Bs)
+      {
+        __split (a, na, Ar, Ai, As);
+        __split (b, nb, Br, Bi, Bs);
+
+        T1 = __rmm->mult (Ar, Br, arows, acols, brows, bcols);
+        T2 = __rmm->mult (Ai, Bi, arows, acols, brows, bcols);
+        T3 = __rmm->mult (As, Bs, arows, acols, brows, bcols);
+      }
+
+    if (T1 && T2 && T3)
+      C = this->__alloc (nc);
+
+    if (C)
+      {
+        for (size_t i = 0; i < nc; i++)
+          {
+            C[i] = std::complex<T> (T1[i] - T2[i], T3[i] - T1[i] - T2[i]);
+          }
+      }
+
+    acct->release (Ar);
+    acct->release (Ai);
+    acct->release (As);
+    acct->release (Br);
+    acct->release (Bi);
+    acct->release (Bs);
+    acct->release (T1);
+    acct->release (T2);
+    acct->release (T3);
+
+    return C;
+  }
+
+  /**
+   * Splits the n elements of A into planes of real parts, imaginary parts, and the sums of the two.
+   */
+  template <typename T>
+  void
+  complex_matrix_multiplier<T>::__split (const std::complex<T> *A, size_t n, T *re, T *im, T *sum)
+  {
+    for (size_t i = 0; i < n; i++)
+      {
+        re[i] = A[i].real ();
+        im[i] = A[i].imag ();
+        sum[i] = re[i] + im[i];
+      }
+  }
+}
+
+#endif /* COMPLEX_MATRIX_MULTIPLIER_HPP_ */
@@ -0,0 +1,825 @@
+#ifndef DISTRIBUTED_STRASSEN_MATRIX_MULTIPLIER_HPP_
+#define DISTRIBUTED_STRASSEN_MATRIX_MULTIPLIER_HPP_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include <string>
+#include <vector>
+
+#include "allocator.hpp"
+#include "strassen_matrix_multiplier.hpp"
+#include "trace.hpp"
+
+namespace strassen
+{
+  /* Marks every message between a coordinator and a worker */
+  const uint32_t DISTRIBUTED_MAGIC = 0x53545250;
+
+  /* Largest operand edge a worker accepts; its operands are already 32 GiB of doubles */
+  const uint64_t DISTRIBUTED_MAX_N = 1 << 16;
+
+  /**
+   * Precedes every message. A request is followed by the two n x n operands and a reply by their product,
+   * all row-major and in the coordinator's own representation of the elements, so coordinator and workers
+   * must run on the same architecture. A reply with n = 0 reports that the product could not be computed.
+   */
+  struct distributed_header
+  {
+    uint32_t magic;
+    uint32_t element_size;
+    uint64_t n;
+    double compute;       /* In a reply, the seconds the worker spent multiplying */
+  };
+
+  /**
+   * What the top-level products of the most recent multiplication cost. Communication is the time from
+   * sending a request to having read its reply, less the time the worker spent computing the product.
+   */
+  struct distributed_stats
+  {
+    size_t products;          /* Computed by workers */
+    size_t local;             /* Computed by the coordinator, as their worker could not be reached */
+    size_t bytes_sent;
+    size_t bytes_received;
+    double compute;           /* Seconds spent multiplying by the workers, summed over the products */
+    double communication;     /* Seconds spent moving operands and products, summed over the products */
+    double wall;              /* Seconds from sending the first request to having every product */
+  };
+
+  inline double
+  distributed_now ()
+  {
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return (ts.tv_sec + (ts.tv_nsec / 1e9));
+  }
+
+  inline bool
+  distributed_send (int fd, const void *buf, size_t len)
+  {
+    const char *p = (const char *) buf;
+
+    while (len)
+      {
+        ssize_t r = send (fd, p, len, MSG_NOSIGNAL);
+
+        if (r < 0 && errno == EINTR)
+          continue;
+
+        if (r <= 0)
+          return false;
+
+        p += r;
+        len -= r;
+      }
+
+    return true;
+  }
+
+  inline bool
+  distributed_recv (int fd, void *buf, size_t len)
+  {
+    char *p = (char *) buf;
+
+    while (len)
+      {
+        ssize_t r = recv (fd, p, len, 0);
+
+        if (r < 0 && errno == EINTR)
+          continue;
+
+        if (r <= 0)
+          return false;
+
+        p += r;
+        len -= r;
+      }
+
+    return true;
+  }
+
+  /**
+   * Connects to an endpoint of the form host:port, returning the socket or -1.
+   */
+  inline int
+  distributed_connect (const std::string &endpoint)
+  {
+    size_t colon = endpoint.rfind (':');
+
+    if (colon == std::string::npos)
+      {
+        fprintf (stderr, "distributed_connect: bad endpoint '%s'\n", endpoint.c_str ());
+        return -1;
+      }
+
+    std::string host = endpoint.substr (0, colon);
+    std::string port = endpoint.substr (colon + 1);
+
+    struct addrinfo hints;
+    struct addrinfo *res = NULL;
+
+    memset (&hints, 0, sizeof (hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    int err = getaddrinfo (host.c_str (), port.c_str (), &hints, &res);
+
+    if (err)
+      {
+        fprintf (stderr, "distributed_connect: %s: %s\n", endpoint.c_str (), gai_strerror (err));
+        return -1;
+      }
+
+    int fd = -1;
+
+    for (struct addrinfo *ai = res; ai; ai = ai->ai_next)
+      {
+        fd = socket (ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+
+        if (fd < 0)
+          continue;
+
+        if (!connect (fd, ai->ai_addr, ai->ai_addrlen))
+          break;
+
+        close (fd);
+        fd = -1;
+      }
+
+    freeaddrinfo (res);
+
+    if (fd < 0)
+      {
+        fprintf (stderr, "distributed_connect: cannot connect to %s\n", endpoint.c_str ());
+        return -1;
+      }
+
+    /* Headers are small and each is followed at once by the data, or awaited by the other side */
+    int one = 1;
+    setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof (one));
+
+    return fd;
+  }
+
+  /**
+   * A strassen_worker multiplies the operands coordinators send it with the sequential Strassen multiplier,
+   * recursing down to the threshold it was given, and sends back the products. Each connection is served on
+   * a thread of its own, with a multiplier of its own, for as many requests as its coordinator sends, so
+   * that one coordinator keeping its connection open does not hold up another. spawn () runs a worker in a
+   * child process listening on a free port of the loopback interface, which is how several of them are run
+   * on one machine.
+   */
+  template <typename T>
+  class strassen_worker
+  {
+  private:
+    int __listen;
+    uint16_t __port;
+    size_t __threshold;
+
+    struct connection
+    {
+      strassen_worker<T> *worker;
+      int fd;
+    };
+
+    static void* __serve_entry (void *p);
+
+    strassen_worker (const strassen_worker<T> &w);
+    strassen_worker<T>& operator = (const strassen_worker<T> &w);
+
+  public:
+    strassen_worker (size_t threshold = STRASSEN_THRESHOLD);
+    ~strassen_worker ();
+
+    /* Listens on the given address and port; port 0 picks a free one, reported by port () */
+    bool listen (const char *address = "127.0.0.1", uint16_t port = 0);
+    uint16_t port () const;
+
+    /* Accepts connections until an error on the listening socket */
+    void serve ();
+    /* Answers requests on fd until the coordinator closes it or sends something invalid */
+    void serve (int fd);
+
+    /**
+     * Starts a worker in a child process, setting endpoint to the address it listens on. Returns the child's
+     * process ID, or -1 on failure.
+     */
+    static pid_t spawn (std::string &endpoint, size_t threshold = STRASSEN_THRESHOLD);
+    /* Terminates a worker started by spawn () */
+    static void stop (pid_t pid);
+  };
+
+  template <typename T>
+  strassen_worker<T>::strassen_worker (size_t threshold)
+    : __listen (-1),
+      __port (0),
+      __threshold (threshold)
+  {
+  }
+
+  template <typename T>
+  strassen_worker<T>::~strassen_worker ()
+  {
+    if (__listen >= 0)
+      close (__listen);
+  }
+
+  template <typename T>
+  bool
+  strassen_worker<T>::listen (const char *address, uint16_t port)
+  {
+    struct sockaddr_in sa;
+
+    memset (&sa, 0, sizeof (sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons (port);
+
+    if (inet_pton (AF_INET, address, &sa.sin_addr) != 1)
+      {
+        fprintf (stderr, "strassen_worker: bad address '%s'\n", address);
+        return false;
+      }
+
+    __listen = socket (AF_INET, SOCK_STREAM, 0);
+
+    if (__listen < 0)
+      {
+        perror ("strassen_worker: socket");
+        return false;
+      }
+
+    int one = 1;
+    setsockopt (__listen, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one));
+
+    socklen_t len = sizeof (sa);
+
+    if (bind (__listen, (struct sockaddr *) &sa, sizeof (sa)) || ::listen (__listen, 16)
+        || getsockname (__listen, (struct sockaddr *) &sa, &len))
+      {
+        perror ("strassen_worker: bind");
+        close (__listen);
+        __listen = -1;
+        return false;
+      }
+
+    __port = ntohs (sa.sin_port);
+
+    return true;
+  }
+
+  template <typename T>
+  uint16_t
+  strassen_worker<T>::port () const
+  {
+    return __port;
+  }
+
+  template <typename T>
+  void
+  strassen_worker<T>::serve ()
+  {
+    for (;;)
+      {
+        int fd = accept (__listen, NULL, NULL);
+
+        if (fd < 0)
+          {
+            if (errno == EINTR)
+              continue;
+
+            perror ("strassen_worker: accept");
+            return;
+          }
+
+        int one = 1;
+        setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof (one));
+
+        connection *c = new connection ();
+        pthread_t thread;
+
+        c->worker = this;
+        c->fd = fd;
+
+        if (pthread_create (&thread, NULL, __serve_entry, c))
+          {
+            perror ("strassen_worker: pthread_create");
+            __serve_entry (c);
+          }
+        else
+          pthread_detach (thread);
+      }
+  }
+
+  template <typename T>
+  void*
+  strassen_worker<T>::__serve_entry (void *p)
+  {
+    connection *c = (connection *) p;
+
+    c->worker->serve (c->fd);
+    close (c->fd);
+    delete c;
+
+    return NULL;
+  }
+
+  template <typename T>
+  void
+  strassen_worker<T>::serve (int fd)
+  {
+    strassen_matrix_multiplier<T> smm (__threshold);
+    distributed_header h;
+
+    while (distributed_recv (fd, &h, sizeof (h)))
+      {
+        distributed_header reply = { DISTRIBUTED_MAGIC, (uint32_t) sizeof (T), 0, 0.0 };
+
+        /* The stream cannot be followed past a header which is not understood, or whose operands could
+         * not even be sized */
+        if (h.magic != DISTRIBUTED_MAGIC || h.element_size != sizeof (T) || !h.n || h.n > DISTRIBUTED_MAX_N
+            || h.n > SIZE_MAX / h.n / sizeof (T))
+          {
+            fprintf (stderr, "strassen_worker: bad request header\n");
+            distributed_send (fd, &reply, sizeof (reply));
+            return;
+          }
+
+        size_t n = h.n;
+        size_t bytes = n * n * sizeof (T);
+        T *A = (T *) aligned_malloc (bytes);
+        T *B = (T *) aligned_malloc (bytes);
+
+        /* Operands which do not fit are still read, to stay in step with the stream */
+        bool ok = A && B;
+
+        for (size_t i = 0; i < 2 && !ok; i++)
+          {
+            char buf[65536];
+
+            for (size_t left = bytes; left; )
+              {
+                size_t len = (left < sizeof (buf)) ? left : sizeof (buf);
+
+                if (!distributed_recv (fd, buf, len))
+                  {
+                    free (A);
+                    free (B);
+                    return;
+                  }
+
+                left -= len;
+              }
+          }
+
+        if (ok && (!distributed_recv (fd, A, bytes) || !distributed_recv (fd, B, bytes)))
+          {
+            free (A);
+            free (B);
+            return;
+          }
+
+        double start = distributed_now ();
+        T *M = ok ? smm.mult (A, B, n, n, n, n) : NULL;
+
+        reply.compute = distributed_now () - start;
+        reply.n = M ? n : 0;
+
+        bool sent = distributed_send (fd, &reply, sizeof (reply)) && (!M || distributed_send (fd, M, bytes));
+
+        free (A);
+        free (B);
+        free (M);
+
+        if (!sent)
+          return;
+      }
+  }
+
+  template <typename T>
+  pid_t
+  strassen_worker<T>::spawn (std::string &endpoint, size_t threshold)
+  {
+    strassen_worker<T> w (threshold);
+
+    /* Listening before the fork means the port is known, and connections wait, as soon as this returns */
+    if (!w.listen ())
+      return -1;
+
+    fflush (stdout);
+    fflush (stderr);
+
+    pid_t pid = fork ();
+
+    if (pid < 0)
+      {
+        perror ("strassen_worker: fork");
+        return -1;
+      }
+
+    if (!pid)
+      {
+        w.serve ();
+        _exit (0);
+      }
+
+    endpoint = "127.0.0.1:" + std::to_string (w.port ());
+
+    return pid;
+  }
+
+  template <typename T>
+  void
+  strassen_worker<T>::stop (pid_t pid)
+  {
+    if (pid > 0)
+      {
+        kill (pid, SIGTERM);
+        waitpid (pid, NULL, 0);
+      }
+  }
+
+  /**
+   * A distributed_strassen_matrix_multiplier sends the seven top-level products of the Strassen recursion to
+   * worker processes over TCP. It pads the operands and forms the blocks AA[i] and BB[i] as the sequential
+   * multiplier does, hands product i to worker i modulo the number of workers, each worker's share on a
+   * thread of its own, and combines the products M[i] the workers send back. The workers recurse locally.
+   *
+   * Connections are made on first use and kept for later multiplications. A product whose worker cannot be
+   * reached, or fails to answer, is computed locally instead, and the connection is tried again by the next
+   * multiplication. Products below the threshold are computed locally altogether, as are all of them when
+   * there are no workers.
+   *
+   * Each top-level product costs 2m^2 elements sent and m^2 received for about m^2.81 multiply-adds, so the
+   * communication becomes less significant as the products grow; stats () reports both for the most recent
+   * multiplication.
+   */
+  template <typename T>
+  class distributed_strassen_matrix_multiplier : public strassen::strassen_matrix_multiplier<T>
+  {
+  private:
+    std::vector<std::string> __endpoints;
+    std::vector<int> __fds;
+    distributed_stats __stats;
+
+    /* The products given to one worker, and what they cost */
+    struct shipment
+    {
+      distributed_strassen_matrix_multiplier<T> *dsmm;
+      size_t worker;
+      T * const *AA;
+      T * const *BB;
+      T * const *MM;
+      size_t m;
+      bool done[7];
+      distributed_stats stats;
+    };
+
+    static void* __ship_entry (void *p);
+    void __ship (shipment *s);
+
+    T* __distribute (const T *A, const T *B, size_t n);
+
+  public:
+    distributed_strassen_matrix_multiplier (const std::vector<std::string> &endpoints,
+                                            size_t threshold = STRASSEN_THRESHOLD);
+    virtual ~distributed_strassen_matrix_multiplier ();
+
+    T* mult (const T *a, const T *b, size_t arows, size_t acols, size_t brows, size_t bcols);
+    matrix_multiplier<T>* copy () const;
+
+    /* The squaring path would keep every product local; these go through mult () to ship them */
+    T* square (const T *a, size_t n);
+    T* pow (const T *a, size_t n, size_t k, double tolerance = 0.0);
+
+    size_t workers () const;
+    const distributed_stats& stats () const;
+
+    /**
+     * Peak bytes the coordinator allocates in one call to mult () with these dimensions: the padded operands,
+     * the output, the 14 operand blocks and the 7 products received, when every product is computed remotely.
+     */
+    static size_t predicted_peak_bytes (size_t arows, size_t acols, size_t brows, size_t bcols,
+                                        size_t threshold = STRASSEN_THRESHOLD);
+  };
+
+  template <typename T>
+  distributed_strassen_matrix_multiplier<T>::distributed_strassen_matrix_multiplier
+    (const std::vector<std::string> &endpoints, size_t threshold)
+    : strassen_matrix_multiplier<T> (threshold),
+      __endpoints (endpoints),
+      __fds (endpoints.size (), -1)
+  {
+    memset (&__stats, 0, sizeof (__stats));
+  }
+
+  template <typename T>
+  distributed_strassen_matrix_multiplier<T>::~distributed_strassen_matrix_multiplier ()
+  {
+    for (size_t i = 0; i < __fds.size (); i++)
+      {
+        if (__fds[i] >= 0)
+          close (__fds[i]);
+      }
+  }
+
+  template <typename T>
+  matrix_multiplier<T>*
+  distributed_strassen_matrix_multiplier<T>::copy () const
+  {
+    return (new distributed_strassen_matrix_multiplier<T> (__endpoints, this->__threshold));
+  }
+
+  template <typename T>
+  size_t
+  distributed_strassen_matrix_multiplier<T>::workers () const
+  {
+    return __endpoints.size ();
+  }
+
+  template <typename T>
+  const distributed_stats&
+  distributed_strassen_matrix_multiplier<T>::stats () const
+  {
+    return __stats;
+  }
+
+  template <typename T>
+  size_t
+  distributed_strassen_matrix_multiplier<T>::predicted_peak_bytes (size_t arows, size_t acols,
+                                                                   size_t brows, size_t bcols,
+                                                                   size_t threshold)
+  {
+    if (acols != brows)
+      return 0;
+
+    if (!threshold)
+      threshold = 1;
+
+    size_t N = strassen_matrix_multiplier<T>::padded_size (arows, acols, brows, bcols);
+    size_t pads = 0;
+
+    if (arows != N || acols != N)
+      pads += allocation_bytes (N * N * sizeof (T));
+
+    if (brows != N || bcols != N)
+      pads += allocation_bytes (N * N * sizeof (T));
+
+    if (N <= threshold)
+      return (pads + strassen_matrix_multiplier<T>::__predicted_mult_bytes (N, threshold));
+
+    size_t m = N / 2;
+
+    return (pads + allocation_bytes (N * N * sizeof (T)) + (21 * allocation_bytes (m * m * sizeof (T))));
+  }
+
+  template <typename T>
+  T*
+  distributed_strassen_matrix_multiplier<T>::square (const T *a, size_t n)
+  {
+    return (mult (a, a, n, n, n, n));
+  }
+
+  template <typename T>
+  T*
+  distributed_strassen_matrix_multiplier<T>::pow (const T *a, size_t n, size_t k, double tolerance)
+  {
+    return (matrix_multiplier<T>::pow (a, n, k, tolerance));
+  }
+
+  template <typename T>
+  T*
+  distributed_strassen_matrix_multiplier<T>::mult (const T *a, const T *b,
+                                                   size_t arows, size_t acols, size_t brows, size_t bcols)
+  {
+    this->__begin ();
+    memset (&__stats, 0, sizeof (__stats));
+
+    if (acols != brows)
+      return NULL;
+
+    size_t N = this->padded_size (arows, acols, brows, bcols);
+
+    T *A = NULL;
+    T *B = NULL;
+
+    this->__phase (PHASE_PAD);
+
+    {
+      STRASSEN_TRACE_SCOPE ("pad", N);
+
+      if (arows != N || acols != N)
+        A = this->__pad (a, arows, acols, N, this->__row_threads);
+
+      if (brows != N || bcols != N)
+        B = this->__pad (b, brows, bcols, N, this->__row_threads);
+    }
+
+    T *C = __distribute (A ? A : a, B ? B : b, N);
+    T *D = C;
+
+    if (C && (arows != N || bcols != N))
+      {
+        this->__phase (PHASE_UNPAD);
+
+        {
+          STRASSEN_TRACE_SCOPE ("unpad", N);
+          D = this->__unpad (C, arows, bcols, N, this->__row_threads);
+        }
+
+        this->__free (C);
+      }
+
+    this->__free (A);
+    this->__free (B);
+
+    this->__phase (PHASE_NONE);
+
+    return D;
+  }
+
+  /**
+   * Multiplies the n x n matrices A and B, sending the top-level products to the workers.
+   */
+  template <typename T>
+  T*
+  distributed_strassen_matrix_multiplier<T>::__distribute (const T *A, const T *B, size_t n)
+  {
+    if (n <= this->__threshold || __endpoints.empty ())
+      return (this->__mult (A, B, n));
+
+    STRASSEN_TRACE_SCOPE ("operands", n);
+    this->__phase (PHASE_OPERANDS);
+
+    size_t m = n / 2;
+    T *C = this->__alloc (n * n);
+
+    T* AA[7]; /* Submatrix blocks for A */
+    T* BB[7]; /* Submatrix blocks for B */
+    T* MM[7]; /* Products of above submatrices, as received */
+
+    for (uint32_t i = 0; i < 7; i++)
+      {
+        AA[i] = this->__alloc (m * m);
+        BB[i] = this->__alloc (m * m);
+        MM[i] = this->__alloc (m * m);
+      }
+
+    this->__operands (AA, BB, A, B, m, n, this->__row_threads);
+
+    STRASSEN_TRACE_NEXT ("wait");
+    this->__phase (PHASE_WAIT);
+
+    size_t workers = (__endpoints.size () < 7) ? __endpoints.size () : 7;
+    std::vector<shipment> ships (workers);
+    std::vector<pthread_t> threads (workers);
+    std::vector<bool> spawned (workers, false);
+    double start = distributed_now ();
+
+    for (size_t w = 0; w < workers; w++)
+      {
+        shipment &s = ships[w];
+
+        s.dsmm = this;
+        s.worker = w;
+        s.AA = AA;
+        s.BB = BB;
+        s.MM = MM;
+        s.m = m;
+
+        memset (s.done, 0, sizeof (s.done));
+        memset (&s.stats, 0, sizeof (s.stats));
+
+        /* The last share is shipped from this thread */
+        if (w + 1 < workers)
+          {
+            spawned[w] = !pthread_create (&threads[w], NULL, __ship_entry, &s);
+
+            if (!spawned[w])
+              perror ("distributed_strassen_matrix_multiplier: pthread_create");
+          }
+      }
+
+    __ship (&ships[workers - 1]);
+
+    for (size_t w = 0; w + 1 < workers; w++)
+      {
+        if (spawned[w])
+          pthread_join (threads[w], NULL);
+        else
+          __ship (&ships[w]);
+      }
+
+    __stats.wall = distributed_now () - start;
+
+    for (size_t w = 0; w < workers; w++)
+      {
+        const distributed_stats &s = ships[w].stats;
+
+        __stats.products += s.products;
+        __stats.bytes_sent += s.bytes_sent;
+        __stats.bytes_received += s.bytes_received;
+        __stats.compute += s.compute;
+        __stats.communication += s.communication;
+
+        for (size_t i = w; i < 7; i += workers)
+          {
+            if (!ships[w].done[i])
+              {
+                STRASSEN_TRACE_SCOPE ("local", m);
+
+                this->__mult (AA[i], BB[i], m, MM[i]);
+                __stats.local++;
+              }
+          }
+      }
+
+    STRASSEN_TRACE_NEXT ("combine");
+    this->__phase (PHASE_COMBINE);
+
+    this->__combine (C, MM, m, n, this->__row_threads);
+
+    for (uint32_t i = 0; i < 7; i++)
+      {
+        this->__free (AA[i]);
+        this->__free (BB[i]);
+        this->__free (MM[i]);
+      }
+
+    return C;
+  }
+
+  template <typename T>
+  void*
+  distributed_strassen_matrix_multiplier<T>::__ship_entry (void *p)
+  {
+    shipment *s = (shipment *) p;
+    s->dsmm->__ship (s);
+
+    return NULL;
+  }
+
+  /**
+   * Sends products worker, worker + workers, ... to one worker in turn, each request waiting for the reply to
+   * the one before, and marks those it gets back. On any failure the connection is dropped and the rest of
+   * the share left to the caller.
+   */
+  template <typename T>
+  void
+  distributed_strassen_matrix_multiplier<T>::__ship (shipment *s)
+  {
+    STRASSEN_TRACE_SCOPE ("ship", s->m);
+
+    int &fd = __fds[s->worker];
+    size_t workers = (__endpoints.size () < 7) ? __endpoints.size () : 7;
+    size_t bytes = s->m * s->m * sizeof (T);
+
+    if (fd < 0)
+      fd = distributed_connect (__endpoints[s->worker]);
+
+    for (size_t i = s->worker; i < 7 && fd >= 0; i += workers)
+      {
+        distributed_header h = { DISTRIBUTED_MAGIC, (uint32_t) sizeof (T), s->m, 0.0 };
+        distributed_header reply;
+        double start = distributed_now ();
+
+        bool ok = distributed_send (fd, &h, sizeof (h)) && distributed_send (fd, s->AA[i], bytes)
+          && distributed_send (fd, s->BB[i], bytes) && distributed_recv (fd, &reply, sizeof (reply))
+          && reply.magic == DISTRIBUTED_MAGIC && reply.n == s->m && distributed_recv (fd, s->MM[i], bytes);
+
+        if (!ok)
+          {
+            fprintf (stderr, "distributed_strassen_matrix_multiplier: no product from %s\n",
+                     __endpoints[s->worker].c_str ());
+            close (fd);
+            fd = -1;
+            break;
+          }
+
+        s->done[i] = true;
+        s->stats.products++;
+        s->stats.bytes_sent += sizeof (h) + (2 * bytes);
+        s->stats.bytes_received += sizeof (reply) + bytes;
+        s->stats.compute += reply.compute;
+        s->stats.communication += (distributed_now () - start) - reply.compute;
+      }
+  }
+}
+
+#endif /* DISTRIBUTED_STRASSEN_MATRIX_MULTIPLIER_HPP_ */
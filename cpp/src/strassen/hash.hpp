@@ -0,0 +1,123 @@
+#ifndef HASH_HPP_
+#define HASH_HPP_
+
+#include <stdint.h>
+#include <string.h>
+
+namespace strassen
+{
+  const uint64_t HASH_PRIME1 = 11400714785074694791ULL;
+  const uint64_t HASH_PRIME2 = 14029467366897019727ULL;
+  const uint64_t HASH_PRIME3 = 1609587929392839161ULL;
+  const uint64_t HASH_PRIME4 = 9650029242287828579ULL;
+  const uint64_t HASH_PRIME5 = 2870177450012600261ULL;
+
+  inline uint64_t
+  __hash_rotl (uint64_t x, int r)
+  {
+    return ((x << r) | (x >> (64 - r)));
+  }
+
+  inline uint64_t
+  __hash_read64 (const unsigned char *p)
+  {
+    uint64_t v;
+    memcpy (&v, p, sizeof (v));
+    return v;
+  }
+
+  inline uint32_t
+  __hash_read32 (const unsigned char *p)
+  {
+    uint32_t v;
+    memcpy (&v, p, sizeof (v));
+    return v;
+  }
+
+  inline uint64_t
+  __hash_round (uint64_t acc, uint64_t input)
+  {
+    acc += input * HASH_PRIME2;
+    acc = __hash_rotl (acc, 31);
+    return (acc * HASH_PRIME1);
+  }
+
+  inline uint64_t
+  __hash_merge (uint64_t acc, uint64_t val)
+  {
+    acc ^= __hash_round (0, val);
+    return ((acc * HASH_PRIME1) + HASH_PRIME4);
+  }
+
+  /**
+   * Returns the 64-bit xxHash (XXH64) of the len bytes at p. This runs at several bytes per cycle, so
+   * hashing a matrix costs far less than reading it from disk or multiplying it.
+   */
+  inline uint64_t
+  hash64 (const void *data, size_t len, uint64_t seed = 0)
+  {
+    const unsigned char *p = (const unsigned char *) data;
+    const unsigned char *end = p + len;
+    uint64_t h;
+
+    if (len >= 32)
+      {
+        const unsigned char *limit = end - 32;
+        uint64_t v1 = seed + HASH_PRIME1 + HASH_PRIME2;
+        uint64_t v2 = seed + HASH_PRIME2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - HASH_PRIME1;
+
+        do
+          {
+            v1 = __hash_round (v1, __hash_read64 (p));
+            v2 = __hash_round (v2, __hash_read64 (p + 8));
+            v3 = __hash_round (v3, __hash_read64 (p + 16));
+            v4 = __hash_round (v4, __hash_read64 (p + 24));
+            p += 32;
+          }
+        while (p <= limit);
+
+        h = __hash_rotl (v1, 1) + __hash_rotl (v2, 7) + __hash_rotl (v3, 12) + __hash_rotl (v4, 18);
+        h = __hash_merge (h, v1);
+        h = __hash_merge (h, v2);
+        h = __hash_merge (h, v3);
+        h = __hash_merge (h, v4);
+      }
+    else
+      {
+        h = seed + HASH_PRIME5;
+      }
+
+    h += (uint64_t) len;
+
+    for (; p + 8 <= end; p += 8)
+      {
+        h ^= __hash_round (0, __hash_read64 (p));
+        h = (__hash_rotl (h, 27) * HASH_PRIME1) + HASH_PRIME4;
+      }
+
+    if (p + 4 <= end)
+      {
+        h ^= (uint64_t) __hash_read32 (p) * HASH_PRIME1;
+        h = (__hash_rotl (h, 23) * HASH_PRIME2) + HASH_PRIME3;
+        p += 4;
+      }
+
+    for (; p < end; p++)
+      {
+        h ^= (*p) * HASH_PRIME5;
+        h = __hash_rotl (h, 11) * HASH_PRIME1;
+      }
+
+    h ^= h >> 33;
+    h *= HASH_PRIME2;
+    h ^= h >> 29;
+    h *= HASH_PRIME3;
+    h ^= h >> 32;
+
+    return h;
+  }
+}
+
+#endif /* HASH_HPP_ */
@@ -0,0 +1,306 @@
+#ifndef MAINTAINED_PRODUCT_HPP_
+#define MAINTAINED_PRODUCT_HPP_
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "allocator.hpp"
+#include "matrix.hpp"
+#include "adaptive_matrix_multiplier.hpp"
+
+namespace strassen
+{
+  /* Fraction of the work of a full product beyond which a maintained_product recomputes it in full */
+  const double MAINTAINED_MAX_DIRTY = 0.25;
+
+  /* What the updates of a maintained_product have done */
+  struct maintained_stats
+  {
+    size_t full;            /* Products computed in full */
+    size_t incremental;     /* Updates made incrementally */
+    size_t a_rows;          /* Rows of C recomputed for changed rows of A */
+    size_t b_rows;          /* Changed rows of B applied as rank-1 updates */
+  };
+
+  /**
+   * A maintained_product keeps C = A B up to date as A and B change, doing only the work the changes call
+   * for. update () asks each operand which of its rows have changed since the last update:
+   *
+   * - for each changed row r of B, C += A[:, r] (B[r, :] - B'[r, :]), where B' is B as of the last update,
+   *   so that a change to a few rows of B, a change of low rank, costs m n per row;
+   * - then, for each changed row i of A, C[i, :] = A[i, :] B, which costs k n per row.
+   *
+   * The rank-1 updates use the new A, so rows of C which are then recomputed are right either way. When the
+   * work of the changes exceeds the given fraction of that of a full product, or the operands have changed
+   * shape, layout or all at once, C is recomputed in full with the multiplier instead.
+   *
+   * The copy B' costs k n elements on top of C. Both operands must outlive the maintained_product, and are
+   * only read; changes made to them through data () must be reported with matrix::touch () to be seen.
+   * M is the multiplier class the operands bind, as in matrix<T, M>.
+   */
+  template <typename T, typename M = matrix_multiplier<T> >
+  class maintained_product
+  {
+  private:
+    const matrix<T, M> *__a;
+    const matrix<T, M> *__b;
+    matrix_multiplier<T> *__mm;
+    double __max_dirty;
+
+    T *__c;
+    T *__b_copy;
+    size_t __m;
+    size_t __k;
+    size_t __n;
+    uint64_t __a_version;
+    uint64_t __b_version;
+
+    maintained_stats __stats;
+
+    bool __full ();
+
+    maintained_product (const maintained_product<T, M> &p);
+    maintained_product<T, M>& operator = (const maintained_product<T, M> &p);
+
+  public:
+    /* The product is computed by the first update (); full products are computed by mm, which we own */
+    maintained_product (const matrix<T, M> &a, const matrix<T, M> &b,
+                        double max_dirty = MAINTAINED_MAX_DIRTY,
+                        matrix_multiplier<T> *mm = new adaptive_matrix_multiplier<T> ());
+    ~maintained_product ();
+
+    /* Brings C up to date with A and B, returning it, or NULL if they do not conform or memory runs out */
+    const T* update ();
+
+    /* C as of the last update, row-major */
+    const T* data () const;
+    size_t rows () const;
+    size_t cols () const;
+
+    double max_dirty () const;
+    void max_dirty (double fraction);
+
+    const maintained_stats& stats () const;
+  };
+
+  template <typename T, typename M>
+  maintained_product<T, M>::maintained_product (const matrix<T, M> &a, const matrix<T, M> &b,
+                                                double max_dirty, matrix_multiplier<T> *mm)
+    : __a (&a),
+      __b (&b),
+      __mm (mm),
+      __max_dirty (max_dirty),
+      __c (NULL),
+      __b_copy (NULL),
+      __m (0),
+      __k (0),
+      __n (0),
+      __a_version (0),
+      __b_version (0)
+  {
+    memset (&__stats, 0, sizeof (__stats));
+  }
+
+  template <typename T, typename M>
+  maintained_product<T, M>::~maintained_product ()
+  {
+    free (__c);
+    free (__b_copy);
+
+    delete __mm;
+  }
+
+  template <typename T, typename M>
+  const T*
+  maintained_product<T, M>::data () const
+  {
+    return __c;
+  }
+
+  template <typename T, typename M>
+  size_t
+  maintained_product<T, M>::rows () const
+  {
+    return __m;
+  }
+
+  template <typename T, typename M>
+  size_t
+  maintained_product<T, M>::cols () const
+  {
+    return __n;
+  }
+
+  template <typename T, typename M>
+  double
+  maintained_product<T, M>::max_dirty () const
+  {
+    return __max_dirty;
+  }
+
+  template <typename T, typename M>
+  void
+  maintained_product<T, M>::max_dirty (double fraction)
+  {
+    __max_dirty = fraction;
+  }
+
+  template <typename T, typename M>
+  const maintained_stats&
+  maintained_product<T, M>::stats () const
+  {
+    return __stats;
+  }
+
+  /**
+   * Recomputes C in full and takes a fresh copy of B.
+   */
+  template <typename T, typename M>
+  bool
+  maintained_product<T, M>::__full ()
+  {
+    const matrix<T, M> &a = *__a;
+    const matrix<T, M> &b = *__b;
+
+    free (__c);
+    free (__b_copy);
+    __c = NULL;
+    __b_copy = NULL;
+    __m = __k = __n = 0;
+
+    if (a.cols () != b.rows ())
+      return false;
+
+    T *C = ((a.layout () == ROW_MAJOR && b.layout () == ROW_MAJOR)
+            ? __mm->mult (a.data (), b.data (), a.rows (), a.cols (), b.rows (), b.cols ())
+            : __mm->mult_layout (a.data (), a.layout (), b.data (), b.layout (), a.rows (), a.cols (),
+                                 b.rows (), b.cols ()));
+    T *B = (T *) aligned_malloc (b.rows () * b.cols () * sizeof (T));
+
+    if (!C || !B)
+      {
+        free (C);
+        free (B);
+        return false;
+      }
+
+    if (b.layout () == ROW_MAJOR)
+      memcpy (B, b.data (), b.rows () * b.cols () * sizeof (T));
+    else
+      transpose_blocked (b.data (), B, b.cols (), b.rows ());
+
+    __c = C;
+    __b_copy = B;
+    __m = a.rows ();
+    __k = a.cols ();
+    __n = b.cols ();
+    __a_version = a.version ();
+    __b_version = b.version ();
+    __stats.full++;
+
+    return true;
+  }
+
+  template <typename T, typename M>
+  const T*
+  maintained_product<T, M>::update ()
+  {
+    const matrix<T, M> &a = *__a;
+    const matrix<T, M> &b = *__b;
+
+    /* The incremental kernels read both operands by rows */
+    if (!__c || a.rows () != __m || a.cols () != __k || b.rows () != __k || b.cols () != __n
+        || a.layout () != ROW_MAJOR || b.layout () != ROW_MAJOR
+        || a.all_changed_since (__a_version) || b.all_changed_since (__b_version))
+      return (__full () ? __c : NULL);
+
+    std::vector<size_t> a_rows;
+    std::vector<size_t> b_rows;
+
+    for (size_t i = 0; i < __m; i++)
+      {
+        if (a.changed_since (i, __a_version))
+          a_rows.push_back (i);
+      }
+
+    for (size_t r = 0; r < __k; r++)
+      {
+        if (b.changed_since (r, __b_version))
+          b_rows.push_back (r);
+      }
+
+    if (a_rows.empty () && b_rows.empty ())
+      return __c;
+
+    /* Each changed row of A costs k n of the m k n of a full product, and each changed row of B m n */
+    double dirty = ((double) a_rows.size () / __m) + ((double) b_rows.size () / __k);
+
+    if (dirty > __max_dirty)
+      return (__full () ? __c : NULL);
+
+    const T *A = a.data ();
+    const T *B = b.data ();
+
+    if (!b_rows.empty ())
+      {
+        T *D = (T *) aligned_malloc (__n * sizeof (T));
+
+        if (!D)
+          return (__full () ? __c : NULL);
+
+        for (size_t x = 0; x < b_rows.size (); x++)
+          {
+            size_t r = b_rows[x];
+            T *old = &__b_copy[r * __n];
+
+            for (size_t j = 0; j < __n; j++)
+              D[j] = B[(r * __n) + j] - old[j];
+
+            for (size_t i = 0; i < __m; i++)
+              {
+                T air = A[(i * __k) + r];
+                T *c = &__c[i * __n];
+
+                for (size_t j = 0; j < __n; j++)
+                  c[j] += air * D[j];
+              }
+
+            memcpy (old, &B[r * __n], __n * sizeof (T));
+          }
+
+        free (D);
+      }
+
+    for (size_t x = 0; x < a_rows.size (); x++)
+      {
+        size_t i = a_rows[x];
+        const T *arow = &A[i * __k];
+        T *c = &__c[i * __n];
+
+        for (size_t j = 0; j < __n; j++)
+          c[j] = T ();
+
+        for (size_t p = 0; p < __k; p++)
+          {
+            T aip = arow[p];
+            const T *brow = &B[p * __n];
+
+            for (size_t j = 0; j < __n; j++)
+              c[j] += aip * brow[j];
+          }
+      }
+
+    __a_version = a.version ();
+    __b_version = b.version ();
+    __stats.incremental++;
+    __stats.a_rows += a_rows.size ();
+    __stats.b_rows += b_rows.size ();
+
+    return __c;
+  }
+}
+
+#endif /* MAINTAINED_PRODUCT_HPP_ */
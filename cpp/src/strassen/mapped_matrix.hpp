@@ -0,0 +1,308 @@
+#ifndef MAPPED_MATRIX_HPP_
+#define MAPPED_MATRIX_HPP_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "matrix_io.hpp"
+
+namespace strassen
+{
+  /**
+   * A mapped_matrix is a row-major matrix of type T whose storage is a memory-mapped file rather than
+   * malloc'd memory. The file is in the binary matrix format of matrix_io.hpp, so the operating system pages
+   * the matrix in and out on demand and it may be far larger than physical memory. Mapped matrices are
+   * meant to be processed piecewise, for example by the out_of_core_matrix_multiplier.
+   *
+   * Files created through a mapped_matrix are marked MATRIX_FILE_UNCHECKED, since maintaining a checksum
+   * would mean rereading the whole file on every sync.
+   */
+  template <typename T>
+  class mapped_matrix
+  {
+  private:
+    size_t _rows;   /* Number of rows in our matrix */
+    size_t _cols;   /* Number of columns in our matrix */
+    int __fd;       /* Descriptor of the backing file */
+    size_t __len;   /* Length of the mapping, in bytes */
+    void *__base;   /* Start of the mapping */
+    T *__matrix;    /* Start of the matrix data, just past the file header */
+
+    bool __map (const char *path, size_t len, int flags);
+
+    /* Mappings own a file descriptor and are not copyable */
+    mapped_matrix (const mapped_matrix<T> &m);
+    mapped_matrix<T>& operator = (const mapped_matrix<T> &m);
+
+  public:
+    mapped_matrix ();
+    ~mapped_matrix ();
+
+    /* Create (or truncate) the file at path to hold a rows x cols matrix and map it read-write */
+    bool create (const char *path, size_t rows, size_t cols);
+    /* Map an existing matrix file */
+    bool open (const char *path, bool writable = false);
+    /* Flush modifications to disk and unmap the file */
+    void close ();
+    /* Flush modifications to disk */
+    void sync ();
+
+    /* Pass the advice (MADV_WILLNEED, MADV_DONTNEED, ...) to the kernel for the given block of the matrix */
+    bool advise (size_t row_start, size_t col_start, size_t rows, size_t cols, int advice) const;
+
+    bool ok () const;
+    size_t rows () const;
+    size_t cols () const;
+    T* data () const;
+
+    T& at (size_t i, size_t j);
+    T& operator () (size_t i, size_t j);
+  };
+
+  template <typename T>
+  mapped_matrix<T>::mapped_matrix ()
+    : _rows (0),
+      _cols (0),
+      __fd (-1),
+      __len (0),
+      __base (NULL),
+      __matrix (NULL)
+  {
+  }
+
+  template <typename T>
+  mapped_matrix<T>::~mapped_matrix ()
+  {
+    close ();
+  }
+
+  template <typename T>
+  bool
+  mapped_matrix<T>::create (const char *path, size_t rows, size_t cols)
+  {
+    matrix_file_header h;
+    size_t len = MATRIX_FILE_HEADER_SIZE + (rows * cols * sizeof (T));
+
+    close ();
+
+    if (!rows || !cols)
+      return false;
+
+    __fd = ::open (path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+    if (__fd < 0)
+      {
+        perror ("mapped_matrix: open");
+        return false;
+      }
+
+    matrix_file_init<T> (h, rows, cols, MATRIX_FILE_UNCHECKED);
+
+    if (ftruncate (__fd, len) || pwrite (__fd, &h, sizeof (h), 0) != sizeof (h))
+      {
+        perror ("mapped_matrix: create");
+        close ();
+        return false;
+      }
+
+    _rows = rows;
+    _cols = cols;
+
+    return (__map (path, len, O_RDWR));
+  }
+
+  template <typename T>
+  bool
+  mapped_matrix<T>::open (const char *path, bool writable)
+  {
+    matrix_file_header h;
+
+    close ();
+
+    __fd = ::open (path, writable ? O_RDWR : O_RDONLY);
+
+    if (__fd < 0)
+      {
+        perror ("mapped_matrix: open");
+        return false;
+      }
+
+    if (!matrix_file_check<T> (__fd, path, h) || !h.rows || !h.cols)
+      {
+        close ();
+        return false;
+      }
+
+    /* Writing through the mapping would invalidate the checksum */
+    if (writable && !(h.flags & MATRIX_FILE_UNCHECKED))
+      {
+        h.flags |= MATRIX_FILE_UNCHECKED;
+
+        if (pwrite (__fd, &h, sizeof (h), 0) != sizeof (h))
+          {
+            perror ("mapped_matrix: write");
+            close ();
+            return false;
+          }
+      }
+
+    _rows = h.rows;
+    _cols = h.cols;
+
+    return (__map (path, MATRIX_FILE_HEADER_SIZE + (_rows * _cols * sizeof (T)), writable ? O_RDWR : O_RDONLY));
+  }
+
+  template <typename T>
+  void
+  mapped_matrix<T>::close ()
+  {
+    if (__base)
+      {
+        munmap (__base, __len);
+        __base = NULL;
+        __matrix = NULL;
+      }
+
+    if (__fd >= 0)
+      {
+        ::close (__fd);
+        __fd = -1;
+      }
+
+    _rows = 0;
+    _cols = 0;
+    __len = 0;
+  }
+
+  template <typename T>
+  void
+  mapped_matrix<T>::sync ()
+  {
+    if (__base)
+      msync (__base, __len, MS_SYNC);
+  }
+
+  /**
+   * Advises the kernel about the rows x cols block starting at (row_start, col_start). madvise () takes
+   * page-aligned ranges, so each row of the block is widened to the start of its first page, and rows which
+   * then meet or overlap the range before them are merged into it; a block of whole rows is a single range.
+   * Blocks narrower than the matrix thus do not drag whole rows of pages along. Returns false if the kernel
+   * rejects any of the advice.
+   */
+  template <typename T>
+  bool
+  mapped_matrix<T>::advise (size_t row_start, size_t col_start, size_t rows, size_t cols, int advice) const
+  {
+    if (!__matrix || row_start >= _rows || col_start >= _cols)
+      return true;
+
+    if (row_start + rows > _rows)
+      rows = _rows - row_start;
+
+    if (col_start + cols > _cols)
+      cols = _cols - col_start;
+
+    uintptr_t page = (uintptr_t) sysconf (_SC_PAGESIZE);
+    uintptr_t range_start = 0;
+    uintptr_t range_end = 0;
+    bool ok = true;
+
+    for (size_t i = row_start; i < row_start + rows; i++)
+      {
+        uintptr_t start = ((uintptr_t) &__matrix[(i * _cols) + col_start]) & ~(page - 1);
+        uintptr_t end = (uintptr_t) &__matrix[(i * _cols) + col_start + cols];
+
+        /* Rows reaching back into the pages of the range so far extend it */
+        if (range_end && start <= ((range_end + page - 1) & ~(page - 1)))
+          {
+            range_end = end;
+            continue;
+          }
+
+        if (range_end && madvise ((void *) range_start, range_end - range_start, advice))
+          ok = false;
+
+        range_start = start;
+        range_end = end;
+      }
+
+    if (range_end && madvise ((void *) range_start, range_end - range_start, advice))
+      ok = false;
+
+    return ok;
+  }
+
+  template <typename T>
+  bool
+  mapped_matrix<T>::ok () const
+  {
+    return (__matrix != NULL);
+  }
+
+  template <typename T>
+  size_t
+  mapped_matrix<T>::rows () const
+  {
+    return _rows;
+  }
+
+  template <typename T>
+  size_t
+  mapped_matrix<T>::cols () const
+  {
+    return _cols;
+  }
+
+  template <typename T>
+  T*
+  mapped_matrix<T>::data () const
+  {
+    return __matrix;
+  }
+
+  template <typename T>
+  T&
+  mapped_matrix<T>::at (size_t i, size_t j)
+  {
+    return (__matrix[(i * _cols) + j]);
+  }
+
+  template <typename T>
+  T&
+  mapped_matrix<T>::operator () (size_t i, size_t j)
+  {
+    return (__matrix[(i * _cols) + j]);
+  }
+
+  /**
+   * Maps len bytes of the open file, and points our matrix data just past its header.
+   */
+  template <typename T>
+  bool
+  mapped_matrix<T>::__map (const char *path, size_t len, int flags)
+  {
+    int prot = (flags & O_RDWR) ? (PROT_READ | PROT_WRITE) : PROT_READ;
+    void *p = mmap (NULL, len, prot, MAP_SHARED, __fd, 0);
+
+    if (p == MAP_FAILED)
+      {
+        fprintf (stderr, "mapped_matrix: cannot map %s\n", path);
+        close ();
+        return false;
+      }
+
+    __len = len;
+    __base = p;
+    __matrix = (T *) ((char *) p + MATRIX_FILE_HEADER_SIZE);
+
+    return true;
+  }
+}
+
+#endif /* MAPPED_MATRIX_HPP_ */
@@ -5,19 +5,63 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 
+#include <atomic>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "allocator.hpp"
 #include "transpose_matrix_multiplier.hpp"
 #include "strassen_matrix_multiplier.hpp"
+#include "adaptive_matrix_multiplier.hpp"
+#include "skinny_matrix_multiplier.hpp"
+#include "multiplier_binding.hpp"
 
 namespace strassen
 {
+  /**
+   * The storage of a matrix once copies of it share it: the malloc'd data, or the file mapping holding it,
+   * and the number of matrices sharing it. The last of them to let go of it frees it.
+   */
+  struct matrix_share
+  {
+    std::atomic<size_t> refs;
+    void *data;
+    void *map;
+    size_t map_len;
+  };
+
   /**
    * The matrix class is essentially a wrapper around an array of type T which maintains row and column
    * information. Various matrix operations are defined. The work of actually multiplying two matrices
    * is done by the matrix_multiplier<T> field present in the class. This defaults to a 
-   * strassen::strassen_matrix_multiplier<T> unless specified otherwise.
+   * strassen::adaptive_matrix_multiplier<T>, which picks an algorithm for each product, unless specified
+   * otherwise.
+   *
+   * The multiplier is chosen at run time in a matrix<T>. A matrix<T, M> instead binds it to the concrete
+   * multiplier class M at compile time, for example matrix<double, transpose_matrix_multiplier<double> >:
+   * the multiplier is part of the matrix rather than allocated for it, and is called without virtual
+   * dispatch, which counts for small matrices made and multiplied in large numbers. See multiplier_binding.
+   *
+   * The data is row-major unless the matrix says otherwise: transpose () exchanges the dimensions and the
+   * layout without moving anything, and the multipliers are told the layout of each operand, so transposed
+   * and column-major operands are multiplied without being rearranged first where the algorithm allows.
+   *
+   * A matrix counts its modifications, so that products kept up to date with it, such as a maintained_product,
+   * can tell which rows have changed since they last looked. Elements written through at () or () mark their
+   * row, and operations on the whole matrix mark all of it; writes through data () are not seen, and should
+   * be reported with touch ().
+   *
+   * Copies share their data until one of them writes to it: copying a matrix, or assigning one, costs a
+   * reference count rather than a copy of the data, and the first write through at (), (), data () or an
+   * operation on the whole matrix takes a copy of its own. A pointer from data () is good for writing only
+   * until the matrix is next copied. Matrices can also be moved, which leaves the source empty. If memory for
+   * the copy runs out, shared data is never written: at (), () and data () throw std::bad_alloc, and the
+   * operations on the whole matrix leave it as it was.
    */
-  template <typename T>
+  template <typename T, typename M = matrix_multiplier<T> >
   class matrix
   {
     friend class iterator;
@@ -26,9 +70,23 @@ namespace strassen
     size_t _rows;   /* Number of rows in our matrix */
     size_t _cols;   /* Number of columns in our matrix */
     T *__matrix;    /* Our actual matrix data */
+    matrix_layout __layout;
+    void *__map;    /* If the data lives in a file mapping rather than malloc'd memory, the mapping */
+    size_t __map_len;
+    mutable std::atomic<matrix_share *> __shared;  /* The storage shared with copies of us, if it is */
+
+    uint64_t __version;                     /* Modifications so far */
+    uint64_t __all_version;                 /* Version of the last modification of the whole matrix */
+    std::vector<uint64_t> __row_version;    /* Version of the last modification of each row, if since */
+
+    /* Records a modification of the whole matrix */
+    void __touch_all ();
 
     /* A matrix_multiplier performs one of several matrix multiplication algorithms */
-    strassen::matrix_multiplier<T> *__mm;
+    multiplier_binding<T, M> __mm;
+
+    /* Returns the position of the matrix element (i, j) in our data */
+    size_t __index (size_t i, size_t j) const;
 
     /* Returns a reference to the matrix element (i, j) */
     T& __at (size_t i, size_t j);
@@ -37,24 +95,41 @@ namespace strassen
     void __mult (T *a, size_t arows, size_t acols, T k);
 
     /* Adds the given matrix to this matrix */
-    void __add (T *A, size_t arows, size_t acols, const matrix<T> &b);
+    void __add (T *A, size_t arows, size_t acols, const matrix<T, M> &b);
 
     /* Subtracts the given matrix from this matrix */
-    void __sub (T *A, size_t arows, size_t acols, const matrix<T> &b);
+    void __sub (T *A, size_t arows, size_t acols, const matrix<T, M> &b);
     
     /* Determines equality */
-    bool __equal (const matrix<T> &m);
+    bool __equal (const matrix<T, M> &m);
+
+    /* Frees or unmaps our matrix data */
+    void __release ();
+
+    /* Lets go of our data, which is freed if nothing else shares it, without counting a modification */
+    void __drop ();
+
+    /* Shares the data of m, whose storage becomes shared if it was not */
+    void __share (const matrix<T, M> &m);
+
+    /* Takes a copy of our data of our own if it is shared, before it is written; false if memory runs out */
+    bool __unshare ();
 
   public:
     /* Declare a new, empty matrix */
-    matrix (matrix_multiplier<T> *mm = new strassen_matrix_multiplier<T> ());
+    matrix (typename multiplier_binding<T, M>::argument mm = multiplier_binding<T, M>::make ());
     /* Declare a new matrix with dimensions defined */
-    matrix (size_t h, size_t w, matrix_multiplier<T> *mm = new strassen_matrix_multiplier<T> ());
-    matrix (const matrix<T> &m);
+    matrix (size_t h, size_t w, typename multiplier_binding<T, M>::argument mm = multiplier_binding<T, M>::make ());
+    matrix (const matrix<T, M> &m);
+    matrix (matrix<T, M> &&m);
     ~matrix ();
 
     /* Clear the contents of this matrix */
     void clear ();
+    /* Discard the contents of this matrix and reallocate it with the given dimensions */
+    void resize (size_t rows, size_t cols);
+    /* Adopt a file mapping of len bytes at base, holding a rows x cols matrix at data, as our storage */
+    void map (void *base, size_t len, T *data, size_t rows, size_t cols, matrix_layout layout = ROW_MAJOR);
     /* Initialize this matrix to zero */
     void zeroes ();
     /* Initialize this matrix with random numbers bounded by the parameter; max = 0 means no bound */
@@ -62,35 +137,67 @@ namespace strassen
 
     T& at (size_t i, size_t j);
     void mult (T k);
-    void mult (const matrix<T> &m);
-    void add (const matrix<T> &m);
-    void sub (const matrix<T> &m);
-    bool equal (const matrix<T> &m);
+    void mult (const matrix<T, M> &m);
+    /* Multiply by an operand prepared by prepare () on a matrix whose multiplier is of the same kind as ours */
+    void mult (const prepared_operand<T> &b);
+    /* Prepare this matrix, with our multiplier, as the second operand of repeated products; see mult_prepared () */
+    prepared_operand<T>* prepare () const;
+    void pow (size_t k, double tolerance = 0.0);
+    /* Become this this^T, computing only triangle t and mirroring it into the other or leaving that zero */
+    void syrk (matrix_triangle t = LOWER_TRIANGLE, bool mirror = false);
+    /* Writes y = this x, for x of cols () elements and y of rows (), on up to threads threads (0 for all) */
+    void mult_vector (const T *x, T *y, size_t threads = 0) const;
+    void add (const matrix<T, M> &m);
+    void sub (const matrix<T, M> &m);
+    bool equal (const matrix<T, M> &m);
 
     size_t rows () const;
     size_t cols () const;
+
+    /* The multiplier we multiply with */
+    M& multiplier () const;
+
+    /* The number of modifications so far */
+    uint64_t version () const;
+    /* Records a modification of count rows from row first, made through data () */
+    void touch (size_t first, size_t count = 1);
+    /* Whether the given row has been modified since version () returned version */
+    bool changed_since (size_t row, uint64_t version) const;
+    /* Whether the whole matrix, or its shape, has been modified since then */
+    bool all_changed_since (uint64_t version) const;
+
+    /* How our data is laid out in memory */
+    matrix_layout layout () const;
+    /* Become our own transpose, by exchanging the dimensions and the layout; no data is moved */
+    void transpose ();
+    /* Rearrange our data into the given layout, in place if we are square */
+    void relayout (matrix_layout layout);
+
     T* raw_data_copy () const;
+    T* data ();
+    const T* data () const;
 
     T& operator () (size_t i, size_t j);
-    matrix<T>& operator * (T k);
-    matrix<T>& operator * (const matrix<T> &m);
-    matrix<T>& operator + (const matrix<T> &m);
-    matrix<T>& operator - (const matrix<T> &m);
-    matrix<T>& operator = (const matrix<T> &m);
-    bool operator == (const matrix<T> &m);
-
-    /* Iterator class allows iteration over the internal matrix data structures */
+    matrix<T, M>& operator * (T k);
+    matrix<T, M>& operator * (const matrix<T, M> &m);
+    matrix<T, M>& operator + (const matrix<T, M> &m);
+    matrix<T, M>& operator - (const matrix<T, M> &m);
+    matrix<T, M>& operator = (const matrix<T, M> &m);
+    matrix<T, M>& operator = (matrix<T, M> &&m);
+    bool operator == (const matrix<T, M> &m);
+
+    /* Iterator over the elements of a matrix in row-major order, whatever the layout of its storage */
     class iterator
     {
     private:
-      T *__m;
+      const matrix<T, M> *__m;
       size_t __rows;
       size_t __cols;
       size_t __indx;
       size_t __n;
 
     public:
-      iterator (matrix<T> &m);
+      iterator (matrix<T, M> &m);
       ~iterator ();
 
       T val ();
@@ -101,69 +208,190 @@ namespace strassen
     };
   };
 
-  template <typename T>
-  matrix<T>::matrix (matrix_multiplier<T> *mm)
+  template <typename T, typename M>
+  matrix<T, M>::matrix (typename multiplier_binding<T, M>::argument mm)
     : _rows (0),
       _cols (0),
       __matrix (NULL),
+      __layout (ROW_MAJOR),
+      __map (NULL),
+      __map_len (0),
+      __shared (NULL),
+      __version (1),
+      __all_version (1),
       __mm (mm)
   {    
   }
   
-  template <typename T>
-  matrix<T>::matrix (size_t rows, size_t cols, matrix_multiplier<T> *mm)
+  template <typename T, typename M>
+  matrix<T, M>::matrix (size_t rows, size_t cols, typename multiplier_binding<T, M>::argument mm)
     : _rows (rows),
       _cols (cols),
+      __layout (ROW_MAJOR),
+      __map (NULL),
+      __map_len (0),
+      __shared (NULL),
+      __version (1),
+      __all_version (1),
       __mm (mm)
   {
-    __matrix = (T *) malloc (_rows * _cols * sizeof (T));
+    __matrix = (T *) aligned_malloc (_rows * _cols * sizeof (T));
   }
   
-  template <typename T>
-  matrix<T>::matrix (const matrix<T> &m)
+  template <typename T, typename M>
+  matrix<T, M>::matrix (const matrix<T, M> &m)
     : _rows (m.rows ()),
       _cols (m.cols ()),
-      __mm (m.__mm->copy ())
+      __matrix (NULL),
+      __layout (m.__layout),
+      __map (NULL),
+      __map_len (0),
+      __shared (NULL),
+      __version (1),
+      __all_version (1),
+      __mm (m.__mm)
+  {
+    __share (m);
+  }
+
+  /**
+   * Takes over the data and the multiplier of m, leaving it an empty matrix, which makes a multiplier again
+   * if it is used.
+   */
+  template <typename T, typename M>
+  matrix<T, M>::matrix (matrix<T, M> &&m)
+    : _rows (m._rows),
+      _cols (m._cols),
+      __matrix (m.__matrix),
+      __layout (m.__layout),
+      __map (m.__map),
+      __map_len (m.__map_len),
+      __shared (m.__shared.load ()),
+      __version (1),
+      __all_version (1),
+      __mm (std::move (m.__mm))
   {
-    __matrix = m.raw_data_copy ();
+    m._rows = 0;
+    m._cols = 0;
+    m.__matrix = NULL;
+    m.__layout = ROW_MAJOR;
+    m.__map = NULL;
+    m.__map_len = 0;
+    m.__shared = NULL;
+    m.__touch_all ();
   }
   
-  template <typename T>
-  matrix<T>::~matrix ()
+  template <typename T, typename M>
+  matrix<T, M>::~matrix ()
   {
-    if (__matrix)
-      {
-        free (__matrix);
-        __matrix = NULL;
-        delete __mm;
-      }
+    __release ();
   }
 
-  template <typename T>
+  template <typename T, typename M>
   void
-  matrix<T>::clear ()
+  matrix<T, M>::clear ()
   {
     if (__matrix)
       {
         _rows = 0;
         _cols = 0;
         
-        free (__matrix);
-        __matrix = NULL;
+        __release ();
       }
   }
 
-  template <typename T>
+  template <typename T, typename M>
+  void
+  matrix<T, M>::resize (size_t rows, size_t cols)
+  {
+    __release ();
+
+    _rows = rows;
+    _cols = cols;
+    __layout = ROW_MAJOR;
+    __matrix = (T *) aligned_malloc (_rows * _cols * sizeof (T));
+  }
+
+  /**
+   * Replaces our data with a matrix which lives in a region mapped by mmap. The matrix takes ownership
+   * of the mapping, and unmaps it when the data is released. The mapping should be private, so that
+   * modifications to the matrix do not find their way back into the file.
+   */
+  template <typename T, typename M>
+  void
+  matrix<T, M>::map (void *base, size_t len, T *data, size_t rows, size_t cols, matrix_layout layout)
+  {
+    __release ();
+
+    _rows = rows;
+    _cols = cols;
+    __layout = layout;
+    __matrix = data;
+    __map = base;
+    __map_len = len;
+  }
+
+  template <typename T, typename M>
   T&
-  matrix<T>::at (size_t i, size_t j)
+  matrix<T, M>::at (size_t i, size_t j)
   {
+    if (!__unshare ())
+      throw std::bad_alloc ();
+
+    touch (i);
     return (__at (i, j));
   }
 
-  template <typename T>
+  template <typename T, typename M>
+  uint64_t
+  matrix<T, M>::version () const
+  {
+    return __version;
+  }
+
+  template <typename T, typename M>
+  void
+  matrix<T, M>::touch (size_t first, size_t count)
+  {
+    /* The versions of the rows are dropped with a change of shape, which is a change of everything */
+    if (__row_version.size () != _rows)
+      __row_version.assign (_rows, 0);
+
+    ++__version;
+
+    for (size_t i = first; i < first + count && i < _rows; i++)
+      __row_version[i] = __version;
+  }
+
+  template <typename T, typename M>
+  bool
+  matrix<T, M>::changed_since (size_t row, uint64_t version) const
+  {
+    return (__all_version > version || (row < __row_version.size () && __row_version[row] > version));
+  }
+
+  template <typename T, typename M>
+  bool
+  matrix<T, M>::all_changed_since (uint64_t version) const
+  {
+    return (__all_version > version);
+  }
+
+  template <typename T, typename M>
+  void
+  matrix<T, M>::__touch_all ()
+  {
+    __all_version = ++__version;
+  }
+
+  template <typename T, typename M>
   void
-  matrix<T>::zeroes ()
+  matrix<T, M>::zeroes ()
   {
+    if (!__unshare ())
+      return;
+
+    __touch_all ();
     memset (__matrix, 0, _rows * _cols * sizeof (T));
   }
 
@@ -171,12 +399,16 @@ namespace strassen
    * Initialize this matrix to random values. Values are bounded by the max parameter
    * unless it is zero, in which case they are not bounded.
    */
-  template <typename T>
+  template <typename T, typename M>
   void
-  matrix<T>::random (uint32_t max)
+  matrix<T, M>::random (uint32_t max)
   {
     size_t n = _rows * _cols;
 
+    if (!__unshare ())
+      return;
+
+    __touch_all ();
     srand (time (NULL));
 
     if (!max)
@@ -191,36 +423,112 @@ namespace strassen
       }
   }
 
-  template <typename T>
+  template <typename T, typename M>
   size_t
-  matrix<T>::rows () const
+  matrix<T, M>::rows () const
   {
     return _rows;
   }
 
-  template <typename T>
+  template <typename T, typename M>
   size_t
-  matrix<T>::cols () const
+  matrix<T, M>::cols () const
   {
     return _cols;
   }
 
+  template <typename T, typename M>
+  M&
+  matrix<T, M>::multiplier () const
+  {
+    return __mm.get ();
+  }
+
+  template <typename T, typename M>
+  matrix_layout
+  matrix<T, M>::layout () const
+  {
+    return __layout;
+  }
+
+  template <typename T, typename M>
+  void
+  matrix<T, M>::transpose ()
+  {
+    size_t rows = _rows;
+
+    __touch_all ();
+
+    _rows = _cols;
+    _cols = rows;
+    __layout = other_layout (__layout);
+  }
+
+  template <typename T, typename M>
+  void
+  matrix<T, M>::relayout (matrix_layout layout)
+  {
+    if (layout == __layout || !__matrix)
+      return;
+
+    /* Row-major data of one shape is column-major data of the transposed shape */
+    size_t rows = (__layout == ROW_MAJOR) ? _rows : _cols;
+    size_t cols = (__layout == ROW_MAJOR) ? _cols : _rows;
+
+    if (!__unshare ())
+      return;
+
+    if (rows == cols && !__map)
+      transpose_in_place (__matrix, rows);
+    else
+      {
+        T *t = (T *) aligned_malloc (_rows * _cols * sizeof (T));
+
+        if (!t)
+          return;
+
+        transpose_blocked (__matrix, t, rows, cols);
+
+        __release ();
+        __matrix = t;
+      }
+
+    __layout = layout;
+  }
+
   /**
    * Return a new array containing a copy of the data in our matrix.
    */
-  template <typename T>
+  template <typename T, typename M>
   T*
-  matrix<T>::raw_data_copy () const
+  matrix<T, M>::raw_data_copy () const
   {
-    T *t = (T *) malloc (_rows * _cols * sizeof (T));
+    T *t = (T *) aligned_malloc (_rows * _cols * sizeof (T));
     memcpy (t, __matrix, (_rows * _cols * sizeof (T)));
 
     return t;
   }
 
-  template <typename T>
+  template <typename T, typename M>
+  T*
+  matrix<T, M>::data ()
+  {
+    if (!__unshare ())
+      throw std::bad_alloc ();
+
+    return __matrix;
+  }
+
+  template <typename T, typename M>
+  const T*
+  matrix<T, M>::data () const
+  {
+    return __matrix;
+  }
+
+  template <typename T, typename M>
   void
-  matrix<T>::mult (T k)
+  matrix<T, M>::mult (T k)
   {
     __mult (__matrix, _rows, _cols, k);
   }
@@ -231,160 +539,389 @@ namespace strassen
    * Given another matrix m, use the __mm object to multiply this matrix by m. Depending on 
    * how this object was constructed, it may perform one of naive, transpose-naive, strassen, or
    * parallel-strassen multiplication algorithms. Returns a new array of type T. If the return
-   * is NULL, something went wrong so nothing will be changed.
+   * is NULL, something went wrong so nothing will be changed. The product is row-major.
    */
-  template <typename T>
+  template <typename T, typename M>
   void
-  matrix<T>::mult (const matrix<T> &m)
+  matrix<T, M>::mult (const matrix<T, M> &m)
   { 
-    T *C = __mm -> mult (__matrix, m.__matrix, _rows, _cols, m.rows (), m.cols ());
+    size_t cols = m.cols ();
+    T *C = ((__layout == ROW_MAJOR && m.__layout == ROW_MAJOR)
+            ? __mm.mult (__matrix, m.__matrix, _rows, _cols, m.rows (), cols)
+            : __mm.mult_layout (__matrix, __layout, m.__matrix, m.__layout, _rows, _cols, m.rows (), cols));
 
     if (C)
       {
-        free (__matrix);
+        __release ();
         
         __matrix = C; 
+        _cols = cols;
+        __layout = ROW_MAJOR;
+      }
+  }
+
+  /**
+   * Multiplication by a prepared operand. Our data is laid out by rows first if it is column-major, since
+   * prepared products take their first operand by rows.
+   */
+  template <typename T, typename M>
+  void
+  matrix<T, M>::mult (const prepared_operand<T> &b)
+  {
+    if (_cols != b.rows ())
+      return;
+
+    T *A = NULL;
+
+    if (__layout == COLUMN_MAJOR)
+      {
+        A = (T *) aligned_malloc (_rows * _cols * sizeof (T));
+
+        if (!A)
+          return;
+
+        transpose_blocked (__matrix, A, _cols, _rows);
+      }
+
+    T *C = __mm.mult_prepared (A ? A : __matrix, b, _rows);
+
+    free (A);
+
+    if (C)
+      {
+        __release ();
+
+        __matrix = C;
+        _cols = b.cols ();
+        __layout = ROW_MAJOR;
+      }
+  }
+
+  template <typename T, typename M>
+  prepared_operand<T>*
+  matrix<T, M>::prepare () const
+  {
+    if (__layout == ROW_MAJOR)
+      return (__mm.prepare (__matrix, _rows, _cols));
+
+    T *B = (T *) aligned_malloc (_rows * _cols * sizeof (T));
+
+    if (!B)
+      return NULL;
+
+    transpose_blocked (__matrix, B, _cols, _rows);
+
+    prepared_operand<T> *p = __mm.prepare (B, _rows, _cols);
+
+    free (B);
+
+    return p;
+  }
+
+  /**
+   * Matrix-vector product. It goes straight to the skinny kernels in our own layout, without a multiplier,
+   * a padded copy or an allocation, since nothing about it is worth choosing.
+   */
+  template <typename T, typename M>
+  void
+  matrix<T, M>::mult_vector (const T *x, T *y, size_t threads) const
+  {
+    skinny_matrix_multiplier<T>::gemv (__matrix, __layout, x, y, _rows, _cols, threads);
+  }
+
+  /**
+   * Symmetric rank-k product with our own transpose, through the multiplier's syrk (). It reads rows, so
+   * column-major data is laid out by rows first. As with mult (), nothing is changed if the return of the
+   * multiplier is NULL.
+   */
+  template <typename T, typename M>
+  void
+  matrix<T, M>::syrk (matrix_triangle t, bool mirror)
+  {
+    T *A = NULL;
+
+    if (__layout == COLUMN_MAJOR)
+      {
+        A = (T *) aligned_malloc (_rows * _cols * sizeof (T));
+
+        if (!A)
+          return;
+
+        transpose_blocked (__matrix, A, _cols, _rows);
+      }
+
+    T *C = __mm.syrk (A ? A : __matrix, _rows, _cols, t, mirror);
+
+    free (A);
+
+    if (C)
+      {
+        __release ();
+
+        __matrix = C;
         _cols = _rows;
+        __layout = ROW_MAJOR;
+      }
+  }
+
+  /**
+   * Raises this square matrix to the power k by repeated squaring. If tolerance is positive, stops early once
+   * successive squares differ by no more than tolerance in any element, taking the last as the result. As
+   * with mult (), nothing is changed if the return of the multiplier is NULL. Column-major data is the
+   * row-major transpose, whose powers are the transposed powers, so it is used as it is and stays
+   * column-major.
+   */
+  template <typename T, typename M>
+  void
+  matrix<T, M>::pow (size_t k, double tolerance)
+  {
+    if (_rows != _cols)
+      return;
+
+    T *C = __mm.pow (__matrix, _rows, k, tolerance);
+
+    if (C)
+      {
+        __release ();
+
+        __matrix = C;
       }
   }
 
-  template <typename T>
+  template <typename T, typename M>
   void
-  matrix<T>::add (const matrix<T> &m)
+  matrix<T, M>::add (const matrix<T, M> &m)
   {
     __add (__matrix, _rows, _cols, m);
   }
 
-  template <typename T>
+  template <typename T, typename M>
   void
-  matrix<T>::sub (const matrix<T> &m)
+  matrix<T, M>::sub (const matrix<T, M> &m)
   {
     __sub (__matrix, _rows, _cols, m);
   }
 
-  template <typename T>
+  template <typename T, typename M>
   bool
-  matrix<T>::equal (const matrix<T> &m)
+  matrix<T, M>::equal (const matrix<T, M> &m)
   {
     return (__equal (m));
   }
 
-  template <typename T>
+  template <typename T, typename M>
   T&
-  matrix<T>::operator () (size_t i, size_t j)
+  matrix<T, M>::operator () (size_t i, size_t j)
   {
+    if (!__unshare ())
+      throw std::bad_alloc ();
+
+    touch (i);
     return (__at (i , j));
   }
 
-  template <typename T>
-  matrix<T>&
-  matrix<T>::operator * (T k)
+  template <typename T, typename M>
+  matrix<T, M>&
+  matrix<T, M>::operator * (T k)
   {
     __mult (__matrix, _rows, _cols, k);
     return (*this);
   }
 
-  template <typename T>
-  matrix<T>&
-  matrix<T>::operator * (const matrix<T> &m)
+  template <typename T, typename M>
+  matrix<T, M>&
+  matrix<T, M>::operator * (const matrix<T, M> &m)
   {
     mult (m);
     return (*this);
   }
 
-  template <typename T>
-  matrix<T>&
-  matrix<T>::operator + (const matrix<T> &m)
+  template <typename T, typename M>
+  matrix<T, M>&
+  matrix<T, M>::operator + (const matrix<T, M> &m)
   {
     __add (__matrix, _rows, _cols, m);
     return (*this);
   }
   
-  template <typename T>
-  matrix<T>&
-  matrix<T>::operator - (const matrix<T> &m)
+  template <typename T, typename M>
+  matrix<T, M>&
+  matrix<T, M>::operator - (const matrix<T, M> &m)
   {
     __sub (__matrix, _rows, _cols, m);
     return (*this);
   }
   
-  template <typename T>
-  matrix<T>&
-  matrix<T>::operator = (const matrix<T> &m)
+  template <typename T, typename M>
+  matrix<T, M>&
+  matrix<T, M>::operator = (const matrix<T, M> &m)
   {
-    if (__matrix)
-      free (__matrix);
+    if (this == &m)
+      return (*this);
+
+    __release ();
 
     _rows = m.rows ();
     _cols = m.cols ();
-    __matrix = m.raw_data_copy ();
+    __layout = m.__layout;
+    __share (m);
+
+    return (*this);
+  }
+
+  /**
+   * Takes over the data of m, leaving it empty. Our multiplier is kept, as it is by copy assignment.
+   */
+  template <typename T, typename M>
+  matrix<T, M>&
+  matrix<T, M>::operator = (matrix<T, M> &&m)
+  {
+    if (this == &m)
+      return (*this);
+
+    __release ();
+
+    _rows = m._rows;
+    _cols = m._cols;
+    __matrix = m.__matrix;
+    __layout = m.__layout;
+    __map = m.__map;
+    __map_len = m.__map_len;
+    __shared = m.__shared.load ();
+
+    m._rows = 0;
+    m._cols = 0;
+    m.__matrix = NULL;
+    m.__layout = ROW_MAJOR;
+    m.__map = NULL;
+    m.__map_len = 0;
+    m.__shared = NULL;
+    m.__touch_all ();
 
     return (*this);
   }
 
-  template <typename T>
+  template <typename T, typename M>
   bool
-  matrix<T>::operator == (const matrix<T> &m)
+  matrix<T, M>::operator == (const matrix<T, M> &m)
   {
     return (__equal (m));
   }
 
-  template <typename T>
+  template <typename T, typename M>
   T&
-  matrix<T>::__at (size_t i, size_t j)
+  matrix<T, M>::__at (size_t i, size_t j)
   {
-    return (__matrix[(i * _cols) + j]);
+    return (__matrix[__index (i, j)]);
   }
 
-  template <typename T>
+  template <typename T, typename M>
+  size_t
+  matrix<T, M>::__index (size_t i, size_t j) const
+  {
+    return ((__layout == ROW_MAJOR) ? (i * _cols) + j : (j * _rows) + i);
+  }
+
+  template <typename T, typename M>
   void
-  matrix<T>::__mult (T *A, size_t arows, size_t acols, T k)
+  matrix<T, M>::__mult (T *A, size_t arows, size_t acols, T k)
   {
     size_t n = arows * acols;
+
+    if (!__unshare ())
+      return;
+
+    __touch_all ();
     
     for (size_t i = 0; i < n; i++)
-      A[i] = A[i] * k;
+      __matrix[i] = A[i] * k;
   }
 
-  template <typename T>
+  template <typename T, typename M>
   void
-  matrix<T>::__add (T *A, size_t arows, size_t acols, const matrix<T> &b)
+  matrix<T, M>::__add (T *A, size_t arows, size_t acols, const matrix<T, M> &b)
   {
     if (_rows == b.rows () && _cols == b.cols ())
       {
+        if (!__unshare ())
+          return;
+
+        __touch_all ();
+
         size_t n = _rows * _cols;
         T *B = b.__matrix;
 
-        for (size_t i = 0; i < n; i++)
-          __matrix[i] = A[i] + B[i];
+        if (__layout == b.__layout)
+          {
+            for (size_t i = 0; i < n; i++)
+              __matrix[i] = A[i] + B[i];
+          }
+        else
+          {
+            for (size_t i = 0; i < _rows; i++)
+              {
+                for (size_t j = 0; j < _cols; j++)
+                  __matrix[__index (i, j)] = A[__index (i, j)] + B[b.__index (i, j)];
+              }
+          }
       }
     //else throw exception
   }
 
-  template <typename T>
+  template <typename T, typename M>
   void
-  matrix<T>::__sub (T *A, size_t arows, size_t acols, const matrix<T> &b)
+  matrix<T, M>::__sub (T *A, size_t arows, size_t acols, const matrix<T, M> &b)
   {
     if (_rows == b.rows () && _cols == b.cols ())
       {
+        if (!__unshare ())
+          return;
+
+        __touch_all ();
+
         size_t n = _rows * _cols;
         T *B = b.__matrix;
 
-        for (size_t i = 0; i < n; i++)
-          __matrix[i] = A[i] - B[i];
+        if (__layout == b.__layout)
+          {
+            for (size_t i = 0; i < n; i++)
+              __matrix[i] = A[i] - B[i];
+          }
+        else
+          {
+            for (size_t i = 0; i < _rows; i++)
+              {
+                for (size_t j = 0; j < _cols; j++)
+                  __matrix[__index (i, j)] = A[__index (i, j)] - B[b.__index (i, j)];
+              }
+          }
       }
     //else throw exception
   }
 
-  template <typename T>
+  template <typename T, typename M>
   bool
-  matrix<T>::__equal (const matrix<T> &m)
+  matrix<T, M>::__equal (const matrix<T, M> &m)
   {
     if (_rows == m.rows () && _cols == m.cols ())
       {
         size_t n = _rows * _cols;
         T *B = m.__matrix;
 
+        if (__layout != m.__layout)
+          {
+            for (size_t i = 0; i < _rows; i++)
+              {
+                for (size_t j = 0; j < _cols; j++)
+                  {
+                    if (__matrix[__index (i, j)] != B[m.__index (i, j)])
+                      return false;
+                  }
+              }
+
+            return true;
+          }
+
         for (size_t i = 0; i < n; i++)	  
           {
             if (__matrix[i] != B[i])
@@ -399,9 +936,123 @@ namespace strassen
       return false;
   }
 
-  template <typename T>
-  matrix<T>::iterator::iterator (matrix<T> &m)
-    : __m (m.__matrix),
+  template <typename T, typename M>
+  void
+  matrix<T, M>::__release ()
+  {
+    /* Whatever replaces the data is a modification of all of it */
+    __touch_all ();
+    __drop ();
+  }
+
+  template <typename T, typename M>
+  void
+  matrix<T, M>::__drop ()
+  {
+    matrix_share *s = __shared.load ();
+
+    if (s)
+      {
+        if (s->refs.fetch_sub (1) == 1)
+          {
+            if (s->map)
+              munmap (s->map, s->map_len);
+            else
+              free (s->data);
+
+            delete s;
+          }
+
+        __shared = NULL;
+      }
+    else if (__map)
+      munmap (__map, __map_len);
+    else if (__matrix)
+      free (__matrix);
+
+    __matrix = NULL;
+    __map = NULL;
+    __map_len = 0;
+  }
+
+  /**
+   * The storage of m is handed to a matrix_share the first time it is copied, which m and its copies then
+   * point to. The share is installed with a compare and exchange, so that a matrix can be copied from
+   * several threads at once, as any other const operation.
+   */
+  template <typename T, typename M>
+  void
+  matrix<T, M>::__share (const matrix<T, M> &m)
+  {
+    if (!m.__matrix)
+      return;
+
+    matrix_share *s = m.__shared.load ();
+
+    if (!s)
+      {
+        matrix_share *n = new matrix_share;
+
+        n->refs = 1;
+        n->data = m.__map ? NULL : m.__matrix;
+        n->map = m.__map;
+        n->map_len = m.__map_len;
+
+        if (m.__shared.compare_exchange_strong (s, n))
+          s = n;
+        else
+          delete n;
+      }
+
+    ++s->refs;
+
+    __shared = s;
+    __matrix = m.__matrix;
+    __map = m.__map;
+    __map_len = m.__map_len;
+  }
+
+  /**
+   * If the data is shared and another matrix still holds it, we copy it and let go of the share; if we are
+   * the last, the storage is ours alone again and nothing is copied. Should the copy fail, the data stays
+   * shared and false is returned; the write must then not be made, or the other copies would see it. Writes
+   * through references and pointers, which cannot be refused, throw std::bad_alloc instead.
+   */
+  template <typename T, typename M>
+  bool
+  matrix<T, M>::__unshare ()
+  {
+    matrix_share *s = __shared.load ();
+
+    if (!s)
+      return true;
+
+    if (s->refs.load () == 1)
+      {
+        __shared = NULL;
+        delete s;
+        return true;
+      }
+
+    T *t = (T *) aligned_malloc (_rows * _cols * sizeof (T));
+
+    if (!t)
+      {
+        fprintf (stderr, "matrix: out of memory copying shared data\n");
+        return false;
+      }
+
+    memcpy (t, __matrix, _rows * _cols * sizeof (T));
+
+    __drop ();
+    __matrix = t;
+
+    return true;
+  }
+
+  template <typename T, typename M>
+  matrix<T, M>::iterator::iterator (matrix<T, M> &m)
+    : __m (&m),
       __rows (m.rows ()),
       __cols (m.cols ()),
       __indx (0)
@@ -409,42 +1060,42 @@ namespace strassen
     __n = __rows * __cols;
   }
 
-  template <typename T>
-  matrix<T>::iterator::~iterator ()
+  template <typename T, typename M>
+  matrix<T, M>::iterator::~iterator ()
   {    
   }
 
-  template <typename T>
+  template <typename T, typename M>
   T
-  matrix<T>::iterator::val ()
+  matrix<T, M>::iterator::val ()
   {
-    return (__m[__indx]);
+    return (__m->__matrix[__m->__index (row (), col ())]);
   }
 
-  template <typename T>
+  template <typename T, typename M>
   size_t
-  matrix<T>::iterator::row ()
+  matrix<T, M>::iterator::row ()
   {
-    return (__indx / __rows);
+    return (__indx / __cols);
   }
 
-  template <typename T>
+  template <typename T, typename M>
   size_t
-  matrix<T>::iterator::col ()
+  matrix<T, M>::iterator::col ()
   {
     return (__indx % __cols);
   }
 
-  template <typename T>
+  template <typename T, typename M>
   bool
-  matrix<T>::iterator::ok ()
+  matrix<T, M>::iterator::ok ()
   {
     return (__indx < __n);
   }
 
-  template <typename T>
+  template <typename T, typename M>
   void
-  matrix<T>::iterator::operator ++ ()
+  matrix<T, M>::iterator::operator ++ ()
   {
     ++__indx;
   }
@@ -0,0 +1,358 @@
+#ifndef MATRIX_CHAIN_HPP_
+#define MATRIX_CHAIN_HPP_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "allocator.hpp"
+#include "mem_account.hpp"
+#include "matrix.hpp"
+#include "adaptive_matrix_multiplier.hpp"
+
+namespace strassen
+{
+  /**
+   * The order in which to evaluate a chain of products A1 A2 ... An, where Ai is dims[i-1] x dims[i].
+   * split[i][j] is the index s at which the product of Ai+1 .. Aj+1 (counting from zero, i < j) is divided
+   * into (Ai+1 .. As+1) (As+2 .. Aj+1).
+   */
+  struct chain_plan
+  {
+    std::vector<size_t> dims;
+    std::vector<std::vector<size_t> > split;
+    double estimate;        /* Predicted time of the whole chain in this order, in seconds */
+    double left_to_right;   /* Predicted time of evaluating it from left to right */
+
+    /* The order as a parenthesized expression, such as ((A1(A2A3))A4) */
+    std::string
+    order () const
+    {
+      return (split.empty () ? std::string () : __order (0, dims.size () - 2));
+    }
+
+  private:
+    std::string
+    __order (size_t i, size_t j) const
+    {
+      if (i == j)
+        return ("A" + std::to_string (i + 1));
+
+      return ("(" + __order (i, split[i][j]) + __order (split[i][j] + 1, j) + ")");
+    }
+  };
+
+  /**
+   * A matrix_chain_multiplier evaluates a product of several matrices of compatible shapes in the order which
+   * is cheapest according to the adaptive multiplier's cost model. Since that model knows the calibrated rates
+   * of the kernels and the padding Strassen needs to reach a power of 2, the chosen order can differ from the
+   * one minimizing multiply-adds: a product just above a power of 2 is priced as the padded product it is.
+   *
+   * The usual dynamic program finds the order. Products whose operands are both intermediate results do not
+   * depend on each other, and are evaluated on separate threads, up to the given number at once. Each
+   * intermediate result is released as soon as the product consuming it is done, and the operand with the
+   * larger result is evaluated first, so that the smaller one is what waits in memory while the other is
+   * computed. All of the memory is allocated through one mem_account, whose usage () covers the whole chain.
+   */
+  template <typename T>
+  class matrix_chain_multiplier
+  {
+  private:
+    mem_account __account;
+    adaptive_matrix_multiplier<T> __amm;
+    size_t __threads;
+    std::atomic<size_t> __running;
+
+    struct task
+    {
+      matrix_chain_multiplier<T> *chain;
+      const chain_plan *plan;
+      const std::vector<const T *> *ops;
+      adaptive_matrix_multiplier<T> *amm;
+      size_t i;
+      size_t j;
+      T *result;
+    };
+
+    static void* __run (void *arg);
+
+    T* __eval (const chain_plan &p, const std::vector<const T *> &ops, adaptive_matrix_multiplier<T> *amm,
+               size_t i, size_t j);
+
+    matrix_chain_multiplier (const matrix_chain_multiplier<T> &m);
+    matrix_chain_multiplier<T>& operator = (const matrix_chain_multiplier<T> &m);
+
+  public:
+    /* Evaluate up to threads products at once; 0 means one per processor */
+    matrix_chain_multiplier (size_t threads = 0);
+
+    /* The cheapest order for a chain of matrices with the given dimensions */
+    static chain_plan plan (const std::vector<size_t> &dims);
+
+    /* Predicted time of an m x k by k x n product */
+    static double cost (size_t m, size_t k, size_t n);
+
+    /**
+     * Multiplies ops[0] ops[1] ... in the cheapest order, where ops[i] is dims[i] x dims[i+1]. Returns a new
+     * dims.front () x dims.back () array, to be released with free (), or NULL if the dimensions do not
+     * describe the operands or an allocation fails.
+     */
+    T* mult (const std::vector<const T *> &ops, const std::vector<size_t> &dims);
+    template <typename M>
+    T* mult (const std::vector<const matrix<T, M> *> &ms);
+
+    /* Memory usage of the most recent chain */
+    const mem_account& usage () const;
+  };
+
+  template <typename T>
+  matrix_chain_multiplier<T>::matrix_chain_multiplier (size_t threads)
+    : __threads (threads ? threads : adaptive_matrix_multiplier<T>::model ().cpus),
+      __running (1)
+  {
+    __amm.account (&__account);
+  }
+
+  template <typename T>
+  double
+  matrix_chain_multiplier<T>::cost (size_t m, size_t k, size_t n)
+  {
+    return (adaptive_matrix_multiplier<T>::decide (m, k, n).estimate);
+  }
+
+  template <typename T>
+  chain_plan
+  matrix_chain_multiplier<T>::plan (const std::vector<size_t> &dims)
+  {
+    chain_plan p;
+    p.dims = dims;
+    p.estimate = 0.0;
+    p.left_to_right = 0.0;
+
+    if (dims.size () < 2)
+      return p;
+
+    size_t n = dims.size () - 1;
+    std::vector<std::vector<double> > best (n, std::vector<double> (n, 0.0));
+
+    p.split.assign (n, std::vector<size_t> (n, 0));
+
+    for (size_t len = 2; len <= n; len++)
+      {
+        for (size_t i = 0; i + len <= n; i++)
+          {
+            size_t j = i + len - 1;
+
+            for (size_t s = i; s < j; s++)
+              {
+                double t = best[i][s] + best[s + 1][j] + cost (dims[i], dims[s + 1], dims[j + 1]);
+
+                if (s == i || t < best[i][j])
+                  {
+                    best[i][j] = t;
+                    p.split[i][j] = s;
+                  }
+              }
+          }
+      }
+
+    p.estimate = best[0][n - 1];
+
+    for (size_t j = 1; j < n; j++)
+      p.left_to_right += cost (dims[0], dims[j], dims[j + 1]);
+
+    return p;
+  }
+
+  template <typename T>
+  T*
+  matrix_chain_multiplier<T>::mult (const std::vector<const T *> &ops, const std::vector<size_t> &dims)
+  {
+    if (ops.empty () || dims.size () != ops.size () + 1)
+      {
+        fprintf (stderr, "matrix_chain_multiplier: %lu operands but %lu dimensions\n", ops.size (), dims.size ());
+        return NULL;
+      }
+
+    __account.reset ();
+
+    if (ops.size () == 1)
+      {
+        T *C = (T *) __account.alloc (dims[0] * dims[1] * sizeof (T));
+
+        if (C)
+          memcpy (C, ops[0], dims[0] * dims[1] * sizeof (T));
+
+        return C;
+      }
+
+    chain_plan p = plan (dims);
+
+    __running = 1;
+
+    return (__eval (p, ops, &__amm, 0, ops.size () - 1));
+  }
+
+  template <typename T>
+  template <typename M>
+  T*
+  matrix_chain_multiplier<T>::mult (const std::vector<const matrix<T, M> *> &ms)
+  {
+    std::vector<const T *> ops;
+    std::vector<size_t> dims;
+    std::vector<T *> copies;
+
+    for (size_t i = 0; i < ms.size (); i++)
+      {
+        if (i && ms[i]->rows () != ms[i - 1]->cols ())
+          {
+            fprintf (stderr, "matrix_chain_multiplier: operand %lu is %lux%lu, after one with %lu columns\n",
+                     i, ms[i]->rows (), ms[i]->cols (), ms[i - 1]->cols ());
+            break;
+          }
+
+        if (!i)
+          dims.push_back (ms[i]->rows ());
+
+        dims.push_back (ms[i]->cols ());
+
+        /* The products are formed from row-major operands */
+        if (ms[i]->layout () == COLUMN_MAJOR)
+          {
+            T *t = (T *) aligned_malloc (ms[i]->rows () * ms[i]->cols () * sizeof (T));
+
+            if (!t)
+              break;
+
+            transpose_blocked (ms[i]->data (), t, ms[i]->cols (), ms[i]->rows ());
+            copies.push_back (t);
+            ops.push_back (t);
+          }
+        else
+          ops.push_back (ms[i]->data ());
+      }
+
+    /* Stopped early by a mismatch or a failed allocation */
+    T *C = (ops.size () == ms.size ()) ? mult (ops, dims) : NULL;
+
+    for (size_t i = 0; i < copies.size (); i++)
+      free (copies[i]);
+
+    return C;
+  }
+
+  template <typename T>
+  const mem_account&
+  matrix_chain_multiplier<T>::usage () const
+  {
+    return __account;
+  }
+
+  template <typename T>
+  void*
+  matrix_chain_multiplier<T>::__run (void *arg)
+  {
+    task *t = (task *) arg;
+    t->result = t->chain->__eval (*t->plan, *t->ops, t->amm, t->i, t->j);
+
+    return NULL;
+  }
+
+  /**
+   * Evaluates the product of operands i .. j. If both halves are products themselves and a thread is free, the
+   * half with the larger result is evaluated on a new thread, with its own multiplier, while this thread does
+   * the other; otherwise they are evaluated in turn, that half first.
+   */
+  template <typename T>
+  T*
+  matrix_chain_multiplier<T>::__eval (const chain_plan &p, const std::vector<const T *> &ops,
+                                      adaptive_matrix_multiplier<T> *amm, size_t i, size_t j)
+  {
+    if (i == j)
+      return ((T *) ops[i]);
+
+    const std::vector<size_t> &d = p.dims;
+    size_t s = p.split[i][j];
+    bool left_first = (d[i] * d[s + 1] >= d[s + 1] * d[j + 1]);
+
+    T *L = NULL;
+    T *R = NULL;
+
+    if (s > i && s + 1 < j && __running.fetch_add (1) < __threads)
+      {
+        adaptive_matrix_multiplier<T> sub;
+        sub.account (&__account);
+
+        task t = { this, &p, &ops, &sub, 0, 0, NULL };
+        pthread_t thread;
+
+        if (left_first)
+          {
+            t.i = i;
+            t.j = s;
+          }
+        else
+          {
+            t.i = s + 1;
+            t.j = j;
+          }
+
+        bool spawned = !pthread_create (&thread, NULL, __run, &t);
+
+        if (!spawned)
+          {
+            perror ("matrix_chain_multiplier: pthread_create");
+            __run (&t);
+          }
+
+        if (left_first)
+          R = __eval (p, ops, amm, s + 1, j);
+        else
+          L = __eval (p, ops, amm, i, s);
+
+        if (spawned)
+          pthread_join (thread, NULL);
+
+        if (left_first)
+          L = t.result;
+        else
+          R = t.result;
+
+        --__running;
+      }
+    else
+      {
+        if (s > i && s + 1 < j)
+          --__running;
+
+        if (left_first)
+          {
+            L = __eval (p, ops, amm, i, s);
+            R = __eval (p, ops, amm, s + 1, j);
+          }
+        else
+          {
+            R = __eval (p, ops, amm, s + 1, j);
+            L = __eval (p, ops, amm, i, s);
+          }
+      }
+
+    T *C = (L && R) ? amm->mult (L, R, d[i], d[s + 1], d[s + 1], d[j + 1]) : NULL;
+
+    /* Intermediate results are ours to release; the operands are the caller's */
+    if (s > i)
+      __account.release (L);
+
+    if (s + 1 < j)
+      __account.release (R);
+
+    return C;
+  }
+}
+
+#endif /* MATRIX_CHAIN_HPP_ */
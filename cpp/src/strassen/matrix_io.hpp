@@ -0,0 +1,419 @@
+#ifndef MATRIX_IO_HPP_
+#define MATRIX_IO_HPP_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <charconv>
+#include <complex>
+#include <vector>
+
+#include "hash.hpp"
+#include "matrix.hpp"
+
+namespace strassen
+{
+  /**
+   * Binary matrix files consist of a MATRIX_FILE_HEADER_SIZE byte header followed by the matrix elements in
+   * native byte order. The header is exactly one cache line long, so a payload mapped straight from the file
+   * is cache-line aligned and can be used in place.
+   */
+  const char MATRIX_FILE_MAGIC[8] = { 'S', 'M', 'A', 'T', 'R', 'I', 'X', '\0' };
+  const uint32_t MATRIX_FILE_VERSION = 1;
+  const uint32_t MATRIX_FILE_ENDIAN = 0x01020304;
+  const size_t MATRIX_FILE_HEADER_SIZE = 64;
+
+  /* Element layouts */
+  const uint32_t MATRIX_FILE_ROW_MAJOR = 0;
+  const uint32_t MATRIX_FILE_COL_MAJOR = 1;
+
+  /* Header flags */
+  const uint32_t MATRIX_FILE_UNCHECKED = 0x1;  /* The checksum field is not maintained */
+
+  struct matrix_file_header
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t endian;      /* MATRIX_FILE_ENDIAN as written by the producer */
+    uint32_t type;        /* matrix_file_type<T>::code of the elements */
+    uint32_t elem_size;   /* sizeof (T) */
+    uint64_t rows;
+    uint64_t cols;
+    uint32_t layout;
+    uint32_t flags;
+    uint64_t checksum;    /* hash64 of the payload */
+    uint64_t reserved;
+  };
+
+  /**
+   * Identifies the element type of a matrix file. Types without a code of their own are stored as
+   * code 0 and only matched on element size.
+   */
+  template <typename T> struct matrix_file_type { static const uint32_t code = 0; };
+  template <> struct matrix_file_type<int8_t> { static const uint32_t code = 1; };
+  template <> struct matrix_file_type<uint8_t> { static const uint32_t code = 2; };
+  template <> struct matrix_file_type<int16_t> { static const uint32_t code = 3; };
+  template <> struct matrix_file_type<uint16_t> { static const uint32_t code = 4; };
+  template <> struct matrix_file_type<int32_t> { static const uint32_t code = 5; };
+  template <> struct matrix_file_type<uint32_t> { static const uint32_t code = 6; };
+  template <> struct matrix_file_type<int64_t> { static const uint32_t code = 7; };
+  template <> struct matrix_file_type<uint64_t> { static const uint32_t code = 8; };
+  template <> struct matrix_file_type<float> { static const uint32_t code = 9; };
+  template <> struct matrix_file_type<double> { static const uint32_t code = 10; };
+  template <> struct matrix_file_type<std::complex<float> > { static const uint32_t code = 11; };
+  template <> struct matrix_file_type<std::complex<double> > { static const uint32_t code = 12; };
+
+  /**
+   * Fills in a header for a rows x cols matrix of T. The checksum is left for the caller.
+   */
+  template <typename T>
+  void
+  matrix_file_init (matrix_file_header &h, size_t rows, size_t cols, uint32_t flags = 0)
+  {
+    memset (&h, 0, sizeof (h));
+    memcpy (h.magic, MATRIX_FILE_MAGIC, sizeof (h.magic));
+
+    h.version = MATRIX_FILE_VERSION;
+    h.endian = MATRIX_FILE_ENDIAN;
+    h.type = matrix_file_type<T>::code;
+    h.elem_size = sizeof (T);
+    h.rows = rows;
+    h.cols = cols;
+    h.layout = MATRIX_FILE_ROW_MAJOR;
+    h.flags = flags;
+  }
+
+  /**
+   * Reads the header of the open matrix file fd and checks that it holds a matrix of T which
+   * we are able to use. Returns false, with a message naming path, if not.
+   */
+  template <typename T>
+  bool
+  matrix_file_check (int fd, const char *path, matrix_file_header &h)
+  {
+    struct stat st;
+
+    if (pread (fd, &h, sizeof (h), 0) != sizeof (h) || memcmp (h.magic, MATRIX_FILE_MAGIC, sizeof (h.magic)))
+      {
+        fprintf (stderr, "matrix_io: %s is not a matrix file\n", path);
+        return false;
+      }
+
+    if (h.version != MATRIX_FILE_VERSION || h.endian != MATRIX_FILE_ENDIAN)
+      {
+        fprintf (stderr, "matrix_io: %s has unsupported version %u or byte order\n", path, h.version);
+        return false;
+      }
+
+    if (h.type != matrix_file_type<T>::code || h.elem_size != sizeof (T))
+      {
+        fprintf (stderr, "matrix_io: %s holds elements of type %u, size %u\n", path, h.type, h.elem_size);
+        return false;
+      }
+
+    if (h.layout != MATRIX_FILE_ROW_MAJOR && h.layout != MATRIX_FILE_COL_MAJOR)
+      {
+        fprintf (stderr, "matrix_io: %s has unsupported layout %u\n", path, h.layout);
+        return false;
+      }
+
+    if (fstat (fd, &st) || (uint64_t) st.st_size != MATRIX_FILE_HEADER_SIZE + (h.rows * h.cols * sizeof (T)))
+      {
+        fprintf (stderr, "matrix_io: %s is truncated\n", path);
+        return false;
+      }
+
+    return true;
+  }
+
+  /**
+   * Writes m to path in the binary matrix format, in the layout m has in memory.
+   */
+  template <typename T, typename M>
+  bool
+  save_binary (const matrix<T, M> &m, const char *path)
+  {
+    matrix_file_header h;
+    size_t len = m.rows () * m.cols () * sizeof (T);
+    const char *p = (const char *) m.data ();
+
+    matrix_file_init<T> (h, m.rows (), m.cols ());
+    h.layout = (m.layout () == COLUMN_MAJOR) ? MATRIX_FILE_COL_MAJOR : MATRIX_FILE_ROW_MAJOR;
+    h.checksum = hash64 (p, len);
+
+    int fd = open (path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0)
+      {
+        perror ("save_binary: open");
+        return false;
+      }
+
+    bool ok = (write (fd, &h, sizeof (h)) == sizeof (h));
+
+    while (ok && len)
+      {
+        ssize_t w = write (fd, p, len);
+
+        if (w <= 0)
+          ok = false;
+        else
+          {
+            p += w;
+            len -= w;
+          }
+      }
+
+    if (!ok)
+      perror ("save_binary: write");
+
+    close (fd);
+    return ok;
+  }
+
+  /**
+   * Loads the binary matrix file at path into m without copying it: the file is mapped privately and m uses
+   * the payload in place, so pages are read only as they are touched and modifications to m stay in memory.
+   * If verify is set the payload checksum is checked, which reads the whole file once.
+   */
+  template <typename T, typename M>
+  bool
+  load_binary (matrix<T, M> &m, const char *path, bool verify = true)
+  {
+    matrix_file_header h;
+    int fd = open (path, O_RDONLY);
+
+    if (fd < 0)
+      {
+        perror ("load_binary: open");
+        return false;
+      }
+
+    if (!matrix_file_check<T> (fd, path, h))
+      {
+        close (fd);
+        return false;
+      }
+
+    size_t payload = h.rows * h.cols * sizeof (T);
+    size_t len = MATRIX_FILE_HEADER_SIZE + payload;
+    void *base = mmap (NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+
+    close (fd);
+
+    if (base == MAP_FAILED)
+      {
+        perror ("load_binary: mmap");
+        return false;
+      }
+
+    T *data = (T *) ((char *) base + MATRIX_FILE_HEADER_SIZE);
+
+    if (verify && !(h.flags & MATRIX_FILE_UNCHECKED))
+      {
+        madvise (base, len, MADV_SEQUENTIAL);
+
+        if (hash64 (data, payload) != h.checksum)
+          {
+            fprintf (stderr, "load_binary: %s fails its checksum\n", path);
+            munmap (base, len);
+            return false;
+          }
+      }
+
+    m.map (base, len, data, h.rows, h.cols, (h.layout == MATRIX_FILE_COL_MAJOR) ? COLUMN_MAJOR : ROW_MAJOR);
+
+    return true;
+  }
+
+  /**
+   * Writes m to path as text, one row per line with elements separated by delim. Numbers are formatted
+   * with std::to_chars, which for floating point types gives the shortest text that reads back exactly.
+   */
+  template <typename T, typename M>
+  bool
+  save_text (const matrix<T, M> &m, const char *path, char delim = ',')
+  {
+    /* Flush whenever less than this much room is left in the buffer; longer than any formatted number */
+    const size_t slack = 128;
+    const size_t size = 1 << 16;
+
+    /* Allocated first, so that running out of memory leaves any existing file alone */
+    char *buf = (char *) malloc (size);
+
+    if (!buf)
+      {
+        perror ("save_text: malloc");
+        return false;
+      }
+
+    FILE *f = fopen (path, "w");
+
+    if (!f)
+      {
+        perror ("save_text: fopen");
+        free (buf);
+        return false;
+      }
+
+    size_t pos = 0;
+    size_t rows = m.rows ();
+    size_t cols = m.cols ();
+    const T *A = m.data ();
+
+    for (size_t i = 0; i < rows; i++)
+      {
+        for (size_t j = 0; j < cols; j++)
+          {
+            if (j)
+              buf[pos++] = delim;
+
+            size_t k = (m.layout () == ROW_MAJOR) ? (i * cols) + j : (j * rows) + i;
+            pos = std::to_chars (buf + pos, buf + size, A[k]).ptr - buf;
+
+            if (pos > size - slack)
+              {
+                fwrite (buf, 1, pos, f);
+                pos = 0;
+              }
+          }
+
+        buf[pos++] = '\n';
+      }
+
+    fwrite (buf, 1, pos, f);
+    free (buf);
+
+    bool ok = !ferror (f);
+
+    if (fclose (f) || !ok)
+      {
+        perror ("save_text: write");
+        return false;
+      }
+
+    return true;
+  }
+
+  /**
+   * Reads a text matrix from path into m, as written by save_text or a typical CSV dump. Elements are
+   * separated by delim and/or blanks, rows by newlines; blank lines are skipped and every row must have
+   * the same number of elements. The file is mapped rather than read, and parsed with std::from_chars.
+   */
+  template <typename T, typename M>
+  bool
+  load_text (matrix<T, M> &m, const char *path, char delim = ',')
+  {
+    struct stat st;
+    int fd = open (path, O_RDONLY);
+
+    if (fd < 0)
+      {
+        perror ("load_text: open");
+        return false;
+      }
+
+    if (fstat (fd, &st))
+      {
+        perror ("load_text: fstat");
+        close (fd);
+        return false;
+      }
+
+    size_t len = st.st_size;
+    std::vector<T> v;
+    size_t rows = 0;
+    size_t cols = 0;
+    size_t n = 0;
+    bool ok = true;
+
+    const char *base = NULL;
+
+    if (len)
+      {
+        base = (const char *) mmap (NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (base == MAP_FAILED)
+          {
+            perror ("load_text: mmap");
+            close (fd);
+            return false;
+          }
+
+        madvise ((void *) base, len, MADV_SEQUENTIAL);
+      }
+
+    close (fd);
+
+    const char *p = base;
+    const char *end = base + len;
+
+    while (ok && base && p <= end)
+      {
+        if (p == end || *p == '\n')
+          {
+            /* End of a row */
+            if (n)
+              {
+                if (!rows)
+                  {
+                    cols = n;
+
+                    /* Guess the total from the length of the first row */
+                    v.reserve ((len / (p - base + 1)) * cols + cols);
+                  }
+                else if (n != cols)
+                  {
+                    fprintf (stderr, "load_text: %s row %lu has %lu elements, expected %lu\n", path, rows + 1, n, cols);
+                    ok = false;
+                  }
+
+                ++rows;
+                n = 0;
+              }
+
+            ++p;
+          }
+        else if (*p == delim || *p == ' ' || *p == '\t' || *p == '\r')
+          {
+            ++p;
+          }
+        else
+          {
+            T t;
+            std::from_chars_result r = std::from_chars (p, end, t);
+
+            if (r.ec != std::errc ())
+              {
+                fprintf (stderr, "load_text: %s row %lu: bad element\n", path, rows + 1);
+                ok = false;
+              }
+
+            v.push_back (t);
+            p = r.ptr;
+            ++n;
+          }
+      }
+
+    if (base)
+      munmap ((void *) base, len);
+
+    if (ok)
+      {
+        m.resize (rows, cols);
+
+        if (!v.empty ())
+          memcpy (m.data (), &v[0], v.size () * sizeof (T));
+      }
+
+    return ok;
+  }
+}
+
+#endif /* MATRIX_IO_HPP_ */
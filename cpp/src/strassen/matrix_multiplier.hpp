@@ -1,20 +1,569 @@
 #ifndef MATRIX_MULTIPLIER_HPP_
 #define MATRIX_MULTIPLIER_HPP_
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <complex>
+
+#include "mem_account.hpp"
+#include "transpose.hpp"
+
 namespace strassen
 {
+  /* Which half of a symmetric result to compute */
+  enum matrix_triangle
+  {
+    LOWER_TRIANGLE = 0,
+    UPPER_TRIANGLE
+  };
+
+  /* Rows of A below which syrk () computes a diagonal block directly rather than dividing it */
+  const size_t SYRK_LEAF = 64;
+
+  /* Partial sums kept by the syrk () dot product kernel */
+  const size_t SYRK_LANES = 8;
+
+  /* The distance between two elements, for deciding whether successive matrix powers have converged */
+  template <typename T>
+  inline double
+  element_distance (const T &a, const T &b)
+  {
+    return ((double) (a > b ? a - b : b - a));
+  }
+
+  template <typename T>
+  inline double
+  element_distance (const std::complex<T> &a, const std::complex<T> &b)
+  {
+    return (std::abs (a - b));
+  }
+
+  /**
+   * A second operand prepared once by a multiplier's prepare (), for multiplying many first operands by it
+   * with mult_prepared (). What it holds depends on the multiplier that prepared it, which is the kind of
+   * multiplier it can be used with; it is released with delete. bytes () is the memory it holds, which is not
+   * counted in any multiplier's usage ().
+   */
+  template <typename T>
+  class prepared_operand
+  {
+  private:
+    size_t __rows;
+    size_t __cols;
+
+    prepared_operand (const prepared_operand<T> &p);
+    prepared_operand<T>& operator = (const prepared_operand<T> &p);
+
+  protected:
+    prepared_operand (size_t rows, size_t cols)
+      : __rows (rows),
+        __cols (cols)
+    {
+    }
+
+  public:
+    virtual ~prepared_operand () {}
+
+    size_t rows () const { return __rows; }
+    size_t cols () const { return __cols; }
+
+    virtual size_t bytes () const = 0;
+  };
+
+  /**
+   * The operand prepared by a multiplier with nothing better to do: a copy, so that the caller's array may go.
+   */
+  template <typename T>
+  class copied_operand : public prepared_operand<T>
+  {
+  private:
+    T *__data;
+
+  public:
+    copied_operand (const T *b, size_t rows, size_t cols)
+      : prepared_operand<T> (rows, cols),
+        __data ((T *) aligned_malloc (rows * cols * sizeof (T)))
+    {
+      if (__data)
+        memcpy (__data, b, rows * cols * sizeof (T));
+    }
+
+    ~copied_operand ()
+    {
+      free (__data);
+    }
+
+    const T* data () const { return __data; }
+    size_t bytes () const { return (this->rows () * this->cols () * sizeof (T)); }
+  };
+
   /**
    * A matrix_multiplier object performs matrix multiplication on two arrays with given row and column
    * bounds, representing matrices.
+   *
+   * Working memory is allocated through a mem_account. Each multiplier has one of its own, which is reset
+   * at the start of every call to mult (), so that usage () describes the most recent multiplication: its
+   * peak memory, its allocations, and the bytes still held afterwards (the result). Multipliers which use
+   * others internally share their account with them, so that the figures cover the whole computation.
    */
   template <typename T>
   class matrix_multiplier
   {
-  public:    
+  protected:
+    mem_account __own_account;
+    mem_account *__account;
+
+    /* Called at the start of mult (); resets the account unless it is shared from an enclosing multiplier */
+    void
+    __begin ()
+    {
+      if (__account == &__own_account)
+        __own_account.reset ();
+    }
+
+    T*
+    __alloc (size_t n)
+    {
+      return ((T *) __account->alloc (n * sizeof (T)));
+    }
+
+    void
+    __free (T *p)
+    {
+      __account->release (p);
+    }
+
+    static T __syrk_dot (const T *a, const T *b, size_t k);
+    bool __syrk (const T *a, T *C, size_t n, size_t k, size_t ldc, matrix_triangle t);
+
+    /* Whether no element of P differs from the corresponding one of Q by more than tolerance */
+    static bool
+    __converged (const T *P, const T *Q, size_t len, double tolerance)
+    {
+      for (size_t i = 0; i < len; i++)
+        {
+          if (element_distance (P[i], Q[i]) > tolerance)
+            return false;
+        }
+
+      return true;
+    }
+
+  public:
+    matrix_multiplier ()
+      : __account (&__own_account)
+    {
+    }
+
     virtual T* mult (const T *a, const T *b, size_t arows, size_t acols, size_t brows, size_t bcols) = 0;
     virtual matrix_multiplier<T>* copy () const = 0;
     virtual ~matrix_multiplier<T>() {}
+
+    /* The square of the n x n matrix a; multipliers which can do better than mult (a, a) override this */
+    virtual T*
+    square (const T *a, size_t n)
+    {
+      return (mult (a, a, n, n, n, n));
+    }
+
+    virtual T* pow (const T *a, size_t n, size_t k, double tolerance = 0.0);
+
+    /**
+     * The n x n product a a^T of the n x k matrix a, of which only the given triangle is computed; the other
+     * is copied from it if mirror, and left zero otherwise.
+     */
+    virtual T* syrk (const T *a, size_t n, size_t k, matrix_triangle t = LOWER_TRIANGLE, bool mirror = false);
+
+    /**
+     * Prepares the brows x bcols matrix b as the second operand of any number of products, doing once
+     * whatever of the work on it does not depend on the first operand. Returns a new operand, to be deleted
+     * by the caller, or NULL on failure. This version only copies b.
+     */
+    virtual prepared_operand<T>* prepare (const T *b, size_t brows, size_t bcols);
+
+    /**
+     * Multiplies the arows x b.rows () matrix a by the prepared operand b, which must have been prepared by
+     * a multiplier of this kind; returns NULL otherwise. This version takes copies, which any multiplier
+     * accepts, and multiplies with mult ().
+     */
+    virtual T* mult_prepared (const T *a, const prepared_operand<T> &b, size_t arows);
+
+    virtual T* mult_layout (const T *a, matrix_layout al, const T *b, matrix_layout bl,
+                            size_t arows, size_t acols, size_t brows, size_t bcols);
+
+    /* Allocate through a, or through our own account again if a is NULL */
+    virtual void
+    account (mem_account *a)
+    {
+      __account = a ? a : &__own_account;
+    }
+
+    /* Memory usage of the most recent multiplication */
+    const mem_account&
+    usage () const
+    {
+      return *__account;
+    }
   };
+
+  /**
+   * Multiplies a by b as mult () does, where each operand is laid out in memory as given. The dimensions are
+   * those of the operands as matrices, whatever their layout, so that a^T b is computed by passing a in the
+   * other layout with its dimensions exchanged. The result is row-major.
+   *
+   * This version lays column-major operands out by rows with transpose_blocked () before calling mult ();
+   * multipliers which can use them as they are override it. The copies are not accounted for.
+   */
+  template <typename T>
+  T*
+  matrix_multiplier<T>::mult_layout (const T *a, matrix_layout al, const T *b, matrix_layout bl,
+                                     size_t arows, size_t acols, size_t brows, size_t bcols)
+  {
+    T *A = NULL;
+    T *B = NULL;
+
+    if (al == COLUMN_MAJOR)
+      {
+        A = (T *) aligned_malloc (arows * acols * sizeof (T));
+
+        if (!A)
+          return NULL;
+
+        transpose_blocked (a, A, acols, arows);
+        a = A;
+      }
+
+    if (bl == COLUMN_MAJOR)
+      {
+        B = (T *) aligned_malloc (brows * bcols * sizeof (T));
+
+        if (!B)
+          {
+            free (A);
+            return NULL;
+          }
+
+        transpose_blocked (b, B, bcols, brows);
+        b = B;
+      }
+
+    T *C = mult (a, b, arows, acols, brows, bcols);
+
+    free (A);
+    free (B);
+
+    return C;
+  }
+
+  /**
+   * Raises the n x n matrix a to the power k by repeated squaring, with about 2 log2 (k) products rather than
+   * k - 1. If tolerance is positive and two successive squares differ by no more than tolerance in any element,
+   * the powers are taken to have converged, and the latter is returned as a^k; this suits the powers of
+   * Markov chain transition matrices, which approach their limit quickly. Returns a new n x n array, the
+   * identity if k is 0, or NULL on failure.
+   *
+   * Each product is a separate call to mult () or square (), so usage () describes the last of them; the
+   * powers held in between are not accounted for.
+   */
+  template <typename T>
+  T*
+  matrix_multiplier<T>::pow (const T *a, size_t n, size_t k, double tolerance)
+  {
+    T *R = NULL;
+    T *P = (T *) aligned_malloc (n * n * sizeof (T));
+
+    if (!P)
+      return NULL;
+
+    if (!k)
+      {
+        for (size_t i = 0; i < n * n; i++)
+          P[i] = T ();
+
+        for (size_t i = 0; i < n; i++)
+          P[(i * n) + i] = T (1);
+
+        return P;
+      }
+
+    memcpy (P, a, n * n * sizeof (T));
+
+    for (;;)
+      {
+        if (k & 1)
+          {
+            T *S = R ? mult (R, P, n, n, n, n) : (T *) aligned_malloc (n * n * sizeof (T));
+
+            if (!S)
+              break;
+
+            if (!R)
+              memcpy (S, P, n * n * sizeof (T));
+
+            free (R);
+            R = S;
+          }
+
+        k >>= 1;
+
+        if (!k)
+          break;
+
+        T *Q = square (P, n);
+
+        if (!Q)
+          break;
+
+        bool converged = (tolerance > 0.0 && __converged (P, Q, n * n, tolerance));
+
+        free (P);
+        P = Q;
+
+        if (converged)
+          {
+            free (R);
+            return P;
+          }
+      }
+
+    free (P);
+
+    /* Stopped early by a failed allocation */
+    if (k)
+      {
+        free (R);
+        return NULL;
+      }
+
+    return R;
+  }
+
+  template <typename T>
+  prepared_operand<T>*
+  matrix_multiplier<T>::prepare (const T *b, size_t brows, size_t bcols)
+  {
+    copied_operand<T> *p = new copied_operand<T> (b, brows, bcols);
+
+    if (!p->data ())
+      {
+        delete p;
+        return NULL;
+      }
+
+    return p;
+  }
+
+  template <typename T>
+  T*
+  matrix_multiplier<T>::mult_prepared (const T *a, const prepared_operand<T> &b, size_t arows)
+  {
+    const copied_operand<T> *p = dynamic_cast<const copied_operand<T> *> (&b);
+
+    if (!p)
+      {
+        fprintf (stderr, "matrix_multiplier: operand prepared by another kind of multiplier\n");
+        return NULL;
+      }
+
+    return (mult (a, p->data (), arows, b.rows (), b.rows (), b.cols ()));
+  }
+
+  /**
+   * Computes the symmetric product a a^T by dividing the rows of a in two, a1 over a2. The result is
+   *
+   *   a1 a1^T   a1 a2^T
+   *   a2 a1^T   a2 a2^T
+   *
+   * where the diagonal blocks are again symmetric products, divided in turn, and the off-diagonal blocks
+   * are mirror images of one another, so only the one in the wanted triangle is computed. It is an ordinary
+   * product of a block of rows of a by another in the column-major layout, which is their transpose, and goes
+   * to mult_layout (): the transpose multiplier takes it as it is, and the Strassen multipliers recurse on it.
+   * When a has many more columns than the block has rows, the block is the sum of the products of slices of
+   * the columns, so that each product is about square.
+   * Blocks of up to SYRK_LEAF rows are computed directly, element by element of the triangle, by dot products
+   * of rows of a, so that a^T is never formed. Altogether this is about half the multiply-adds of a full
+   * product.
+   *
+   * Returns a new n x n array, or NULL on failure. Each off-diagonal block is a separate call to
+   * mult_layout (), so as with pow (), usage () describes the last of them.
+   */
+  template <typename T>
+  T*
+  matrix_multiplier<T>::syrk (const T *a, size_t n, size_t k, matrix_triangle t, bool mirror)
+  {
+    T *C = (T *) aligned_malloc (n * n * sizeof (T));
+
+    if (!C)
+      return NULL;
+
+    if (!__syrk (a, C, n, k, n, t))
+      {
+        free (C);
+        return NULL;
+      }
+
+    /* Fill the other triangle, in tiles so that the columns read stay in cache */
+    const size_t tile = 64;
+
+    for (size_t i0 = 0; i0 < n; i0 += tile)
+      {
+        for (size_t j0 = 0; j0 <= i0; j0 += tile)
+          {
+            size_t i1 = (i0 + tile < n) ? i0 + tile : n;
+            size_t j1 = (j0 + tile < n) ? j0 + tile : n;
+
+            for (size_t i = i0; i < i1; i++)
+              {
+                for (size_t j = j0; j < j1 && j < i; j++)
+                  {
+                    T *lower = &C[(i * n) + j];
+                    T *upper = &C[(j * n) + i];
+
+                    if (t == LOWER_TRIANGLE)
+                      *upper = mirror ? *lower : T ();
+                    else
+                      *lower = mirror ? *upper : T ();
+                  }
+              }
+          }
+      }
+
+    return C;
+  }
+
+  template <typename T>
+  T
+  matrix_multiplier<T>::__syrk_dot (const T *a, const T *b, size_t k)
+  {
+    T s[SYRK_LANES];
+    size_t p = 0;
+
+    for (size_t q = 0; q < SYRK_LANES; q++)
+      s[q] = T ();
+
+    for (; p + SYRK_LANES <= k; p += SYRK_LANES)
+      {
+        for (size_t q = 0; q < SYRK_LANES; q++)
+          s[q] += a[p + q] * b[p + q];
+      }
+
+    for (; p < k; p++)
+      s[0] += a[p] * b[p];
+
+    T sum = T ();
+
+    for (size_t q = 0; q < SYRK_LANES; q++)
+      sum += s[q];
+
+    return sum;
+  }
+
+  /**
+   * Writes triangle t of a a^T, for the n rows of a from the given one, to C, whose rows are ldc apart.
+   */
+  template <typename T>
+  bool
+  matrix_multiplier<T>::__syrk (const T *a, T *C, size_t n, size_t k, size_t ldc, matrix_triangle t)
+  {
+    if (n <= SYRK_LEAF)
+      {
+        for (size_t i = 0; i < n; i++)
+          {
+            for (size_t j = 0; j <= i; j++)
+              {
+                T d = __syrk_dot (&a[i * k], &a[j * k], k);
+
+                if (t == LOWER_TRIANGLE)
+                  C[(i * ldc) + j] = d;
+                else
+                  C[(j * ldc) + i] = d;
+              }
+          }
+
+        return true;
+      }
+
+    size_t n1 = n / 2;
+    size_t n2 = n - n1;
+    const T *a2 = &a[n1 * k];
+
+    /* a2 a1^T below the diagonal, or a1 a2^T above it; row-major rows of a read by columns are their transpose */
+    const T *left = (t == LOWER_TRIANGLE) ? a2 : a;
+    const T *right = (t == LOWER_TRIANGLE) ? a : a2;
+    size_t rows = (t == LOWER_TRIANGLE) ? n2 : n1;
+    size_t cols = (t == LOWER_TRIANGLE) ? n1 : n2;
+    T *block = (t == LOWER_TRIANGLE) ? &C[n1 * ldc] : &C[n1];
+
+    /* A long k is taken in slices of about as many columns as the block has rows, each slice a square-ish
+       product, rather than in one product which Strassen would pad to a k x k square */
+    size_t w = (k > n2) ? n2 : k;
+    T *L = NULL;
+    T *R = NULL;
+
+    if (w < k)
+      {
+        L = (T *) aligned_malloc (rows * w * sizeof (T));
+        R = (T *) aligned_malloc (cols * w * sizeof (T));
+
+        if (!L || !R)
+          {
+            free (L);
+            free (R);
+            return false;
+          }
+      }
+
+    for (size_t p0 = 0; p0 < k; p0 += w)
+      {
+        size_t width = (p0 + w <= k) ? w : k - p0;
+        const T *l = left;
+        const T *r = right;
+
+        if (L)
+          {
+            for (size_t i = 0; i < rows; i++)
+              memcpy (&L[i * width], &left[(i * k) + p0], width * sizeof (T));
+
+            for (size_t j = 0; j < cols; j++)
+              memcpy (&R[j * width], &right[(j * k) + p0], width * sizeof (T));
+
+            l = L;
+            r = R;
+          }
+
+        T *D = mult_layout (l, ROW_MAJOR, r, COLUMN_MAJOR, rows, width, width, cols);
+
+        if (!D)
+          {
+            free (L);
+            free (R);
+            return false;
+          }
+
+        for (size_t i = 0; i < rows; i++)
+          {
+            T *c = &block[i * ldc];
+            const T *d = &D[i * cols];
+
+            if (!p0)
+              memcpy (c, d, cols * sizeof (T));
+            else
+              {
+                for (size_t j = 0; j < cols; j++)
+                  c[j] += d[j];
+              }
+          }
+
+        free (D);
+      }
+
+    free (L);
+    free (R);
+
+    return (__syrk (a, C, n1, k, ldc, t) && __syrk (a2, &C[(n1 * ldc) + n1], n2, k, ldc, t));
+  }
 }
 
 #endif /* MATRIX_MULTIPLIER_HPP_ */
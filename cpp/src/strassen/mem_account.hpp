@@ -0,0 +1,96 @@
+#ifndef MEM_ACCOUNT_HPP_
+#define MEM_ACCOUNT_HPP_
+
+#include <stdlib.h>
+#include <malloc.h>
+
+#include <atomic>
+
+#include "allocator.hpp"
+
+namespace strassen
+{
+  /**
+   * A mem_account keeps track of the memory allocated through it: the bytes currently in use, the high-water
+   * mark of that figure, and the number and total size of allocations. The multipliers allocate all of their
+   * working memory through an account, so that the cost of each multiplication can be measured. The memory itself
+   * comes from aligned_malloc ().
+   *
+   * Sizes are taken from malloc_usable_size (), so they include the allocator's rounding, and memory allocated
+   * through an account is released with plain free () just as well; it is then simply not accounted for. This
+   * is what happens to the result of a multiplication, which belongs to the caller. The counters are atomic,
+   * as the parallel multipliers allocate from several threads at once.
+   */
+  class mem_account
+  {
+  private:
+    std::atomic<size_t> __in_use;
+    std::atomic<size_t> __peak;
+    std::atomic<size_t> __allocations;
+    std::atomic<size_t> __allocated;
+
+    mem_account (const mem_account &a);
+    mem_account& operator = (const mem_account &a);
+
+  public:
+    mem_account ()
+      : __in_use (0),
+        __peak (0),
+        __allocations (0),
+        __allocated (0)
+    {
+    }
+
+    void*
+    alloc (size_t bytes)
+    {
+      void *p = aligned_malloc (bytes);
+
+      if (p)
+        {
+          size_t len = malloc_usable_size (p);
+          size_t cur = __in_use.fetch_add (len) + len;
+          size_t peak = __peak.load ();
+
+          while (cur > peak && !__peak.compare_exchange_weak (peak, cur))
+            ;
+
+          ++__allocations;
+          __allocated += len;
+        }
+
+      return p;
+    }
+
+    void
+    release (void *p)
+    {
+      if (p)
+        {
+          __in_use -= malloc_usable_size (p);
+          free (p);
+        }
+    }
+
+    /* Starts counting afresh; memory still held from before is forgotten */
+    void
+    reset ()
+    {
+      __in_use = 0;
+      __peak = 0;
+      __allocations = 0;
+      __allocated = 0;
+    }
+
+    /* Bytes allocated and not yet released */
+    size_t in_use () const { return __in_use.load (); }
+    /* Highest value of in_use () since the last reset */
+    size_t peak () const { return __peak.load (); }
+    /* Number of allocations since the last reset */
+    size_t allocations () const { return __allocations.load (); }
+    /* Total bytes allocated since the last reset */
+    size_t allocated () const { return __allocated.load (); }
+  };
+}
+
+#endif /* MEM_ACCOUNT_HPP_ */
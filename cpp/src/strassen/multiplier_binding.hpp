@@ -0,0 +1,195 @@
+#ifndef MULTIPLIER_BINDING_HPP_
+#define MULTIPLIER_BINDING_HPP_
+
+#include "matrix_multiplier.hpp"
+#include "adaptive_matrix_multiplier.hpp"
+
+namespace strassen
+{
+  /* What a matrix bound to a concrete multiplier class is given in place of a multiplier, which it holds itself */
+  struct bound_multiplier
+  {
+  };
+
+  /**
+   * How a matrix<T, M> holds its multiplier M. For a concrete multiplier class, such as
+   * transpose_matrix_multiplier<T>, the multiplier is a member, default-constructed with the matrix, so that
+   * making a matrix allocates nothing besides its data. Every call is qualified with M, which binds it at
+   * compile time: there is no virtual dispatch at the boundary, and the compiler is free to inline the
+   * multiplier into the caller. A copy of the matrix default-constructs a multiplier of its own, as the
+   * multipliers cannot be copied; configure it again through multiplier () if need be.
+   *
+   * The specialization for matrix_multiplier<T> is the runtime form below.
+   */
+  template <typename T, typename M>
+  class multiplier_binding
+  {
+  private:
+    mutable M __mm;
+
+    multiplier_binding<T, M>& operator = (const multiplier_binding<T, M> &b);
+
+  public:
+    typedef bound_multiplier argument;
+
+    static argument
+    make ()
+    {
+      return argument ();
+    }
+
+    multiplier_binding (argument)
+    {
+    }
+
+    multiplier_binding (const multiplier_binding<T, M> &)
+    {
+    }
+
+    multiplier_binding (multiplier_binding<T, M> &&)
+    {
+    }
+
+    M&
+    get () const
+    {
+      return __mm;
+    }
+
+    T*
+    mult (const T *a, const T *b, size_t arows, size_t acols, size_t brows, size_t bcols) const
+    {
+      return (__mm.M::mult (a, b, arows, acols, brows, bcols));
+    }
+
+    T*
+    mult_layout (const T *a, matrix_layout al, const T *b, matrix_layout bl,
+                 size_t arows, size_t acols, size_t brows, size_t bcols) const
+    {
+      return (__mm.M::mult_layout (a, al, b, bl, arows, acols, brows, bcols));
+    }
+
+    T*
+    mult_prepared (const T *a, const prepared_operand<T> &b, size_t arows) const
+    {
+      return (__mm.M::mult_prepared (a, b, arows));
+    }
+
+    prepared_operand<T>*
+    prepare (const T *b, size_t brows, size_t bcols) const
+    {
+      return (__mm.M::prepare (b, brows, bcols));
+    }
+
+    T*
+    syrk (const T *a, size_t n, size_t k, matrix_triangle t, bool mirror) const
+    {
+      return (__mm.M::syrk (a, n, k, t, mirror));
+    }
+
+    T*
+    pow (const T *a, size_t n, size_t k, double tolerance) const
+    {
+      return (__mm.M::pow (a, n, k, tolerance));
+    }
+  };
+
+  /**
+   * The runtime form, which is what matrix<T> uses: any multiplier, chosen when the matrix is made and
+   * owned by it, called through the virtual interface. An adaptive_matrix_multiplier<T> is made if none is
+   * given, and a copy of the matrix copy ()s the multiplier. A move takes the multiplier with it, and the
+   * matrix moved from makes an adaptive one again should it be used.
+   */
+  template <typename T>
+  class multiplier_binding<T, matrix_multiplier<T> >
+  {
+  private:
+    mutable matrix_multiplier<T> *__mm;
+
+    matrix_multiplier<T>*
+    __get () const
+    {
+      if (!__mm)
+        __mm = make ();
+
+      return __mm;
+    }
+
+    multiplier_binding<T, matrix_multiplier<T> >& operator = (const multiplier_binding<T, matrix_multiplier<T> > &b);
+
+  public:
+    typedef matrix_multiplier<T>* argument;
+
+    static argument
+    make ()
+    {
+      return (new adaptive_matrix_multiplier<T> ());
+    }
+
+    multiplier_binding (argument mm)
+      : __mm (mm)
+    {
+    }
+
+    multiplier_binding (const multiplier_binding<T, matrix_multiplier<T> > &b)
+      : __mm (b.__get ()->copy ())
+    {
+    }
+
+    multiplier_binding (multiplier_binding<T, matrix_multiplier<T> > &&b)
+      : __mm (b.__mm)
+    {
+      b.__mm = NULL;
+    }
+
+    ~multiplier_binding ()
+    {
+      delete __mm;
+    }
+
+    matrix_multiplier<T>&
+    get () const
+    {
+      return *__get ();
+    }
+
+    T*
+    mult (const T *a, const T *b, size_t arows, size_t acols, size_t brows, size_t bcols) const
+    {
+      return (__get ()->mult (a, b, arows, acols, brows, bcols));
+    }
+
+    T*
+    mult_layout (const T *a, matrix_layout al, const T *b, matrix_layout bl,
+                 size_t arows, size_t acols, size_t brows, size_t bcols) const
+    {
+      return (__get ()->mult_layout (a, al, b, bl, arows, acols, brows, bcols));
+    }
+
+    T*
+    mult_prepared (const T *a, const prepared_operand<T> &b, size_t arows) const
+    {
+      return (__get ()->mult_prepared (a, b, arows));
+    }
+
+    prepared_operand<T>*
+    prepare (const T *b, size_t brows, size_t bcols) const
+    {
+      return (__get ()->prepare (b, brows, bcols));
+    }
+
+    T*
+    syrk (const T *a, size_t n, size_t k, matrix_triangle t, bool mirror) const
+    {
+      return (__get ()->syrk (a, n, k, t, mirror));
+    }
+
+    T*
+    pow (const T *a, size_t n, size_t k, double tolerance) const
+    {
+      return (__get ()->pow (a, n, k, tolerance));
+    }
+  };
+}
+
+#endif /* MULTIPLIER_BINDING_HPP_ */
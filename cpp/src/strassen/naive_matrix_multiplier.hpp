@@ -17,6 +17,9 @@ namespace strassen
     
     T* mult (const T *a, const T *b, size_t arows, size_t acols, size_t brows, size_t bcols);
     matrix_multiplier<T>* copy () const;
+
+    /* Peak bytes allocated by one call to mult () with these dimensions: just the result */
+    static size_t predicted_peak_bytes (size_t arows, size_t acols, size_t brows, size_t bcols);
   };
 
   template <typename T>
@@ -36,28 +39,37 @@ namespace strassen
     return (new naive_matrix_multiplier<T> ());
   }
 
+  template <typename T>
+  size_t
+  naive_matrix_multiplier<T>::predicted_peak_bytes (size_t arows, size_t acols, size_t brows, size_t bcols)
+  {
+    return (allocation_bytes (arows * bcols * sizeof (T)));
+  }
+
   template <typename T>
   T*
   naive_matrix_multiplier<T>::mult (const T *A, const T *B,
                                     size_t arows, size_t acols,
                                     size_t brows, size_t bcols)
   {
-    if (arows == bcols)
+    this->__begin ();
+
+    if (acols == brows)
       {
         T t;
         size_t m = arows;
         size_t n = acols;
         size_t im;	
         
-        T *C = (T *) malloc (m * m * sizeof (T));
+        T *C = this->__alloc (m * bcols);
         const T *a_row = NULL;
 
         for (size_t i = 0; i < m; i++)
           {
-            im = i * m;
+            im = i * bcols;
             a_row = &A[i * acols];	    
 
-            for (size_t j = 0; j < m; j++)
+            for (size_t j = 0; j < bcols; j++)
               {
                 t = 0;
                 
@@ -74,7 +86,7 @@ namespace strassen
       }
     else
       {
-        fprintf (stderr, "a.rows %lu != b.cols%lu\n", arows, bcols);
+        fprintf (stderr, "a.cols %lu != b.rows %lu\n", acols, brows);
         exit (1);
       }
 
@@ -0,0 +1,253 @@
+#ifndef OUT_OF_CORE_MATRIX_MULTIPLIER_HPP_
+#define OUT_OF_CORE_MATRIX_MULTIPLIER_HPP_
+
+#include "matrix_multiplier.hpp"
+#include "mapped_matrix.hpp"
+#include "strassen_matrix_multiplier.hpp"
+
+namespace strassen
+{
+  /* Smallest tile edge the out-of-core multiplier will use, whatever the memory budget */
+  const size_t OUT_OF_CORE_MIN_TILE = 16;
+
+  /**
+   * Bytes of working memory assumed per element of a tile: the A, B and C tiles themselves, plus the
+   * temporaries of the in-memory multiplier (Strassen needs about 8 tiles' worth across its recursion).
+   */
+  const size_t OUT_OF_CORE_WORKSPACE_FACTOR = 12;
+
+  /**
+   * The out_of_core_matrix_multiplier multiplies mapped_matrix operands which need not fit in memory. C = A * B
+   * is computed one square t x t tile of C at a time; for each C tile, the matching tiles of A and B are copied
+   * out of their mappings, zero-padded at the edges, and multiplied in memory by an ordinary matrix_multiplier<T>
+   * (a strassen_matrix_multiplier<T> by default). The tile edge t is the largest power of two for which the
+   * working set of one step fits into the memory budget given at construction.
+   *
+   * While one pair of tiles is being multiplied, the kernel is asked to read ahead the pair needed by the next
+   * step, and rows of A which will not be visited again are dropped from the page cache mapping.
+   */
+  template <typename T>
+  class out_of_core_matrix_multiplier
+  {
+  private:
+    size_t __budget;            /* Memory budget, in bytes */
+    matrix_multiplier<T> *__mm; /* In-memory multiplier used on tiles */
+
+    void __load  (T *M, const mapped_matrix<T> &A, size_t row_start, size_t col_start, size_t t);
+    void __store (mapped_matrix<T> &C, const T *M, size_t row_start, size_t col_start, size_t t);
+    void __prefetch (const mapped_matrix<T> &A, const mapped_matrix<T> &B,
+                     size_t i, size_t j, size_t k, size_t t);
+
+    out_of_core_matrix_multiplier (const out_of_core_matrix_multiplier<T> &m);
+    out_of_core_matrix_multiplier<T>& operator = (const out_of_core_matrix_multiplier<T> &m);
+
+  public:
+    out_of_core_matrix_multiplier (size_t budget, matrix_multiplier<T> *mm = new strassen_matrix_multiplier<T> ());
+    ~out_of_core_matrix_multiplier ();
+
+    /* Computes C = A * B. C must already be mapped writable with dimensions A.rows () x B.cols () */
+    bool mult (const mapped_matrix<T> &A, const mapped_matrix<T> &B, mapped_matrix<T> &C);
+
+    /* The tile edge used to multiply an m x k matrix by a k x n matrix */
+    size_t tile_size (size_t m, size_t k, size_t n) const;
+  };
+
+  template <typename T>
+  out_of_core_matrix_multiplier<T>::out_of_core_matrix_multiplier (size_t budget, matrix_multiplier<T> *mm)
+    : __budget (budget),
+      __mm (mm)
+  {
+  }
+
+  template <typename T>
+  out_of_core_matrix_multiplier<T>::~out_of_core_matrix_multiplier ()
+  {
+    delete __mm;
+  }
+
+  template <typename T>
+  size_t
+  out_of_core_matrix_multiplier<T>::tile_size (size_t m, size_t k, size_t n) const
+  {
+    size_t max_term = m;
+    size_t t = OUT_OF_CORE_MIN_TILE;
+
+    if (k > max_term)
+      max_term = k;
+
+    if (n > max_term)
+      max_term = n;
+
+    /* Grow t while a tile twice the size still fits, and is still useful for matrices this large */
+    while (t < max_term && (4 * t * t * sizeof (T) * OUT_OF_CORE_WORKSPACE_FACTOR) <= __budget)
+      t *= 2;
+
+    return t;
+  }
+
+  /**
+   * Walks the tiles of C in row-major order, accumulating the products of the corresponding A and B tiles.
+   * Returns false if the dimensions do not agree, the tiles cannot be allocated or the in-memory multiplier
+   * fails.
+   */
+  template <typename T>
+  bool
+  out_of_core_matrix_multiplier<T>::mult (const mapped_matrix<T> &A, const mapped_matrix<T> &B, mapped_matrix<T> &C)
+  {
+    if (!A.ok () || !B.ok () || !C.ok ())
+      return false;
+
+    if (A.cols () != B.rows () || C.rows () != A.rows () || C.cols () != B.cols ())
+      return false;
+
+    size_t t = tile_size (A.rows (), A.cols (), B.cols ());
+    size_t tt = t * t;
+
+    /* Number of tiles along each dimension */
+    size_t mt = (A.rows () + t - 1) / t;
+    size_t kt = (A.cols () + t - 1) / t;
+    size_t nt = (B.cols () + t - 1) / t;
+
+    T *At = (T *) aligned_malloc (tt * sizeof (T));
+    T *Bt = (T *) aligned_malloc (tt * sizeof (T));
+    T *Ct = (T *) aligned_malloc (tt * sizeof (T));
+    T *P = NULL;
+
+    if (!At || !Bt || !Ct)
+      {
+        free (At);
+        free (Bt);
+        free (Ct);
+        return false;
+      }
+
+    bool ok = true;
+
+    __prefetch (A, B, 0, 0, 0, t);
+
+    for (size_t i = 0; i < mt && ok; i++)
+      {
+        for (size_t j = 0; j < nt && ok; j++)
+          {
+            for (size_t x = 0; x < tt; x++)
+              Ct[x] = T ();
+
+            for (size_t k = 0; k < kt; k++)
+              {
+                __load (At, A, i * t, k * t, t);
+                __load (Bt, B, k * t, j * t, t);
+
+                /* Start reading in the next step's tiles while this one is multiplied */
+                if (k + 1 < kt)
+                  __prefetch (A, B, i, j, k + 1, t);
+                else if (j + 1 < nt)
+                  __prefetch (A, B, i, j + 1, 0, t);
+                else if (i + 1 < mt)
+                  __prefetch (A, B, i + 1, 0, 0, t);
+
+                P = __mm->mult (At, Bt, t, t, t, t);
+
+                if (!P)
+                  {
+                    ok = false;
+                    break;
+                  }
+
+                for (size_t x = 0; x < tt; x++)
+                  Ct[x] += P[x];
+
+                free (P);
+              }
+
+            /* A tile left incomplete must not reach C, which is likely a file */
+            if (ok)
+              __store (C, Ct, i * t, j * t, t);
+          }
+
+        /* This row of A tiles is finished with; the advice is only a hint, so its failure is not one */
+        A.advise (i * t, 0, t, A.cols (), MADV_DONTNEED);
+      }
+
+    free (At);
+    free (Bt);
+    free (Ct);
+
+    return ok;
+  }
+
+  /**
+   * Copies the t x t tile of A starting at (row_start, col_start) into M, padding with zeroes
+   * past the edges of A.
+   */
+  template <typename T>
+  void
+  out_of_core_matrix_multiplier<T>::__load (T *M, const mapped_matrix<T> &A,
+                                            size_t row_start, size_t col_start, size_t t)
+  {
+    size_t rows = A.rows () - row_start;
+    size_t cols = A.cols () - col_start;
+    const T *row = NULL;
+    T *m_row = NULL;
+
+    if (rows > t)
+      rows = t;
+
+    if (cols > t)
+      cols = t;
+
+    for (size_t i = 0; i < rows; i++)
+      {
+        row = &A.data ()[((row_start + i) * A.cols ()) + col_start];
+        m_row = &M[i * t];
+
+        for (size_t j = 0; j < cols; j++)
+          m_row[j] = row[j];
+
+        for (size_t j = cols; j < t; j++)
+          m_row[j] = T ();
+      }
+
+    for (size_t i = rows * t; i < t * t; i++)
+      M[i] = T ();
+  }
+
+  /**
+   * Copies the part of the t x t tile M which lies within C into C at (row_start, col_start).
+   */
+  template <typename T>
+  void
+  out_of_core_matrix_multiplier<T>::__store (mapped_matrix<T> &C, const T *M,
+                                             size_t row_start, size_t col_start, size_t t)
+  {
+    size_t rows = C.rows () - row_start;
+    size_t cols = C.cols () - col_start;
+    T *row = NULL;
+
+    if (rows > t)
+      rows = t;
+
+    if (cols > t)
+      cols = t;
+
+    for (size_t i = 0; i < rows; i++)
+      {
+        row = &C.data ()[((row_start + i) * C.cols ()) + col_start];
+        memcpy (row, &M[i * t], cols * sizeof (T));
+      }
+  }
+
+  /**
+   * Asks the kernel to start reading the tiles of A and B used by step (i, j, k). Like any advice, this
+   * may be refused without affecting the product.
+   */
+  template <typename T>
+  void
+  out_of_core_matrix_multiplier<T>::__prefetch (const mapped_matrix<T> &A, const mapped_matrix<T> &B,
+                                                size_t i, size_t j, size_t k, size_t t)
+  {
+    A.advise (i * t, k * t, t, t, MADV_WILLNEED);
+    B.advise (k * t, j * t, t, t, MADV_WILLNEED);
+  }
+}
+
+#endif /* OUT_OF_CORE_MATRIX_MULTIPLIER_HPP_ */
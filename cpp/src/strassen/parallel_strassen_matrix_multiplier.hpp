@@ -1,32 +1,54 @@
 #ifndef PARALLEL_STRASSEN_MATRIX_MULTIPLIER_HPP_
 #define PARALLEL_STRASSEN_MATRIX_MULTIPLIER_HPP_
 
-#include <cmath>
+#include <pthread.h>
 #include "matrix_multiplier.hpp"
 #include "strassen_matrix_multiplier.hpp"
 #include "transpose_matrix_multiplier.hpp"
+#include "trace.hpp"
 
 namespace strassen
 {  
+  /* Threads of a parallel_strassen_matrix_multiplier unless told otherwise: the calling thread and 7 workers */
+  const size_t PARALLEL_STRASSEN_THREADS = 8;
+
   template <typename T>
   class psmm_pair
   {
   public:
-    T *A;
-    T *B;
-    T *C;
+    /* The products this worker computes: MM[first], MM[first + stride], ... of AA[i] and BB[i] */
+    T * const *AA;
+    T * const *BB;
+    T **MM;
+    size_t first;
+    size_t stride;
     size_t m;
     void *pmm;
     int j;
+
+    /* Set by the main thread when it hands the worker something to do, and cleared by the worker on waking */
+    bool pending;
+
+    /* If set, rows [i0, i1) of an O(n^2) phase to run instead of a product */
+    const std::function<void (size_t, size_t)> *rows;
+    size_t i0;
+    size_t i1;
   };
   
   /**
    * A parallel implementation of strassen_matrix_multiplier.
    *
    * The main thread performs the initial division of the input matrices A and B into respective their 7 submatrix 
-   * elements. These top-level divisions are then spread across 7 threads which will continue to recursively
+   * elements. These top-level divisions are then spread across the worker threads which will continue to recursively
    * multiply their matrices in parallel. When completed, the main thread aggregates their work and returns
    * the completed matrix.
+   *
+   * The threads are given at construction, PARALLEL_STRASSEN_THREADS by default: the calling thread and a worker
+   * for each of the others. With fewer than 7 workers, each takes several of the products in turn, and with no
+   * workers the calling thread computes them itself; workers beyond the seventh only share the O(n^2) phases.
+   *
+   * The O(n^2) phases of the main thread (padding, forming the 14 top-level operand blocks, combining the
+   * products and removing the padding) are divided by rows between the main thread and the idle workers.
    */
   template <typename T>
   class parallel_strassen_matrix_multiplier : public strassen::strassen_matrix_multiplier<T>
@@ -37,9 +59,9 @@ namespace strassen
     size_t __nthreads;
     pthread_t *__threads;
     pthread_mutex_t *__lock;
-    pthread_cond_t *__cond[7];
+    pthread_cond_t **__cond;
     pthread_cond_t *__main_cond;
-    psmm_pair<T>* __thread_data[7];   /* Data needed for each thread; referenced by thread ID */
+    psmm_pair<T>** __thread_data;   /* Data needed for each thread; referenced by thread ID */
 
     /* Re-entrant strassen_matrix_multiplier used to do actual work */
     strassen_matrix_multiplier<T> __smm;
@@ -48,15 +70,34 @@ namespace strassen
 
     T* __mult (const T *A, const T *B, size_t n, uint32_t id);
 
+    /* Divides a phase between the main thread and the workers, which are idle whenever the main thread runs one */
+    void __rows_parallel (size_t rows, size_t threads, const std::function<void (size_t, size_t)> &f);
+
   public:
-    parallel_strassen_matrix_multiplier ();
+    parallel_strassen_matrix_multiplier (size_t threshold = STRASSEN_THRESHOLD,
+                                         size_t threads = PARALLEL_STRASSEN_THREADS);
     virtual ~parallel_strassen_matrix_multiplier ();
     
     T* mult (const T *a, const T *b, size_t arows, size_t acols, size_t brows, size_t bcols);
     matrix_multiplier<T>* copy () const;
 
+    /* The sequential squaring path would use one thread; these go through mult () to use all of them */
+    T* square (const T *a, size_t n);
+    T* pow (const T *a, size_t n, size_t k, double tolerance = 0.0);
+
     /* Thread entry function for this class */
     void thread_loop (int id);
+
+    void account (mem_account *a);
+
+    /**
+     * Peak bytes allocated by one call to mult () with these dimensions. At the top level each worker
+     * computes its products in turn, following the sequential recursion, so the peaks of the products in
+     * progress add up, on top of the products already done.
+     */
+    static size_t predicted_peak_bytes (size_t arows, size_t acols, size_t brows, size_t bcols,
+                                        size_t threshold = STRASSEN_THRESHOLD,
+                                        size_t threads = PARALLEL_STRASSEN_THREADS);
   };
 
   template <typename T>
@@ -75,12 +116,19 @@ namespace strassen
    * Initializes a few threads and necessary synchronization primitives used for concurrent calculations
    */
   template <typename T>
-  parallel_strassen_matrix_multiplier<T>::parallel_strassen_matrix_multiplier ()
+  parallel_strassen_matrix_multiplier<T>::parallel_strassen_matrix_multiplier (size_t threshold, size_t threads)
+    : strassen_matrix_multiplier<T> (threshold),
+      __smm (threshold)
   {
+    account (this->__account);
+
     __loop = true;
-    __nthreads = 8;
+    __nthreads = threads ? threads : 1;
     __cntr = __nthreads - 1;
+    this->__row_threads = __nthreads;
     __threads = (pthread_t *) malloc ((__nthreads - 1) * sizeof (pthread_t));
+    __cond = (pthread_cond_t **) malloc ((__nthreads - 1) * sizeof (pthread_cond_t *));
+    __thread_data = (psmm_pair<T> **) malloc ((__nthreads - 1) * sizeof (psmm_pair<T> *));
     __lock = (pthread_mutex_t *) malloc (sizeof (pthread_mutex_t));
     __main_cond = (pthread_cond_t *) malloc (sizeof (pthread_cond_t));
     
@@ -95,23 +143,35 @@ namespace strassen
         __thread_data[i] = (psmm_pair<T> *) malloc (sizeof (psmm_pair<T>));
         __thread_data[i] -> pmm = (void *) this;
         __thread_data[i] -> j = i + 1;
+        __thread_data[i] -> rows = NULL;
+        __thread_data[i] -> pending = false;
         pthread_create (&__threads[i], NULL, psmm_thread_entry<T>, (void *) __thread_data[i]);
       }
     
-    sleep (1);
+    /* Wait for every worker to reach its first wait, so that no wakeup is missed */
+    pthread_mutex_lock (__lock);
+
+    while (__cntr)
+      pthread_cond_wait (__main_cond, __lock);
+
+    pthread_mutex_unlock (__lock);
   }
 
   template <typename T>
   parallel_strassen_matrix_multiplier<T>::~parallel_strassen_matrix_multiplier ()
   {
+    pthread_mutex_lock (__lock);
+
     __loop = false;
 
-    pthread_mutex_lock (__lock);
+    for (size_t i = 0; i < (__nthreads - 1); i++)
+      pthread_cond_signal (__cond[i]);
+
+    /* Workers need the lock back to return from their wait, so it must be released before joining them */
+    pthread_mutex_unlock (__lock);
 
     for (size_t i = 0; i < (__nthreads - 1); i++)
       {
-        pthread_cond_signal (__cond[i]);
-
         pthread_join (__threads[i], NULL);
 
         free (__thread_data[i]);
@@ -120,9 +180,9 @@ namespace strassen
         free (__cond[i]);
       }
 
-    pthread_mutex_unlock (__lock);
-
     free (__threads);
+    free (__cond);
+    free (__thread_data);
     pthread_mutex_destroy (__lock);
     pthread_cond_destroy (__main_cond);
 
@@ -134,7 +194,62 @@ namespace strassen
   matrix_multiplier<T>*
   parallel_strassen_matrix_multiplier<T>::copy () const
   {
-    return (new parallel_strassen_matrix_multiplier<T> ());
+    return (new parallel_strassen_matrix_multiplier<T> (this->__threshold, __nthreads));
+  }
+
+  template <typename T>
+  void
+  parallel_strassen_matrix_multiplier<T>::account (mem_account *a)
+  {
+    strassen_matrix_multiplier<T>::account (a);
+    __smm.account (this->__account);
+    __tmm.account (this->__account);
+  }
+
+  template <typename T>
+  size_t
+  parallel_strassen_matrix_multiplier<T>::predicted_peak_bytes (size_t arows, size_t acols,
+                                                                size_t brows, size_t bcols,
+                                                                size_t threshold, size_t threads)
+  {
+    if (acols != brows)
+      return 0;
+
+    if (!threshold)
+      threshold = 1;
+
+    size_t N = strassen_matrix_multiplier<T>::padded_size (arows, acols, brows, bcols);
+    size_t pads = 0;
+
+    if (arows != N || acols != N)
+      pads += allocation_bytes (N * N * sizeof (T));
+
+    if (brows != N || bcols != N)
+      pads += allocation_bytes (N * N * sizeof (T));
+
+    if (N <= threshold)
+      return (pads + transpose_matrix_multiplier<T>::predicted_peak_bytes (N, N, N, N));
+
+    size_t m = N / 2;
+    size_t block = allocation_bytes (m * m * sizeof (T));
+    size_t tasks = (threads > 1) ? ((threads - 1 < 7) ? threads - 1 : 7) : 1;
+
+    return (pads + allocation_bytes (N * N * sizeof (T)) + ((21 - tasks) * block)
+            + (tasks * strassen_matrix_multiplier<T>::__predicted_mult_bytes (m, threshold)));
+  }
+
+  template <typename T>
+  T*
+  parallel_strassen_matrix_multiplier<T>::square (const T *a, size_t n)
+  {
+    return (mult (a, a, n, n, n, n));
+  }
+
+  template <typename T>
+  T*
+  parallel_strassen_matrix_multiplier<T>::pow (const T *a, size_t n, size_t k, double tolerance)
+  {
+    return (matrix_multiplier<T>::pow (a, n, k, tolerance));
   }
 
   /**
@@ -146,45 +261,42 @@ namespace strassen
 						size_t arows, size_t acols,
 						size_t brows, size_t bcols)
   {
+    this->__begin ();
+
     /* Make sure this is a valid multiplication */
     if (acols == brows)
       {
         /* Check to see if these matrices are already square and have dimensions of a power of 2. If not,
         * the matrices must be resized and padded with zeroes to meet this criteria. */
-        if (arows == acols && brows == bcols && !(arows & (arows - 1)))
+        if (arows == acols && acols == bcols && !(arows & (arows - 1)))
           {
             /* Call __mult with an ID of 0 */
             T *C = __mult (m, n, arows, 0);
+            this->__phase (PHASE_NONE);
             return C;
           }
         else
           {
-            size_t N;
-            size_t max_term = acols;
+            size_t N = this->padded_size (arows, acols, brows, bcols);
 
             T *A = NULL;
             T *B = NULL;
             T *C = NULL;
+            T *D = NULL;
 
-            if (arows >= acols && arows >= brows)
-              max_term = arows;
-            else if (acols >= arows && acols >= bcols)
-              max_term = acols;
-            else if (brows >= bcols && brows >= arows)
-              max_term = brows;
-            else if (bcols >= brows && bcols >= acols)
-              max_term = bcols;
-            
-            /* Find the nearest power of 2 greater than the largest dimension of these matrices */
-            N = std::pow (2, (size_t) (std::log (max_term) / strassen_matrix_multiplier<T>::__log2) + 1);
+            this->__phase (PHASE_PAD);
 
-            /* If m needs padding, pad it */
-            if (arows != acols || arows & (arows - 1))
-              A = this->__pad (m, arows, acols, N);
-            
-            /* If n needs padding, pad it */
-            if (brows != bcols || brows & (brows - 1))
-              B = this->__pad (n, brows, bcols, N);
+            {
+              STRASSEN_TRACE_SCOPE ("pad", N);
+
+              /* If m needs padding, pad it */
+              if (arows != N || acols != N)
+                A = this->__pad (m, arows, acols, N, this->__row_threads);
+
+              /* If n needs padding, pad it */
+              if (brows != N || bcols != N)
+                B = this->__pad (n, brows, bcols, N, this->__row_threads);
+            }
 
             /* __mult does the actual multiplication work - call with ID of 0 to identify this as the
             * main thread. */
@@ -197,15 +309,18 @@ namespace strassen
 
             /* Extract the non-zero elements out of C and put them into a new matrix D which is 
             * of the size arows x bcols */
-            T *D = this->__unpad (C, arows, arows, N);
-            
-            if (A)
-              free (A);
+            this->__phase (PHASE_UNPAD);
 
-            if (B)
-              free (B);
+            {
+              STRASSEN_TRACE_SCOPE ("unpad", N);
+              D = this->__unpad (C, arows, bcols, N, this->__row_threads);
+            }
+            
+            this->__free (A);
+            this->__free (B);
+            this->__free (C);
 
-            free (C);
+            this->__phase (PHASE_NONE);
             
             return D;
           }
@@ -225,31 +340,26 @@ namespace strassen
   parallel_strassen_matrix_multiplier<T>::__mult (const T *A, const T *B, size_t n, uint32_t id)
   { 
     /* If the given matrices are small, its more efficient to use the transpose naive algorithm. */
-    if (n <= STRASSEN_THRESHOLD)
+    if (n <= this->__threshold)
       {
-	      return (__tmm.mult (A, B, n, n, n, n));
-      }
+        STRASSEN_TRACE_SCOPE ("leaf", n);
 
-    size_t m = n / 2;
+        /* Only the calling thread reports its phases */
+        if (!id)
+          this->__phase (PHASE_LEAF);
 
-    /* Top left submatrix */
-    size_t tl_row_start = 0;
-    size_t tl_col_start = 0;
+	      return (__tmm.mult (A, B, n, n, n, n));
+      }
 
-    /* Top right submatrix */
-    size_t tr_row_start = 0;
-    size_t tr_col_start = m;
+    STRASSEN_TRACE_SCOPE ("operands", n);
 
-    /* Bottom left submatrix */
-    size_t bl_row_start = m;
-    size_t bl_col_start = 0;
+    if (!id)
+      this->__phase (PHASE_OPERANDS);
 
-    /* Bottom right submatrix */
-    size_t br_row_start = m;
-    size_t br_col_start = m;
+    size_t m = n / 2;
 
     /* The output matrix */
-    T *C = (T *) malloc (n * n * sizeof (T));
+    T *C = this->__alloc (n * n);
 
     T* AA[7]; /* Submatrix blocks for A */
     T* BB[7]; /* Submatrix blocks for B */
@@ -259,9 +369,11 @@ namespace strassen
       {
         /* Make sure that neither A or B consist entirely of zeroes. If so, easy; nullify the
         * contents of C and return. */
-        if ((!A[0] && !A[1] && this->__zeroes (A, n)) || (!B[0] && !B[1] && this->__zeroes (B, n)))
+        if ((A[0] == T () && A[1] == T () && this->__zeroes (A, n))
+            || (B[0] == T () && B[1] == T () && this->__zeroes (B, n)))
           {
-            memset (C, 0, n * n * sizeof (T));
+            for (size_t i = 0; i < n * n; i++)
+              C[i] = T ();
             return C;
           }
       }
@@ -269,99 +381,63 @@ namespace strassen
     /* Make room for the submatrices */
     for (uint32_t i = 0; i < 7; i++)
       {
-        AA[i] = (T *) malloc (m * m * sizeof (T));
-        BB[i] = (T *) malloc (m * m * sizeof (T));	
+        AA[i] = this->__alloc (m * m);
+        BB[i] = this->__alloc (m * m);
       }
 
-    /*
-     * The output matrix C is expressed in terms of the block matrices M1..M7
-     *
-     * C1,1 = M1 + M4 - M5 + M7
-     * C1,2 = M3 + M5
-     * C2,1 = M2 + M4
-     * C2,2 = M1 - M2 + M3 + M6
-     * 
-     * Each of the block matrices M1..M7 is composed of quadrants from A and B as follows:
-     * 
-     * M1 = AA[0] * BB[0] = (A1,1 + A2,2)(B1,1 + B2,2)
-     * M2 = AA[1] * BB[1] = (A2,1 + A2,2)(B1,1)
-     * M3 = AA[2] * BB[2] = (A1,1)(B1,2 - B2,2)
-     * M4 = AA[3] * BB[3] = (A2,2)(B2,1 - B1,1)
-     * M5 = AA[4] * BB[4] = (A1,1 + A1,2)(B2,2)
-     * M6 = AA[5] * BB[5] = (A2,1 - A1,1)(B1,1 + B1,2)
-     * M7 = AA[6] * BB[6] = (A1,2 - A2,2)(B2,1 + B2,2)
-     */
+    /* Only the main thread divides the phases of its level between threads; the workers are busy below it */
+    size_t threads = id ? 1 : this->__row_threads;
 
-    /* AA[0] = (A1,1 + A2,2) */
-    this->__submatrix_add (AA[0], A, tl_row_start, tl_col_start, br_row_start, br_col_start, m, n);
-    /* AA[1] = (A2,1 + A2,2) */
-    this->__submatrix_add (AA[1], A, bl_row_start, bl_col_start, br_row_start, br_row_start, m, n);
-    /* AA[2] = (A1,1) */
-    this->__submatrix_cpy (AA[2], A, tl_row_start, tl_col_start, m, n);
-    /* AA[3] = (A2,2) */
-    this->__submatrix_cpy (AA[3], A, br_row_start, br_col_start, m, n);
-    /* AA[4] = (A1,1 + A1,2) */
-    this->__submatrix_add (AA[4], A, tl_row_start, tl_col_start, tr_row_start, tr_col_start, m, n);
-    /* AA[5] = (A2,1 - A1,1) */
-    this->__submatrix_sub (AA[5], A, bl_row_start, bl_col_start, tl_row_start, tl_col_start, m, n);
-    /* AA[6] = (A1,2 - A2,2) */
-    this->__submatrix_sub (AA[6], A, tr_row_start, tr_col_start, br_row_start, br_col_start, m, n);
-
-    /* BB[0] = (B1,1 + B2,2) */
-    this->__submatrix_add (BB[0], B, tl_row_start, tl_col_start, br_row_start, br_col_start, m, n);
-    /* BB[1] = (B1,1) */
-    this->__submatrix_cpy (BB[1], B, tl_row_start, tl_col_start, m, n);
-    /* BB[2] = (B1,2 - B2,2) */
-    this->__submatrix_sub (BB[2], B, tr_row_start, tr_col_start, br_row_start, br_col_start, m, n);
-    /* BB[3] = (B2,1 - B1,1) */
-    this->__submatrix_sub (BB[3], B, bl_row_start, bl_col_start, tl_row_start, tl_col_start, m, n);
-    /* BB[4] = (B2,2) */
-    this->__submatrix_cpy (BB[4], B, br_row_start, br_col_start, m, n);
-    /* BB[5] = (B1,1 + B1,2) */
-    this->__submatrix_add (BB[5], B, tl_row_start, tl_col_start, tr_row_start, tr_col_start, m, n); 
-    /* BB[6] = (B2,1 + B2,2) */
-    this->__submatrix_add (BB[6], B, bl_row_start, bl_col_start, br_row_start, br_col_start, m, n);
+    this->__operands (AA, BB, A, B, m, n, threads);
     
+    size_t tasks = (__nthreads - 1 < 7) ? __nthreads - 1 : 7;
+
     /* If the thread ID is zero, this is the main thread */
-    if (!id)
+    if (!id && tasks)
       {	    
         pthread_mutex_lock (__lock);
-        __cntr = 7;
-        pthread_mutex_unlock (__lock);
+        __cntr = tasks;
 
-        /* Copy the above submatrix data into the global thread data structures. Each thread
-        * from 1 - 7 corresponds to an AA[i], BB[i], and MM[i] which they will process in parallel. */
-        for (uint32_t i = 0; i < (__nthreads - 1); i++)
+        /* Copy the above submatrix data into the global thread data structures. Worker i computes
+        * MM[i - 1], MM[i - 1 + tasks], ... from the corresponding AA and BB, in parallel with the others. */
+        for (uint32_t i = 0; i < tasks; i++)
           {
-            __thread_data[i]->A = AA[i]; /* The A submatrix data */
-            __thread_data[i]->B = BB[i]; /* The B submatrix data */
-            __thread_data[i]->C = MM[i]; /* The M data */
+            __thread_data[i]->AA = AA;
+            __thread_data[i]->BB = BB;
+            __thread_data[i]->MM = MM;
+            __thread_data[i]->first = i;
+            __thread_data[i]->stride = tasks;
             __thread_data[i]->m = m;     /* The current size of the submatrices */
+            __thread_data[i]->pending = true;
 
             /* Wake this thread up */
             pthread_cond_signal (__cond[i]);
           }	
+
+        pthread_mutex_unlock (__lock);
             
+        STRASSEN_TRACE_NEXT ("wait");
+        this->__phase (PHASE_WAIT);
+
         pthread_mutex_lock (__lock);
             
-        /* Wait here for all the threads to complete their work */
+        /* Wait here for all the threads to complete their work, which they leave in MM */
         while (__cntr)
           pthread_cond_wait (__main_cond, __lock);
 
-        /* Copy back the completed data */
-        MM[0] = __thread_data[0] -> C;
-        MM[1] = __thread_data[1] -> C;
-        MM[2] = __thread_data[2] -> C;
-        MM[3] = __thread_data[3] -> C;
-        MM[4] = __thread_data[4] -> C;
-        MM[5] = __thread_data[5] -> C;
-        MM[6] = __thread_data[6] -> C;
-            
         pthread_mutex_unlock (__lock);
+
+        STRASSEN_TRACE_NEXT ("combine");
+        this->__phase (PHASE_COMBINE);
       }
     else
       {
-        /* This is a worker thread - do the M multiplications as necessary */
+        STRASSEN_TRACE_NEXT ("recurse");
+
+        /* This is a worker thread, or the main thread without workers - do the M multiplications as necessary.
+         * The main thread recurses as a worker would, with an ID which is not its own. */
+        id = id ? id : 1;
+
         MM[0] = __mult (AA[0], BB[0], m, id);
         MM[1] = __mult (AA[1], BB[1], m, id);
         MM[2] = __mult (AA[2], BB[2], m, id);
@@ -369,34 +445,66 @@ namespace strassen
         MM[4] = __mult (AA[4], BB[4], m, id);
         MM[5] = __mult (AA[5], BB[5], m, id);
         MM[6] = __mult (AA[6], BB[6], m, id);
-      }
 
-    /* C1,1 = M1 + M4 - M5 + M7 */
-    this->__submatrix_add (C, MM[0], MM[3], tl_row_start, tl_col_start, m, n);
-    this->__submatrix_sub (C, MM[4], tl_row_start, tl_col_start, m, n);
-    this->__submatrix_add (C, MM[6], tl_row_start, tl_col_start, m, n);
-    
-    /* C1,2 = M3 + M5 */
-    this->__submatrix_add (C, MM[2], MM[4], tr_row_start, tr_col_start, m, n);
+        STRASSEN_TRACE_NEXT ("combine");
+      }
 
-    /* C2,1 = M2 + M4 */
-    this->__submatrix_add (C, MM[1], MM[3], bl_row_start, bl_col_start, m,  n);
-    
-    /* C2,2 = M1 - M2 + M3 + M6 */
-    this->__submatrix_sub (C, MM[0], MM[1], br_row_start, br_col_start, m, n);
-    this->__submatrix_add (C, MM[2], br_row_start, br_col_start, m, n);
-    this->__submatrix_add (C, MM[5], br_row_start, br_col_start, m, n);
+    this->__combine (C, MM, m, n, threads);
 
     for (uint32_t i = 0; i < 7; i++)
       {
-        free (AA[i]);
-        free (BB[i]);
-        free (MM[i]);
+        this->__free (AA[i]);
+        this->__free (BB[i]);
+        this->__free (MM[i]);
       }
 
     return C;
   }
 
+  template <typename T>
+  void
+  parallel_strassen_matrix_multiplier<T>::__rows_parallel (size_t rows, size_t threads,
+                                                           const std::function<void (size_t, size_t)> &f)
+  {
+    size_t blocks = __nthreads;
+
+    if (rows < blocks || blocks < 2)
+      {
+        f (0, rows);
+        return;
+      }
+
+    pthread_mutex_lock (__lock);
+
+    __cntr = __nthreads - 1;
+
+    for (uint32_t i = 0; i < (__nthreads - 1); i++)
+      {
+        __thread_data[i]->rows = &f;
+        __thread_data[i]->i0 = (rows * (i + 1)) / blocks;
+        __thread_data[i]->i1 = (rows * (i + 2)) / blocks;
+        __thread_data[i]->pending = true;
+
+        pthread_cond_signal (__cond[i]);
+      }
+
+    pthread_mutex_unlock (__lock);
+
+    f (0, rows / blocks);
+
+    STRASSEN_TRACE_SCOPE ("wait", rows);
+
+    pthread_mutex_lock (__lock);
+
+    while (__cntr)
+      pthread_cond_wait (__main_cond, __lock);
+
+    for (uint32_t i = 0; i < (__nthreads - 1); i++)
+      __thread_data[i]->rows = NULL;
+
+    pthread_mutex_unlock (__lock);
+  }
+
   /**
    * Loop for worker threads. Waits here until signalled by the main thread that
    * its thread data is ready for processing.
@@ -414,18 +522,38 @@ namespace strassen
         if (!__cntr)
           pthread_cond_broadcast (__main_cond);
         
-        /* Wait here for work */
-        pthread_cond_wait (__cond[id - 1], __lock);
+        /* Wait here for work; a wakeup without any, spurious or not, goes back to waiting */
+        {
+          STRASSEN_TRACE_SCOPE ("idle", 0);
+
+          while (!__thread_data[id-1]->pending && __loop)
+            pthread_cond_wait (__cond[id - 1], __lock);
+        }
+
+        __thread_data[id-1]->pending = false;
         pthread_mutex_unlock (__lock);
 
         if (!__loop)
           break;
-              
-        /* Begin recursively multiplying using the supplied thread data */
-        __thread_data[id-1]->C = __mult (__thread_data[id-1]->A, 
-                __thread_data[id-1]->B, 
-                __thread_data[id-1]->m, 
-                id);	
+
+        if (__thread_data[id-1]->rows)
+          {
+            STRASSEN_TRACE_SCOPE ("rows", __thread_data[id-1]->i1 - __thread_data[id-1]->i0);
+
+            (*__thread_data[id-1]->rows) (__thread_data[id-1]->i0, __thread_data[id-1]->i1);
+            continue;
+          }
+
+        /* Begin recursively multiplying using the supplied thread data. Each task sits one level below
+         * the main thread's top-level multiplication, and is traced as such. */
+        psmm_pair<T> *d = __thread_data[id-1];
+
+        for (size_t i = d->first; i < 7; i += d->stride)
+          {
+            STRASSEN_TRACE_SCOPE ("task", d->m);
+
+            d->MM[i] = __mult (d->AA[i], d->BB[i], d->m, id);
+          }
       }
   }
 }
@@ -0,0 +1,43 @@
+#ifndef PHASE_OBSERVER_HPP_
+#define PHASE_OBSERVER_HPP_
+
+namespace strassen
+{
+  /**
+   * The phases a Strassen multiplication moves through. Every level of the recursion forms its operand
+   * submatrices, recurses (or, below the threshold, does a leaf multiplication) and combines the products.
+   */
+  enum mult_phase
+    {
+      PHASE_NONE = 0,   /* Outside of any multiplication */
+      PHASE_PAD,        /* Padding the inputs to a power of two */
+      PHASE_OPERANDS,   /* Forming the AA[i] and BB[i] operand sums */
+      PHASE_LEAF,       /* Multiplying below the Strassen threshold */
+      PHASE_COMBINE,    /* Combining the M products into C */
+      PHASE_WAIT,       /* Waiting for worker threads */
+      PHASE_UNPAD,      /* Extracting the result from the padded product */
+      NUM_PHASES
+    };
+
+  /**
+   * A phase_observer is told each time a multiplier moves into a new phase. Each call ends the previous
+   * phase, and a multiplication ends with PHASE_NONE. Multipliers only report the phases of the thread
+   * that called mult (), so observers need not be thread-safe.
+   */
+  class phase_observer
+  {
+  public:
+    virtual void phase (mult_phase p) = 0;
+    virtual ~phase_observer () {}
+  };
+
+  inline const char*
+  phase_name (mult_phase p)
+  {
+    static const char *names[NUM_PHASES] = { "none", "pad", "operands", "leaf", "combine", "wait", "unpad" };
+
+    return names[p];
+  }
+}
+
+#endif /* PHASE_OBSERVER_HPP_ */
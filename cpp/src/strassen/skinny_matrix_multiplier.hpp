@@ -0,0 +1,392 @@
+#ifndef SKINNY_MATRIX_MULTIPLIER_HPP_
+#define SKINNY_MATRIX_MULTIPLIER_HPP_
+
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <vector>
+
+#include "matrix_multiplier.hpp"
+#include "transpose.hpp"
+
+namespace strassen
+{
+  /* A product is skinny when one of its dimensions is at most this */
+  const size_t SKINNY_MAX = 16;
+
+  /* Multiply-adds below which a skinny product is not worth another thread */
+  const size_t SKINNY_PARALLEL_MIN = 1 << 18;
+
+  /* Partial sums kept by the dot product kernel, which the compiler can hold in one or two vector registers */
+  const size_t SKINNY_LANES = 8;
+
+  /**
+   * A skinny_matrix_multiplier multiplies products with a tiny dimension: matrix-vector products (n = 1 or
+   * m = 1), and products with at most SKINNY_MAX rows of A, columns of B, or terms per element (k). Padding
+   * these to a square for Strassen, or transposing a large B for the transpose kernel, costs more than the
+   * product itself. Instead:
+   *
+   * - with few columns of B and more terms, each element of C is a dot product of a row of A and a column of
+   *   B, the few columns of B being copied into rows once; the dot product keeps SKINNY_LANES partial sums,
+   *   so that it runs on vector registers without reassociating a floating point sum;
+   * - otherwise each row of C is a combination of the rows of B, weighted by a row of A, an inner loop
+   *   without any reduction which the compiler vectorizes as it is.
+   *
+   * Large enough products are divided between threads, by rows of C or, when C has few rows, by columns.
+   * gemv () computes A x directly for an operand in either layout.
+   */
+  template <typename T>
+  class skinny_matrix_multiplier : public strassen::matrix_multiplier<T>
+  {
+  private:
+    size_t __threads;
+
+    /* The part of a product one thread computes: rows [i0, i1) and columns [j0, j1) of C */
+    struct band
+    {
+      const T *A;
+      const T *B;
+      T *C;
+      size_t m;
+      size_t k;
+      size_t n;
+      size_t i0;
+      size_t i1;
+      size_t j0;
+      size_t j1;
+      void (*kernel) (const band &b);
+    };
+
+    static void* __band_entry (void *p);
+    static void __run (band &whole, size_t threads, bool by_rows);
+
+    static T __dot (const T *a, const T *b, size_t k);
+    static void __dot_kernel (const band &b);
+    static void __axpy_kernel (const band &b);
+    static void __gemv_columns_kernel (const band &b);
+
+  public:
+    /* Use up to threads threads, or one per processor if 0 */
+    skinny_matrix_multiplier (size_t threads = 0);
+
+    T* mult (const T *a, const T *b, size_t arows, size_t acols, size_t brows, size_t bcols);
+    matrix_multiplier<T>* copy () const;
+
+    size_t threads () const;
+    void threads (size_t t);
+
+    /* Whether an m x k by k x n product has a dimension small enough for this multiplier */
+    static bool suits (size_t m, size_t k, size_t n);
+
+    /* Threads a product of these dimensions is divided between, given up to threads */
+    static size_t threads_for (size_t m, size_t k, size_t n, size_t threads);
+
+    /**
+     * Writes y = A x, for A m x k in the given layout, on up to threads threads (0 for one per processor).
+     * Nothing is allocated.
+     */
+    static void gemv (const T *A, matrix_layout al, const T *x, T *y, size_t m, size_t k, size_t threads = 0);
+
+    static size_t predicted_peak_bytes (size_t arows, size_t acols, size_t brows, size_t bcols);
+  };
+
+  /* Asked of the system once, as sysconf () reads /sys each time, which takes longer than a small product */
+  inline size_t
+  skinny_processors ()
+  {
+    static const long cpus = sysconf (_SC_NPROCESSORS_ONLN);
+
+    return ((cpus > 0) ? cpus : 1);
+  }
+
+  template <typename T>
+  skinny_matrix_multiplier<T>::skinny_matrix_multiplier (size_t threads)
+    : __threads (threads ? threads : skinny_processors ())
+  {
+  }
+
+  template <typename T>
+  matrix_multiplier<T>*
+  skinny_matrix_multiplier<T>::copy () const
+  {
+    return (new skinny_matrix_multiplier<T> (__threads));
+  }
+
+  template <typename T>
+  size_t
+  skinny_matrix_multiplier<T>::threads () const
+  {
+    return __threads;
+  }
+
+  template <typename T>
+  void
+  skinny_matrix_multiplier<T>::threads (size_t t)
+  {
+    __threads = t ? t : skinny_processors ();
+  }
+
+  template <typename T>
+  bool
+  skinny_matrix_multiplier<T>::suits (size_t m, size_t k, size_t n)
+  {
+    return (m <= SKINNY_MAX || k <= SKINNY_MAX || n <= SKINNY_MAX);
+  }
+
+  template <typename T>
+  size_t
+  skinny_matrix_multiplier<T>::threads_for (size_t m, size_t k, size_t n, size_t threads)
+  {
+    size_t t = ((double) m * k * n) / SKINNY_PARALLEL_MIN;
+
+    if (t > threads)
+      t = threads;
+
+    return (t ? t : 1);
+  }
+
+  /**
+   * The dot product form copies the few columns of B into rows, unless there is only one, which are all it
+   * allocates besides C.
+   */
+  template <typename T>
+  size_t
+  skinny_matrix_multiplier<T>::predicted_peak_bytes (size_t arows, size_t acols, size_t brows, size_t bcols)
+  {
+    if (acols != brows)
+      return 0;
+
+    size_t bytes = allocation_bytes (arows * bcols * sizeof (T));
+
+    if (bcols > 1 && bcols <= SKINNY_MAX && bcols < acols)
+      bytes += allocation_bytes (brows * bcols * sizeof (T));
+
+    return bytes;
+  }
+
+  template <typename T>
+  T*
+  skinny_matrix_multiplier<T>::mult (const T *a, const T *b, size_t arows, size_t acols, size_t brows, size_t bcols)
+  {
+    this->__begin ();
+
+    if (acols != brows)
+      return NULL;
+
+    T *C = this->__alloc (arows * bcols);
+
+    if (!C)
+      return NULL;
+
+    band whole = { a, b, C, arows, acols, bcols, 0, arows, 0, bcols, NULL };
+    size_t threads = threads_for (arows, acols, bcols, __threads);
+    T *Bt = NULL;
+
+    if (bcols <= SKINNY_MAX && bcols < acols)
+      {
+        /* A column of one column is already a row */
+        if (bcols > 1)
+          {
+            Bt = this->__alloc (brows * bcols);
+
+            if (!Bt)
+              {
+                this->__free (C);
+                return NULL;
+              }
+
+            transpose_blocked (b, Bt, brows, bcols);
+            whole.B = Bt;
+          }
+
+        whole.kernel = __dot_kernel;
+      }
+    else
+      whole.kernel = __axpy_kernel;
+
+    __run (whole, threads, arows >= threads * SKINNY_MAX || arows >= bcols);
+
+    this->__free (Bt);
+
+    return C;
+  }
+
+  template <typename T>
+  void
+  skinny_matrix_multiplier<T>::gemv (const T *A, matrix_layout al, const T *x, T *y, size_t m, size_t k,
+                                     size_t threads)
+  {
+    band whole = { A, x, y, m, k, 1, 0, m, 0, 1, NULL };
+
+    /* Row-major rows are dot products with x; column-major columns are scaled by x and summed */
+    whole.kernel = (al == ROW_MAJOR) ? __dot_kernel : __gemv_columns_kernel;
+
+    __run (whole, threads_for (m, k, 1, threads ? threads : skinny_processors ()), true);
+  }
+
+  /**
+   * Divides whole between threads by rows or columns of C and runs its kernel on each part, one of them on
+   * the calling thread.
+   */
+  template <typename T>
+  void
+  skinny_matrix_multiplier<T>::__run (band &whole, size_t threads, bool by_rows)
+  {
+    size_t extent = by_rows ? whole.m : whole.n;
+
+    if (threads > extent)
+      threads = extent;
+
+    if (threads <= 1)
+      {
+        whole.kernel (whole);
+        return;
+      }
+
+    std::vector<band> parts (threads);
+    std::vector<pthread_t> tids (threads);
+    std::vector<bool> spawned (threads, false);
+
+    for (size_t t = 0; t < threads; t++)
+      {
+        size_t lo = (extent * t) / threads;
+        size_t hi = (extent * (t + 1)) / threads;
+
+        parts[t] = whole;
+
+        if (by_rows)
+          {
+            parts[t].i0 = lo;
+            parts[t].i1 = hi;
+          }
+        else
+          {
+            parts[t].j0 = lo;
+            parts[t].j1 = hi;
+          }
+
+        if (t)
+          {
+            spawned[t] = !pthread_create (&tids[t], NULL, __band_entry, &parts[t]);
+
+            if (!spawned[t])
+              perror ("skinny_matrix_multiplier: pthread_create");
+          }
+      }
+
+    whole.kernel (parts[0]);
+
+    for (size_t t = 1; t < threads; t++)
+      {
+        if (spawned[t])
+          pthread_join (tids[t], NULL);
+        else
+          parts[t].kernel (parts[t]);
+      }
+  }
+
+  template <typename T>
+  void*
+  skinny_matrix_multiplier<T>::__band_entry (void *p)
+  {
+    band *b = (band *) p;
+    b->kernel (*b);
+
+    return NULL;
+  }
+
+  template <typename T>
+  T
+  skinny_matrix_multiplier<T>::__dot (const T *a, const T *b, size_t k)
+  {
+    T s[SKINNY_LANES];
+    size_t p = 0;
+
+    for (size_t q = 0; q < SKINNY_LANES; q++)
+      s[q] = T ();
+
+    for (; p + SKINNY_LANES <= k; p += SKINNY_LANES)
+      {
+        for (size_t q = 0; q < SKINNY_LANES; q++)
+          s[q] += a[p + q] * b[p + q];
+      }
+
+    for (; p < k; p++)
+      s[0] += a[p] * b[p];
+
+    T t = T ();
+
+    for (size_t q = 0; q < SKINNY_LANES; q++)
+      t += s[q];
+
+    return t;
+  }
+
+  /**
+   * C[i, j] = A[i, :] . Bt[j, :], with each row of A read once for all of the few columns.
+   */
+  template <typename T>
+  void
+  skinny_matrix_multiplier<T>::__dot_kernel (const band &b)
+  {
+    for (size_t i = b.i0; i < b.i1; i++)
+      {
+        const T *a_row = &b.A[i * b.k];
+        T *c_row = &b.C[i * b.n];
+
+        for (size_t j = b.j0; j < b.j1; j++)
+          c_row[j] = __dot (a_row, &b.B[j * b.k], b.k);
+      }
+  }
+
+  /**
+   * C[i, :] = sum over p of A[i, p] B[p, :], over the band's columns.
+   */
+  template <typename T>
+  void
+  skinny_matrix_multiplier<T>::__axpy_kernel (const band &b)
+  {
+    for (size_t i = b.i0; i < b.i1; i++)
+      {
+        const T *a_row = &b.A[i * b.k];
+        T *c_row = &b.C[i * b.n];
+
+        for (size_t j = b.j0; j < b.j1; j++)
+          c_row[j] = T ();
+
+        for (size_t p = 0; p < b.k; p++)
+          {
+            T a = a_row[p];
+            const T *b_row = &b.B[p * b.n];
+
+            for (size_t j = b.j0; j < b.j1; j++)
+              c_row[j] += a * b_row[j];
+          }
+      }
+  }
+
+  /**
+   * y = sum over p of x[p] A[:, p], for A stored by columns, over the band's rows.
+   */
+  template <typename T>
+  void
+  skinny_matrix_multiplier<T>::__gemv_columns_kernel (const band &b)
+  {
+    T *y = b.C;
+
+    for (size_t i = b.i0; i < b.i1; i++)
+      y[i] = T ();
+
+    for (size_t p = 0; p < b.k; p++)
+      {
+        T x = b.B[p];
+        const T *col = &b.A[p * b.m];
+
+        for (size_t i = b.i0; i < b.i1; i++)
+          y[i] += x * col[i];
+      }
+  }
+}
+
+#endif /* SKINNY_MATRIX_MULTIPLIER_HPP_ */
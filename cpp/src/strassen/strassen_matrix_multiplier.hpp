@@ -1,63 +1,230 @@
 #ifndef STRASSEN_MATRIX_MULTIPLIER_HPP_
 #define STRASSEN_MATRIX_MULTIPLIER_HPP_
 
-#include <cmath>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <functional>
+#include <utility>
+#include <vector>
+
 #include "matrix_multiplier.hpp"
+#include "transpose_matrix_multiplier.hpp"
+#include "phase_observer.hpp"
+#include "trace.hpp"
 
 namespace strassen
 {
   const size_t STRASSEN_THRESHOLD = 128;
 
+  /* Elements an O(n^2) phase (padding, operand formation, combining) must touch to be divided between threads */
+  const size_t STRASSEN_PARALLEL_ROWS_MIN = 1 << 18;
+
+  /* Rows [i0, i1) of a phase, for a thread started by strassen_matrix_multiplier::__rows_parallel () */
+  struct strassen_row_block
+  {
+    const std::function<void (size_t, size_t)> *f;
+    size_t i0;
+    size_t i1;
+  };
+
+  inline void*
+  strassen_row_block_entry (void *p)
+  {
+    strassen_row_block *b = (strassen_row_block *) p;
+    (*b->f) (b->i0, b->i1);
+
+    return NULL;
+  }
+
   /**
    * The strassen_matrix_multiplier class multiplies two matrices over a given size together using the Strassen
    * Algorithm for matrix multiplication. 
+   *
+   * Operands which are not square with a power of 2 size are padded with zeroes up to the next power of 2.
+   * The recursion stops at submatrices of the threshold size given at construction (STRASSEN_THRESHOLD by
+   * default), which are multiplied by a transpose_matrix_multiplier.
+   *
+   * Squaring a matrix takes a path of its own: it is padded once rather than twice, and since the operand
+   * sums formed from A and B are then the same seven blocks, only those seven are formed, one of whose
+   * products is again a square. Powers are computed by repeated squaring on the padded matrix, which stays
+   * padded with zeroes throughout, in two pairs of buffers used alternately.
+   *
+   * The O(n^2) phases of each level (padding, forming the operand blocks, combining the products and
+   * removing the padding) go a row at a time, and those of large enough blocks are divided by rows between
+   * threads (), 1 by default.
    */
   template <typename T>
   class strassen_matrix_multiplier : public strassen::matrix_multiplier<T>
   {
   protected:
-    static double __log2;
+    /* Submatrices of this size or smaller are not divided any further */
+    size_t __threshold;
 
-    /* A transpose_matrix_multiplier for use on submatrices with size below the STRASSEN_THRESOLD defined above */
+    /* A transpose_matrix_multiplier for use on submatrices with size below the threshold */
     transpose_matrix_multiplier<T> __tmm;
 
-    T* __pad   (const T *m, size_t rows, size_t cols, size_t n);
-    T* __unpad (const T *m, size_t rows, size_t cols, size_t n);
-    T* __mult  (const T *A, const T *B, size_t n);
+    /* If set, told about each phase of the multiplication */
+    phase_observer *__observer;
 
-    bool __zeroes (const T *A, size_t n);
+    /* Threads the O(n^2) phases are divided between */
+    size_t __row_threads;
 
-    void __submatrix_add (T *C, const T *A,
-			  size_t a_row_start, size_t a_col_start, 
-			  size_t b_row_start, size_t b_col_start, 
-			  size_t m, size_t n);    
+    /**
+     * Calls f (i0, i1) on row blocks covering [0, rows), divided between up to threads threads if the phase
+     * touches at least STRASSEN_PARALLEL_ROWS_MIN elements, and at once on the calling thread otherwise.
+     */
+    template <typename F>
+    void __rows (size_t rows, size_t elements, size_t threads, const F &f);
 
-    void __submatrix_sub (T *C, const T *A, 
-			  size_t a_row_start, size_t a_col_start, 
-			  size_t b_row_start, size_t b_col_start, 
-			  size_t m, size_t n);
-    
-    void __submatrix_cpy (T *C, const T *A, size_t start, size_t end, size_t m, size_t n);
+    /* The division between threads for __rows (); this version starts threads - 1 threads for the call */
+    virtual void __rows_parallel (size_t rows, size_t threads, const std::function<void (size_t, size_t)> &f);
+
+    void __phase (mult_phase p);
+
+    static size_t __predicted_mult_bytes (size_t n, size_t threshold);
+    static size_t __predicted_square_bytes (size_t n, size_t threshold);
+
+    /* These divide their work between threads threads, as __rows () does */
+    T* __pad   (const T *m, size_t rows, size_t cols, size_t n, size_t threads = 1);
+    T* __unpad (const T *m, size_t rows, size_t cols, size_t n, size_t threads = 1);
+
+    /* These write the n x n product into C, or into a new array if C is NULL, and return it */
+    T* __mult   (const T *A, const T *B, size_t n, T *C = NULL);
+    T* __square (const T *A, size_t n, T *C = NULL);
+    T* __leaf   (const T *A, const T *B, size_t n, T *C);
+
+    void __operands (T * const *AA, T * const *BB, const T *A, const T *B, size_t m, size_t n, size_t threads = 1);
+    void __operands_a (T * const *AA, const T *A, size_t m, size_t n, size_t threads = 1);
+    void __operands_b (T * const *BB, const T *B, size_t m, size_t n, size_t threads = 1);
+    void __combine (T *C, T * const *MM, size_t m, size_t n, size_t threads = 1);
+
+    /* Rows [i0, i1) of the above */
+    static void __operands_a_rows (T * const *AA, const T *A, size_t m, size_t n, size_t i0, size_t i1);
+    static void __operands_b_rows (T * const *BB, const T *B, size_t m, size_t n, size_t i0, size_t i1);
+    static void __combine_rows (T *C, T * const *MM, size_t m, size_t n, size_t i0, size_t i1);
 
-    void __submatrix_add (T *C, const T *A, size_t row_start, size_t col_start, size_t m, size_t n);
-    void __submatrix_add (T *C, const T *A, const T *B, size_t row_start, size_t col_start, size_t m, size_t n);
-    void __submatrix_sub (T *C, const T *A, size_t row_start, size_t col_start, size_t m, size_t n);
-    void __submatrix_sub (T *C, const T *A, const T *B, size_t row_start, size_t col_start, size_t m, size_t n);
+    /* c = a + b, c = a - b and c = a over a row of m elements */
+    static void __row_add (T *c, const T *a, const T *b, size_t m);
+    static void __row_sub (T *c, const T *a, const T *b, size_t m);
+    static void __row_cpy (T *c, const T *a, size_t m);
+
+    bool __zeroes (const T *A, size_t n);
+
+    static size_t __predicted_prepared_mult_bytes (size_t n, size_t threshold);
+
+    void __prepare (const T *B, size_t n, size_t threshold, T *&leaf, char *&zero);
+    T* __mult_prepared (const T *A, const T *leaves, const char *zero, size_t n, size_t count, size_t leaf_size,
+                        T *C);
     
   public:
-    strassen_matrix_multiplier ();
+    strassen_matrix_multiplier (size_t threshold = STRASSEN_THRESHOLD);
     virtual ~strassen_matrix_multiplier ();
     
     virtual T* mult (const T *a, const T *b, size_t arows, size_t acols, size_t brows, size_t bcols);
     virtual matrix_multiplier<T>* copy () const;
+
+    virtual T* square (const T *a, size_t n);
+    virtual T* pow (const T *a, size_t n, size_t k, double tolerance = 0.0);
+
+    /**
+     * Prepares b by padding it, forming its operand blocks at every level of the recursion and transposing
+     * the leaf blocks, so that products with it only do the work on the first operand.
+     */
+    virtual prepared_operand<T>* prepare (const T *b, size_t brows, size_t bcols);
+    virtual T* mult_prepared (const T *a, const prepared_operand<T> &b, size_t arows);
+
+    /* Report the phases of subsequent multiplications to o, or to nobody if o is NULL */
+    void observe (phase_observer *o);
+
+    virtual void account (mem_account *a);
+
+    size_t threshold () const;
+    void threshold (size_t t);
+
+    size_t threads () const;
+    void threads (size_t t);
+
+    /* The size of the power of 2 square matrices to which operands of the given dimensions are padded */
+    static size_t padded_size (size_t arows, size_t acols, size_t brows, size_t bcols);
+
+    /**
+     * Peak bytes allocated by one call to mult () with these dimensions: the padded copies of the operands,
+     * plus the output, operand blocks and pending products of every level of the recursion down to the leaf,
+     * each counted with the most the allocator can round it up to (see allocation_bytes ()). This is an upper
+     * bound, which the peak comes within a page or so a buffer of unless some blocks turn out to be entirely
+     * zero.
+     */
+    static size_t predicted_peak_bytes (size_t arows, size_t acols, size_t brows, size_t bcols,
+                                        size_t threshold = STRASSEN_THRESHOLD);
+
+    /* Peak bytes allocated by one call to square () on an n x n matrix, or to mult () with a == b */
+    static size_t predicted_square_peak_bytes (size_t n, size_t threshold = STRASSEN_THRESHOLD);
+
+    /* Bytes held by the operand prepare () makes of a brows x bcols matrix */
+    static size_t predicted_prepared_bytes (size_t brows, size_t bcols, size_t threshold = STRASSEN_THRESHOLD);
+
+    /* Peak bytes allocated by one call to mult_prepared () with these dimensions */
+    static size_t predicted_prepared_peak_bytes (size_t arows, size_t brows, size_t bcols,
+                                                 size_t threshold = STRASSEN_THRESHOLD);
   };
 
+  /**
+   * An operand prepared by a strassen_matrix_multiplier: b padded to n x n, and the 7^depth blocks at the leaves
+   * of its recursion, each the transpose of the operand block BB that the leaf would multiply by, in the
+   * order the recursion visits them. Along with each leaf is whether it is all zeroes.
+   */
   template <typename T>
-  double strassen_matrix_multiplier<T>::__log2 = std::log (2.0);  
+  class strassen_prepared_operand : public prepared_operand<T>
+  {
+  private:
+    size_t __n;
+    size_t __threshold;
+    size_t __count;
+    size_t __leaf_size;
+    T *__leaves;
+    std::vector<char> __zero;
+
+    template <typename U> friend class strassen_matrix_multiplier;
+
+  public:
+    strassen_prepared_operand (size_t rows, size_t cols, size_t n, size_t threshold)
+      : prepared_operand<T> (rows, cols),
+        __n (n),
+        __threshold (threshold),
+        __count (1),
+        __leaf_size (n)
+    {
+      while (__leaf_size > threshold)
+        {
+          __leaf_size /= 2;
+          __count *= 7;
+        }
+
+      __leaves = (T *) aligned_malloc (__count * __leaf_size * __leaf_size * sizeof (T));
+      __zero.resize (__count);
+    }
+
+    ~strassen_prepared_operand ()
+    {
+      free (__leaves);
+    }
+
+    /* The padded size, which is also the most rows of a first operand multiplied at once */
+    size_t padded_size () const { return __n; }
+    size_t threshold () const { return __threshold; }
+
+    size_t bytes () const { return (__count * ((__leaf_size * __leaf_size * sizeof (T)) + 1)); }
+  };
 
   template <typename T>
-  strassen_matrix_multiplier<T>::strassen_matrix_multiplier ()
+  strassen_matrix_multiplier<T>::strassen_matrix_multiplier (size_t threshold)
+    : __threshold (threshold ? threshold : 1),
+      __observer (NULL),
+      __row_threads (1)
   {
+    __tmm.account (this->__account);
   }
 
   template <typename T>
@@ -69,7 +236,159 @@ namespace strassen
   matrix_multiplier<T>*
   strassen_matrix_multiplier<T>::copy () const
   {
-    return (new strassen_matrix_multiplier<T> ());
+    strassen_matrix_multiplier<T> *smm = new strassen_matrix_multiplier<T> (__threshold);
+    smm->threads (__row_threads);
+
+    return smm;
+  }
+
+  template <typename T>
+  size_t
+  strassen_matrix_multiplier<T>::threshold () const
+  {
+    return __threshold;
+  }
+
+  template <typename T>
+  void
+  strassen_matrix_multiplier<T>::threshold (size_t t)
+  {
+    __threshold = t ? t : 1;
+  }
+
+  template <typename T>
+  size_t
+  strassen_matrix_multiplier<T>::threads () const
+  {
+    return __row_threads;
+  }
+
+  template <typename T>
+  void
+  strassen_matrix_multiplier<T>::threads (size_t t)
+  {
+    __row_threads = t ? t : 1;
+  }
+
+  template <typename T>
+  void
+  strassen_matrix_multiplier<T>::observe (phase_observer *o)
+  {
+    __observer = o;
+  }
+
+  template <typename T>
+  void
+  strassen_matrix_multiplier<T>::account (mem_account *a)
+  {
+    matrix_multiplier<T>::account (a);
+    __tmm.account (this->__account);
+  }
+
+  template <typename T>
+  size_t
+  strassen_matrix_multiplier<T>::padded_size (size_t arows, size_t acols, size_t brows, size_t bcols)
+  {
+    size_t max_term = arows;
+
+    if (acols > max_term)
+      max_term = acols;
+
+    if (brows > max_term)
+      max_term = brows;
+
+    if (bcols > max_term)
+      max_term = bcols;
+
+    /* Find the nearest power of 2 no smaller than the largest dimension of these matrices */
+    size_t N = 1;
+
+    while (N < max_term)
+      N *= 2;
+
+    return N;
+  }
+
+  /**
+   * Peak bytes allocated by __mult on n x n operands. Above the threshold, the output and the 14 operand
+   * blocks are held while the products are computed one after another; the peak comes during the last of
+   * them, with the other 6 products held.
+   */
+  template <typename T>
+  size_t
+  strassen_matrix_multiplier<T>::__predicted_mult_bytes (size_t n, size_t threshold)
+  {
+    if (n <= threshold)
+      return (transpose_matrix_multiplier<T>::predicted_peak_bytes (n, n, n, n));
+
+    size_t m = n / 2;
+
+    return (allocation_bytes (n * n * sizeof (T)) + (20 * allocation_bytes (m * m * sizeof (T)))
+            + __predicted_mult_bytes (m, threshold));
+  }
+
+  template <typename T>
+  size_t
+  strassen_matrix_multiplier<T>::predicted_peak_bytes (size_t arows, size_t acols, size_t brows, size_t bcols,
+                                                       size_t threshold)
+  {
+    if (acols != brows)
+      return 0;
+
+    if (!threshold)
+      threshold = 1;
+
+    size_t N = padded_size (arows, acols, brows, bcols);
+    size_t pads = 0;
+
+    if (arows != N || acols != N)
+      pads += allocation_bytes (N * N * sizeof (T));
+
+    if (brows != N || bcols != N)
+      pads += allocation_bytes (N * N * sizeof (T));
+
+    /* The unpadded result is smaller than the recursion's own peak */
+    return (pads + __predicted_mult_bytes (N, threshold));
+  }
+
+  /**
+   * Peak bytes allocated by __square on an n x n operand. The first product is a square, taken with only
+   * the output and the 7 blocks held; the peak comes during the last, with 6 products held as well.
+   */
+  template <typename T>
+  size_t
+  strassen_matrix_multiplier<T>::__predicted_square_bytes (size_t n, size_t threshold)
+  {
+    if (n <= threshold)
+      return (transpose_matrix_multiplier<T>::predicted_peak_bytes (n, n, n, n));
+
+    size_t m = n / 2;
+    size_t whole = allocation_bytes (n * n * sizeof (T));
+    size_t block = allocation_bytes (m * m * sizeof (T));
+    size_t first = whole + (7 * block) + __predicted_square_bytes (m, threshold);
+    size_t last = whole + (13 * block) + __predicted_mult_bytes (m, threshold);
+
+    return (first > last ? first : last);
+  }
+
+  template <typename T>
+  size_t
+  strassen_matrix_multiplier<T>::predicted_square_peak_bytes (size_t n, size_t threshold)
+  {
+    if (!threshold)
+      threshold = 1;
+
+    size_t N = padded_size (n, n, n, n);
+
+    return ((N != n ? allocation_bytes (N * N * sizeof (T)) : 0) + __predicted_square_bytes (N, threshold));
+  }
+
+  template <typename T>
+  void
+  strassen_matrix_multiplier<T>::__phase (mult_phase p)
+  {
+    if (__observer)
+      __observer->phase (p);
   }
 
   /**
@@ -81,44 +400,45 @@ namespace strassen
 				       size_t arows, size_t acols,
 				       size_t brows, size_t bcols)
   {
+    this->__begin ();
+
+    /* A square gets a path of its own */
+    if (m == n && arows == acols && acols == bcols)
+      return (square (m, arows));
+
     /* Make sure this is a valid multiplication */
     if (acols == brows)
       {
         /* Check to see if these matrices are already square and have dimensions of a power of 2. If not,
         * the matrices must be resized and padded with zeroes to meet this criteria. */
-        if (arows == acols && brows == bcols && !(arows & (arows - 1)))
+        if (arows == acols && acols == bcols && !(arows & (arows - 1)))
           {
             T *C = __mult (m, n, arows);
+            __phase (PHASE_NONE);
             return C;
           }
         else
           {
-            size_t N;
-            size_t max_term = acols;
+            size_t N = padded_size (arows, acols, brows, bcols);
 
             T *A = NULL;
             T *B = NULL;
             T *C = NULL;
+            T *D = NULL;
 
-            if (arows >= acols && arows >= brows)
-              max_term = arows;
-            else if (acols >= arows && acols >= bcols)
-              max_term = acols;
-            else if (brows >= bcols && brows >= arows)
-              max_term = brows;
-            else if (bcols >= brows && bcols >= acols)
-              max_term = bcols;
-            
-            /* Find the nearest power of 2 greater than the largest dimension of these matrices */
-            N = std::pow (2, (size_t) (std::log (max_term) / __log2) + 1);
-            
-            /* If m needs padding, pad it */
-            if (arows != acols || arows & (arows - 1))
-              A = __pad (m, arows, acols, N);
-            
-            /* If n needs padding, pad it */
-            if (brows != bcols || brows & (brows - 1))
-              B = __pad (n, brows, bcols, N);
+            __phase (PHASE_PAD);
+
+            {
+              STRASSEN_TRACE_SCOPE ("pad", N);
+
+              /* If m needs padding, pad it */
+              if (arows != N || acols != N)
+                A = __pad (m, arows, acols, N, __row_threads);
+
+              /* If n needs padding, pad it */
+              if (brows != N || bcols != N)
+                B = __pad (n, brows, bcols, N, __row_threads);
+            }
 
             /* __mult does the actual multiplication work */
             if (A && B)
@@ -130,15 +450,18 @@ namespace strassen
 
             /* Extract the non-zero elements out of C and put them into a new matrix D which is 
             * of the size arows x bcols */
-            T *D = __unpad (C, arows, arows, N);
-            
-            if (A)
-              free (A);
+            __phase (PHASE_UNPAD);
 
-            if (B)
-              free (B);
+            {
+              STRASSEN_TRACE_SCOPE ("unpad", N);
+              D = __unpad (C, arows, bcols, N, __row_threads);
+            }
+            
+            this->__free (A);
+            this->__free (B);
+            this->__free (C);
 
-            free (C);
+            __phase (PHASE_NONE);
             
             return D;
           }
@@ -148,42 +471,420 @@ namespace strassen
   }
 
   /**
-   * Performs the actual strassen multiplication.
-   *
-   * The Strassen algorithm works by breaking the given matrices A and B into submatrices and 
-   * performing operations on those quadrants. This function will break apart A and B into those
-   * submatrices and recursively multiply them together using the same method.
+   * Squares the n x n matrix a, padding it once if n is not a power of 2.
    */
   template <typename T>
   T*
-  strassen_matrix_multiplier<T>::__mult (const T *A, const T *B, size_t n)
+  strassen_matrix_multiplier<T>::square (const T *a, size_t n)
   {
-    /* If the given matrices are small, its more efficient to use the transpose naive algorithm. */
-    if (n <= STRASSEN_THRESHOLD)
+    this->__begin ();
+
+    size_t N = padded_size (n, n, n, n);
+
+    if (N == n)
       {
-	      return (__tmm.mult (A, B, n, n, n, n));
+        T *C = __square (a, n);
+        __phase (PHASE_NONE);
+        return C;
+      }
+
+    T *A = NULL;
+    T *C = NULL;
+    T *D = NULL;
+
+    __phase (PHASE_PAD);
+
+    {
+      STRASSEN_TRACE_SCOPE ("pad", N);
+      A = __pad (a, n, n, N, __row_threads);
+    }
+
+    C = __square (A, N);
+
+    __phase (PHASE_UNPAD);
+
+    {
+      STRASSEN_TRACE_SCOPE ("unpad", N);
+      D = __unpad (C, n, n, N, __row_threads);
+    }
+
+    this->__free (A);
+    this->__free (C);
+
+    __phase (PHASE_NONE);
+
+    return D;
+  }
+
+  /**
+   * Raises the n x n matrix a to the power k as matrix_multiplier<T>::pow () does, but pads a only once: the
+   * powers of a zero-padded matrix are the zero-padded powers. The squares are written alternately into two
+   * buffers, and so are the accumulated products, so that no allocation is made per step beyond the scratch
+   * space of the recursion.
+   */
+  template <typename T>
+  T*
+  strassen_matrix_multiplier<T>::pow (const T *a, size_t n, size_t k, double tolerance)
+  {
+    if (k < 2)
+      return (matrix_multiplier<T>::pow (a, n, k, tolerance));
+
+    this->__begin ();
+
+    size_t N = padded_size (n, n, n, n);
+
+    T *P = NULL;
+    T *R = NULL;
+    bool have_result = false;
+
+    __phase (PHASE_PAD);
+
+    {
+      STRASSEN_TRACE_SCOPE ("pad", N);
+      P = __pad (a, n, n, N, __row_threads);
+    }
+
+    /* The buffers that P and R are alternately written into */
+    T *P2 = this->__alloc (N * N);
+    T *R2 = this->__alloc (N * N);
+    R = this->__alloc (N * N);
+
+    for (;;)
+      {
+        if (k & 1)
+          {
+            if (have_result)
+              {
+                __mult (R, P, N, R2);
+                std::swap (R, R2);
+              }
+            else
+              {
+                memcpy (R, P, N * N * sizeof (T));
+                have_result = true;
+              }
+          }
+
+        k >>= 1;
+
+        if (!k)
+          break;
+
+        __square (P, N, P2);
+        std::swap (P, P2);
+
+        if (tolerance > 0.0 && this->__converged (P, P2, N * N, tolerance))
+          {
+            std::swap (R, P);
+            break;
+          }
       }
 
+    T *D = R;
+
+    if (N != n)
+      {
+        __phase (PHASE_UNPAD);
+        STRASSEN_TRACE_SCOPE ("unpad", N);
+
+        D = __unpad (R, n, n, N, __row_threads);
+        this->__free (R);
+      }
+
+    this->__free (P);
+    this->__free (P2);
+    this->__free (R2);
+
+    __phase (PHASE_NONE);
+
+    return D;
+  }
+
+  template <typename T>
+  size_t
+  strassen_matrix_multiplier<T>::predicted_prepared_bytes (size_t brows, size_t bcols, size_t threshold)
+  {
+    size_t leaf = padded_size (brows, bcols, brows, bcols);
+    size_t count = 1;
+
+    if (!threshold)
+      threshold = 1;
+
+    while (leaf > threshold)
+      {
+        leaf /= 2;
+        count *= 7;
+      }
+
+    return (count * ((leaf * leaf * sizeof (T)) + 1));
+  }
+
+  /**
+   * Peak bytes allocated by __mult_prepared on an n x n operand: as __mult, without the 7 blocks of B at each
+   * level, or the transpose at the leaf.
+   */
+  template <typename T>
+  size_t
+  strassen_matrix_multiplier<T>::__predicted_prepared_mult_bytes (size_t n, size_t threshold)
+  {
+    if (n <= threshold)
+      return (2 * allocation_bytes (n * n * sizeof (T)));
+
     size_t m = n / 2;
 
-    /* Top left submatrix */
-    size_t tl_row_start = 0;
-    size_t tl_col_start = 0;
+    return (allocation_bytes (n * n * sizeof (T)) + (13 * allocation_bytes (m * m * sizeof (T)))
+            + __predicted_prepared_mult_bytes (m, threshold));
+  }
+
+  template <typename T>
+  size_t
+  strassen_matrix_multiplier<T>::predicted_prepared_peak_bytes (size_t arows, size_t brows, size_t bcols,
+                                                                size_t threshold)
+  {
+    if (!threshold)
+      threshold = 1;
+
+    size_t N = padded_size (brows, bcols, brows, bcols);
+    /* A block of rows of a is padded unless it is already N x N */
+    size_t pad = ((arows % N) || brows != N) ? allocation_bytes (N * N * sizeof (T)) : 0;
+
+    return (allocation_bytes (arows * bcols * sizeof (T)) + pad
+            + __predicted_prepared_mult_bytes (N, threshold));
+  }
+
+  /**
+   * Pads b to the next power of 2, as mult () would, and walks the recursion down to the leaves, forming the
+   * blocks of b at each level and keeping only those at the leaves. The memory the operand holds grows with
+   * the depth of the recursion, by 7/4 per level: (7/4)^depth times the padded b. The scratch space of this
+   * walk is allocated through the account, so usage () describes it.
+   */
+  template <typename T>
+  prepared_operand<T>*
+  strassen_matrix_multiplier<T>::prepare (const T *b, size_t brows, size_t bcols)
+  {
+    this->__begin ();
 
-    /* Top right submatrix */
-    size_t tr_row_start = 0;
-    size_t tr_col_start = m;
+    size_t N = padded_size (brows, bcols, brows, bcols);
+    strassen_prepared_operand<T> *p = new strassen_prepared_operand<T> (brows, bcols, N, __threshold);
 
-    /* Bottom left submatrix */
-    size_t bl_row_start = m;
-    size_t bl_col_start = 0;
+    if (!p->__leaves)
+      {
+        delete p;
+        return NULL;
+      }
 
-    /* Bottom right submatrix */
-    size_t br_row_start = m;
-    size_t br_col_start = m;
+    const T *B = b;
+    T *P = NULL;
+
+    if (brows != N || bcols != N)
+      {
+        P = __pad (b, brows, bcols, N, __row_threads);
+        B = P;
+      }
+
+    T *leaf = p->__leaves;
+    char *zero = &p->__zero[0];
+
+    __prepare (B, N, __threshold, leaf, zero);
+
+    this->__free (P);
+
+    return p;
+  }
+
+  template <typename T>
+  void
+  strassen_matrix_multiplier<T>::__prepare (const T *B, size_t n, size_t threshold, T *&leaf, char *&zero)
+  {
+    if (n <= threshold)
+      {
+        transpose_blocked (B, leaf, n, n);
+        *zero = __zeroes (B, n);
+
+        leaf += n * n;
+        zero++;
+        return;
+      }
+
+    size_t m = n / 2;
+    T *BB[7];
+
+    for (uint32_t i = 0; i < 7; i++)
+      BB[i] = this->__alloc (m * m);
+
+    __operands_b (BB, B, m, n, __row_threads);
+
+    for (uint32_t i = 0; i < 7; i++)
+      {
+        __prepare (BB[i], m, threshold, leaf, zero);
+        this->__free (BB[i]);
+      }
+  }
+
+  /**
+   * Multiplies a by an operand prepared by a strassen_matrix_multiplier, with the threshold it was prepared
+   * with. The operand fixes the padded size N, so a first operand with more than N rows is multiplied N rows
+   * at a time.
+   */
+  template <typename T>
+  T*
+  strassen_matrix_multiplier<T>::mult_prepared (const T *a, const prepared_operand<T> &b, size_t arows)
+  {
+    const strassen_prepared_operand<T> *p = dynamic_cast<const strassen_prepared_operand<T> *> (&b);
+
+    if (!p)
+      return (matrix_multiplier<T>::mult_prepared (a, b, arows));
+
+    this->__begin ();
+
+    size_t N = p->__n;
+    size_t k = b.rows ();
+    size_t n = b.cols ();
+    T *D = this->__alloc (arows * n);
+
+    for (size_t r0 = 0; r0 < arows; r0 += N)
+      {
+        size_t rows = (r0 + N <= arows) ? N : arows - r0;
+        const T *A = &a[r0 * k];
+        T *P = NULL;
+
+        if (rows != N || k != N)
+          {
+            __phase (PHASE_PAD);
+            STRASSEN_TRACE_SCOPE ("pad", N);
+
+            P = __pad (A, rows, k, N, __row_threads);
+            A = P;
+          }
+
+        /* Without padding on either side, the product is written where it belongs */
+        if (!P && n == N)
+          {
+            __mult_prepared (A, p->__leaves, &p->__zero[0], N, p->__count, p->__leaf_size, &D[r0 * n]);
+            continue;
+          }
+
+        T *C = __mult_prepared (A, p->__leaves, &p->__zero[0], N, p->__count, p->__leaf_size, NULL);
+
+        __phase (PHASE_UNPAD);
+
+        {
+          STRASSEN_TRACE_SCOPE ("unpad", N);
+
+          for (size_t i = 0; i < rows; i++)
+            memcpy (&D[(r0 + i) * n], &C[i * N], n * sizeof (T));
+        }
+
+        this->__free (P);
+        this->__free (C);
+      }
+
+    __phase (PHASE_NONE);
+
+    return D;
+  }
+
+  /**
+   * The recursion of __mult, with the blocks of B taken from the count leaves of a prepared operand rather
+   * than formed: the leaves of the i-th product are the i-th seventh of them.
+   */
+  template <typename T>
+  T*
+  strassen_matrix_multiplier<T>::__mult_prepared (const T *A, const T *leaves, const char *zero, size_t n,
+                                                  size_t count, size_t leaf_size, T *C)
+  {
+    if (!C)
+      C = this->__alloc (n * n);
+
+    if (count == 1)
+      {
+        STRASSEN_TRACE_SCOPE ("leaf", n);
+        __phase (PHASE_LEAF);
+
+        if (*zero)
+          {
+            for (size_t i = 0; i < n * n; i++)
+              C[i] = T ();
+            return C;
+          }
+
+        /* The leaf is the transpose of the block, which is the block read by columns */
+        T *P = __tmm.mult_layout (A, ROW_MAJOR, leaves, COLUMN_MAJOR, n, n, n, n);
+
+        memcpy (C, P, n * n * sizeof (T));
+        this->__free (P);
+
+        return C;
+      }
+
+    STRASSEN_TRACE_SCOPE ("operands", n);
+    __phase (PHASE_OPERANDS);
+
+    size_t m = n / 2;
+    size_t sub = count / 7;
+    bool zero_b = true;
+
+    for (size_t i = 0; i < count && zero_b; i++)
+      zero_b = zero[i];
+
+    if (zero_b || (A[0] == T () && A[1] == T () && __zeroes (A, n)))
+      {
+        for (size_t i = 0; i < n * n; i++)
+          C[i] = T ();
+        return C;
+      }
+
+    T* AA[7];
+    T* MM[7];
+
+    for (uint32_t i = 0; i < 7; i++)
+      AA[i] = this->__alloc (m * m);
+
+    __operands_a (AA, A, m, n, __row_threads);
+
+    STRASSEN_TRACE_NEXT ("recurse");
+
+    for (uint32_t i = 0; i < 7; i++)
+      MM[i] = __mult_prepared (AA[i], &leaves[i * sub * leaf_size * leaf_size], &zero[i * sub], m, sub, leaf_size,
+                               NULL);
+
+    STRASSEN_TRACE_NEXT ("combine");
+    __phase (PHASE_COMBINE);
+
+    __combine (C, MM, m, n, __row_threads);
+
+    for (uint32_t i = 0; i < 7; i++)
+      {
+        this->__free (AA[i]);
+        this->__free (MM[i]);
+      }
+
+    return C;
+  }
+
+  /**
+   * Performs the actual strassen multiplication.
+   *
+   * The Strassen algorithm works by breaking the given matrices A and B into submatrices and 
+   * performing operations on those quadrants. This function will break apart A and B into those
+   * submatrices and recursively multiply them together using the same method.
+   */
+  template <typename T>
+  T*
+  strassen_matrix_multiplier<T>::__mult (const T *A, const T *B, size_t n, T *C)
+  {
+    /* If the given matrices are small, its more efficient to use the transpose naive algorithm. */
+    if (n <= __threshold)
+      return (__leaf (A, B, n, C));
+
+    STRASSEN_TRACE_SCOPE ("operands", n);
+    __phase (PHASE_OPERANDS);
+
+    size_t m = n / 2;
 
     /* The output matrix */
-    T *C = (T *) malloc (n * n * sizeof (T));
+    if (!C)
+      C = this->__alloc (n * n);
 
     T* AA[7]; /* Submatrix blocks for A */
     T* BB[7]; /* Submatrix blocks for B */
@@ -191,67 +892,23 @@ namespace strassen
 
     /* Make sure that neither A or B consist entirely of zeroes. If so, easy; nullify the
      * contents of C and return. */
-    if ((!A[0] && !A[1] && __zeroes (A, n)) || (!B[0] && !B[1] && __zeroes (B, n)))
+    if ((A[0] == T () && A[1] == T () && __zeroes (A, n)) || (B[0] == T () && B[1] == T () && __zeroes (B, n)))
       {
-        memset (C, 0, n * n * sizeof (T));
+        for (size_t i = 0; i < n * n; i++)
+          C[i] = T ();
         return C;
       }
     
     /* Make room for the submatrices */
     for (uint32_t i = 0; i < 7; i++)
       {
-        AA[i] = (T *) malloc (m * m * sizeof (T));
-        BB[i] = (T *) malloc (m * m * sizeof (T));
+        AA[i] = this->__alloc (m * m);
+        BB[i] = this->__alloc (m * m);
       }
 
-    /*
-     * The output matrix C is expressed in terms of the block matrices M1..M7
-     *
-     * C1,1 = M1 + M4 - M5 + M7
-     * C1,2 = M3 + M5
-     * C2,1 = M2 + M4
-     * C2,2 = M1 - M2 + M3 + M6
-     * 
-     * Each of the block matrices M1..M7 is composed of quadrants from A and B as follows:
-     * 
-     * M1 = AA[0] * BB[0] = (A1,1 + A2,2)(B1,1 + B2,2)
-     * M2 = AA[1] * BB[1] = (A2,1 + A2,2)(B1,1)
-     * M3 = AA[2] * BB[2] = (A1,1)(B1,2 - B2,2)
-     * M4 = AA[3] * BB[3] = (A2,2)(B2,1 - B1,1)
-     * M5 = AA[4] * BB[4] = (A1,1 + A1,2)(B2,2)
-     * M6 = AA[5] * BB[5] = (A2,1 - A1,1)(B1,1 + B1,2)
-     * M7 = AA[6] * BB[6] = (A1,2 - A2,2)(B2,1 + B2,2)
-     */
+    __operands (AA, BB, A, B, m, n, __row_threads);
 
-    /* AA[0] = (A1,1 + A2,2) */
-    __submatrix_add (AA[0], A, tl_row_start, tl_col_start, br_row_start, br_col_start, m, n);
-    /* AA[1] = (A2,1 + A2,2) */
-    __submatrix_add (AA[1], A, bl_row_start, bl_col_start, br_row_start, br_col_start, m, n);
-    /* AA[2] = (A1,1) */
-    __submatrix_cpy (AA[2], A, tl_row_start, tl_col_start, m, n);
-    /* AA[3] = (A2,2) */
-    __submatrix_cpy (AA[3], A, br_row_start, br_col_start, m, n);
-    /* AA[4] = (A1,1 + A1,2) */
-    __submatrix_add (AA[4], A, tl_row_start, tl_col_start, tr_row_start, tr_col_start, m, n);
-    /* AA[5] = (A2,1 - A1,1) */
-    __submatrix_sub (AA[5], A, bl_row_start, bl_col_start, tl_row_start, tl_col_start, m, n);
-    /* AA[6] = (A1,2 - A2,2) */
-    __submatrix_sub (AA[6], A, tr_row_start, tr_col_start, br_row_start, br_col_start, m, n);
-
-    /* BB[0] = (B1,1 + B2,2) */
-    __submatrix_add (BB[0], B, tl_row_start, tl_col_start, br_row_start, br_col_start, m, n);
-    /* BB[1] = (B1,1) */
-    __submatrix_cpy (BB[1], B, tl_row_start, tl_col_start, m, n);
-    /* BB[2] = (B1,2 - B2,2) */
-    __submatrix_sub (BB[2], B, tr_row_start, tr_col_start, br_row_start, br_col_start, m, n);
-    /* BB[3] = (B2,1 - B1,1) */
-    __submatrix_sub (BB[3], B, bl_row_start, bl_col_start, tl_row_start, tl_col_start, m, n);
-    /* BB[4] = (B2,2) */
-    __submatrix_cpy (BB[4], B, br_row_start, br_col_start, m, n);
-    /* BB[5] = (B1,1 + B1,2) */
-    __submatrix_add (BB[5], B, tl_row_start, tl_col_start, tr_row_start, tr_col_start, m, n); 
-    /* BB[6] = (B2,1 + B2,2) */
-    __submatrix_add (BB[6], B, bl_row_start, bl_col_start, br_row_start, br_col_start, m, n);
+    STRASSEN_TRACE_NEXT ("recurse");
 
     MM[0] = __mult (AA[0], BB[0], m);
     MM[1] = __mult (AA[1], BB[1], m);
@@ -261,243 +918,344 @@ namespace strassen
     MM[5] = __mult (AA[5], BB[5], m);
     MM[6] = __mult (AA[6], BB[6], m);
 
-    /* C1,1 = M1 + M4 - M5 + M7 */
-    __submatrix_add (C, MM[0], MM[3], tl_row_start, tl_col_start, m, n);
-    __submatrix_sub (C, MM[4], tl_row_start, tl_col_start, m, n);
-    __submatrix_add (C, MM[6], tl_row_start, tl_col_start, m, n);
+    STRASSEN_TRACE_NEXT ("combine");
+    __phase (PHASE_COMBINE);
 
-    /* C1,2 = M3 + M5 */
-    __submatrix_add (C, MM[2], MM[4], tr_row_start, tr_col_start, m, n);
-
-    /* C2,1 = M2 + M4 */
-    __submatrix_add (C, MM[1], MM[3], bl_row_start, bl_col_start, m,  n);
-
-    /* C2,2 = M1 - M2 + M3 + M6 */
-    __submatrix_sub (C, MM[0], MM[1], br_row_start, br_col_start, m, n);
-    __submatrix_add (C, MM[2], br_row_start, br_col_start, m, n);
-    __submatrix_add (C, MM[5], br_row_start, br_col_start, m, n);
+    __combine (C, MM, m, n, __row_threads);
 
     for (uint32_t i = 0; i < 7; i++)
       {
-        free (AA[i]);
-        free (BB[i]);
-        free (MM[i]);
+        this->__free (AA[i]);
+        this->__free (BB[i]);
+        this->__free (MM[i]);
       }
 
     return C;
   }
 
   /**
-   * Returns true only if the given matrix consists entirely of zeroes
+   * Forms the 7 m x m operand blocks AA[i] and BB[i] of the n x n matrices A and B, whose products are the
+   * M1..M7 of the recursion.
    */
   template <typename T>
-  bool
-  strassen_matrix_multiplier<T>::__zeroes (const T *A, size_t n)
+  void
+  strassen_matrix_multiplier<T>::__operands (T * const *AA, T * const *BB, const T *A, const T *B, size_t m, size_t n,
+                                             size_t threads)
   {
-    size_t N = n * n;
+    __operands_a (AA, A, m, n, threads);
+    __operands_b (BB, B, m, n, threads);
+  }
 
-    for (size_t i = 0; i < N; i++)
-      {
-        if (A[i])
-          return false;
-      }
+  template <typename T>
+  void
+  strassen_matrix_multiplier<T>::__operands_a (T * const *AA, const T *A, size_t m, size_t n, size_t threads)
+  {
+    __rows (m, n * n, threads, [&] (size_t i0, size_t i1) { __operands_a_rows (AA, A, m, n, i0, i1); });
+  }
 
-    return true;
+  template <typename T>
+  void
+  strassen_matrix_multiplier<T>::__operands_b (T * const *BB, const T *B, size_t m, size_t n, size_t threads)
+  {
+    __rows (m, n * n, threads, [&] (size_t i0, size_t i1) { __operands_b_rows (BB, B, m, n, i0, i1); });
   }
 
   /**
-   * Assigns to the matrix C the sum of two quandrants of A using the given offsets
+   * The output matrix C is expressed in terms of the block matrices M1..M7
+   *
+   * C1,1 = M1 + M4 - M5 + M7
+   * C1,2 = M3 + M5
+   * C2,1 = M2 + M4
+   * C2,2 = M1 - M2 + M3 + M6
+   *
+   * Each of the block matrices M1..M7 is composed of quadrants from A and B as follows:
+   *
+   * M1 = AA[0] * BB[0] = (A1,1 + A2,2)(B1,1 + B2,2)
+   * M2 = AA[1] * BB[1] = (A2,1 + A2,2)(B1,1)
+   * M3 = AA[2] * BB[2] = (A1,1)(B1,2 - B2,2)
+   * M4 = AA[3] * BB[3] = (A2,2)(B2,1 - B1,1)
+   * M5 = AA[4] * BB[4] = (A1,1 + A1,2)(B2,2)
+   * M6 = AA[5] * BB[5] = (A2,1 - A1,1)(B1,1 + B1,2)
+   * M7 = AA[6] * BB[6] = (A1,2 - A2,2)(B2,1 + B2,2)
+   *
+   * Row i of every block of A is formed from rows i and m + i of A, which are read once for all seven.
    */
   template <typename T>
   void
-  strassen_matrix_multiplier<T>::__submatrix_add (T *C, const T *A,
-						  size_t a_row_start, size_t a_col_start, 
-						  size_t b_row_start, size_t b_col_start, 
-						  size_t m, size_t n)
-  {
-    size_t im;
-    size_t a_row_indx;
-    size_t b_row_indx;
-    const T *a_row;
-    const T *b_row;
-
-    for (size_t i = 0; i < m; i++)
+  strassen_matrix_multiplier<T>::__operands_a_rows (T * const *AA, const T *A, size_t m, size_t n,
+                                                    size_t i0, size_t i1)
+  {
+    for (size_t i = i0; i < i1; i++)
       {
-        im = i * m;
-        a_row_indx = ((a_row_start + i) * n) + a_col_start;
-        b_row_indx = ((b_row_start + i) * n) + b_col_start;
-
-        a_row = &A[a_row_indx];
-        b_row = &A[b_row_indx];
+        const T *a11 = &A[i * n];
+        const T *a12 = a11 + m;
+        const T *a21 = &A[(m + i) * n];
+        const T *a22 = a21 + m;
+        size_t im = i * m;
+
+        __row_add (&AA[0][im], a11, a22, m);
+        __row_add (&AA[1][im], a21, a22, m);
+        __row_cpy (&AA[2][im], a11, m);
+        __row_cpy (&AA[3][im], a22, m);
+        __row_add (&AA[4][im], a11, a12, m);
+        __row_sub (&AA[5][im], a21, a11, m);
+        __row_sub (&AA[6][im], a12, a22, m);
+      }
+  }
 
-        for (size_t j = 0; j < m; j++)
-          {
-            C[im + j] = a_row[j] + b_row[j];
-          }
+  template <typename T>
+  void
+  strassen_matrix_multiplier<T>::__operands_b_rows (T * const *BB, const T *B, size_t m, size_t n,
+                                                    size_t i0, size_t i1)
+  {
+    for (size_t i = i0; i < i1; i++)
+      {
+        const T *b11 = &B[i * n];
+        const T *b12 = b11 + m;
+        const T *b21 = &B[(m + i) * n];
+        const T *b22 = b21 + m;
+        size_t im = i * m;
+
+        __row_add (&BB[0][im], b11, b22, m);
+        __row_cpy (&BB[1][im], b11, m);
+        __row_sub (&BB[2][im], b12, b22, m);
+        __row_sub (&BB[3][im], b21, b11, m);
+        __row_cpy (&BB[4][im], b22, m);
+        __row_add (&BB[5][im], b11, b12, m);
+        __row_add (&BB[6][im], b21, b22, m);
       }
   }
 
   /**
-   * Adds to the matrix C to the specified quadrant of A
+   * Squares A. With B = A, the operand blocks for B are the blocks for A in another order:
+   *
+   * BB[0] = (A1,1 + A2,2) = AA[0]        BB[4] = (A2,2)         = AA[3]
+   * BB[1] = (A1,1)        = AA[2]        BB[5] = (A1,1 + A1,2) = AA[4]
+   * BB[2] = (A1,2 - A2,2) = AA[6]        BB[6] = (A2,1 + A2,2) = AA[1]
+   * BB[3] = (A2,1 - A1,1) = AA[5]
+   *
+   * so only the 7 blocks of A are formed, and M1 is the square of AA[0].
    */
   template <typename T>
-  void
-  strassen_matrix_multiplier<T>::__submatrix_add (T *C, const T *A, 
-						  size_t row_start, size_t col_start, 
-						  size_t m, size_t n)
+  T*
+  strassen_matrix_multiplier<T>::__square (const T *A, size_t n, T *C)
   {
-    size_t im;
-    size_t row_indx;
-    T *row;
+    if (n <= __threshold)
+      return (__leaf (A, A, n, C));
 
-    for (size_t i = 0; i < m; i++)
+    STRASSEN_TRACE_SCOPE ("operands", n);
+    __phase (PHASE_OPERANDS);
+
+    size_t m = n / 2;
+
+    if (!C)
+      C = this->__alloc (n * n);
+
+    T* AA[7]; /* Submatrix blocks for A, which serve for B as well */
+    T* MM[7]; /* Products of above submatrices */
+
+    if (A[0] == T () && A[1] == T () && __zeroes (A, n))
       {
-        im = i * m;
-        row_indx = ((row_start + i) * n) + col_start;
-        row = &C[row_indx];
+        for (size_t i = 0; i < n * n; i++)
+          C[i] = T ();
+        return C;
+      }
 
-        for (size_t j = 0; j < m; j++)
-          {
-            row[j] += A[im + j];
-          }
+    for (uint32_t i = 0; i < 7; i++)
+      AA[i] = this->__alloc (m * m);
+
+    __operands_a (AA, A, m, n, __row_threads);
+
+    STRASSEN_TRACE_NEXT ("recurse");
+
+    MM[0] = __square (AA[0], m);
+    MM[1] = __mult (AA[1], AA[2], m);
+    MM[2] = __mult (AA[2], AA[6], m);
+    MM[3] = __mult (AA[3], AA[5], m);
+    MM[4] = __mult (AA[4], AA[3], m);
+    MM[5] = __mult (AA[5], AA[4], m);
+    MM[6] = __mult (AA[6], AA[1], m);
+
+    STRASSEN_TRACE_NEXT ("combine");
+    __phase (PHASE_COMBINE);
+
+    __combine (C, MM, m, n, __row_threads);
+
+    for (uint32_t i = 0; i < 7; i++)
+      {
+        this->__free (AA[i]);
+        this->__free (MM[i]);
       }
+
+    return C;
   }
 
   /**
-   * Assigns to specified quadrant of C the sum of A and B
+   * Multiplies A and B with the transpose algorithm, into C if it is given.
    */
   template <typename T>
-  void
-  strassen_matrix_multiplier<T>::__submatrix_add (T *C, const T *A, const T *B, 
-						  size_t row_start, size_t col_start, 
-						  size_t m, size_t n)
+  T*
+  strassen_matrix_multiplier<T>::__leaf (const T *A, const T *B, size_t n, T *C)
   {
-    size_t im;
-    size_t row_indx;
-    T *row;
+    STRASSEN_TRACE_SCOPE ("leaf", n);
+    __phase (PHASE_LEAF);
 
-    for (size_t i = 0; i < m; i++)
-      {
-        im = i * m;
-        row_indx = ((row_start + i) * n) + col_start;
-        row = &C[row_indx];
+    T *P = __tmm.mult (A, B, n, n, n, n);
 
-        for (size_t j = 0; j < m; j++)
-          {
-            row[j] = A[im + j] + B[im + j];
-          }
+    if (C)
+      {
+        memcpy (C, P, n * n * sizeof (T));
+        this->__free (P);
+        return C;
       }
+
+    return P;
   }
 
   /**
-   * Assigns to C the difference of the two given quadrants of A
+   * Assembles the n x n output matrix C from the block products M1..M7:
+   *
+   * C1,1 = M1 + M4 - M5 + M7
+   * C1,2 = M3 + M5
+   * C2,1 = M2 + M4
+   * C2,2 = M1 - M2 + M3 + M6
    */
   template <typename T>
   void
-  strassen_matrix_multiplier<T>::__submatrix_sub (T *C, const T *A,
-						  size_t a_row_start, size_t a_col_start, 
-						  size_t b_row_start, size_t b_col_start, 
-						  size_t m, size_t n)
-  {
-    size_t im;
-    size_t a_row_indx;
-    size_t b_row_indx;
-    const T *a_row;
-    const T *b_row;
-
-    for (size_t i = 0; i < m; i++)
+  strassen_matrix_multiplier<T>::__combine (T *C, T * const *MM, size_t m, size_t n, size_t threads)
+  {
+    __rows (m, n * n, threads, [&] (size_t i0, size_t i1) { __combine_rows (C, MM, m, n, i0, i1); });
+  }
+
+  /**
+   * Rows i and m + i of C, each element summed in one pass, in the order the sums above are written.
+   */
+  template <typename T>
+  void
+  strassen_matrix_multiplier<T>::__combine_rows (T *C, T * const *MM, size_t m, size_t n, size_t i0, size_t i1)
+  {
+    for (size_t i = i0; i < i1; i++)
       {
-        im = i * m;
-        a_row_indx = ((a_row_start + i) * n) + a_col_start;
-        b_row_indx = ((b_row_start + i) * n) + b_col_start;
+        T *c11 = &C[i * n];
+        T *c12 = c11 + m;
+        T *c21 = &C[(m + i) * n];
+        T *c22 = c21 + m;
+        size_t im = i * m;
+        const T *m1 = &MM[0][im];
+        const T *m2 = &MM[1][im];
+        const T *m3 = &MM[2][im];
+        const T *m4 = &MM[3][im];
+        const T *m5 = &MM[4][im];
+        const T *m6 = &MM[5][im];
+        const T *m7 = &MM[6][im];
+
+        for (size_t j = 0; j < m; j++)
+          c11[j] = m1[j] + m4[j] - m5[j] + m7[j];
 
-        a_row = &A[a_row_indx];
-        b_row = &A[b_row_indx];
+        __row_add (c12, m3, m5, m);
+        __row_add (c21, m2, m4, m);
 
         for (size_t j = 0; j < m; j++)
-          {
-            C[im + j] = a_row[j] - b_row[j];
-          }
+          c22[j] = m1[j] - m2[j] + m3[j] + m6[j];
       }
   }
 
   /**
-   * Subtracts A from the given quadrant of C
+   * Returns true only if the given matrix consists entirely of zeroes
    */
   template <typename T>
-  void
-  strassen_matrix_multiplier<T>::__submatrix_sub (T *C, const T *A, 
-						  size_t row_start, size_t col_start, 
-						  size_t m, size_t n)
+  bool
+  strassen_matrix_multiplier<T>::__zeroes (const T *A, size_t n)
   {
-    size_t im;
-    size_t row_indx;
-    T *row;
+    size_t N = n * n;
 
-    for (size_t i = 0; i < m; i++)
+    for (size_t i = 0; i < N; i++)
       {
-        im = i * m;
-        row_indx = ((row_start + i) * n) + col_start;
-        row = &C[row_indx];
-
-        for (size_t j = 0; j < m; j++)
-          {
-            row[j] -= A[im + j];
-          }
+        if (A[i] != T ())
+          return false;
       }
+
+    return true;
   }
- 
-  /**
-   * Assigns to the specified quadrant of C the difference of A and B
-   */
+
   template <typename T>
   void
-  strassen_matrix_multiplier<T>::__submatrix_sub (T *C, const T *A, const T *B, 
-						  size_t row_start, size_t col_start, 
-						  size_t m, size_t n)
+  strassen_matrix_multiplier<T>::__row_add (T *c, const T *a, const T *b, size_t m)
   {
-    size_t im;
-    size_t row_indx;
-    T *row;
+    for (size_t j = 0; j < m; j++)
+      c[j] = a[j] + b[j];
+  }
 
-    for (size_t i = 0; i < m; i++)
-      {
-        im = i * m;
-        row_indx = ((row_start + i) * n) + col_start;
-        row = &C[row_indx];
+  template <typename T>
+  void
+  strassen_matrix_multiplier<T>::__row_sub (T *c, const T *a, const T *b, size_t m)
+  {
+    for (size_t j = 0; j < m; j++)
+      c[j] = a[j] - b[j];
+  }
 
-        for (size_t j = 0; j < m; j++)
-          {
-            row[j] = A[im + j] - B[im + j];
-          }
+  template <typename T>
+  void
+  strassen_matrix_multiplier<T>::__row_cpy (T *c, const T *a, size_t m)
+  {
+    memcpy (c, a, m * sizeof (T));
+  }
+
+  template <typename T>
+  template <typename F>
+  void
+  strassen_matrix_multiplier<T>::__rows (size_t rows, size_t elements, size_t threads, const F &f)
+  {
+    if (threads <= 1 || rows < 2 || elements < STRASSEN_PARALLEL_ROWS_MIN)
+      {
+        f (0, rows);
+        return;
       }
+
+    __rows_parallel (rows, threads, std::function<void (size_t, size_t)> (f));
   }
-  
+
   /**
-   * Copies to C the given quadrant of A
+   * Runs the first block on the calling thread and each of the others on a thread of its own, or on the
+   * calling thread after all if the thread cannot be started.
    */
   template <typename T>
   void
-  strassen_matrix_multiplier<T>::__submatrix_cpy (T *C, const T *A,
-						  size_t row_start, size_t col_start, 
-						  size_t m, size_t n)
+  strassen_matrix_multiplier<T>::__rows_parallel (size_t rows, size_t threads,
+                                                  const std::function<void (size_t, size_t)> &f)
   {
-    size_t im;
-    size_t row_indx;
-    const T *row;
+    if (threads > rows)
+      threads = rows;
 
-    for (size_t i = 0; i < m; i++)
+    std::vector<strassen_row_block> blocks (threads);
+    std::vector<pthread_t> tids (threads);
+    std::vector<bool> spawned (threads, false);
+
+    for (size_t t = 0; t < threads; t++)
       {
-        im = i * m;
-        row_indx = ((row_start + i) * n) + col_start;
-        row = &A[row_indx];
+        blocks[t].f = &f;
+        blocks[t].i0 = (rows * t) / threads;
+        blocks[t].i1 = (rows * (t + 1)) / threads;
 
-        for (size_t j = 0; j < m; j++)
+        if (t)
           {
-            C[im + j] = row[j];
+            spawned[t] = !pthread_create (&tids[t], NULL, strassen_row_block_entry, &blocks[t]);
+
+            if (!spawned[t])
+              perror ("strassen_matrix_multiplier: pthread_create");
           }
       }
-  } 
+
+    f (blocks[0].i0, blocks[0].i1);
+
+    for (size_t t = 1; t < threads; t++)
+      {
+        if (spawned[t])
+          pthread_join (tids[t], NULL);
+        else
+          f (blocks[t].i0, blocks[t].i1);
+      }
+  }
 
   /**
    * Returns a new n x n matrix containing the contents of m, but with extra elements 
@@ -505,37 +1263,27 @@ namespace strassen
    */
   template <typename T>
   T*
-  strassen_matrix_multiplier<T>::__pad (const T *m, size_t rows, size_t cols, size_t n)
+  strassen_matrix_multiplier<T>::__pad (const T *m, size_t rows, size_t cols, size_t n, size_t threads)
   {
-    size_t in;
-    size_t ic;
-    T *M = (T *) malloc (n * n * sizeof (T));
-    
-    for (size_t i = 0; i < rows; i++)
-      {
-        in = i * n;
-        ic = i * cols;
+    T *M = this->__alloc (n * n);
 
-        for (size_t j = 0; j < cols; j++)
-          {
-            M[in + j] = m[ic + j];
-          }
-        
-        for (size_t j = cols; j < n; j++)
-          {
-            M[in + j] = 0;
-          }
-      }
+    if (!M)
+      return NULL;
 
-    for (size_t i = rows; i < n; i++)
+    __rows (n, n * n, threads, [&] (size_t i0, size_t i1)
       {
-        in = i * n;
-
-        for (size_t j = 0; j < n; j++)
+        for (size_t i = i0; i < i1; i++)
           {
-            M[in + j] = 0;
+            T *row = &M[i * n];
+            size_t copied = (i < rows) ? cols : 0;
+
+            if (copied)
+              memcpy (row, &m[i * cols], cols * sizeof (T));
+
+            for (size_t j = copied; j < n; j++)
+              row[j] = T ();
           }
-      }
+      });
 
     return M;
   }
@@ -545,22 +1293,18 @@ namespace strassen
    */
   template <typename T>
   T*
-  strassen_matrix_multiplier<T>::__unpad (const T *m, size_t rows, size_t cols, size_t n)
+  strassen_matrix_multiplier<T>::__unpad (const T *m, size_t rows, size_t cols, size_t n, size_t threads)
   {
-    size_t in;
-    size_t ir;
-    T *M = (T *) malloc (rows * cols * sizeof (T));
+    T *M = this->__alloc (rows * cols);
 
-    for (size_t i = 0; i < rows; i++)
-      {
-        in = i * n;
-        ir = i * rows;
+    if (!M)
+      return NULL;
 
-        for (size_t j = 0; j < cols; j++)
-          {
-            M[ir + j] = m[in + j];
-          }
-      }
+    __rows (rows, rows * cols, threads, [&] (size_t i0, size_t i1)
+      {
+        for (size_t i = i0; i < i1; i++)
+          memcpy (&M[i * cols], &m[i * n], cols * sizeof (T));
+      });
 
     return M;
   }
@@ -0,0 +1,277 @@
+#ifndef TRACE_HPP_
+#define TRACE_HPP_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include <mutex>
+#include <vector>
+
+/**
+ * Tracing of the multipliers' internals is compiled in only when STRASSEN_TRACE is defined; otherwise
+ * the macros below expand to nothing and cost nothing.
+ *
+ * STRASSEN_TRACE_SCOPE (name, n) opens a trace event in the enclosing block, for work on a matrix of
+ * size n. STRASSEN_TRACE_NEXT (name) ends the current event and immediately begins another in the same
+ * scope, which suits functions that move through several phases in sequence. Events record their
+ * recursion depth (the number of enclosing events on the same thread), and are written to a per-thread
+ * ring buffer of STRASSEN_TRACE_EVENTS entries when they end.
+ */
+#ifdef STRASSEN_TRACE
+#define STRASSEN_TRACE_SCOPE(name, n) strassen::trace_scope __strassen_trace ((name), (n))
+#define STRASSEN_TRACE_NEXT(name) __strassen_trace.next (name)
+#else
+#define STRASSEN_TRACE_SCOPE(name, n) do { } while (0)
+#define STRASSEN_TRACE_NEXT(name) do { } while (0)
+#endif
+
+#ifndef STRASSEN_TRACE_EVENTS
+#define STRASSEN_TRACE_EVENTS (1 << 16)
+#endif
+
+namespace strassen
+{
+  struct trace_event
+  {
+    const char *name;
+    uint64_t start;   /* Nanoseconds on the monotonic clock */
+    uint64_t end;
+    uint32_t depth;
+    uint64_t n;
+  };
+
+  /**
+   * A ring buffer of the most recent STRASSEN_TRACE_EVENTS events of one thread. Only the owning thread
+   * writes to it. Buffers are kept, so events survive the threads that wrote them; when a thread exits its
+   * buffer goes on to the next thread to start tracing, so that threads started per call (as the CAPS and
+   * distributed multipliers do) need only as many buffers as are ever running at once. The events of such
+   * threads then share a track, carrying the id of the latest of them.
+   */
+  class trace_buffer
+  {
+  public:
+    uint32_t id;      /* Sequential id, in order of each thread's first event */
+    pid_t tid;        /* Operating system thread id */
+    uint32_t depth;   /* Number of open events on this thread */
+    uint64_t count;   /* Total events written; only the last STRASSEN_TRACE_EVENTS are kept */
+    trace_event events[STRASSEN_TRACE_EVENTS];
+
+    void
+    push (const trace_event &e)
+    {
+      events[count % STRASSEN_TRACE_EVENTS] = e;
+      ++count;
+    }
+  };
+
+  inline std::mutex __trace_lock;
+  inline std::vector<trace_buffer *> __trace_buffers;
+  /* Buffers of threads which have exited, for the next threads to take */
+  inline std::vector<trace_buffer *> __trace_free;
+
+  /* Holds a thread's buffer, and hands it back when the thread exits */
+  class trace_holder
+  {
+  public:
+    trace_buffer *buf;
+
+    trace_holder ()
+      : buf (NULL)
+    {
+    }
+
+    ~trace_holder ()
+    {
+      if (buf)
+        {
+          std::lock_guard<std::mutex> guard (__trace_lock);
+          __trace_free.push_back (buf);
+        }
+    }
+  };
+
+  inline thread_local trace_holder __trace_local;
+
+  inline uint64_t
+  trace_now ()
+  {
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return (((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec);
+  }
+
+  /**
+   * Returns the calling thread's buffer. On first use it takes the buffer of a thread which has exited, or
+   * else creates and registers a new one.
+   */
+  inline trace_buffer*
+  trace_thread_buffer ()
+  {
+    if (!__trace_local.buf)
+      {
+        std::lock_guard<std::mutex> guard (__trace_lock);
+        trace_buffer *b;
+
+        if (!__trace_free.empty ())
+          {
+            b = __trace_free.back ();
+            __trace_free.pop_back ();
+          }
+        else
+          {
+            b = new trace_buffer ();
+            b->count = 0;
+            b->id = __trace_buffers.size ();
+            __trace_buffers.push_back (b);
+          }
+
+        b->tid = syscall (SYS_gettid);
+        b->depth = 0;
+        __trace_local.buf = b;
+      }
+
+    return __trace_local.buf;
+  }
+
+  /**
+   * Discards all recorded events. Buffers stay registered to their threads and are reused.
+   * Must not be called while traced work is running.
+   */
+  inline void
+  trace_reset ()
+  {
+    std::lock_guard<std::mutex> guard (__trace_lock);
+
+    for (size_t i = 0; i < __trace_buffers.size (); i++)
+      {
+        __trace_buffers[i]->count = 0;
+      }
+  }
+
+  /**
+   * Writes all recorded events to path in the Chrome trace event format, which chrome://tracing and
+   * Perfetto can load. Each thread appears as its own track, with events nested by recursion depth.
+   * Must not be called while traced work is running. Returns false if the file cannot be written.
+   */
+  inline bool
+  trace_export_chrome (const char *path)
+  {
+    FILE *f = fopen (path, "w");
+
+    if (!f)
+      {
+        perror ("trace_export_chrome: fopen");
+        return false;
+      }
+
+    std::lock_guard<std::mutex> guard (__trace_lock);
+
+    bool first = true;
+    int pid = getpid ();
+    uint64_t origin = UINT64_MAX;
+
+    /* Make timestamps relative to the earliest retained event */
+    for (size_t i = 0; i < __trace_buffers.size (); i++)
+      {
+        trace_buffer *b = __trace_buffers[i];
+        uint64_t kept = (b->count < STRASSEN_TRACE_EVENTS) ? b->count : STRASSEN_TRACE_EVENTS;
+
+        for (uint64_t j = b->count - kept; j < b->count; j++)
+          {
+            if (b->events[j % STRASSEN_TRACE_EVENTS].start < origin)
+              origin = b->events[j % STRASSEN_TRACE_EVENTS].start;
+          }
+      }
+
+    fprintf (f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+
+    for (size_t i = 0; i < __trace_buffers.size (); i++)
+      {
+        trace_buffer *b = __trace_buffers[i];
+        uint64_t kept = (b->count < STRASSEN_TRACE_EVENTS) ? b->count : STRASSEN_TRACE_EVENTS;
+
+        fprintf (f, "%s  {\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": %d, \"tid\": %u, "
+                 "\"args\": {\"name\": \"thread %u (tid %d)\"}}",
+                 first ? "" : ",\n", pid, b->id, b->id, (int) b->tid);
+        first = false;
+
+        for (uint64_t j = b->count - kept; j < b->count; j++)
+          {
+            const trace_event &e = b->events[j % STRASSEN_TRACE_EVENTS];
+
+            fprintf (f, ",\n  {\"ph\": \"X\", \"cat\": \"strassen\", \"name\": \"%s\", \"pid\": %d, \"tid\": %u, "
+                     "\"ts\": %.3f, \"dur\": %.3f, \"args\": {\"depth\": %u, \"n\": %lu}}",
+                     e.name, pid, b->id, (e.start - origin) / 1000.0, (e.end - e.start) / 1000.0,
+                     e.depth, (unsigned long) e.n);
+          }
+      }
+
+    fprintf (f, "\n]}\n");
+
+    bool ok = !ferror (f);
+
+    if (fclose (f) || !ok)
+      {
+        perror ("trace_export_chrome: write");
+        return false;
+      }
+
+    return true;
+  }
+
+  /**
+   * A trace event covering the lifetime of the object, or the part of it up to a call to next ().
+   */
+  class trace_scope
+  {
+  private:
+    trace_buffer *__buf;
+    trace_event __event;
+
+    void
+    __begin (const char *name)
+    {
+      __event.name = name;
+      __event.start = trace_now ();
+    }
+
+    void
+    __end ()
+    {
+      __event.end = trace_now ();
+      __buf->push (__event);
+    }
+
+    trace_scope (const trace_scope &t);
+    trace_scope& operator = (const trace_scope &t);
+
+  public:
+    trace_scope (const char *name, uint64_t n)
+      : __buf (trace_thread_buffer ())
+    {
+      __event.depth = __buf->depth++;
+      __event.n = n;
+      __begin (name);
+    }
+
+    ~trace_scope ()
+    {
+      __end ();
+      --__buf->depth;
+    }
+
+    /* End the current event and begin the next one, at the same depth */
+    void
+    next (const char *name)
+    {
+      __end ();
+      __begin (name);
+    }
+  };
+}
+
+#endif /* TRACE_HPP_ */
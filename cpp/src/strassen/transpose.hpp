@@ -0,0 +1,94 @@
+#ifndef TRANSPOSE_HPP_
+#define TRANSPOSE_HPP_
+
+#include <stddef.h>
+
+#include <utility>
+
+namespace strassen
+{
+  /**
+   * How the elements of a matrix are laid out in memory: row after row, or column after column. A rows x cols
+   * matrix stored column-major is the same array as its cols x rows transpose stored row-major, so a matrix
+   * is transposed without moving any data by exchanging its dimensions and its layout.
+   */
+  enum matrix_layout
+  {
+    ROW_MAJOR = 0,
+    COLUMN_MAJOR
+  };
+
+  inline matrix_layout
+  other_layout (matrix_layout l)
+  {
+    return ((l == ROW_MAJOR) ? COLUMN_MAJOR : ROW_MAJOR);
+  }
+
+  /**
+   * Side of the square tiles the transposes work in. Two tiles of 32 x 32 doubles take 16KiB, so the tile
+   * being read and the one being written stay in the L1 cache together; within a tile the reads run along
+   * rows and the writes along the cache lines of the destination's rows.
+   */
+  const size_t TRANSPOSE_BLOCK = 32;
+
+  /**
+   * Writes to B (cols x rows) the transpose of A (rows x cols), both row-major, one tile at a time. A plain
+   * transpose reads one of the two arrays with a stride of a whole row, missing the cache on every element
+   * once the rows are longer than a few pages.
+   */
+  template <typename T>
+  void
+  transpose_blocked (const T *A, T *B, size_t rows, size_t cols)
+  {
+    for (size_t ii = 0; ii < rows; ii += TRANSPOSE_BLOCK)
+      {
+        size_t iend = (ii + TRANSPOSE_BLOCK < rows) ? ii + TRANSPOSE_BLOCK : rows;
+
+        for (size_t jj = 0; jj < cols; jj += TRANSPOSE_BLOCK)
+          {
+            size_t jend = (jj + TRANSPOSE_BLOCK < cols) ? jj + TRANSPOSE_BLOCK : cols;
+
+            for (size_t j = jj; j < jend; j++)
+              {
+                T *b_row = &B[j * rows];
+
+                for (size_t i = ii; i < iend; i++)
+                  b_row[i] = A[(i * cols) + j];
+              }
+          }
+      }
+  }
+
+  /**
+   * Transposes the n x n matrix A in place, exchanging each tile above the diagonal with its mirror image
+   * below it, and transposing the tiles on the diagonal within themselves.
+   */
+  template <typename T>
+  void
+  transpose_in_place (T *A, size_t n)
+  {
+    for (size_t ii = 0; ii < n; ii += TRANSPOSE_BLOCK)
+      {
+        size_t iend = (ii + TRANSPOSE_BLOCK < n) ? ii + TRANSPOSE_BLOCK : n;
+
+        for (size_t i = ii; i < iend; i++)
+          {
+            for (size_t j = i + 1; j < iend; j++)
+              std::swap (A[(i * n) + j], A[(j * n) + i]);
+          }
+
+        for (size_t jj = iend; jj < n; jj += TRANSPOSE_BLOCK)
+          {
+            size_t jend = (jj + TRANSPOSE_BLOCK < n) ? jj + TRANSPOSE_BLOCK : n;
+
+            for (size_t i = ii; i < iend; i++)
+              {
+                for (size_t j = jj; j < jend; j++)
+                  std::swap (A[(i * n) + j], A[(j * n) + i]);
+              }
+          }
+      }
+  }
+}
+
+#endif /* TRANSPOSE_HPP_ */
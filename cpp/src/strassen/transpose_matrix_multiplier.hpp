@@ -1,28 +1,75 @@
 #ifndef TRANSPOSE_MATRIX_MULTIPLIER_HPP_
 #define TRANSPOSE_MATRIX_MULTIPLIER_HPP_
 
+#include <string.h>
+
 #include "matrix_multiplier.hpp"
+#include "transpose.hpp"
 
 namespace strassen
 {
+  /**
+   * An operand prepared by a transpose_matrix_multiplier: its transpose, which the kernel reads by rows.
+   */
+  template <typename T>
+  class transposed_operand : public prepared_operand<T>
+  {
+  private:
+    T *__data;
+
+  public:
+    transposed_operand (const T *b, size_t rows, size_t cols)
+      : prepared_operand<T> (rows, cols),
+        __data ((T *) aligned_malloc (rows * cols * sizeof (T)))
+    {
+      if (__data)
+        transpose_blocked (b, __data, rows, cols);
+    }
+
+    ~transposed_operand ()
+    {
+      free (__data);
+    }
+
+    /* cols () x rows (), row-major */
+    const T* data () const { return __data; }
+    size_t bytes () const { return (this->rows () * this->cols () * sizeof (T)); }
+  };
+
   /**
    * A transpose_matrix_multiplier multiplies two given matrices using the naive multiplication algorithm,
    * with an optimization. Instead of iterating over the rows of one matrix and the columns of the other,
    * take the transpose of the second matrix and perform a row-by-row multiplication. This greatly improves
    * multiplication performance because better cache usage.
+   *
+   * Operands in other layouts are used as they are where possible: a column-major b is already the transpose
+   * the kernel wants, and with a column-major a and a row-major b each row of the result is accumulated from
+   * rows of b instead. Only when both are column-major is a laid out by rows first.
    */
   template <typename T>
   class transpose_matrix_multiplier : public strassen::matrix_multiplier<T>
   {
+  private:
+    static void __dot (const T *A, const T *Bt, T *C, size_t m, size_t k, size_t n);
+    static void __axpy (const T *At, const T *B, T *C, size_t m, size_t k, size_t n);
+
   public:
     transpose_matrix_multiplier ();
     virtual ~transpose_matrix_multiplier ();
     
     T* mult (const T *a, const T *b, size_t arows, size_t acols, size_t brows, size_t bcols);
+    T* mult_layout (const T *a, matrix_layout al, const T *b, matrix_layout bl,
+                    size_t arows, size_t acols, size_t brows, size_t bcols);
     T* transpose (const T *A, size_t rows, size_t cols);
+
+    /* A prepared operand is transposed once, so that products with it need no transpose */
+    prepared_operand<T>* prepare (const T *b, size_t brows, size_t bcols);
+    T* mult_prepared (const T *a, const prepared_operand<T> &b, size_t arows);
     matrix_multiplier<T>* copy () const;
-  };
 
+    /* Peak bytes allocated by one call to mult () with these dimensions: the transpose of b and the result */
+    static size_t predicted_peak_bytes (size_t arows, size_t acols, size_t brows, size_t bcols);
+  };
   template <typename T>
   transpose_matrix_multiplier<T>::transpose_matrix_multiplier ()
   {
@@ -40,74 +87,170 @@ namespace strassen
     return (new transpose_matrix_multiplier<T> ());
   }
 
+  template <typename T>
+  size_t
+  transpose_matrix_multiplier<T>::predicted_peak_bytes (size_t arows, size_t acols, size_t brows, size_t bcols)
+  {
+    return (allocation_bytes (brows * bcols * sizeof (T)) + allocation_bytes (arows * bcols * sizeof (T)));
+  }
+
   template <typename T>
   T*
   transpose_matrix_multiplier<T>::mult (const T *A, const T *b,
                                         size_t arows, size_t acols,
                                         size_t brows, size_t bcols)
   {
-    if (arows == bcols)
+    this->__begin ();
+
+    if (acols == brows)
       {
-        T t;
-        size_t m = arows;
-        size_t n = acols;
-        size_t im;
-        size_t tmp = brows;
-        brows = bcols;
-        bcols = tmp;
-        
-        /* B is a malloc'd array containing the transpose of the matrix represented by b. */
+        /* B is an array containing the transpose of the matrix represented by b. */
         T *B = transpose (b, brows, bcols);
-        T *C = (T *) malloc (m * m * sizeof (T));
-        const T *a_row = NULL;
-        T *b_row = NULL;
-	
-        for (size_t i = 0; i < m; i++)
+        T *C = this->__alloc (arows * bcols);
+
+        __dot (A, B, C, arows, acols, bcols);
+
+        this->__free (B);
+        return C;
+      }
+
+    return NULL;
+  }
+
+  template <typename T>
+  T*
+  transpose_matrix_multiplier<T>::mult_layout (const T *a, matrix_layout al, const T *b, matrix_layout bl,
+                                               size_t arows, size_t acols, size_t brows, size_t bcols)
+  {
+    if (al == ROW_MAJOR && bl == ROW_MAJOR)
+      return (mult (a, b, arows, acols, brows, bcols));
+
+    this->__begin ();
+
+    if (acols != brows)
+      return NULL;
+
+    T *C = this->__alloc (arows * bcols);
+
+    if (al == ROW_MAJOR)
+      __dot (a, b, C, arows, acols, bcols);
+    else if (bl == ROW_MAJOR)
+      __axpy (a, b, C, arows, acols, bcols);
+    else
+      {
+        T *A = this->__alloc (arows * acols);
+
+        transpose_blocked (a, A, acols, arows);
+        __dot (A, b, C, arows, acols, bcols);
+
+        this->__free (A);
+      }
+
+    return C;
+  }
+
+  template <typename T>
+  prepared_operand<T>*
+  transpose_matrix_multiplier<T>::prepare (const T *b, size_t brows, size_t bcols)
+  {
+    transposed_operand<T> *p = new transposed_operand<T> (b, brows, bcols);
+
+    if (!p->data ())
+      {
+        delete p;
+        return NULL;
+      }
+
+    return p;
+  }
+
+  template <typename T>
+  T*
+  transpose_matrix_multiplier<T>::mult_prepared (const T *a, const prepared_operand<T> &b, size_t arows)
+  {
+    const transposed_operand<T> *p = dynamic_cast<const transposed_operand<T> *> (&b);
+
+    if (!p)
+      return (matrix_multiplier<T>::mult_prepared (a, b, arows));
+
+    this->__begin ();
+
+    T *C = this->__alloc (arows * b.cols ());
+
+    if (C)
+      __dot (a, p->data (), C, arows, b.rows (), b.cols ());
+
+    return C;
+  }
+
+  /**
+   * C = A Bt^T, for A m x k and Bt n x k: each element of C is the dot product of two rows.
+   */
+  template <typename T>
+  void
+  transpose_matrix_multiplier<T>::__dot (const T *A, const T *Bt, T *C, size_t m, size_t k, size_t n)
+  {
+    T t;
+    size_t im = 0;
+    const T *a_row = NULL;
+    const T *b_row = NULL;
+
+    for (size_t i = 0; i < m; i++)
+      {
+        a_row = &A[i * k];
+
+        for (size_t j = 0; j < n; j++)
           {
-            im = i * m;
-            a_row = &A[i * acols];	    
+            t = 0;
+            b_row = &Bt[j * k];
 
-            for (size_t j = 0; j < m; j++)
+            for (size_t p = 0; p < k; p++)
               {
-                t = 0;
-                b_row = &B[j * bcols];
-                
-                for (size_t k = 0; k < n; k++)
-                  {
-                    t += (a_row[k] * b_row[k]);
-                  }
-
-                C[im++] = t;
+                t += (a_row[p] * b_row[p]);
               }
+
+            C[im++] = t;
           }
-        
-        free (B);
-        return C;
       }
-    else
-      arows = 0;
+  }
 
-    return NULL;
+  /**
+   * C = At^T B, for At k x m and B k x n: each row of C is a sum of the rows of B, weighted by a column of At.
+   */
+  template <typename T>
+  void
+  transpose_matrix_multiplier<T>::__axpy (const T *At, const T *B, T *C, size_t m, size_t k, size_t n)
+  {
+    for (size_t i = 0; i < m; i++)
+      {
+        T *c_row = &C[i * n];
+
+        for (size_t j = 0; j < n; j++)
+          c_row[j] = T ();
+
+        for (size_t p = 0; p < k; p++)
+          {
+            T a = At[(p * m) + i];
+            const T *b_row = &B[p * n];
+
+            for (size_t j = 0; j < n; j++)
+              c_row[j] += (a * b_row[j]);
+          }
+      }
   }
 
+  /**
+   * Returns a new cols x rows array holding the transpose of the rows x cols matrix A.
+   */
   template <typename T>
   T*
   transpose_matrix_multiplier<T>::transpose (const T *A, size_t rows, size_t cols)
   {    
     if (A)
       {
-        T *row = NULL;
-        T *m = (T *) malloc (rows * cols * sizeof (T));
-        
-        for (size_t i = 0; i < rows; i++)
-          {
-            row = &m[i * cols];
-            
-            for (size_t j = 0; j < cols; j++)
-              {
-                row[j] = A[j * rows + i];
-              }
-          }
+        T *m = this->__alloc (rows * cols);
+
+        transpose_blocked (A, m, rows, cols);
 
         return m;
       }
@@ -0,0 +1,309 @@
+#ifndef VERIFIED_MATRIX_MULTIPLIER_HPP_
+#define VERIFIED_MATRIX_MULTIPLIER_HPP_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <atomic>
+#include <complex>
+#include <limits>
+#include <vector>
+
+#include "matrix_multiplier.hpp"
+
+namespace strassen
+{
+  /* Random vectors freivalds () tries unless told otherwise */
+  const size_t FREIVALDS_VECTORS = 16;
+
+  /* Multiple of the machine epsilon and the inner dimension allowed as rounding error, relative to the bound */
+  const double FREIVALDS_SLACK = 16.0;
+
+  /* The machine epsilon of T, which is 0 for integers, whose products are checked exactly */
+  template <typename T>
+  inline double
+  freivalds_epsilon (const T *)
+  {
+    return ((double) std::numeric_limits<T>::epsilon ());
+  }
+
+  template <typename T>
+  inline double
+  freivalds_epsilon (const std::complex<T> *)
+  {
+    return ((double) std::numeric_limits<T>::epsilon ());
+  }
+
+  /* A 64-bit generator for the random vectors, so that checking does not disturb rand () */
+  inline uint64_t
+  freivalds_random (uint64_t &state)
+  {
+    uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+
+    return (z ^ (z >> 31));
+  }
+
+  /**
+   * Freivalds' check that the m x n matrix c is the product of the m x k matrix a and the k x n matrix b, all
+   * row-major: for each of the given number of random vectors r, compares a (b r) with c r, which costs
+   * 2 (m k + k n + m n) multiply-adds per vector rather than the m k n of recomputing the product.
+   *
+   * For integers, r has entries of 0 and 1 and the comparison is exact; a wrong product passes one vector
+   * with probability at most 1/2, so at most 2^-vectors in all. Other types draw r uniformly from [-1, 1],
+   * which a wrong product passes only by an error too small to be told from rounding. Row i must then agree
+   * to within tolerance times (|a| (|b| |r|))_i, the scale of the rounding a product can make; a negative
+   * tolerance stands for FREIVALDS_SLACK k times the machine epsilon.
+   *
+   * seed chooses the vectors, 0 for different ones on every call. Returns false if the check fails or memory
+   * runs out.
+   */
+  template <typename T>
+  bool
+  freivalds (const T *a, const T *b, const T *c, size_t m, size_t k, size_t n,
+             size_t vectors = FREIVALDS_VECTORS, double tolerance = -1.0, uint64_t seed = 0)
+  {
+    /* Checks run concurrently, from the workers of asynchronous multipliers among others */
+    static std::atomic<uint64_t> calls (0);
+
+    double eps = freivalds_epsilon ((const T *) NULL);
+    bool exact = (eps == 0.0);
+    uint64_t state = seed ? seed : ((uint64_t) time (NULL) ^ (++calls * 0x2545f4914f6cdd1dULL)
+                                    ^ (uint64_t) (size_t) c);
+
+    if (tolerance < 0.0)
+      tolerance = FREIVALDS_SLACK * (k ? k : 1) * eps;
+
+    std::vector<T> r (n);
+    std::vector<T> br (k);
+    std::vector<T> abr (m);
+    std::vector<double> bound_b (exact ? 0 : k);
+
+    for (size_t v = 0; v < vectors; v++)
+      {
+        for (size_t j = 0; j < n; j++)
+          {
+            uint64_t x = freivalds_random (state);
+
+            if (exact)
+              r[j] = T (x & 1);
+            else
+              r[j] = T (((double) (x >> 11) / 4503599627370496.0) - 1.0);
+          }
+
+        /* b r, and |b| |r| for the bound */
+        for (size_t p = 0; p < k; p++)
+          {
+            const T *row = &b[p * n];
+            T s = T ();
+            double t = 0.0;
+
+            for (size_t j = 0; j < n; j++)
+              s += row[j] * r[j];
+
+            if (!exact)
+              {
+                for (size_t j = 0; j < n; j++)
+                  t += element_distance (row[j], T ()) * element_distance (r[j], T ());
+
+                bound_b[p] = t;
+              }
+
+            br[p] = s;
+          }
+
+        for (size_t i = 0; i < m; i++)
+          {
+            const T *arow = &a[i * k];
+            const T *crow = &c[i * n];
+            T s = T ();
+            T t = T ();
+            double bound = 0.0;
+
+            for (size_t p = 0; p < k; p++)
+              s += arow[p] * br[p];
+
+            for (size_t j = 0; j < n; j++)
+              t += crow[j] * r[j];
+
+            if (exact)
+              {
+                if (s != t)
+                  return false;
+              }
+            else
+              {
+                for (size_t p = 0; p < k; p++)
+                  bound += element_distance (arow[p], T ()) * bound_b[p];
+
+                /* Also fails on NaN, which compares false */
+                if (!(element_distance (s, t) <= tolerance * bound))
+                  return false;
+              }
+          }
+      }
+
+    return true;
+  }
+
+  /* What a verified_matrix_multiplier has checked */
+  struct verify_stats
+  {
+    size_t products;    /* Products computed */
+    size_t checked;     /* Products checked */
+    size_t failed;      /* Products which failed the check */
+  };
+
+  /**
+   * A verified_matrix_multiplier checks a sample of the products another multiplier computes with freivalds (),
+   * so that a kernel or threading bug which makes a wrong product is noticed, at a cost proportional to the
+   * size of the operands rather than to the work of multiplying them. Each product is checked with the given
+   * probability; a failure is reported to stderr and counted in stats (), and the product is returned as it
+   * is, for the caller to act on.
+   *
+   * The multiplier given at construction is owned by the verified_matrix_multiplier and deleted with it.
+   */
+  template <typename T>
+  class verified_matrix_multiplier : public strassen::matrix_multiplier<T>
+  {
+  private:
+    matrix_multiplier<T> *__mm;
+    double __sample;
+    size_t __vectors;
+    uint64_t __state;
+    verify_stats __stats;
+    bool __last_ok;
+
+    verified_matrix_multiplier (const verified_matrix_multiplier<T> &v);
+    verified_matrix_multiplier<T>& operator = (const verified_matrix_multiplier<T> &v);
+
+  public:
+    /* Check each product with probability sample, with the given number of random vectors */
+    verified_matrix_multiplier (matrix_multiplier<T> *mm, double sample = 1.0, size_t vectors = FREIVALDS_VECTORS);
+    virtual ~verified_matrix_multiplier ();
+
+    T* mult (const T *a, const T *b, size_t arows, size_t acols, size_t brows, size_t bcols);
+    matrix_multiplier<T>* copy () const;
+
+    void account (mem_account *a);
+
+    double sample () const;
+    void sample (double fraction);
+
+    /* Whether the most recent product passed its check, or was not checked */
+    bool last_ok () const;
+
+    const verify_stats& stats () const;
+    void reset_stats ();
+  };
+
+  template <typename T>
+  verified_matrix_multiplier<T>::verified_matrix_multiplier (matrix_multiplier<T> *mm, double sample, size_t vectors)
+    : __mm (mm),
+      __sample (sample),
+      __vectors (vectors ? vectors : 1),
+      __state ((uint64_t) time (NULL) ^ (uint64_t) (size_t) this),
+      __last_ok (true)
+  {
+    memset (&__stats, 0, sizeof (__stats));
+
+    account (this->__account);
+  }
+
+  template <typename T>
+  verified_matrix_multiplier<T>::~verified_matrix_multiplier ()
+  {
+    delete __mm;
+  }
+
+  template <typename T>
+  matrix_multiplier<T>*
+  verified_matrix_multiplier<T>::copy () const
+  {
+    return (new verified_matrix_multiplier<T> (__mm->copy (), __sample, __vectors));
+  }
+
+  template <typename T>
+  void
+  verified_matrix_multiplier<T>::account (mem_account *a)
+  {
+    matrix_multiplier<T>::account (a);
+    __mm->account (this->__account);
+  }
+
+  template <typename T>
+  double
+  verified_matrix_multiplier<T>::sample () const
+  {
+    return __sample;
+  }
+
+  template <typename T>
+  void
+  verified_matrix_multiplier<T>::sample (double fraction)
+  {
+    __sample = fraction;
+  }
+
+  template <typename T>
+  bool
+  verified_matrix_multiplier<T>::last_ok () const
+  {
+    return __last_ok;
+  }
+
+  template <typename T>
+  const verify_stats&
+  verified_matrix_multiplier<T>::stats () const
+  {
+    return __stats;
+  }
+
+  template <typename T>
+  void
+  verified_matrix_multiplier<T>::reset_stats ()
+  {
+    memset (&__stats, 0, sizeof (__stats));
+  }
+
+  template <typename T>
+  T*
+  verified_matrix_multiplier<T>::mult (const T *a, const T *b, size_t arows, size_t acols, size_t brows, size_t bcols)
+  {
+    this->__begin ();
+
+    T *C = __mm->mult (a, b, arows, acols, brows, bcols);
+
+    __last_ok = true;
+
+    if (!C)
+      return NULL;
+
+    __stats.products++;
+
+    /* The top 53 bits of a random word, as a fraction in [0, 1) */
+    double u = (double) (freivalds_random (__state) >> 11) / 9007199254740992.0;
+
+    if (u < __sample)
+      {
+        __stats.checked++;
+        __last_ok = freivalds (a, b, C, arows, acols, bcols, __vectors, -1.0, freivalds_random (__state));
+
+        if (!__last_ok)
+          {
+            __stats.failed++;
+            fprintf (stderr, "verified_matrix_multiplier: %lux%lux%lu product failed verification\n",
+                     arows, acols, bcols);
+          }
+      }
+
+    return C;
+  }
+}
+
+#endif /* VERIFIED_MATRIX_MULTIPLIER_HPP_ */
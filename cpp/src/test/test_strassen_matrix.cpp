@@ -1,9 +1,15 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <signal.h>
 #include <execinfo.h>
 #include <unistd.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
 #include <iostream>
-#include <fstream>
+#include <complex>
+#include <vector>
+#include <algorithm>
 
 #include "../util/printer.hpp"
 #include "../util/timer.hpp"
@@ -13,6 +19,23 @@
 #include "../strassen/transpose_matrix_multiplier.hpp"
 #include "../strassen/strassen_matrix_multiplier.hpp"
 #include "../strassen/parallel_strassen_matrix_multiplier.hpp"
+#include "../strassen/caps_strassen_matrix_multiplier.hpp"
+#include "../strassen/complex_matrix_multiplier.hpp"
+#include "../strassen/adaptive_matrix_multiplier.hpp"
+#include "../strassen/skinny_matrix_multiplier.hpp"
+#include "../strassen/matrix_chain.hpp"
+#include "../strassen/async_matrix_multiplier.hpp"
+#include "../strassen/distributed_strassen_matrix_multiplier.hpp"
+#include "../strassen/cached_matrix_multiplier.hpp"
+#include "../strassen/maintained_product.hpp"
+#include "../strassen/verified_matrix_multiplier.hpp"
+#include "../strassen/out_of_core_matrix_multiplier.hpp"
+#include "../strassen/matrix_io.hpp"
+#include "../strassen/trace.hpp"
+#include "../strassen/allocator.hpp"
+
+/* Number of checks which have failed so far; the exit status of the test run */
+static int failures = 0;
 
 void
 simple ()
@@ -41,6 +64,8 @@ simple ()
     printf ("matrices equal!\n");
   else
     {
+      failures++;
+
       std::string os = alg_tostring (o);
       std::string ps = alg_tostring (p);
       
@@ -71,6 +96,7 @@ test_matrix_multipliers ()
   if (!(m_nmm == m || m_tmm == m || m_smm == m || m_psmm == m))
     {
       fprintf (stderr, "time_matrix_multipliers: matrix initialization failure\n");      
+      failures++;
     }
 
   m.mult (n);
@@ -83,6 +109,7 @@ test_matrix_multipliers ()
    if (!(m_nmm == m))
     {
       fprintf (stderr, "test_matrix_multipliers: m_nmm matrix multiplication failure\n");      
+      failures++;
     }
   else
     {
@@ -92,6 +119,7 @@ test_matrix_multipliers ()
   if (!(m_tmm == m))
     {
       fprintf (stderr, "test_matrix_multipliers: m_tmm matrix multiplication failure\n");      
+      failures++;
     }
   else
     {
@@ -101,6 +129,7 @@ test_matrix_multipliers ()
   if (!(m_smm == m))
     {
       fprintf (stderr, "test_matrix_multipliers: m_smm matrix multiplication failure\n");     
+      failures++;
 
       std::string s = alg_tostring (m);
       std::string smm = alg_tostring (m_smm);
@@ -117,6 +146,7 @@ test_matrix_multipliers ()
   if (!(m_psmm == m))
     {
       fprintf (stderr, "test_matrix_multipliers: m_psmm matrix multiplication failure\n");     
+      failures++;
 
       std::string s = alg_tostring (m);
       std::string smm = alg_tostring (m_smm);
@@ -132,312 +162,1915 @@ test_matrix_multipliers ()
 }
 
 void
-time_matrix_multipliers (size_t sz)
+test_rectangular_multipliers ()
 {
-  strassen::timer t;
-  strassen::matrix<int> m (sz, sz);
-  strassen::matrix<int> n (sz, sz);
-  strassen::matrix<int> m_nmm (sz, sz, new strassen::naive_matrix_multiplier<int> ());
-  strassen::matrix<int> m_tmm (sz, sz, new strassen::transpose_matrix_multiplier<int> ());
-  strassen::matrix<int> m_smm (sz, sz, new strassen::strassen_matrix_multiplier<int> ());
-  strassen::matrix<int> m_psmm (sz, sz, new strassen::parallel_strassen_matrix_multiplier<int> ());
-
-  m.random (103);
-  n.random (103);
-  
-  m_nmm = m;
-  m_tmm = m;
-  m_smm = m;
-  m_psmm = m;
+  /* m x k by k x n shapes, including one with a square power of 2 left operand */
+  size_t shapes[][3] = { { 37, 150, 91 }, { 200, 33, 7 }, { 64, 64, 150 }, { 1, 300, 1 } };
 
-  if (!(m_nmm == m || m_tmm == m || m_smm == m || m_psmm == m))
+  for (size_t s = 0; s < sizeof (shapes) / sizeof (shapes[0]); s++)
     {
-      fprintf (stderr, "test_matrix_multipliers: matrix initialization failure\n");      
-    }
+      strassen::matrix<int> a (shapes[s][0], shapes[s][1], new strassen::naive_matrix_multiplier<int> ());
+      strassen::matrix<int> b (shapes[s][1], shapes[s][2]);
 
-  printf ("MM array size: %lu x %lu\n", sz, sz);
+      a.random (100);
+      b.random (100);
 
-  m.mult (n);
+      strassen::matrix<int> expected = a;
+      expected.mult (b);
 
-  t.start ();
-  m_nmm.mult (n);
-  t.stop ();
+      strassen::matrix_multiplier<int> *mm[] =
+        {
+          new strassen::transpose_matrix_multiplier<int> (),
+          new strassen::strassen_matrix_multiplier<int> (16),
+          new strassen::parallel_strassen_matrix_multiplier<int> (16),
+          new strassen::adaptive_matrix_multiplier<int> ()
+        };
 
-  printf ("MM time [naive]: %lu.%0lu\n", t.secs(), t.usecs());
+      for (size_t i = 0; i < sizeof (mm) / sizeof (mm[0]); i++)
+        {
+          strassen::matrix<int> c (1, 1, mm[i]);
+          c = a;
+          c.mult (b);
+
+          if (c.rows () != shapes[s][0] || c.cols () != shapes[s][2] || !(c == expected))
+            {
+              fprintf (stderr, "test_rectangular_multipliers: %lux%lux%lu failure with multiplier %lu\n",
+                       shapes[s][0], shapes[s][1], shapes[s][2], i);
+              failures++;
+            }
+        }
+    }
 
-  t.start ();
-  m_tmm.mult (n);
-  t.stop ();
+  fprintf (stderr, "test_rectangular_multipliers: done\n");
+}
 
-  printf ("MM time [transpose]: %lu.%0lu\n", t.secs(), t.usecs());
-  
-  t.start ();
-  m_smm.mult (n);
-  t.stop ();
+void
+test_skinny_multiplier ()
+{
+  /* Matrix-vector products both ways, small k, few columns of B, and a few rows of A; the last two large
+     enough to be divided between threads, by rows and by columns */
+  size_t shapes[][3] = { { 300, 200, 1 }, { 1, 200, 300 }, { 300, 8, 250 }, { 250, 300, 5 }, { 5, 300, 250 },
+                         { 700, 600, 3 }, { 3, 600, 700 } };
+  bool ok = true;
 
-  printf ("MM time [strassen]: %lu.%0lu\n", t.secs(), t.usecs());
+  for (size_t s = 0; s < sizeof (shapes) / sizeof (shapes[0]); s++)
+    {
+      strassen::matrix<int> a (shapes[s][0], shapes[s][1], new strassen::naive_matrix_multiplier<int> ());
+      strassen::matrix<int> b (shapes[s][1], shapes[s][2]);
 
-  t.start ();
-  m_psmm.mult (n);
-  t.stop ();
+      a.random (100);
+      b.random (100);
 
-  printf ("MM time [parallel strassen]: %lu.%0lu\n", t.secs(), t.usecs());
+      strassen::matrix<int> expected = a;
+      expected.mult (b);
 
-  if (!(m_nmm == m))
-    {
-      fprintf (stderr, "test_matrix_multipliers: m_nmm matrix multiplication failure\n");      
-    }
-  else
-    {
-      fprintf (stderr, "test_matrix_multipliers: naive multiplier success\n");
+      for (size_t threads = 1; threads <= 3; threads += 2)
+        {
+          strassen::skinny_matrix_multiplier<int> skmm (threads);
+          int *C = skmm.mult (a.data (), b.data (), shapes[s][0], shapes[s][1], shapes[s][1], shapes[s][2]);
+
+          if (!C || memcmp (C, expected.data (), shapes[s][0] * shapes[s][2] * sizeof (int)))
+            {
+              fprintf (stderr, "test_skinny_multiplier: %lux%lux%lu failure with %lu threads\n",
+                       shapes[s][0], shapes[s][1], shapes[s][2], threads);
+              ok = false;
+            }
+
+          free (C);
+        }
     }
-  
-  if (!(m_tmm == m))
+
+  /* A x in both layouts, against the product with a one-column matrix */
+  strassen::matrix<int> a (500, 500, new strassen::naive_matrix_multiplier<int> ());
+  strassen::matrix<int> x (500, 1);
+
+  a.random (100);
+  x.random (100);
+
+  for (size_t pass = 0; pass < 2; pass++)
     {
-      fprintf (stderr, "test_matrix_multipliers: m_tmm matrix multiplication failure\n");      
+      strassen::matrix<int> expected = a;
+      expected.mult (x);
+
+      std::vector<int> y (a.rows ());
+
+      for (size_t threads = 1; threads <= 3; threads += 2)
+        {
+          a.mult_vector (x.data (), &y[0], threads);
+
+          if (memcmp (&y[0], expected.data (), a.rows () * sizeof (int)))
+            {
+              fprintf (stderr, "test_skinny_multiplier: %s gemv failure with %lu threads\n",
+                       (a.layout () == strassen::ROW_MAJOR) ? "row-major" : "column-major", threads);
+              ok = false;
+            }
+        }
+
+      a.transpose ();
     }
+
+  strassen::adaptive_matrix_multiplier<int> amm;
+  strassen::matrix<int> v (1, 300);
+  strassen::matrix<int> m (300, 300);
+
+  v.random (100);
+  m.random (100);
+
+  int *C = amm.mult (v.data (), m.data (), 1, 300, 300, 300);
+
+  ok = ok && C && amm.last_decision ().algorithm == strassen::ADAPTIVE_SKINNY;
+  free (C);
+
+  if (!ok)
+    failures++;
   else
+    fprintf (stderr, "test_skinny_multiplier: success\n");
+}
+
+void
+test_syrk ()
+{
+  strassen::matrix<int> a (300, 170, new strassen::naive_matrix_multiplier<int> ());
+  a.random (100);
+
+  strassen::matrix<int> at = a;
+  at.transpose ();
+
+  strassen::matrix<int> expected = a;
+  expected.mult (at);
+
+  strassen::matrix_multiplier<int> *mm[] =
     {
-      fprintf (stderr, "test_matrix_multipliers: transpose multiplier success\n");
-    }
+      new strassen::naive_matrix_multiplier<int> (),
+      new strassen::transpose_matrix_multiplier<int> (),
+      new strassen::strassen_matrix_multiplier<int> (16),
+      new strassen::adaptive_matrix_multiplier<int> ()
+    };
 
-  if (!(m_smm == m))
+  bool ok = true;
+
+  for (size_t i = 0; i < sizeof (mm) / sizeof (mm[0]); i++)
     {
-      fprintf (stderr, "test_matrix_multipliers: m_smm matrix multiplication failure\n");     
+      for (int t = strassen::LOWER_TRIANGLE; t <= strassen::UPPER_TRIANGLE; t++)
+        {
+          for (int mirror = 0; mirror <= 1; mirror++)
+            {
+              int *C = mm[i]->syrk (a.data (), a.rows (), a.cols (), (strassen::matrix_triangle) t, mirror);
+              const int *E = expected.data ();
+              size_t n = a.rows ();
+              bool right = (C != NULL);
+
+              /* The computed triangle, diagonal included, as in the full product, and zeroes elsewhere */
+              for (size_t r = 0; right && r < n; r++)
+                {
+                  for (size_t c = 0; right && c < n; c++)
+                    {
+                      bool computed = mirror || (t == strassen::LOWER_TRIANGLE ? c <= r : c >= r);
+
+                      right = (C[(r * n) + c] == (computed ? E[(r * n) + c] : 0));
+                    }
+                }
+
+              if (!right)
+                {
+                  fprintf (stderr, "test_syrk: failure with multiplier %lu, %s triangle%s\n", i,
+                           (t == strassen::LOWER_TRIANGLE) ? "lower" : "upper", mirror ? ", mirrored" : "");
+                  ok = false;
+                }
+
+              free (C);
+            }
+        }
+
+      delete mm[i];
     }
+
+  /* Column-major, through the matrix */
+  strassen::matrix<int> g = a;
+  g.relayout (strassen::COLUMN_MAJOR);
+  g.syrk (strassen::UPPER_TRIANGLE, true);
+
+  ok = ok && g.layout () == strassen::ROW_MAJOR && g == expected;
+
+  if (!ok)
+    failures++;
   else
+    fprintf (stderr, "test_syrk: success\n");
+}
+
+void
+test_prepared_operand ()
+{
+  /* Second operands padded and not; first operands shorter, as tall as, and taller than the padded size */
+  size_t shapes[][2] = { { 300, 200 }, { 256, 256 } };
+  size_t heights[] = { 150, 256, 512, 700 };
+  bool ok = true;
+
+  for (size_t s = 0; s < sizeof (shapes) / sizeof (shapes[0]); s++)
     {
-      fprintf (stderr, "test_matrix_multipliers: strassen multiplier success\n");      
-    }
-  
-  if (!(m_psmm == m))
-    {
-      fprintf (stderr, "test_matrix_multipliers: m_psmm matrix multiplication failure\n");     
+      size_t k = shapes[s][0];
+      size_t n = shapes[s][1];
+      strassen::matrix<int> b (k, n);
+
+      b.random (100);
+
+      strassen::matrix_multiplier<int> *mm[] =
+        {
+          new strassen::naive_matrix_multiplier<int> (),
+          new strassen::transpose_matrix_multiplier<int> (),
+          new strassen::strassen_matrix_multiplier<int> (16),
+          new strassen::adaptive_matrix_multiplier<int> ()
+        };
+
+      for (size_t i = 0; i < sizeof (mm) / sizeof (mm[0]); i++)
+        {
+          strassen::prepared_operand<int> *p = mm[i]->prepare (b.data (), k, n);
+
+          ok = ok && p && p->rows () == k && p->cols () == n;
+
+          if (i == 2)
+            ok = ok && p->bytes () == strassen::strassen_matrix_multiplier<int>::predicted_prepared_bytes (k, n, 16);
+
+          for (size_t h = 0; p && h < sizeof (heights) / sizeof (heights[0]); h++)
+            {
+              strassen::matrix<int> a (heights[h], k, new strassen::naive_matrix_multiplier<int> ());
+              a.random (100);
+              a.data ()[h] += 1;
+
+              strassen::matrix<int> expected = a;
+              expected.mult (b);
+
+              int *C = mm[i]->mult_prepared (a.data (), *p, heights[h]);
+
+              if (!C || memcmp (C, expected.data (), heights[h] * n * sizeof (int)))
+                {
+                  fprintf (stderr, "test_prepared_operand: %lux%lux%lu failure with multiplier %lu\n",
+                           heights[h], k, n, i);
+                  ok = false;
+                }
+
+              free (C);
+            }
+
+          delete p;
+          delete mm[i];
+        }
     }
+
+  /* Through the matrix, with a column-major first operand */
+  strassen::matrix<int> a (200, 300);
+  strassen::matrix<int> b (300, 250);
+
+  a.random (100);
+  b.random (100);
+  a.data ()[0] += 1;
+
+  strassen::matrix<int> expected = a;
+  expected.mult (b);
+
+  strassen::prepared_operand<int> *p = b.prepare ();
+
+  a.relayout (strassen::COLUMN_MAJOR);
+  a.mult (*p);
+
+  ok = ok && a == expected;
+
+  /* Operands prepared by one kind of multiplier are refused by another */
+  strassen::strassen_matrix_multiplier<int> smm (16);
+  strassen::transpose_matrix_multiplier<int> tmm;
+  strassen::prepared_operand<int> *sp = smm.prepare (b.data (), 300, 250);
+  int *C = tmm.mult_prepared (b.data (), *sp, 200);
+
+  ok = ok && !C;
+
+  delete p;
+  delete sp;
+
+  if (!ok)
+    failures++;
+  else
+    fprintf (stderr, "test_prepared_operand: success\n");
+}
+
+/* Whether matrices bound to the multiplier class M compute a b, a^T b and a a^T as matrix<int> does */
+template <typename M>
+bool
+bound_product (const strassen::matrix<int> &a, const strassen::matrix<int> &b, const strassen::matrix<int> &expected)
+{
+  strassen::matrix<int, M> ba (a.rows (), a.cols ());
+  strassen::matrix<int, M> bb (b.rows (), b.cols ());
+
+  memcpy (ba.data (), a.data (), a.rows () * a.cols () * sizeof (int));
+  memcpy (bb.data (), b.data (), b.rows () * b.cols () * sizeof (int));
+
+  /* A copy has a multiplier of its own */
+  strassen::matrix<int, M> bc = ba;
+
+  ba.mult (bb);
+  bc.mult (bb);
+
+  bool ok = (ba.rows () == expected.rows () && ba.cols () == expected.cols ()
+             && !memcmp (ba.data (), expected.data (), expected.rows () * expected.cols () * sizeof (int))
+             && !memcmp (bc.data (), ba.data (), expected.rows () * expected.cols () * sizeof (int))
+             && &bc.multiplier () != &ba.multiplier ());
+
+  /* Column-major operands, and syrk */
+  strassen::matrix<int, M> at (a.cols (), a.rows ());
+  strassen::matrix<int> ar (a.cols (), a.rows ());
+
+  memcpy (at.data (), a.data (), a.rows () * a.cols () * sizeof (int));
+  memcpy (ar.data (), a.data (), a.rows () * a.cols () * sizeof (int));
+  at.transpose ();
+  ar.transpose ();
+  at.mult (bb);
+  ar.mult (b);
+
+  ok = ok && !memcmp (at.data (), ar.data (), ar.rows () * ar.cols () * sizeof (int));
+
+  strassen::matrix<int, M> sa (a.rows (), a.cols ());
+  strassen::matrix<int> sr = a;
+
+  memcpy (sa.data (), a.data (), a.rows () * a.cols () * sizeof (int));
+  sa.syrk (strassen::LOWER_TRIANGLE, true);
+  sr.syrk (strassen::LOWER_TRIANGLE, true);
+
+  return (ok && !memcmp (sa.data (), sr.data (), sr.rows () * sr.cols () * sizeof (int)));
+}
+
+void
+test_bound_multiplier ()
+{
+  bool ok = true;
+  strassen::matrix<int> a (150, 130, new strassen::naive_matrix_multiplier<int> ());
+  strassen::matrix<int> b (130, 110);
+
+  a.random (100);
+  b.random (100);
+  a.data ()[0] += 1;
+
+  strassen::matrix<int> expected = a;
+  expected.mult (b);
+
+  ok = ok && bound_product<strassen::naive_matrix_multiplier<int> > (a, b, expected);
+  ok = ok && bound_product<strassen::transpose_matrix_multiplier<int> > (a, b, expected);
+  ok = ok && bound_product<strassen::strassen_matrix_multiplier<int> > (a, b, expected);
+  ok = ok && bound_product<strassen::adaptive_matrix_multiplier<int> > (a, b, expected);
+
+  /* The multiplier is reachable for configuration and accounting */
+  strassen::matrix<int, strassen::strassen_matrix_multiplier<int> > s (256, 256);
+  strassen::matrix<int, strassen::strassen_matrix_multiplier<int> > t = s;
+
+  s.random (100);
+  t.random (100);
+  s.multiplier ().threshold (64);
+  s.mult (t);
+
+  ok = ok && s.multiplier ().usage ().allocations () > 0;
+
+  /* Bound matrices print, and make up chains, like any others */
+  strassen::matrix<int, strassen::transpose_matrix_multiplier<int> > u (3, 40);
+  strassen::matrix<int, strassen::transpose_matrix_multiplier<int> > v (40, 2);
+
+  u.random (100);
+  v.random (100);
+
+  strassen::matrix_chain_multiplier<int> chain (1);
+  std::vector<const strassen::matrix<int, strassen::transpose_matrix_multiplier<int> > *> uv;
+  uv.push_back (&u);
+  uv.push_back (&v);
+
+  int *P = chain.mult (uv);
+  u.mult (v);
+  std::string us = alg_tostring (u);
+
+  ok = ok && P && !memcmp (P, u.data (), 3 * 2 * sizeof (int)) && std::count (us.begin (), us.end (), '\n') == 3;
+  free (P);
+
+  /* ... and can be maintained, or multiplied asynchronously */
+  strassen::matrix<int, strassen::transpose_matrix_multiplier<int> > w (30, 40);
+  strassen::matrix<int, strassen::transpose_matrix_multiplier<int> > x (40, 20);
+
+  w.random (100);
+  x.random (100);
+
+  strassen::maintained_product<int, strassen::transpose_matrix_multiplier<int> > mp (w, x);
+  strassen::async_matrix_multiplier<int> async (1);
+
+  int *Q = async.submit (w, x).get ();
+  const int *R = mp.update ();
+  w.mult (x);
+
+  ok = ok && Q && R && !memcmp (Q, w.data (), 30 * 20 * sizeof (int))
+    && !memcmp (R, w.data (), 30 * 20 * sizeof (int));
+  free (Q);
+
+  if (!ok)
+    failures++;
+  else
+    fprintf (stderr, "test_bound_multiplier: success\n");
+}
+
+void
+test_copy_on_write ()
+{
+  bool ok = true;
+  strassen::matrix<int> a (64, 48);
+
+  a.random (100);
+
+  /* Copies share the data until written */
+  strassen::matrix<int> b = a;
+  strassen::matrix<int> c (1, 1);
+  c = a;
+
+  const strassen::matrix<int> &ca = a;
+  const strassen::matrix<int> &cb = b;
+  const strassen::matrix<int> &cc = c;
+  const int *shared = ca.data ();
+
+  ok = ok && cb.data () == shared && cc.data () == shared;
+
+  int first = ca.data ()[0];
+
+  b (0, 0) = first + 1;
+
+  ok = ok && ca.data () == shared && cc.data () == shared && cb.data () != shared;
+  ok = ok && ca.data ()[0] == first && cb.data ()[0] == first + 1 && b.rows () == 64 && b.cols () == 48;
+
+  /* The last holder writes in place */
+  c.mult (2);
+  ok = ok && cc.data () != shared && cc.data ()[1] == 2 * ca.data ()[1];
+
+  a (1, 1) = 7;
+  ok = ok && ca.data () == shared && ca.data ()[(1 * 48) + 1] == 7;
+
+  /* Moves take the data, and leave a usable empty matrix */
+  std::vector<strassen::matrix<int> > v;
+  v.push_back (std::move (a));
+
+  ok = ok && v[0].data () == shared && a.rows () == 0 && a.cols () == 0 && !ca.data ();
+
+  strassen::matrix<int> d (64, 48);
+  d = std::move (v[0]);
+  ok = ok && d.data () == shared && !v[0].data ();
+
+  a.resize (2, 2);
+  a.zeroes ();
+  a (0, 0) = 1;
+  a (1, 1) = 1;
+  a.mult (a);
+  ok = ok && a (0, 0) == 1 && a (0, 1) == 0;
+
+  /* A copy of a mapped matrix outlives it */
+  char path[] = "/tmp/strassen_cow.XXXXXX";
+  close (mkstemp (path));
+
+  strassen::matrix<int> *mapped = new strassen::matrix<int> ();
+  strassen::matrix<int> copy;
+
+  if (!strassen::save_binary (d, path) || !strassen::load_binary (*mapped, path))
+    ok = false;
   else
     {
-      fprintf (stderr, "test_matrix_multipliers: parallel strassen multiplier success\n");      
+      copy = *mapped;
+      delete mapped;
+      mapped = NULL;
+
+      ok = ok && copy == d;
+      copy (3, 3) = -1;
+      ok = ok && copy (3, 3) == -1 && d (3, 3) != -1;
     }
+
+  delete mapped;
+  unlink (path);
+
+  if (!ok)
+    failures++;
+  else
+    fprintf (stderr, "test_copy_on_write: success\n");
 }
 
 void
-time_full (size_t lower, size_t upper, size_t factor, size_t trials)
+test_row_threads ()
 {
-  bool b = false;
-  double tmp;
-  double avgsum = 0.0;
+  bool ok = true;
+  size_t sz = 1000;
 
-  strassen::timer t;
-  size_t naive_accumulator = 0;
-  size_t transpose_accumulator = 0;
-  size_t strassen_accumulator = 0;
+  strassen::matrix<int> a (sz, sz);
+  strassen::matrix<int> b (sz, sz);
 
-  printf ("nxn naive transpose strassen\n");
+  a.random (100);
+  b.random (100);
 
-  for (uint32_t i = 1; i < factor + 1; i++) {
+  /* The padded operands are large enough to be divided, and every thread count gives the same product */
+  strassen::strassen_matrix_multiplier<int> one;
+  strassen::strassen_matrix_multiplier<int> four;
+  strassen::parallel_strassen_matrix_multiplier<int> psmm;
 
-    size_t lower_bound = i * lower;
-    size_t upper_bound = i * upper;
+  four.threads (4);
+  ok = ok && one.threads () == 1 && four.threads () == 4;
 
-    int x = (rand () % lower_bound) + upper_bound;
-    int y = (rand () % lower_bound) + upper_bound;
+  strassen::strassen_matrix_multiplier<int> *copy = (strassen::strassen_matrix_multiplier<int> *) four.copy ();
+  ok = ok && copy->threads () == 4;
+  delete copy;
 
-    strassen::matrix<int> n (y, x);
+  int *C1 = one.mult (a.data (), b.data (), sz, sz, sz, sz);
+  int *C4 = four.mult (a.data (), b.data (), sz, sz, sz, sz);
+  int *CP = psmm.mult (a.data (), b.data (), sz, sz, sz, sz);
 
-    n.random (1000000);
+  ok = ok && C1 && C4 && CP;
+  ok = ok && !memcmp (C1, C4, sz * sz * sizeof (int)) && !memcmp (C1, CP, sz * sz * sizeof (int));
+  ok = ok && strassen::freivalds (a.data (), b.data (), C4, sz, sz, sz);
 
-    for (uint32_t j = 0; j < trials; j++)
-      {
-        strassen::matrix<int> m_nmm (x, y, new strassen::naive_matrix_multiplier<int> ());
-        strassen::matrix<int> m_tmm (x, y, new strassen::transpose_matrix_multiplier<int> ());
-        strassen::matrix<int> m_smm (x, y, new strassen::strassen_matrix_multiplier<int> ());
-        m_nmm.random (1000000);
-        m_tmm.random (1000000);
-        m_smm.random (1000000);
+  free (C1);
+  free (C4);
+  free (CP);
 
-        t.start ();
-        m_nmm.mult (n);
-        t.stop ();
+  if (!ok)
+    failures++;
+  else
+    fprintf (stderr, "test_row_threads: success\n");
+}
 
-        // Time in millis
-        naive_accumulator += t.secs() * 1000 + t.usecs() / 1000;
+void
+test_parallel_threads ()
+{
+  bool ok = true;
+  size_t m = 300, k = 500, n = 400;
 
-        t.start ();
-        m_tmm.mult (n);
-        t.stop ();
+  strassen::matrix<int> a (m, k);
+  strassen::matrix<int> b (k, n);
 
-        // Time in millis
-        transpose_accumulator += t.secs() * 1000 + t.usecs() / 1000;
+  a.random (100);
+  b.random (100);
 
-        t.start ();
-        m_smm.mult (n);
-        t.stop ();
+  strassen::transpose_matrix_multiplier<int> tmm;
+  int *R = tmm.mult (a.data (), b.data (), m, k, k, n);
 
-        // Time in millis
-        strassen_accumulator += t.secs() * 1000 + t.usecs() / 1000;
-      }
+  /* No workers, fewer workers than products, and more */
+  size_t threads[] = {1, 3, 12};
 
-    printf ("%d %d %d %lu.0 %lu.0 %lu.0\n", x, y, x * y, naive_accumulator, transpose_accumulator, strassen_accumulator);
-  }
+  for (size_t i = 0; i < 3; i++)
+    {
+      strassen::parallel_strassen_matrix_multiplier<int> psmm (64, threads[i]);
+      int *C = psmm.mult (a.data (), b.data (), m, k, k, n);
+      size_t predicted = strassen::parallel_strassen_matrix_multiplier<int>::predicted_peak_bytes (m, k, k, n, 64,
+                                                                                                 threads[i]);
+
+      ok = ok && C && !memcmp (C, R, m * n * sizeof (int)) && psmm.usage ().peak () <= predicted;
+      free (C);
+
+      strassen::matrix_multiplier<int> *copy = psmm.copy ();
+      C = copy->mult (a.data (), b.data (), m, k, k, n);
+      ok = ok && C && !memcmp (C, R, m * n * sizeof (int));
+      free (C);
+      delete copy;
+    }
+
+  free (R);
+
+  if (!ok)
+    failures++;
+  else
+    fprintf (stderr, "test_parallel_threads: success\n");
 }
 
 void
-mult_test ()
+test_caps_multiplier ()
 {
-  strassen::matrix<int> m (800, 800);
-  strassen::matrix<int> n (800, 800);
-  strassen::matrix<int> o (800, 800);
+  bool ok = true;
+  size_t m = 600, k = 700, n = 500;
 
-  m.random (231);
-  n.random (673);
+  strassen::matrix<int> a (m, k);
+  strassen::matrix<int> b (k, n);
 
-  o = m;
+  a.random (100);
+  b.random (100);
 
-  m.mult (n);
-  o.mult (n);
+  strassen::transpose_matrix_multiplier<int> tmm;
+  int *R = tmm.mult (a.data (), b.data (), m, k, k, n);
 
-  if (!(m == o))
+  /* With memory to spare, the threads spread out at once; with one thread, the recursion is sequential */
+  strassen::caps_strassen_matrix_multiplier<int> wide (8);
+  strassen::caps_strassen_matrix_multiplier<int> one (1);
+
+  /* With only the memory of the sequential recursion, the top steps are depth-first */
+  size_t sequential = strassen::strassen_matrix_multiplier<int>::predicted_peak_bytes (m, k, k, n);
+  strassen::caps_strassen_matrix_multiplier<int> tight (8, sequential + (sequential / 8));
+
+  std::string ws = wide.schedule (m, k, k, n);
+  std::string os = one.schedule (m, k, k, n);
+  std::string ts = tight.schedule (m, k, k, n);
+
+  ok = ok && ws.size () == 3 && ws[0] == 'B' && os == "DDD" && ts.size () == 3 && ts[0] == 'D' && ts != "DDD";
+
+  strassen::caps_strassen_matrix_multiplier<int> *mms[] = {&wide, &one, &tight};
+
+  for (size_t i = 0; i < 3; i++)
     {
-      fprintf (stderr, "matrix mult match failure\n");
-      
-      std::string ms = alg_tostring (m);
-      std::string os = alg_tostring (o);
-      
-      printf ("%s\n\n%s\n\n", ms.c_str(), os.c_str());
+      int *C = mms[i]->mult (a.data (), b.data (), m, k, k, n);
+      size_t predicted = strassen::caps_strassen_matrix_multiplier<int>::predicted_peak_bytes (m, k, k, n,
+                                                                                             mms[i]->threads (),
+                                                                                             mms[i]->budget ());
+
+      ok = ok && C && !memcmp (C, R, m * n * sizeof (int)) && mms[i]->usage ().peak () <= predicted;
+      free (C);
     }
+
+  ok = ok && tight.usage ().peak () <= tight.budget ();
+
+  strassen::matrix_multiplier<int> *copy = tight.copy ();
+  ok = ok && ((strassen::caps_strassen_matrix_multiplier<int> *) copy)->schedule (m, k, k, n) == ts;
+  delete copy;
+
+  free (R);
+
+  if (!ok)
+    failures++;
+  else
+    fprintf (stderr, "test_caps_multiplier: success\n");
 }
 
+/* A multiplier with a bug: one element of every product is off by one */
+template <typename T>
+class broken_matrix_multiplier : public strassen::transpose_matrix_multiplier<T>
+{
+public:
+  T*
+  mult (const T *a, const T *b, size_t arows, size_t acols, size_t brows, size_t bcols)
+  {
+    T *C = strassen::transpose_matrix_multiplier<T>::mult (a, b, arows, acols, brows, bcols);
+
+    if (C)
+      C[(arows / 2) * bcols + (bcols / 3)] += T (1);
+
+    return C;
+  }
+};
+
 void
-big_test (size_t start)
+test_freivalds ()
 {
-  std::ofstream out;
+  /* Large products are checked with Freivalds' algorithm rather than recomputed */
+  const size_t n = 1024;
+  bool ok = true;
+
+  strassen::matrix<int> a (n, n, new strassen::strassen_matrix_multiplier<int> ());
+  strassen::matrix<int> b (n, n);
+
+  a.random (100);
+  b.random (100);
+
+  strassen::matrix<int> c = a;
+  c.mult (b);
+
+  ok = ok && strassen::freivalds (a.data (), b.data (), c.data (), n, n, n);
+
+  c.data ()[(n * n) / 2 + 7] -= 1;
+  ok = ok && !strassen::freivalds (a.data (), b.data (), c.data (), n, n, n);
 
-  out.open ("./matrix_mult.out", std::ios::out | std::ios::app);
+  /* Floating point, within rounding; rectangular, through the parallel multiplier */
+  strassen::matrix<double> x (700, 900, new strassen::parallel_strassen_matrix_multiplier<double> (64));
+  strassen::matrix<double> y (900, 500);
 
-  if (out.fail ())
+  x.random ();
+  y.random ();
+
+  for (size_t i = 0; i < 700 * 900; i++)
+    x.data ()[i] /= RAND_MAX;
+
+  for (size_t i = 0; i < 900 * 500; i++)
+    y.data ()[i] = (y.data ()[i] / RAND_MAX) - 0.5;
+
+  strassen::matrix<double> z = x;
+  z.mult (y);
+
+  ok = ok && strassen::freivalds (x.data (), y.data (), z.data (), 700, 900, 500);
+
+  z.data ()[12345] += 1e-6;
+  ok = ok && !strassen::freivalds (x.data (), y.data (), z.data (), 700, 900, 500);
+
+  /* Spot checks catch the broken multiplier, and pass a working one */
+  strassen::verified_matrix_multiplier<int> broken (new broken_matrix_multiplier<int> ());
+  strassen::verified_matrix_multiplier<int> working (new strassen::strassen_matrix_multiplier<int> (), 0.5);
+
+  for (size_t i = 0; i < 8; i++)
     {
-      fprintf (stderr, "error opening output file\n");
-      perror ("open");
-      exit (1);
+      free (broken.mult (a.data (), b.data (), 200, 200, 200, 200));
+      free (working.mult (a.data (), b.data (), 200, 200, 200, 200));
     }
 
-  strassen::timer t;
+  ok = ok && broken.stats ().products == 8 && broken.stats ().checked == 8 && broken.stats ().failed == 8
+    && !broken.last_ok () && working.stats ().products == 8 && working.stats ().checked <= 8
+    && !working.stats ().failed;
 
-  size_t reps = 4;
-
-  size_t s = start;
-  time_t secs[5];
-  time_t usecs[5];
-  char buf[128];
-
-  while (s < 5000)
-    {     
-      strassen::matrix<int> m (s, s);
-      strassen::matrix<int> n (s, s);
-      strassen::matrix<int> m_nmm (s, s, new strassen::naive_matrix_multiplier<int> ());
-      strassen::matrix<int> m_tmm (s, s, new strassen::transpose_matrix_multiplier<int> ());
-      strassen::matrix<int> m_smm (s, s, new strassen::strassen_matrix_multiplier<int> ());
-      strassen::matrix<int> m_psmm (s, s, new strassen::parallel_strassen_matrix_multiplier<int> ());
-      
-      m.random (197);
-      n.random (213);
-      
-      m_nmm = m;
-      m_tmm = m;
-      m_smm = m;
-      m_psmm = m;
-      
-      printf ("\nMM array size: %lu x %lu\n", s, s);
-      
-      secs[0] = 0;
-      usecs[0] = 0;
-      
-      for (uint32_t i = 0; i < reps; i++)
-        {
-          t.start ();
-          m_nmm.mult (n);
-          t.stop ();
-          
-          secs[0] += t.secs ();
-          usecs[0] += t.usecs ();
-        }           
-
-      secs[0] = secs[0] / reps;
-      usecs[0] = usecs[0] / reps;
-      m_nmm.clear ();
-      
-      printf ("MM time [naive]: %lu.%lu\n", secs[0], usecs[0]);
-            
-      secs[1] = 0;
-      usecs[1] = 0;
-      
-      for (uint32_t i = 0; i < reps; i++)
-        {
-          t.start ();
-          m_tmm.mult (n);
-          t.stop ();
-          
-          secs[1] += t.secs ();
-          usecs[1] += t.usecs ();
-        }            
-
-      secs[1] = (time_t)(secs[1] / reps);
-      usecs[1] = (time_t)(usecs[1] / reps);
-      m_tmm.clear ();
-
-      printf ("MM time [transpose]: %lu.%lu\n", secs[1], usecs[1]);
-      
-      secs[3] = 0;
-      usecs[3] = 0;
-      
-      for (uint32_t i = 0; i < reps; i++)
-        {
-          t.start ();
-          m_smm.mult (n);
-          t.stop ();
-          
-          secs[3] += t.secs ();
-          usecs[3] += t.usecs ();
-        }      
-
-      secs[3] = secs[3] / reps;
-      usecs[3] = usecs[3] / reps;
-      m_smm.clear ();      
-     
-      printf ("MM time [strassen]: %lu.%lu\n", secs[3], usecs[3]);
-
-      secs[4] = 0;
-      usecs[4] = 0;
-      
-      for (uint32_t i = 0; i < reps; i++)
-        {
-          t.start ();
-          m_psmm.mult (n);
-          t.stop ();
-          
-          secs[4] += t.secs ();
-          usecs[4] += t.usecs ();
-        }      
+  if (!ok)
+    failures++;
+  else
+    fprintf (stderr, "test_freivalds: success\n");
+}
+
+void
+test_adaptive_multiplier ()
+{
+  strassen::adaptive_cost_model saved = strassen::adaptive_matrix_multiplier<int>::model ();
+  strassen::adaptive_cost_model cm;
+
+  /* Kernels at 1 G multiply-adds and 1 G block elements per second, naive at half speed; one processor */
+  cm.naive_rate = 0.5e9;
+  cm.transpose_rate = 1e9;
+  cm.block_rate = 1e9;
+  cm.call_overhead = 1e-6;
+  cm.thread_overhead = 100e-6;
+  cm.cpus = 1;
+
+  strassen::adaptive_matrix_multiplier<int>::set_model (cm);
+
+  strassen::adaptive_decision small = strassen::adaptive_matrix_multiplier<int>::decide (32, 32, 32);
+  strassen::adaptive_decision large = strassen::adaptive_matrix_multiplier<int>::decide (2048, 2048, 2048);
+  strassen::adaptive_decision skinny = strassen::adaptive_matrix_multiplier<int>::decide (2048, 8, 2048);
+
+  cm.cpus = 4;
+  strassen::adaptive_matrix_multiplier<int>::set_model (cm);
+
+  strassen::adaptive_decision parallel = strassen::adaptive_matrix_multiplier<int>::decide (2048, 2048, 2048);
 
-      secs[4] = secs[4] / reps;
-      usecs[4] = usecs[4] / reps;
-      m_psmm.clear ();
+  bool ok = (small.algorithm == strassen::ADAPTIVE_TRANSPOSE
+             && large.algorithm == strassen::ADAPTIVE_STRASSEN && large.depth >= 1
+             && large.threshold == (2048u >> large.depth)
+             && skinny.algorithm == strassen::ADAPTIVE_SKINNY && skinny.threads == 1
+             && parallel.algorithm == strassen::ADAPTIVE_PARALLEL && parallel.threads > 1
+             && parallel.estimate < large.estimate);
 
-      printf ("MM time [parallel strassen]: %lu.%lu\n", secs[4], usecs[4]);
+  strassen::adaptive_matrix_multiplier<int>::set_model (saved);
 
-      snprintf (buf, 128, "%lu %lu.%lu %lu.%lu %lu.%lu %lu.%lu %lu.%lu\n", 
-        s,
-        secs[0], usecs[0],
-        secs[1], usecs[1],
-        secs[2], usecs[2],
-        secs[3], usecs[3],
-        secs[4], usecs[4]);
+  /* With the real model, the multiplier's result must not depend on its choice */
+  strassen::adaptive_matrix_multiplier<int> amm;
+  strassen::matrix<int> a (300, 300, new strassen::naive_matrix_multiplier<int> ());
+  strassen::matrix<int> b (300, 300);
 
-      out.write (buf, strlen (buf));
-      out.flush ();
+  a.random (100);
+  b.random (100);
 
-      s += 137;
-      sleep (1);
+  int *C = amm.mult (a.data (), b.data (), 300, 300, 300, 300);
+  a.mult (b);
+
+  ok = ok && !memcmp (C, a.data (), 300 * 300 * sizeof (int));
+  free (C);
+
+  if (!ok)
+    {
+      fprintf (stderr, "test_adaptive_multiplier: unexpected decision\n");
+      failures++;
+    }
+  else
+    {
+      fprintf (stderr, "test_adaptive_multiplier: decision success (300^3 -> %s, depth %lu)\n",
+               strassen::adaptive_algorithm_name (amm.last_decision ().algorithm), amm.last_decision ().depth);
+    }
+}
+
+void
+test_matrix_chain ()
+{
+  strassen::adaptive_cost_model saved = strassen::adaptive_matrix_multiplier<unsigned>::model ();
+  strassen::adaptive_cost_model cm;
+
+  /* With free block operations and calls, the cost is proportional to the multiply-adds */
+  cm.naive_rate = 0.5e9;
+  cm.transpose_rate = 1e9;
+  cm.block_rate = 1e30;
+  cm.call_overhead = 0.0;
+  cm.thread_overhead = 0.0;
+  cm.cpus = 1;
+
+  strassen::adaptive_matrix_multiplier<unsigned>::set_model (cm);
+
+  std::vector<size_t> textbook = { 30, 35, 15, 5, 10, 20, 25 };
+  strassen::chain_plan p = strassen::matrix_chain_multiplier<unsigned>::plan (textbook);
+
+  bool ok = (p.order () == "((A1(A2A3))((A4A5)A6))" && p.estimate < p.left_to_right);
+
+  strassen::adaptive_matrix_multiplier<unsigned>::set_model (saved);
+
+  /* Unsigned arithmetic is exact modulo 2^32, so every order gives the same result */
+  std::vector<size_t> dims = { 40, 300, 20, 250, 10, 90, 60 };
+  std::vector<strassen::matrix<unsigned> *> ms;
+
+  for (size_t i = 0; i + 1 < dims.size (); i++)
+    {
+      ms.push_back (new strassen::matrix<unsigned> (dims[i], dims[i + 1],
+                                                    new strassen::naive_matrix_multiplier<unsigned> ()));
+      ms.back ()->random (100);
+    }
+
+  strassen::matrix<unsigned> expected = *ms[0];
+
+  for (size_t i = 1; i < ms.size (); i++)
+    expected.mult (*ms[i]);
+
+  std::vector<const strassen::matrix<unsigned> *> cms (ms.begin (), ms.end ());
+
+  for (size_t threads = 1; threads <= 2; threads++)
+    {
+      strassen::matrix_chain_multiplier<unsigned> chain (threads);
+      unsigned *C = chain.mult (cms);
+
+      ok = ok && C && !memcmp (C, expected.data (), dims.front () * dims.back () * sizeof (unsigned))
+        && chain.usage ().in_use () >= dims.front () * dims.back () * sizeof (unsigned);
+      free (C);
+    }
+
+  for (size_t i = 0; i < ms.size (); i++)
+    delete ms[i];
+
+  if (!ok)
+    {
+      fprintf (stderr, "test_matrix_chain: failure (order %s)\n", p.order ().c_str ());
+      failures++;
+    }
+  else
+    {
+      fprintf (stderr, "test_matrix_chain: success\n");
+    }
+}
+
+void
+test_async_multiplier ()
+{
+  /* Mixed shapes through a short queue, so that submit () has to wait for the workers */
+  const size_t shapes[][3] = { { 64, 64, 64 }, { 130, 70, 90 }, { 1, 200, 150 }, { 200, 33, 1 }, { 96, 96, 96 } };
+  const size_t count = sizeof (shapes) / sizeof (shapes[0]);
+  const size_t requests = 3 * count;
+
+  std::vector<strassen::matrix<int> *> as;
+  std::vector<strassen::matrix<int> *> bs;
+
+  for (size_t s = 0; s < count; s++)
+    {
+      as.push_back (new strassen::matrix<int> (shapes[s][0], shapes[s][1],
+                                               new strassen::naive_matrix_multiplier<int> ()));
+      bs.push_back (new strassen::matrix<int> (shapes[s][1], shapes[s][2],
+                                               new strassen::naive_matrix_multiplier<int> ()));
+      as.back ()->random (100);
+      bs.back ()->random (100);
+    }
+
+  /* One operand stored column-major */
+  bs[1]->relayout (strassen::COLUMN_MAJOR);
+
+  bool ok = true;
+  std::atomic<size_t> called (0);
+
+  for (size_t workers = 1; workers <= 2; workers++)
+    {
+      strassen::async_matrix_multiplier<int> amm (workers, 2);
+      std::vector<std::future<int *> > results;
+
+      called = 0;
+
+      for (size_t r = 0; r < requests; r++)
+        results.push_back (amm.submit (*as[r % count], *bs[r % count], [&called] (int *C)
+                                       {
+                                         if (C)
+                                           ++called;
+                                       }));
+
+      amm.wait ();
+      ok = ok && amm.workers () == workers && !amm.pending () && called == requests;
+
+      for (size_t r = 0; r < requests; r++)
+        {
+          strassen::matrix<int> expected = *as[r % count];
+          expected.mult (*bs[r % count]);
+
+          int *C = results[r].get ();
+
+          ok = ok && C && !memcmp (C, expected.data (), expected.rows () * expected.cols () * sizeof (int));
+          free (C);
+        }
+    }
+
+  /* A product of operands which do not conform is NULL */
+  {
+    strassen::async_matrix_multiplier<int> amm (1);
+    std::future<int *> f = amm.submit (as[0]->data (), as[1]->data (), 64, 64, 130, 70);
+
+    ok = ok && !f.get ();
+  }
+
+  for (size_t s = 0; s < count; s++)
+    {
+      delete as[s];
+      delete bs[s];
+    }
+
+  if (!ok)
+    {
+      fprintf (stderr, "test_async_multiplier: failure\n");
+      failures++;
+    }
+  else
+    {
+      fprintf (stderr, "test_async_multiplier: success\n");
+    }
+}
+
+void
+test_cached_multiplier ()
+{
+  const size_t n = 64;
+  const size_t bytes = n * n * sizeof (int);
+
+  strassen::matrix<int> a (n, n, new strassen::naive_matrix_multiplier<int> ());
+  strassen::matrix<int> b (n, n, new strassen::naive_matrix_multiplier<int> ());
+  strassen::matrix<int> c (n, n, new strassen::naive_matrix_multiplier<int> ());
+
+  a.random (100);
+  b.random (100);
+  c.random (100);
+
+  /* random () seeds with the time, so the three are likely the same until told apart */
+  b.data ()[1] += 1;
+  c.data ()[2] += 2;
+
+  /* Room for two products */
+  strassen::cached_matrix_multiplier<int> cmm (new strassen::strassen_matrix_multiplier<int> (16), (2 * bytes) + 100);
+  const strassen::matrix<int> *pairs[][2] = { { &a, &b }, { &a, &b }, { &a, &c }, { &b, &c }, { &a, &c }, { &a, &b } };
+  bool ok = true;
+
+  for (size_t i = 0; i < sizeof (pairs) / sizeof (pairs[0]); i++)
+    {
+      strassen::matrix<int> expected = *pairs[i][0];
+      expected.mult (*pairs[i][1]);
+
+      int *C = cmm.mult (pairs[i][0]->data (), pairs[i][1]->data (), n, n, n, n);
+
+      ok = ok && C && !memcmp (C, expected.data (), bytes) && cmm.usage ().in_use () >= bytes;
+      free (C);
+    }
+
+  /* (a, b) was evicted by (b, c), and (b, c) by (a, b) again */
+  strassen::cache_stats s = cmm.stats ();
+
+  ok = ok && s.hits == 2 && s.misses == 4 && s.evictions == 2 && s.entries == 2 && s.bytes == 2 * bytes;
+
+  /* An operand changed in place is a different operand */
+  a.data ()[0]++;
+
+  strassen::matrix<int> expected = a;
+  expected.mult (c);
+
+  int *C = cmm.mult (a.data (), c.data (), n, n, n, n);
+
+  ok = ok && C && !memcmp (C, expected.data (), bytes) && cmm.stats ().misses == 5;
+  free (C);
+
+  /* Products larger than the budget are computed but not kept */
+  cmm.budget (bytes / 2);
+  C = cmm.mult (a.data (), c.data (), n, n, n, n);
+
+  ok = ok && C && !cmm.stats ().entries && cmm.stats ().uncacheable == 1 && cmm.stats ().misses == 6;
+  free (C);
+
+  if (!ok)
+    {
+      fprintf (stderr, "test_cached_multiplier: failure (%lu hits, %lu misses, %lu evictions)\n",
+               s.hits, s.misses, s.evictions);
+      failures++;
+    }
+  else
+    {
+      fprintf (stderr, "test_cached_multiplier: success\n");
+    }
+}
+
+/* Whether p holds the product of a and b */
+static bool
+product_matches (const int *p, const strassen::matrix<int> &a, const strassen::matrix<int> &b)
+{
+  strassen::matrix<int> expected = a;
+  expected.mult (b);
+
+  return (p && !memcmp (p, expected.data (), expected.rows () * expected.cols () * sizeof (int)));
+}
+
+void
+test_maintained_product ()
+{
+  strassen::matrix<int> a (120, 80, new strassen::naive_matrix_multiplier<int> ());
+  strassen::matrix<int> b (80, 100, new strassen::naive_matrix_multiplier<int> ());
+
+  a.random (100);
+  b.random (100);
+
+  strassen::maintained_product<int> p (a, b, 0.25, new strassen::naive_matrix_multiplier<int> ());
+
+  bool ok = product_matches (p.update (), a, b) && p.stats ().full == 1;
+
+  /* Two rows of A, and one of B written through data () */
+  a (3, 5) += 7;
+  a (70, 0) = -2;
+
+  for (size_t j = 0; j < b.cols (); j++)
+    b.data ()[(10 * b.cols ()) + j] += (int) j;
+
+  b.touch (10);
+
+  ok = ok && product_matches (p.update (), a, b) && p.stats ().full == 1 && p.stats ().incremental == 1
+    && p.stats ().a_rows == 2 && p.stats ().b_rows == 1;
+
+  /* Nothing changed */
+  ok = ok && product_matches (p.update (), a, b) && p.stats ().incremental == 1;
+
+  /* Half of A is too much */
+  a.touch (0, 60);
+  ok = ok && product_matches (p.update (), a, b) && p.stats ().full == 2;
+
+  /* As is all of B */
+  b.mult (3);
+  ok = ok && product_matches (p.update (), a, b) && p.stats ().full == 3;
+
+  /* A product of a matrix with itself */
+  strassen::matrix<int> s (64, 64, new strassen::naive_matrix_multiplier<int> ());
+  s.random (100);
+
+  strassen::maintained_product<int> q (s, s);
+
+  q.update ();
+  s (9, 40) = 11;
+  ok = ok && product_matches (q.update (), s, s) && q.stats ().incremental == 1;
+
+  if (!ok)
+    {
+      fprintf (stderr, "test_maintained_product: failure\n");
+      failures++;
+    }
+  else
+    {
+      fprintf (stderr, "test_maintained_product: success\n");
+    }
+}
+
+void
+test_matrix_power ()
+{
+  bool ok = true;
+
+  /* Unsigned arithmetic is exact modulo 2^32, so the squaring order cannot change the result */
+  strassen::matrix<unsigned> a (37, 37, new strassen::naive_matrix_multiplier<unsigned> ());
+  a.random (5);
+
+  strassen::matrix<unsigned> expected = a;
+
+  for (size_t i = 1; i < 13; i++)
+    expected.mult (a);
+
+  strassen::strassen_matrix_multiplier<unsigned> smm (8);
+  unsigned *S = smm.square (a.data (), 37);
+  unsigned *P = smm.pow (a.data (), 37, 13);
+  unsigned *Q = smm.pow (a.data (), 37, 0);
+
+  strassen::matrix<unsigned> sq = a;
+  sq.mult (a);
+
+  ok = ok && !memcmp (S, sq.data (), 37 * 37 * sizeof (unsigned))
+    && !memcmp (P, expected.data (), 37 * 37 * sizeof (unsigned))
+    && Q[0] == 1 && Q[1] == 0 && Q[37 + 1] == 1;
+
+  free (S);
+  free (P);
+  free (Q);
+
+  /* Through the matrix, with the default multiplier */
+  strassen::matrix<unsigned> b (37, 37);
+  b = a;
+  b.pow (13);
+  ok = ok && b == expected;
+
+  /* A two state Markov chain, whose powers converge to rows of (5/6, 1/6) */
+  strassen::matrix<double> markov (2, 2, new strassen::strassen_matrix_multiplier<double> (1));
+  markov (0, 0) = 0.9;
+  markov (0, 1) = 0.1;
+  markov (1, 0) = 0.5;
+  markov (1, 1) = 0.5;
+  markov.pow ((size_t) 1 << 40, 1e-12);
+
+  for (size_t i = 0; i < 2; i++)
+    ok = ok && fabs (markov (i, 0) - 5.0 / 6.0) < 1e-9 && fabs (markov (i, 1) - 1.0 / 6.0) < 1e-9;
+
+  if (!ok)
+    {
+      fprintf (stderr, "test_matrix_power: failure\n");
+      failures++;
+    }
+  else
+    {
+      fprintf (stderr, "test_matrix_power: success\n");
+    }
+}
+
+void
+test_layouts ()
+{
+  bool ok = true;
+
+  /* The blocked transposes against the definition, on sizes which are not multiples of the tile */
+  strassen::matrix<int> a (37, 91);
+  strassen::matrix<int> sq (70, 70);
+  a.random (1000);
+  sq.random (1000);
+
+  int *T = (int *) malloc (37 * 91 * sizeof (int));
+  strassen::transpose_blocked (a.data (), T, 37, 91);
+
+  for (size_t i = 0; i < 37; i++)
+    {
+      for (size_t j = 0; j < 91; j++)
+        ok = ok && T[(j * 37) + i] == a (i, j);
+    }
+
+  free (T);
+
+  strassen::matrix<int> sq_t = sq;
+  strassen::transpose_in_place (sq_t.data (), 70);
+
+  for (size_t i = 0; i < 70; i++)
+    {
+      for (size_t j = 0; j < 70; j++)
+        ok = ok && sq_t.data ()[(j * 70) + i] == sq (i, j);
+    }
+
+  /* Every combination of layouts, with each multiplier, against the naive product of row-major copies */
+  size_t m = 45;
+  size_t k = 70;
+  size_t n = 33;
+
+  strassen::matrix<int> A (m, k, new strassen::naive_matrix_multiplier<int> ());
+  strassen::matrix<int> B (k, n);
+  A.random (100);
+  B.random (100);
+
+  strassen::matrix<int> expected = A;
+  expected.mult (B);
+
+  strassen::matrix_multiplier<int> *mm[] =
+    {
+      new strassen::naive_matrix_multiplier<int> (),
+      new strassen::transpose_matrix_multiplier<int> (),
+      new strassen::strassen_matrix_multiplier<int> (16),
+      new strassen::adaptive_matrix_multiplier<int> ()
+    };
+
+  for (size_t l = 0; l < 4; l++)
+    {
+      strassen::matrix<int> Al = A;
+      strassen::matrix<int> Bl = B;
+
+      Al.relayout ((l & 1) ? strassen::COLUMN_MAJOR : strassen::ROW_MAJOR);
+      Bl.relayout ((l & 2) ? strassen::COLUMN_MAJOR : strassen::ROW_MAJOR);
+
+      ok = ok && Al == A && Bl == B;
+
+      for (size_t i = 0; i < sizeof (mm) / sizeof (mm[0]); i++)
+        {
+          int *C = mm[i]->mult_layout (Al.data (), Al.layout (), Bl.data (), Bl.layout (), m, k, k, n);
+
+          ok = ok && C && !memcmp (C, expected.data (), m * n * sizeof (int));
+          free (C);
+        }
+    }
+
+  for (size_t i = 0; i < sizeof (mm) / sizeof (mm[0]); i++)
+    delete mm[i];
+
+  /* Transposing a matrix moves no data; the product of transposes is the transposed product */
+  strassen::matrix<int> At = B;
+  strassen::matrix<int> Bt = A;
+  At.transpose ();
+  Bt.transpose ();
+  At.mult (Bt);
+  expected.transpose ();
+
+  ok = ok && At.rows () == n && At.cols () == m && At.layout () == strassen::ROW_MAJOR && At == expected;
+
+  /* Iteration, and printing, follow the rows of a transposed matrix rather than its storage */
+  strassen::matrix<int> s (2, 3);
+
+  for (size_t i = 0; i < 6; i++)
+    s.data ()[i] = i;
+
+  s.transpose ();
+
+  strassen::matrix<int>::iterator it (s);
+
+  for (size_t i = 0; i < 6; i++, ++it)
+    ok = ok && it.ok () && it.row () == i / 2 && it.col () == i % 2 && it.val () == s (i / 2, i % 2);
+
+  ok = ok && !it.ok () && alg_tostring (s) == "| 0 3 |\n| 1 4 |\n| 2 5 |\n";
+
+  /* Files record the layout */
+  char path[] = "/tmp/strassen_layout.XXXXXX";
+  close (mkstemp (path));
+
+  strassen::matrix<int> loaded;
+  ok = ok && strassen::save_binary (expected, path) && strassen::load_binary (loaded, path)
+    && loaded.layout () == strassen::COLUMN_MAJOR && loaded == expected;
+  unlink (path);
+
+  if (!ok)
+    {
+      fprintf (stderr, "test_layouts: failure\n");
+      failures++;
+    }
+  else
+    {
+      fprintf (stderr, "test_layouts: success\n");
+    }
+}
+
+void
+test_complex_multiplier ()
+{
+  size_t s = 150;
+
+  strassen::matrix<std::complex<double> > m (s, s, new strassen::naive_matrix_multiplier<std::complex<double> > ());
+  strassen::matrix<std::complex<double> > n (s, s);
+  strassen::matrix<std::complex<double> > m_smm (s, s);
+  strassen::matrix<std::complex<double> > m_cmm (s, s, new strassen::complex_matrix_multiplier<double> ());
+
+  for (size_t i = 0; i < s; i++)
+    {
+      for (size_t j = 0; j < s; j++)
+        {
+          m (i, j) = std::complex<double> ((rand () % 201) - 100, (rand () % 201) - 100);
+          n (i, j) = std::complex<double> ((rand () % 201) - 100, (rand () % 201) - 100);
+        }
+    }
+
+  m_smm = m;
+  m_cmm = m;
+
+  m.mult (n);
+  m_smm.mult (n);
+  m_cmm.mult (n);
+
+  if (!(m_smm == m))
+    {
+      fprintf (stderr, "test_complex_multiplier: m_smm matrix multiplication failure\n");
+      failures++;
+    }
+  else
+    {
+      fprintf (stderr, "test_complex_multiplier: complex strassen multiplier success\n");
+    }
+
+  if (!(m_cmm == m))
+    {
+      fprintf (stderr, "test_complex_multiplier: m_cmm matrix multiplication failure\n");
+      failures++;
+    }
+  else
+    {
+      fprintf (stderr, "test_complex_multiplier: 3M multiplier success\n");
+    }
+}
+
+/* A multiplier which always runs out of memory */
+template <typename T>
+class failing_matrix_multiplier : public strassen::transpose_matrix_multiplier<T>
+{
+public:
+  T*
+  mult (const T *a, const T *b, size_t arows, size_t acols, size_t brows, size_t bcols)
+  {
+    return NULL;
+  }
+};
+
+void
+test_out_of_core_multiplier ()
+{
+  size_t rows = 300;
+  size_t cols = 170;
+
+  char a_path[] = "/tmp/strassen_a.XXXXXX";
+  char b_path[] = "/tmp/strassen_b.XXXXXX";
+  char c_path[] = "/tmp/strassen_c.XXXXXX";
+
+  close (mkstemp (a_path));
+  close (mkstemp (b_path));
+  close (mkstemp (c_path));
+
+  strassen::mapped_matrix<int> a;
+  strassen::mapped_matrix<int> b;
+  strassen::mapped_matrix<int> c;
+
+  strassen::matrix<int> m (rows, cols);
+  strassen::matrix<int> n (cols, rows);
+
+  m.random (197);
+  n.random (213);
+
+  if (!a.create (a_path, rows, cols) || !b.create (b_path, cols, rows) || !c.create (c_path, rows, rows))
+    {
+      fprintf (stderr, "test_out_of_core_multiplier: mapping failure\n");
+      failures++;
+      return;
+    }
+
+  int *raw = m.raw_data_copy ();
+  memcpy (a.data (), raw, rows * cols * sizeof (int));
+  free (raw);
+
+  raw = n.raw_data_copy ();
+  memcpy (b.data (), raw, rows * cols * sizeof (int));
+  free (raw);
+
+  /* A budget this small forces 64 x 64 tiles */
+  strassen::out_of_core_matrix_multiplier<int> ooc (64 * 64 * sizeof (int) * strassen::OUT_OF_CORE_WORKSPACE_FACTOR);
+
+  m.mult (n);
+  raw = m.raw_data_copy ();
+
+  if (!ooc.mult (a, b, c))
+    {
+      fprintf (stderr, "test_out_of_core_multiplier: out-of-core multiplication failure\n");
+      failures++;
+    }
+  else if (memcmp (c.data (), raw, rows * rows * sizeof (int)))
+    {
+      fprintf (stderr, "test_out_of_core_multiplier: out-of-core multiplication mismatch\n");
+      failures++;
+    }
+  else
+    {
+      fprintf (stderr, "test_out_of_core_multiplier: out-of-core multiplier success (tile %lu)\n",
+               ooc.tile_size (rows, cols, rows));
+    }
+
+  free (raw);
+
+  /* A failed product leaves C as it was */
+  strassen::out_of_core_matrix_multiplier<int> failing (64 * 64 * sizeof (int)
+                                                        * strassen::OUT_OF_CORE_WORKSPACE_FACTOR,
+                                                        new failing_matrix_multiplier<int> ());
+
+  for (size_t i = 0; i < rows * rows; i++)
+    c.data ()[i] = 7;
+
+  if (failing.mult (a, b, c) || c.data ()[0] != 7 || c.data ()[(rows * rows) - 1] != 7)
+    {
+      fprintf (stderr, "test_out_of_core_multiplier: failed product written out\n");
+      failures++;
+    }
+
+  /* The kernel rejects unaligned ranges, so both a narrow tile and whole rows must be advised cleanly */
+  if (!a.advise (7, 13, 64, 64, MADV_WILLNEED) || !a.advise (7, 0, 64, cols, MADV_DONTNEED)
+      || !b.advise (cols - 1, rows - 1, 64, 64, MADV_WILLNEED))
+    {
+      fprintf (stderr, "test_out_of_core_multiplier: madvise failure\n");
+      failures++;
+    }
+  else
+    {
+      fprintf (stderr, "test_out_of_core_multiplier: advice success\n");
+    }
+
+  a.close ();
+  b.close ();
+  c.close ();
+
+  unlink (a_path);
+  unlink (b_path);
+  unlink (c_path);
+}
+
+void
+test_matrix_io ()
+{
+  char bin_path[] = "/tmp/strassen_bin.XXXXXX";
+  char txt_path[] = "/tmp/strassen_txt.XXXXXX";
+
+  close (mkstemp (bin_path));
+  close (mkstemp (txt_path));
+
+  strassen::matrix<int> m (97, 131);
+  strassen::matrix<int> m_bin;
+  strassen::matrix<int> m_txt;
+
+  m.random ();
+
+  if (!strassen::save_binary (m, bin_path) || !strassen::load_binary (m_bin, bin_path) || !(m_bin == m))
+    {
+      fprintf (stderr, "test_matrix_io: binary round trip failure\n");
+      failures++;
+    }
+  else if (((uintptr_t) m_bin.data ()) % 64)
+    {
+      fprintf (stderr, "test_matrix_io: binary payload misaligned\n");
+      failures++;
+    }
+  else
+    {
+      fprintf (stderr, "test_matrix_io: binary round trip success\n");
+    }
+
+  if (!strassen::save_text (m, txt_path) || !strassen::load_text (m_txt, txt_path) || !(m_txt == m))
+    {
+      fprintf (stderr, "test_matrix_io: integer text round trip failure\n");
+      failures++;
+    }
+  else
+    {
+      fprintf (stderr, "test_matrix_io: integer text round trip success\n");
+    }
+
+  strassen::matrix<double> d (64, 33);
+  strassen::matrix<double> d_txt;
+
+  for (size_t i = 0; i < d.rows (); i++)
+    {
+      for (size_t j = 0; j < d.cols (); j++)
+        d (i, j) = (rand () - (RAND_MAX / 2)) / 7919.0;
+    }
+
+  if (!strassen::save_text (d, txt_path, ' ') || !strassen::load_text (d_txt, txt_path, ' ') || !(d_txt == d))
+    {
+      fprintf (stderr, "test_matrix_io: floating point text round trip failure\n");
+      failures++;
+    }
+  else
+    {
+      fprintf (stderr, "test_matrix_io: floating point text round trip success\n");
+    }
+
+  /* Flip a byte of the payload; the checksum should catch it */
+  int fd = open (bin_path, O_RDWR);
+  char c = 0;
+  pread (fd, &c, 1, strassen::MATRIX_FILE_HEADER_SIZE + 17);
+  c ^= 0x5a;
+  pwrite (fd, &c, 1, strassen::MATRIX_FILE_HEADER_SIZE + 17);
+  close (fd);
+
+  if (strassen::load_binary (m_bin, bin_path))
+    {
+      fprintf (stderr, "test_matrix_io: corrupted file loaded\n");
+      failures++;
+    }
+  else
+    {
+      fprintf (stderr, "test_matrix_io: checksum success\n");
+    }
+
+  unlink (bin_path);
+  unlink (txt_path);
+}
+
+/* Counts the phase changes reported by a multiplier */
+class phase_counter : public strassen::phase_observer
+{
+public:
+  size_t counts[strassen::NUM_PHASES];
+
+  phase_counter ()
+  {
+    memset (counts, 0, sizeof (counts));
+  }
+
+  void phase (strassen::mult_phase p)
+  {
+    counts[p]++;
+  }
+};
+
+void
+test_phase_observer ()
+{
+  size_t s = 4 * strassen::STRASSEN_THRESHOLD;
+
+  phase_counter pc;
+  strassen::strassen_matrix_multiplier<int> smm;
+  strassen::matrix<int> m (s, s);
+  strassen::matrix<int> n (s, s);
+
+  m.random (100);
+  n.random (100);
+
+  smm.observe (&pc);
+  free (smm.mult (m.data (), n.data (), s, s, s, s));
+
+  /* Two levels of recursion: 1 + 7 operand formations and combines, and 49 leaves */
+  if (pc.counts[strassen::PHASE_OPERANDS] != 8 || pc.counts[strassen::PHASE_COMBINE] != 8
+      || pc.counts[strassen::PHASE_LEAF] != 49 || pc.counts[strassen::PHASE_NONE] != 1)
+    {
+      fprintf (stderr, "test_phase_observer: unexpected phase counts\n");
+      failures++;
+    }
+  else
+    {
+      fprintf (stderr, "test_phase_observer: phase reporting success\n");
+    }
+}
+
+/**
+ * Whether a measured peak lies within 3% below the predicted one. The predictions count each buffer at the
+ * most the allocator can round it up to, which buffers served from the heap rather than by mmap fall short of.
+ */
+bool
+peak_matches (size_t peak, size_t predicted)
+{
+  return (peak <= predicted && peak >= predicted - ((3 * predicted) / 100));
+}
+
+void
+test_mem_accounting ()
+{
+  strassen::strassen_matrix_multiplier<int> smm;
+  strassen::parallel_strassen_matrix_multiplier<int> psmm;
+  strassen::complex_matrix_multiplier<double> cmm;
+
+  strassen::matrix<int> m (512, 512);
+  strassen::matrix<int> n (512, 512);
+  strassen::matrix<int> p (300, 300);
+  strassen::matrix<std::complex<double> > c (200, 200);
+
+  m.random (100);
+  n.random (100);
+  p.random (100);
+
+  for (size_t i = 0; i < c.rows (); i++)
+    {
+      for (size_t j = 0; j < c.cols (); j++)
+        c (i, j) = std::complex<double> ((rand () % 200) - 100, (rand () % 200) - 100);
+    }
+
+  bool ok = true;
+  int *C = smm.mult (m.data (), n.data (), 512, 512, 512, 512);
+
+  /* The result is all that is left in use afterwards */
+  ok = ok && peak_matches (smm.usage ().peak (), smm.predicted_peak_bytes (512, 512, 512, 512))
+    && smm.usage ().in_use () >= 512 * 512 * sizeof (int)
+    && smm.usage ().in_use () <= (512 * 512 * sizeof (int)) + 4096;
+  free (C);
+
+  C = smm.mult (m.data (), p.data (), 300, 300, 300, 300);
+  ok = ok && peak_matches (smm.usage ().peak (), smm.predicted_peak_bytes (300, 300, 300, 300));
+  free (C);
+
+  /* A product of a matrix with itself takes the squaring path */
+  C = smm.mult (p.data (), p.data (), 300, 300, 300, 300);
+  ok = ok && peak_matches (smm.usage ().peak (), smm.predicted_square_peak_bytes (300));
+  free (C);
+
+  /* The workers may or may not all be at their peaks at once */
+  C = psmm.mult (m.data (), n.data (), 512, 512, 512, 512);
+  ok = ok && psmm.usage ().peak () <= psmm.predicted_peak_bytes (512, 512, 512, 512)
+    && psmm.usage ().peak () >= smm.predicted_peak_bytes (512, 512, 512, 512) / 2;
+  free (C);
+
+  std::complex<double> *D = cmm.mult (c.data (), c.data (), 200, 200, 200, 200);
+  ok = ok && peak_matches (cmm.usage ().peak (), cmm.predicted_peak_bytes (200, 200, 200, 200));
+  free (D);
+
+  if (!ok)
+    {
+      fprintf (stderr, "test_mem_accounting: peak memory differs from prediction\n");
+      failures++;
+    }
+  else
+    {
+      fprintf (stderr, "test_mem_accounting: peak memory success\n");
+    }
+}
+
+void
+test_distributed_multiplier ()
+{
+  std::vector<std::string> endpoints;
+  std::vector<pid_t> pids;
+
+  for (size_t i = 0; i < 3; i++)
+    {
+      std::string e;
+      pid_t pid = strassen::strassen_worker<int>::spawn (e, 32);
+
+      if (pid > 0)
+        {
+          endpoints.push_back (e);
+          pids.push_back (pid);
+        }
+    }
+
+  bool ok = (pids.size () == 3);
+
+  strassen::matrix<int> a (300, 200, new strassen::naive_matrix_multiplier<int> ());
+  strassen::matrix<int> b (200, 250, new strassen::naive_matrix_multiplier<int> ());
+
+  a.random (100);
+  b.random (100);
+
+  strassen::matrix<int> expected = a;
+  expected.mult (b);
+
+  /* Padded to 512, so each worker gets products of 256 x 256 blocks */
+  strassen::distributed_strassen_matrix_multiplier<int> dsmm (endpoints, 32);
+  size_t block = 256 * 256 * sizeof (int);
+  size_t header = sizeof (strassen::distributed_header);
+
+  for (size_t rep = 0; rep < 2; rep++)
+    {
+      int *C = dsmm.mult (a.data (), b.data (), 300, 200, 200, 250);
+      const strassen::distributed_stats &s = dsmm.stats ();
+
+      ok = ok && C && !memcmp (C, expected.data (), 300 * 250 * sizeof (int))
+        && s.products == 7 && !s.local && s.bytes_sent == 7 * (header + (2 * block))
+        && s.bytes_received == 7 * (header + block) && s.compute > 0.0
+        && peak_matches (dsmm.usage ().peak (),
+                         strassen::distributed_strassen_matrix_multiplier<int>::predicted_peak_bytes (300, 200,
+                                                                                                      200, 250, 32));
+      free (C);
+    }
+
+  /* Without one of its workers, that worker's products are computed locally */
+  strassen::strassen_worker<int>::stop (pids[1]);
+
+  {
+    strassen::distributed_strassen_matrix_multiplier<int> lost (endpoints, 32);
+    int *C = lost.mult (a.data (), b.data (), 300, 200, 200, 250);
+
+    ok = ok && C && !memcmp (C, expected.data (), 300 * 250 * sizeof (int))
+      && lost.stats ().products == 5 && lost.stats ().local == 2;
+    free (C);
+  }
+
+  /* A request for operands too large to size is refused, and the connection dropped */
+  int fd = strassen::distributed_connect (endpoints[0]);
+  strassen::distributed_header h = { strassen::DISTRIBUTED_MAGIC, (uint32_t) sizeof (int), 1ULL << 40, 0.0 };
+  strassen::distributed_header reply;
+
+  ok = ok && fd >= 0 && strassen::distributed_send (fd, &h, sizeof (h))
+    && strassen::distributed_recv (fd, &reply, sizeof (reply)) && reply.n == 0
+    && !strassen::distributed_recv (fd, &reply, sizeof (reply));
+
+  if (fd >= 0)
+    close (fd);
+
+  for (size_t i = 0; i < pids.size (); i++)
+    {
+      if (i != 1)
+        strassen::strassen_worker<int>::stop (pids[i]);
+    }
+
+  if (!ok)
+    {
+      fprintf (stderr, "test_distributed_multiplier: failure\n");
+      failures++;
+    }
+  else
+    {
+      fprintf (stderr, "test_distributed_multiplier: success\n");
+    }
+}
+
+void
+test_allocator ()
+{
+  bool ok = true;
+  size_t saved = strassen::huge_page_threshold ();
+
+  strassen::set_huge_page_threshold (0);
+
+  strassen::matrix<double> m (37, 41);
+  strassen::strassen_matrix_multiplier<double> smm (16);
+
+  m.random (100);
+
+  double *C = smm.mult (m.data (), m.data (), 37, 37, 37, 37);
+  ok = ok && ((uintptr_t) m.data () % STRASSEN_ALIGNMENT) == 0 && ((uintptr_t) C % STRASSEN_ALIGNMENT) == 0;
+  free (C);
+
+  /* Buffers at or above the threshold are aligned to whole huge pages */
+  strassen::set_huge_page_threshold (1024 * 1024);
+
+  void *small = strassen::aligned_malloc (1000);
+  void *large = strassen::aligned_malloc (3 * 1024 * 1024);
+  ok = ok && small && large && ((uintptr_t) small % STRASSEN_ALIGNMENT) == 0
+    && ((uintptr_t) large % strassen::HUGE_PAGE_SIZE) == 0;
+  free (small);
+  free (large);
+
+  strassen::set_huge_page_threshold (saved);
+
+  if (!ok)
+    {
+      fprintf (stderr, "test_allocator: misaligned storage\n");
+      failures++;
+    }
+  else
+    {
+      fprintf (stderr, "test_allocator: alignment success\n");
+    }
+}
+
+/* Opens an event on a thread of its own, and reports the buffer it went to */
+void*
+trace_thread (void *arg)
+{
+  strassen::trace_scope t ("thread", 0);
+  *(strassen::trace_buffer **) arg = strassen::trace_thread_buffer ();
+
+  return NULL;
+}
+
+void
+test_trace ()
+{
+  char path[] = "/tmp/strassen_trace.XXXXXX";
+  close (mkstemp (path));
+
+  strassen::trace_reset ();
+
+  {
+    strassen::trace_scope outer ("outer", 4);
+
+    {
+      strassen::trace_scope inner ("inner", 2);
+      inner.next ("inner_next");
+    }
+  }
+
+  strassen::trace_buffer *b = strassen::trace_thread_buffer ();
+
+  /* Events are written as they end, innermost first */
+  bool ok = (b->count == 3 && b->depth == 0
+             && !strcmp (b->events[0].name, "inner") && b->events[0].depth == 1
+             && !strcmp (b->events[1].name, "inner_next") && b->events[1].depth == 1
+             && !strcmp (b->events[2].name, "outer") && b->events[2].depth == 0 && b->events[2].n == 4
+             && b->events[2].start <= b->events[0].start && b->events[1].end <= b->events[2].end);
+
+  /* Overfill the ring; only the most recent events are exported */
+  for (size_t i = 0; i < STRASSEN_TRACE_EVENTS; i++)
+    strassen::trace_scope t ("wrap", 0);
+
+  ok = ok && strassen::trace_export_chrome (path);
+
+  FILE *f = fopen (path, "r");
+  size_t events = 0;
+  size_t outer = 0;
+  char line[512];
+
+  while (f && fgets (line, sizeof (line), f))
+    {
+      if (strstr (line, "\"ph\": \"X\""))
+        events++;
+
+      if (strstr (line, "\"name\": \"outer\""))
+        outer++;
+    }
+
+  if (f)
+    fclose (f);
+
+  /* A thread started after another has exited takes over its buffer */
+  strassen::trace_buffer *first = NULL;
+  strassen::trace_buffer *second = NULL;
+  pthread_t thread;
+
+  ok = ok && !pthread_create (&thread, NULL, trace_thread, &first) && !pthread_join (thread, NULL)
+    && !pthread_create (&thread, NULL, trace_thread, &second) && !pthread_join (thread, NULL)
+    && first && first == second && first != b && first->count == 2;
+
+  if (!ok || events != STRASSEN_TRACE_EVENTS || outer)
+    {
+      fprintf (stderr, "test_trace: trace failure\n");
+      failures++;
+    }
+  else
+    {
+      fprintf (stderr, "test_trace: trace success\n");
+    }
+
+  strassen::trace_reset ();
+  unlink (path);
+}
+
+void
+time_matrix_multipliers (size_t sz)
+{
+  strassen::timer t;
+  strassen::matrix<int> m (sz, sz);
+  strassen::matrix<int> n (sz, sz);
+  strassen::matrix<int> m_nmm (sz, sz, new strassen::naive_matrix_multiplier<int> ());
+  strassen::matrix<int> m_tmm (sz, sz, new strassen::transpose_matrix_multiplier<int> ());
+  strassen::matrix<int> m_smm (sz, sz, new strassen::strassen_matrix_multiplier<int> ());
+  strassen::matrix<int> m_psmm (sz, sz, new strassen::parallel_strassen_matrix_multiplier<int> ());
+
+  m.random (103);
+  n.random (103);
+  
+  m_nmm = m;
+  m_tmm = m;
+  m_smm = m;
+  m_psmm = m;
+
+  if (!(m_nmm == m || m_tmm == m || m_smm == m || m_psmm == m))
+    {
+      fprintf (stderr, "test_matrix_multipliers: matrix initialization failure\n");      
+      failures++;
+    }
+
+  printf ("MM array size: %lu x %lu\n", sz, sz);
+
+  t.start ();
+  m_nmm.mult (n);
+  t.stop ();
+
+  printf ("MM time [naive]: %.6f\n", t.elapsed ());
+
+  t.start ();
+  m_tmm.mult (n);
+  t.stop ();
+
+  printf ("MM time [transpose]: %.6f\n", t.elapsed ());
+  
+  t.start ();
+  m_smm.mult (n);
+  t.stop ();
+
+  printf ("MM time [strassen]: %.6f\n", t.elapsed ());
+
+  t.start ();
+  m_psmm.mult (n);
+  t.stop ();
+
+  printf ("MM time [parallel strassen]: %.6f\n", t.elapsed ());
+
+  if (!strassen::freivalds (m.data (), n.data (), m_nmm.data (), sz, sz, sz))
+    {
+      fprintf (stderr, "test_matrix_multipliers: m_nmm matrix multiplication failure\n");      
+      failures++;
+    }
+  else
+    {
+      fprintf (stderr, "test_matrix_multipliers: naive multiplier success\n");
+    }
+  
+  if (!strassen::freivalds (m.data (), n.data (), m_tmm.data (), sz, sz, sz))
+    {
+      fprintf (stderr, "test_matrix_multipliers: m_tmm matrix multiplication failure\n");      
+      failures++;
+    }
+  else
+    {
+      fprintf (stderr, "test_matrix_multipliers: transpose multiplier success\n");
+    }
+
+  if (!strassen::freivalds (m.data (), n.data (), m_smm.data (), sz, sz, sz))
+    {
+      fprintf (stderr, "test_matrix_multipliers: m_smm matrix multiplication failure\n");     
+      failures++;
+    }
+  else
+    {
+      fprintf (stderr, "test_matrix_multipliers: strassen multiplier success\n");      
+    }
+  
+  if (!strassen::freivalds (m.data (), n.data (), m_psmm.data (), sz, sz, sz))
+    {
+      fprintf (stderr, "test_matrix_multipliers: m_psmm matrix multiplication failure\n");     
+      failures++;
+    }
+  else
+    {
+      fprintf (stderr, "test_matrix_multipliers: parallel strassen multiplier success\n");      
+    }
+}
+
+void
+mult_test ()
+{
+  strassen::matrix<int> m (800, 800);
+  strassen::matrix<int> n (800, 800);
+  strassen::matrix<int> o (800, 800);
+
+  m.random (231);
+  n.random (673);
+
+  o = m;
+
+  m.mult (n);
+  o.mult (n);
+
+  if (!(m == o))
+    {
+      fprintf (stderr, "matrix mult match failure\n");
+      failures++;
+      
+      std::string ms = alg_tostring (m);
+      std::string os = alg_tostring (o);
+      
+      printf ("%s\n\n%s\n\n", ms.c_str(), os.c_str());
     }
 }
 
@@ -460,13 +2093,37 @@ main ()
   signal(SIGSEGV, handler);
   srand (time (NULL));
 
-  //simple ();
-  //test_matrix_multipliers ();
-  time_full (50, 100, 50, 2);
+  simple ();
+  test_matrix_multipliers ();
+  test_rectangular_multipliers ();
+  test_skinny_multiplier ();
+  test_syrk ();
+  test_prepared_operand ();
+  test_bound_multiplier ();
+  test_copy_on_write ();
+  test_row_threads ();
+  test_parallel_threads ();
+  test_caps_multiplier ();
+  test_freivalds ();
+  test_adaptive_multiplier ();
+  test_matrix_chain ();
+  test_async_multiplier ();
+  test_cached_multiplier ();
+  test_maintained_product ();
+  test_matrix_power ();
+  test_layouts ();
+  test_complex_multiplier ();
+  test_out_of_core_multiplier ();
+  test_matrix_io ();
+  test_phase_observer ();
+  test_trace ();
+  test_mem_accounting ();
+  test_distributed_multiplier ();
+  test_allocator ();
   //mult_test ();
+  //time_matrix_multipliers (1024);
 
-  //13
-  //big_test (40);
+  /* Benchmarks live in src/bench/strassen_bench.cpp */
 
-  return 0;
+  return (failures ? 1 : 0);
 }
@@ -0,0 +1,225 @@
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "perf_counters.hpp"
+
+using namespace strassen;
+
+static int
+perf_event_open (struct perf_event_attr *attr, int group_fd)
+{
+  /* Count the calling thread, on whichever CPU it runs */
+  return syscall (__NR_perf_event_open, attr, 0, -1, group_fd, 0);
+}
+
+static void
+perf_event_attr_init (struct perf_event_attr &attr, perf_event e)
+{
+  memset (&attr, 0, sizeof (attr));
+
+  attr.size = sizeof (attr);
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP;
+
+  switch (e)
+    {
+    case PERF_CYCLES:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_CPU_CYCLES;
+      break;
+
+    case PERF_INSTRUCTIONS:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+      break;
+
+    case PERF_L1D_MISSES:
+      attr.type = PERF_TYPE_HW_CACHE;
+      attr.config = PERF_COUNT_HW_CACHE_L1D
+        | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+        | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+      break;
+
+    case PERF_LLC_MISSES:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_CACHE_MISSES;
+      break;
+
+    case PERF_DTLB_MISSES:
+      attr.type = PERF_TYPE_HW_CACHE;
+      attr.config = PERF_COUNT_HW_CACHE_DTLB
+        | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+        | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+      break;
+
+    default:
+      break;
+    }
+}
+
+/**
+ * Opens as many of the events as the system allows, in a single group so that they are scheduled
+ * onto the PMU together and read with one system call.
+ */
+perf_counters::perf_counters ()
+  : __leader (-1),
+    __nopen (0),
+    __running (false),
+    __current (PHASE_NONE)
+{
+  struct perf_event_attr attr;
+
+  for (int i = 0; i < NUM_PERF_EVENTS; i++)
+    {
+      perf_event_attr_init (attr, (perf_event) i);
+
+      __fds[i] = perf_event_open (&attr, __leader);
+      __slot[i] = -1;
+
+      if (__fds[i] >= 0)
+        {
+          if (__leader < 0)
+            __leader = __fds[i];
+
+          __slot[i] = __nopen++;
+        }
+    }
+
+  __clear (__total);
+
+  for (int p = 0; p < NUM_PHASES; p++)
+    __clear (__phases[p]);
+}
+
+perf_counters::~perf_counters ()
+{
+  for (int i = 0; i < NUM_PERF_EVENTS; i++)
+    {
+      if (__fds[i] >= 0)
+        close (__fds[i]);
+    }
+}
+
+bool
+perf_counters::available () const
+{
+  return (__leader >= 0);
+}
+
+void
+perf_counters::start ()
+{
+  __clear (__total);
+
+  for (int p = 0; p < NUM_PHASES; p++)
+    __clear (__phases[p]);
+
+  __current = PHASE_NONE;
+
+  if (__leader < 0)
+    return;
+
+  ioctl (__leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl (__leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+
+  memset (__last, 0, sizeof (__last));
+  __running = true;
+}
+
+void
+perf_counters::stop ()
+{
+  if (!__running)
+    return;
+
+  /* Close out whichever phase was current, and take the totals */
+  phase (PHASE_NONE);
+
+  ioctl (__leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+  __running = false;
+
+  __accumulate (__total, __last);
+}
+
+/**
+ * Attributes everything counted since the last phase change to the phase which is ending.
+ */
+void
+perf_counters::phase (mult_phase p)
+{
+  uint64_t now[NUM_PERF_EVENTS];
+  uint64_t delta[NUM_PERF_EVENTS];
+
+  if (__running && __read (now))
+    {
+      for (int i = 0; i < NUM_PERF_EVENTS; i++)
+        {
+          delta[i] = now[i] - __last[i];
+          __last[i] = now[i];
+        }
+
+      __accumulate (__phases[__current], delta);
+    }
+
+  __current = p;
+}
+
+const perf_sample&
+perf_counters::total () const
+{
+  return __total;
+}
+
+const perf_sample&
+perf_counters::phase_total (mult_phase p) const
+{
+  return __phases[p];
+}
+
+const char*
+perf_counters::event_name (perf_event e)
+{
+  static const char *names[NUM_PERF_EVENTS] = { "cycles", "instructions", "l1d_misses", "llc_misses", "dtlb_misses" };
+
+  return names[e];
+}
+
+/**
+ * Reads the whole group. The kernel returns the number of events followed by one value per event, in the
+ * order they joined the group.
+ */
+bool
+perf_counters::__read (uint64_t *counts)
+{
+  uint64_t buf[1 + NUM_PERF_EVENTS];
+
+  if (read (__leader, buf, sizeof (buf)) < (ssize_t) ((1 + __nopen) * sizeof (uint64_t)))
+    return false;
+
+  for (int i = 0; i < NUM_PERF_EVENTS; i++)
+    counts[i] = (__slot[i] >= 0) ? buf[1 + __slot[i]] : 0;
+
+  return true;
+}
+
+void
+perf_counters::__clear (perf_sample &s)
+{
+  for (int i = 0; i < NUM_PERF_EVENTS; i++)
+    {
+      s.count[i] = 0;
+      s.valid[i] = (__fds[i] >= 0);
+    }
+}
+
+void
+perf_counters::__accumulate (perf_sample &s, const uint64_t *delta)
+{
+  for (int i = 0; i < NUM_PERF_EVENTS; i++)
+    s.count[i] += delta[i];
+}
@@ -0,0 +1,81 @@
+#ifndef PERF_COUNTERS_HPP_
+#define PERF_COUNTERS_HPP_
+
+#include <stdint.h>
+
+#include "../strassen/phase_observer.hpp"
+
+namespace strassen
+{
+  /* The hardware events counted by a perf_counters group */
+  enum perf_event
+    {
+      PERF_CYCLES = 0,
+      PERF_INSTRUCTIONS,
+      PERF_L1D_MISSES,
+      PERF_LLC_MISSES,
+      PERF_DTLB_MISSES,
+      NUM_PERF_EVENTS
+    };
+
+  /* Counts of each event; events which could not be counted are not valid */
+  struct perf_sample
+  {
+    uint64_t count[NUM_PERF_EVENTS];
+    bool valid[NUM_PERF_EVENTS];
+  };
+
+  /**
+   * Counts hardware events for the calling thread using a perf_event_open group, both in total between
+   * start () and stop () and broken down by the multiplication phase reported through phase_observer.
+   * Attach one to a strassen_matrix_multiplier with observe () to see where cache, TLB and branch
+   * behaviour changes between phases.
+   *
+   * Counters may be missing entirely (no PMU access, perf_event_paranoid too high, inside some VMs) or
+   * individually (events the CPU does not support). Missing counters are left invalid and everything else
+   * keeps working, so callers only need to check valid[] before reporting a count.
+   */
+  class perf_counters : public phase_observer
+  {
+  private:
+    int __fds[NUM_PERF_EVENTS];
+    int __leader;                 /* Group leader descriptor, or -1 if nothing could be opened */
+    int __nopen;                  /* Number of events in the group */
+    int __slot[NUM_PERF_EVENTS];  /* Position of each event in a group read, or -1 */
+    bool __running;
+
+    mult_phase __current;
+    uint64_t __last[NUM_PERF_EVENTS];
+
+    perf_sample __total;
+    perf_sample __phases[NUM_PHASES];
+
+    bool __read (uint64_t *counts);
+    void __clear (perf_sample &s);
+    void __accumulate (perf_sample &s, const uint64_t *delta);
+
+    perf_counters (const perf_counters &p);
+    perf_counters& operator = (const perf_counters &p);
+
+  public:
+    perf_counters ();
+    virtual ~perf_counters ();
+
+    /* True if at least one event can be counted */
+    bool available () const;
+
+    /* Zero all counts and start counting */
+    void start ();
+    /* Stop counting; counts since start () remain available */
+    void stop ();
+
+    void phase (mult_phase p);
+
+    const perf_sample& total () const;
+    const perf_sample& phase_total (mult_phase p) const;
+
+    static const char* event_name (perf_event e);
+  };
+}
+
+#endif /* PERF_COUNTERS_HPP_ */
@@ -8,44 +8,19 @@
 
 namespace strassen
 {
-  //  template <typename T>
+  /**
+   * Returns a human-readable rendering of m, one bracketed row per line. For reading and writing
+   * matrices in bulk, see save_text () and load_text () in matrix_io.hpp.
+   */
+  template <typename T, typename M>
   std::string
-  alg_tostring (strassen::matrix<int> &m)
+  alg_tostring (strassen::matrix<T, M> &m)
   {
     size_t i = 0;
     size_t rows = m.rows ();
     size_t cols = m.cols ();
     std::stringstream ss;
-    matrix<int>::iterator iter (m);
-    
-    ss << "| ";
-    
-    while (iter.ok ())
-      {
-        ss << iter.val () << " ";
-        
-        if (++i == cols && (--rows))
-          {
-            i = 0;
-            ss << "|\n| ";
-          }
-        
-        ++iter;
-      }
-
-    ss << "|\n";
-
-    return ss.str ();
-  }
-
-  std::string
-  alg_tostring (strassen::matrix<uint32_t> &m)
-  {
-    size_t i = 0;
-    size_t rows = m.rows ();
-    size_t cols = m.cols ();
-    std::stringstream ss;
-    matrix<uint32_t>::iterator iter (m);
+    typename matrix<T, M>::iterator iter (m);
     
     ss << "| ";
     
@@ -4,7 +4,8 @@ using namespace strassen;
 
 timer::timer ()
   : _secs (0),
-    _usecs (0)
+    _usecs (0),
+    _nsecs (0)
 {
 }
 
@@ -15,28 +16,43 @@ timer::~timer ()
 void
 timer::start ()
 {
-  gettimeofday (&_start, NULL);
+  clock_gettime (CLOCK_MONOTONIC, &_start);
 }
 
 void
 timer::stop ()
 {
-  gettimeofday (&_stop, NULL);
+  clock_gettime (CLOCK_MONOTONIC, &_stop);
 
-  timersub (&_stop, &_start, &_diff);
-
-  _secs = _diff.tv_sec;
-  _usecs = _diff.tv_usec;
+  _nsecs = ((uint64_t) (_stop.tv_sec - _start.tv_sec) * 1000000000ULL) + _stop.tv_nsec - _start.tv_nsec;
+  _secs = _nsecs / 1000000000ULL;
+  _usecs = (_nsecs % 1000000000ULL) / 1000;
 }
 
+/* Whole seconds in the last interval */
 time_t
 timer::secs ()
 {
   return _secs;
 }
 
+/* Microseconds in the last interval, past the whole seconds */
 time_t
 timer::usecs ()
 {
   return _usecs;
 }
+
+/* The last interval, in nanoseconds */
+uint64_t
+timer::nsecs ()
+{
+  return _nsecs;
+}
+
+/* The last interval, in seconds */
+double
+timer::elapsed ()
+{
+  return (_nsecs / 1e9);
+}
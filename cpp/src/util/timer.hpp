@@ -1,20 +1,25 @@
 #ifndef TIMER_HPP_
 #define TIMER_HPP_
 
+#include <stdint.h>
 #include <time.h>
-#include <sys/time.h>
 
 namespace strassen
 {
+  /**
+   * Measures wall-clock intervals on the monotonic clock. After stop (), the interval is available
+   * either as a whole (nsecs (), elapsed ()) or split into whole seconds and the remaining
+   * microseconds (secs (), usecs ()).
+   */
   class timer
   {
   private:
     time_t _secs;
     time_t _usecs;
+    uint64_t _nsecs;
 
-    struct timeval _start;
-    struct timeval _stop;
-    struct timeval _diff;
+    struct timespec _start;
+    struct timespec _stop;
 
   public:
     timer ();
@@ -24,6 +29,8 @@ namespace strassen
     void stop ();
     time_t secs ();
     time_t usecs ();
+    uint64_t nsecs ();
+    double elapsed ();
   };
 }
 